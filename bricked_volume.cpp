@@ -0,0 +1,553 @@
+#include "bricked_volume.hpp"
+
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include <cassert>
+#include <cstring>
+
+#include "parallel.hpp"
+
+namespace
+{
+	char const kMagic_[8] = { 'B', 'R', 'K', 'V', 'O', 'L', '0', '1' };
+
+	// File layout: the header, the bricks (in the order in which they were
+	// written), and the index: the offset of each brick, level by level, and
+	// within each level in z, y, x order.
+	struct FileHeader_
+	{
+		char magic[8];
+		std::uint64_t size[3];
+		std::uint32_t brickSize;
+		std::uint32_t levelCount;
+		std::uint64_t indexOffset;
+	};
+
+	static_assert( sizeof(FileHeader_) == 48, "FileHeader_ must not be padded" );
+
+	struct LevelLayout_
+	{
+		std::size_t size[3];
+		std::size_t brickCounts[3];
+		std::size_t firstBrick;
+	};
+
+	std::vector<LevelLayout_> level_layout_( std::size_t const aSize[3], std::size_t aBrickSize )
+	{
+		std::vector<LevelLayout_> ret;
+
+		LevelLayout_ level;
+		std::copy( aSize, aSize+3, level.size );
+		level.firstBrick = 0;
+		for( ;; )
+		{
+			for( int d = 0; d < 3; ++d )
+				level.brickCounts[d] = (level.size[d] + aBrickSize-1) / aBrickSize;
+
+			ret.push_back( level );
+
+			if( 1 == level.brickCounts[0] * level.brickCounts[1] * level.brickCounts[2] )
+				return ret;
+
+			level.firstBrick += level.brickCounts[0] * level.brickCounts[1] * level.brickCounts[2];
+			for( int d = 0; d < 3; ++d )
+				level.size[d] = (level.size[d] + 1) / 2;
+		}
+	}
+
+	bool seek_( FILE* aFile, std::uint64_t aOffset )
+	{
+#		if defined(_MSC_VER)
+		return 0 == _fseeki64( aFile, std::int64_t(aOffset), SEEK_SET );
+#		else
+		return 0 == fseeko( aFile, off_t(aOffset), SEEK_SET );
+#		endif
+	}
+
+	void write_( FILE* aFile, void const* aData, std::size_t aSize )
+	{
+		if( aSize != std::fwrite( aData, 1, aSize, aFile ) )
+			throw std::runtime_error( "Could not write to the bricked volume" );
+	}
+	void read_( FILE* aFile, void* aData, std::size_t aSize )
+	{
+		if( aSize != std::fread( aData, 1, aSize, aFile ) )
+			throw std::runtime_error( "Could not read from the bricked volume (truncated file?)" );
+	}
+}
+
+
+BrickedVolumeWriter::BrickedVolumeWriter( char const* aFileName, std::size_t aWidth, std::size_t aHeight, std::size_t aDepth, std::size_t aBrickSize )
+	: mBrickSize(aBrickSize)
+{
+	if( 0 == aWidth || 0 == aHeight || 0 == aDepth || 0 == aBrickSize )
+		throw std::runtime_error( "Bricked volume: invalid size" );
+
+	std::size_t const size[3] = { aWidth, aHeight, aDepth };
+	for( auto const& layout : level_layout_( size, aBrickSize ) )
+	{
+		Level_ level;
+		std::copy( layout.size, layout.size+3, level.size );
+		std::copy( layout.brickCounts, layout.brickCounts+3, level.brickCounts );
+		level.firstBrick = layout.firstBrick;
+		level.slab.resize( aBrickSize * layout.size[0] * layout.size[1] );
+		mLevels.emplace_back( std::move(level) );
+	}
+
+	Level_ const& last = mLevels.back();
+	mIndex.resize( last.firstBrick + 1 );
+
+	mFile = std::fopen( aFileName, "wb" );
+	if( !mFile )
+		throw std::runtime_error( "Could not open file for writing" );
+
+	// Placeholder; finish() writes the actual header.
+	FileHeader_ header{};
+	write_( mFile, &header, sizeof(header) );
+	mOffset = sizeof(header);
+}
+
+BrickedVolumeWriter::~BrickedVolumeWriter()
+{
+	if( mFile )
+		std::fclose( mFile );
+}
+
+void BrickedVolumeWriter::add_slice( float const* aSlice )
+{
+	if( mLevels[0].slices == mLevels[0].size[2] )
+		throw std::runtime_error( "Bricked volume: too many slices" );
+
+	add_slice_( 0, aSlice );
+}
+
+void BrickedVolumeWriter::finish()
+{
+	if( mLevels[0].slices != mLevels[0].size[2] )
+		throw std::runtime_error( "Bricked volume: missing slices" );
+
+	assert( std::all_of( mLevels.begin(), mLevels.end(), [] (Level_ const& aLevel) { return aLevel.slices == aLevel.size[2]; } ) );
+
+	FileHeader_ header;
+	std::memcpy( header.magic, kMagic_, sizeof(kMagic_) );
+	for( int d = 0; d < 3; ++d )
+		header.size[d] = mLevels[0].size[d];
+	header.brickSize = std::uint32_t(mBrickSize);
+	header.levelCount = std::uint32_t(mLevels.size());
+	header.indexOffset = mOffset;
+
+	write_( mFile, mIndex.data(), mIndex.size() * sizeof(std::uint64_t) );
+
+	if( !seek_( mFile, 0 ) )
+		throw std::runtime_error( "Could not write to the bricked volume" );
+	write_( mFile, &header, sizeof(header) );
+
+	FILE* file = mFile;
+	mFile = nullptr;
+	if( 0 != std::fclose( file ) )
+		throw std::runtime_error( "Could not close file" );
+}
+
+void BrickedVolumeWriter::add_slice_( std::size_t aLevel, float const* aSlice )
+{
+	Level_& level = mLevels[aLevel];
+	std::size_t const w = level.size[0], h = level.size[1];
+
+	std::copy( aSlice, aSlice + w*h, level.slab.data() + (level.slices % mBrickSize) * w*h );
+	++level.slices;
+
+	bool const complete = level.slices == level.size[2];
+	if( 0 == level.slices % mBrickSize || complete )
+		write_slab_( aLevel );
+
+	if( aLevel+1 == mLevels.size() )
+		return;
+
+	// Average 2x2 voxels of the slice, and then pairs of slices, into the
+	// next level. Odd sizes repeat the last voxel/slice.
+	Level_& next = mLevels[aLevel+1];
+	std::size_t const nw = next.size[0], nh = next.size[1];
+
+	next.incoming.resize( nw*nh );
+	for( std::size_t y = 0; y < nh; ++y )
+	{
+		std::size_t const y0 = 2*y, y1 = std::min( 2*y+1, h-1 );
+		for( std::size_t x = 0; x < nw; ++x )
+		{
+			std::size_t const x0 = 2*x, x1 = std::min( 2*x+1, w-1 );
+			next.incoming[y*nw + x] = 0.25f * (aSlice[y0*w + x0] + aSlice[y0*w + x1] + aSlice[y1*w + x0] + aSlice[y1*w + x1]);
+		}
+	}
+
+	if( !next.hasPending )
+	{
+		std::swap( next.pending, next.incoming );
+		next.hasPending = true;
+	}
+	else
+	{
+		for( std::size_t i = 0; i < nw*nh; ++i )
+			next.pending[i] = 0.5f * (next.pending[i] + next.incoming[i]);
+
+		next.hasPending = false;
+		add_slice_( aLevel+1, next.pending.data() );
+	}
+
+	if( complete && next.hasPending )
+	{
+		next.hasPending = false;
+		add_slice_( aLevel+1, next.pending.data() );
+	}
+}
+
+void BrickedVolumeWriter::write_slab_( std::size_t aLevel )
+{
+	Level_ const& level = mLevels[aLevel];
+	std::size_t const w = level.size[0], h = level.size[1];
+	std::size_t const b = mBrickSize;
+
+	std::size_t const bz = (level.slices-1) / b;
+	std::size_t const slabSlices = level.slices - bz*b;
+
+	mBrick.resize( b*b*b );
+	for( std::size_t by = 0; by < level.brickCounts[1]; ++by )
+	{
+		for( std::size_t bx = 0; bx < level.brickCounts[0]; ++bx )
+		{
+			for( std::size_t k = 0; k < b; ++k )
+			{
+				std::size_t const z = std::min( k, slabSlices-1 );
+				for( std::size_t j = 0; j < b; ++j )
+				{
+					std::size_t const y = std::min( by*b + j, h-1 );
+					for( std::size_t i = 0; i < b; ++i )
+					{
+						std::size_t const x = std::min( bx*b + i, w-1 );
+						mBrick[(k*b + j)*b + i] = level.slab[(z*h + y)*w + x];
+					}
+				}
+			}
+
+			std::size_t const brick = level.firstBrick + (bz*level.brickCounts[1] + by)*level.brickCounts[0] + bx;
+			mIndex[brick] = mOffset;
+
+			write_( mFile, mBrick.data(), mBrick.size() * sizeof(float) );
+			mOffset += mBrick.size() * sizeof(float);
+		}
+	}
+}
+
+
+BrickedVolume::BrickedVolume( char const* aFileName, std::size_t aBudgetBytes, std::size_t aWorkerCount )
+	: mBudgetBytes(aBudgetBytes)
+{
+	FILE* file = std::fopen( aFileName, "rb" );
+	if( !file )
+		throw std::runtime_error( "Could not open the bricked volume" );
+
+	try
+	{
+		FileHeader_ header;
+		read_( file, &header, sizeof(header) );
+
+		if( 0 != std::memcmp( header.magic, kMagic_, sizeof(kMagic_) ) )
+			throw std::runtime_error( "Not a bricked volume" );
+		if( 0 == header.size[0] || 0 == header.size[1] || 0 == header.size[2] || 0 == header.brickSize )
+			throw std::runtime_error( "Bricked volume: invalid size" );
+
+		mBrickSize = header.brickSize;
+
+		std::size_t const size[3] = { std::size_t(header.size[0]), std::size_t(header.size[1]), std::size_t(header.size[2]) };
+		for( auto const& layout : level_layout_( size, mBrickSize ) )
+		{
+			Level_ level;
+			std::copy( layout.size, layout.size+3, level.size );
+			std::copy( layout.brickCounts, layout.brickCounts+3, level.brickCounts );
+			level.firstBrick = layout.firstBrick;
+			mLevels.push_back( level );
+		}
+
+		if( mLevels.size() != header.levelCount )
+			throw std::runtime_error( "Bricked volume: unexpected number of levels" );
+
+		mIndex.resize( mLevels.back().firstBrick + 1 );
+		if( !seek_( file, header.indexOffset ) )
+			throw std::runtime_error( "Bricked volume: invalid index" );
+		read_( file, mIndex.data(), mIndex.size() * sizeof(std::uint64_t) );
+
+		// The coarsest level (a single brick) is always available.
+		mCoarsest = read_brick_( file, mLevels.back().firstBrick );
+	}
+	catch( ... )
+	{
+		std::fclose( file );
+		throw;
+	}
+
+	// Each worker reads through its own FILE. These are opened here, so that
+	// a failure is reported to the caller (and not left to the workers, with
+	// the requested bricks never arriving).
+	mFiles.push_back( file );
+	while( mFiles.size() < std::max( aWorkerCount, std::size_t(1) ) )
+	{
+		FILE* const other = std::fopen( aFileName, "rb" );
+		if( !other )
+		{
+			for( FILE* f : mFiles )
+				std::fclose( f );
+			throw std::runtime_error( "Could not open the bricked volume" );
+		}
+		mFiles.push_back( other );
+	}
+
+	for( FILE* f : mFiles )
+		mWorkers.emplace_back( [this, f] { run_( f ); } );
+}
+
+BrickedVolume::~BrickedVolume()
+{
+	{
+		std::unique_lock<std::mutex> lock( mMutex );
+		mQuit = true;
+		mQueue.clear();
+	}
+	mWakeUp.notify_all();
+
+	for( auto& worker : mWorkers )
+		worker.join();
+
+	for( FILE* f : mFiles )
+		std::fclose( f );
+}
+
+std::size_t BrickedVolume::level_count() const
+{
+	return mLevels.size();
+}
+std::size_t BrickedVolume::brick_size() const
+{
+	return mBrickSize;
+}
+
+std::size_t BrickedVolume::width( std::size_t aLevel ) const
+{
+	return mLevels[aLevel].size[0];
+}
+std::size_t BrickedVolume::height( std::size_t aLevel ) const
+{
+	return mLevels[aLevel].size[1];
+}
+std::size_t BrickedVolume::depth( std::size_t aLevel ) const
+{
+	return mLevels[aLevel].size[2];
+}
+
+std::size_t BrickedVolume::brick_count( std::size_t aLevel, int aAxis ) const
+{
+	return mLevels[aLevel].brickCounts[aAxis];
+}
+
+BrickHandle BrickedVolume::find( std::size_t aLevel, std::size_t aBx, std::size_t aBy, std::size_t aBz )
+{
+	if( aLevel+1 == mLevels.size() )
+		return mCoarsest;
+
+	std::size_t const brick = brick_id_( aLevel, aBx, aBy, aBz );
+
+	std::unique_lock<std::mutex> lock( mMutex );
+	auto const it = mResident.find( brick );
+	if( mResident.end() == it )
+		return nullptr;
+
+	mLru.splice( mLru.begin(), mLru, it->second );
+	return it->second->data;
+}
+
+void BrickedVolume::request( std::size_t aLevel, std::size_t aBx, std::size_t aBy, std::size_t aBz )
+{
+	if( aLevel+1 == mLevels.size() )
+		return;
+
+	std::size_t const brick = brick_id_( aLevel, aBx, aBy, aBz );
+
+	{
+		std::unique_lock<std::mutex> lock( mMutex );
+		if( mResident.count( brick ) || !mRequested.insert( brick ).second )
+			return;
+
+		mQueue.push_back( brick );
+	}
+
+	mWakeUp.notify_one();
+}
+
+void BrickedVolume::cancel_requests()
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	for( auto const brick : mQueue )
+		mRequested.erase( brick );
+
+	mQueue.clear();
+}
+
+std::uint64_t BrickedVolume::generation() const
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	return mGeneration;
+}
+
+std::size_t BrickedVolume::resident_bytes() const
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	return mResidentBytes;
+}
+
+Volume BrickedVolume::assemble( std::size_t aLevel, std::size_t& aMissing )
+{
+	assert( aLevel < mLevels.size() );
+	Level_ const& level = mLevels[aLevel];
+	std::size_t const b = mBrickSize;
+
+	// Find the data for each brick: the brick itself, or the brick of the
+	// finest resident coarser level that covers it (`coarser` levels up).
+	struct Source
+	{
+		BrickHandle data;
+		std::size_t coarser;
+	};
+
+	std::size_t const brickCount = level.brickCounts[0] * level.brickCounts[1] * level.brickCounts[2];
+	std::vector<Source> sources( brickCount );
+
+	aMissing = 0;
+	for( std::size_t n = 0; n < brickCount; ++n )
+	{
+		std::size_t const bx = n % level.brickCounts[0];
+		std::size_t const by = (n / level.brickCounts[0]) % level.brickCounts[1];
+		std::size_t const bz = n / (level.brickCounts[0] * level.brickCounts[1]);
+
+		Source& source = sources[n];
+		source.coarser = 0;
+		if( (source.data = find( aLevel, bx, by, bz )) )
+			continue;
+
+		request( aLevel, bx, by, bz );
+		++aMissing;
+
+		// The coarsest level is always resident, so this terminates.
+		while( !source.data )
+		{
+			++source.coarser;
+			source.data = find( aLevel + source.coarser, bx >> source.coarser, by >> source.coarser, bz >> source.coarser );
+		}
+	}
+
+	Volume ret( level.size[0], level.size[1], level.size[2] );
+	concurrency::parallel_for( std::size_t(0), brickCount, [&] (std::size_t n) {
+		std::size_t const bx = n % level.brickCounts[0];
+		std::size_t const by = (n / level.brickCounts[0]) % level.brickCounts[1];
+		std::size_t const bz = n / (level.brickCounts[0] * level.brickCounts[1]);
+
+		std::vector<float> const& data = *sources[n].data;
+		std::size_t const k = sources[n].coarser;
+
+		// Origin of the source brick (at its own level)
+		std::size_t const ox = (bx >> k) * b, oy = (by >> k) * b, oz = (bz >> k) * b;
+
+		for( std::size_t z = bz*b; z < std::min( (bz+1)*b, level.size[2] ); ++z )
+		{
+			for( std::size_t y = by*b; y < std::min( (by+1)*b, level.size[1] ); ++y )
+			{
+				for( std::size_t x = bx*b; x < std::min( (bx+1)*b, level.size[0] ); ++x )
+				{
+					std::size_t const sx = (x >> k) - ox, sy = (y >> k) - oy, sz = (z >> k) - oz;
+					ret( x, y, z ) = data[(sz*b + sy)*b + sx];
+				}
+			}
+		}
+	} );
+
+	return ret;
+}
+
+std::size_t BrickedVolume::brick_id_( std::size_t aLevel, std::size_t aBx, std::size_t aBy, std::size_t aBz ) const
+{
+	Level_ const& level = mLevels[aLevel];
+	assert( aBx < level.brickCounts[0] && aBy < level.brickCounts[1] && aBz < level.brickCounts[2] );
+	return level.firstBrick + (aBz*level.brickCounts[1] + aBy)*level.brickCounts[0] + aBx;
+}
+
+BrickHandle BrickedVolume::read_brick_( FILE* aFile, std::size_t aBrick ) const
+{
+	auto data = std::make_shared<std::vector<float>>( mBrickSize*mBrickSize*mBrickSize );
+
+	if( !seek_( aFile, mIndex[aBrick] ) )
+		throw std::runtime_error( "Bricked volume: invalid brick offset" );
+	read_( aFile, data->data(), data->size() * sizeof(float) );
+
+	return data;
+}
+
+void BrickedVolume::insert_( std::size_t aBrick, BrickHandle aData )
+{
+	// Called with mMutex held.
+	mResidentBytes += aData->size() * sizeof(float);
+	mLru.push_front( Entry_{ aBrick, std::move(aData) } );
+	mResident[aBrick] = mLru.begin();
+	++mGeneration;
+
+	// Evict the least recently used bricks. (Bricks that are still in use
+	// by the renderer stay alive through their handles.)
+	while( mResidentBytes > mBudgetBytes && mLru.size() > 1 )
+	{
+		Entry_ const& victim = mLru.back();
+		mResidentBytes -= victim.data->size() * sizeof(float);
+		mResident.erase( victim.brick );
+		mLru.pop_back();
+	}
+}
+
+void BrickedVolume::run_( FILE* aFile )
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	for( ;; )
+	{
+		mWakeUp.wait( lock, [this] { return mQuit || !mQueue.empty(); } );
+		if( mQuit )
+			break;
+
+		std::size_t const brick = mQueue.front();
+		mQueue.pop_front();
+
+		lock.unlock();
+		BrickHandle data;
+		try
+		{
+			data = read_brick_( aFile, brick );
+		}
+		catch( std::exception const& eError )
+		{
+			std::fprintf( stderr, "Bricked volume: %s\n", eError.what() );
+		}
+		lock.lock();
+
+		mRequested.erase( brick );
+		if( data )
+			insert_( brick, std::move(data) );
+	}
+}
+
+
+void save_bricked_volume( Volume const& aVolume, char const* aFileName, std::size_t aBrickSize )
+{
+	BrickedVolumeWriter writer( aFileName, aVolume.width(), aVolume.height(), aVolume.depth(), aBrickSize );
+
+	std::size_t const sliceSize = aVolume.width() * aVolume.height();
+	for( std::size_t z = 0; z < aVolume.depth(); ++z )
+		writer.add_slice( aVolume.data() + z*sliceSize );
+
+	writer.finish();
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <list>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+#include "volume.hpp"
+
+/* Out-of-core volumes
+ *
+ * Volumes that don't fit into memory are stored in a bricked file: the volume
+ * is split into cubic bricks of aBrickSize^3 voxels, and stored at several
+ * levels of detail. Level 0 is the volume itself; each further level halves
+ * the resolution along each axis (averaging 2x2x2 voxels), up to the first
+ * level that is a single brick. Bricks at the border are padded by repeating
+ * the last voxel.
+ *
+ * `BrickedVolumeWriter` creates such a file from the (normalized) densities,
+ * which are passed in one z-slice at a time. It only keeps aBrickSize slices
+ * per level in memory, so it can convert volumes that don't fit into memory
+ * either:
+ *
+ *   BrickedVolumeWriter writer( "scan.bvol", width, height, depth );
+ *   for( std::size_t z = 0; z < depth; ++z )
+ *      writer.add_slice( slice( z ) );
+ *   writer.finish();
+ *
+ * `BrickedVolume` reads the file. It keeps the bricks that were loaded in an
+ * LRU cache with a fixed memory budget; when the budget is exceeded, the
+ * least recently used bricks are dropped. The bricks of the coarsest level
+ * are loaded when the file is opened, and always stay resident.
+ *
+ * Bricks are loaded asynchronously by worker threads: request() queues a
+ * brick, find() returns it once it is resident. In the meantime, the renderer
+ * draws the coarser levels; assemble() does this for a whole level, filling
+ * in the bricks that aren't resident from the finest resident coarser level.
+ *
+ * Errors (I/O, invalid files) are reported with std::runtime_error.
+ */
+
+// The densities of a brick, aBrickSize^3 floats, x fastest.
+using BrickHandle = std::shared_ptr<std::vector<float> const>;
+
+class BrickedVolumeWriter
+{
+	public:
+		BrickedVolumeWriter( char const* aFileName, std::size_t aWidth, std::size_t aHeight, std::size_t aDepth, std::size_t aBrickSize = 32 );
+		~BrickedVolumeWriter();
+
+		BrickedVolumeWriter( BrickedVolumeWriter const& ) = delete;
+		BrickedVolumeWriter& operator= (BrickedVolumeWriter const&) = delete;
+
+	public:
+		// Adds the next slice (aWidth*aHeight densities, x fastest).
+		void add_slice( float const* aSlice );
+
+		// Writes the index. Must be called after the last slice.
+		void finish();
+
+	private:
+		struct Level_
+		{
+			std::size_t size[3];
+			std::size_t brickCounts[3];
+			std::size_t firstBrick;
+
+			std::vector<float> slab; // aBrickSize slices
+			std::size_t slices = 0;
+
+			// Slices from the previous level, downsampled in x and y: the
+			// first one of a pair (pending), and the second one (incoming).
+			std::vector<float> pending, incoming;
+			bool hasPending = false;
+		};
+
+	private:
+		void add_slice_( std::size_t aLevel, float const* aSlice );
+		void write_slab_( std::size_t aLevel );
+
+	private:
+		FILE* mFile = nullptr;
+		std::size_t mBrickSize;
+
+		std::vector<Level_> mLevels;
+		std::vector<std::uint64_t> mIndex; // file offset of each brick
+		std::uint64_t mOffset = 0;
+
+		std::vector<float> mBrick;
+};
+
+class BrickedVolume
+{
+	public:
+		explicit BrickedVolume( char const* aFileName, std::size_t aBudgetBytes = std::size_t(1) << 30, std::size_t aWorkerCount = 2 );
+		~BrickedVolume();
+
+		BrickedVolume( BrickedVolume const& ) = delete;
+		BrickedVolume& operator= (BrickedVolume const&) = delete;
+
+	public:
+		std::size_t level_count() const;
+		std::size_t brick_size() const;
+
+		std::size_t width( std::size_t aLevel ) const;
+		std::size_t height( std::size_t aLevel ) const;
+		std::size_t depth( std::size_t aLevel ) const;
+
+		std::size_t brick_count( std::size_t aLevel, int aAxis ) const;
+
+	public:
+		// Returns the brick if it is resident (and marks it as recently
+		// used), a null handle otherwise.
+		BrickHandle find( std::size_t aLevel, std::size_t aBx, std::size_t aBy, std::size_t aBz );
+
+		// Queues the brick for loading, unless it is resident or queued.
+		void request( std::size_t aLevel, std::size_t aBx, std::size_t aBy, std::size_t aBz );
+
+		// Drops the queued (not yet loading) requests.
+		void cancel_requests();
+
+		// Incremented whenever a brick becomes resident.
+		std::uint64_t generation() const;
+
+		std::size_t resident_bytes() const;
+
+	public:
+		/* Returns level aLevel as a Volume. Bricks that aren't resident are
+		 * requested, and filled in from the finest resident coarser level;
+		 * aMissing receives their number.
+		 */
+		Volume assemble( std::size_t aLevel, std::size_t& aMissing );
+
+	private:
+		struct Level_
+		{
+			std::size_t size[3];
+			std::size_t brickCounts[3];
+			std::size_t firstBrick;
+		};
+
+		struct Entry_
+		{
+			std::size_t brick;
+			BrickHandle data;
+		};
+
+	private:
+		std::size_t brick_id_( std::size_t aLevel, std::size_t aBx, std::size_t aBy, std::size_t aBz ) const;
+
+		BrickHandle read_brick_( FILE*, std::size_t aBrick ) const;
+		void insert_( std::size_t aBrick, BrickHandle );
+		void run_( FILE* );
+
+	private:
+		std::size_t mBrickSize;
+		std::vector<Level_> mLevels;
+		std::vector<std::uint64_t> mIndex;
+
+		// The (single brick of the) coarsest level, always resident
+		BrickHandle mCoarsest;
+
+		mutable std::mutex mMutex;
+		std::condition_variable mWakeUp;
+
+		// LRU cache: most recently used first
+		std::list<Entry_> mLru;
+		std::unordered_map<std::size_t, std::list<Entry_>::iterator> mResident;
+		std::size_t mBudgetBytes;
+		std::size_t mResidentBytes = 0;
+		std::uint64_t mGeneration = 0;
+
+		std::deque<std::size_t> mQueue;
+		std::unordered_set<std::size_t> mRequested; // queued or loading
+
+		std::vector<std::thread> mWorkers;
+		std::vector<FILE*> mFiles; // one per worker
+		bool mQuit = false;
+};
+
+// Writes aVolume to a bricked file; see BrickedVolumeWriter.
+void save_bricked_volume( Volume const&, char const* aFileName, std::size_t aBrickSize = 32 );
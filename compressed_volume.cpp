@@ -0,0 +1,240 @@
+#include "compressed_volume.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "parallel.hpp"
+
+#include "miniz.h"
+
+namespace
+{
+	std::size_t const kGroupSize_ = 64;
+
+	float const kQuantScale_ = 65535.f;
+
+	std::uint16_t quantize_( float aDensity )
+	{
+		return std::uint16_t( std::min( std::max( aDensity, 0.f ), 1.f ) * kQuantScale_ + 0.5f );
+	}
+
+	std::uint32_t zigzag_( std::int32_t aValue )
+	{
+		return (std::uint32_t(aValue) << 1) ^ std::uint32_t(aValue >> 31);
+	}
+	std::int32_t unzigzag_( std::uint32_t aValue )
+	{
+		return std::int32_t(aValue >> 1) ^ -std::int32_t(aValue & 1);
+	}
+
+	void corrupt_()
+	{
+		throw std::runtime_error( "Compressed volume: corrupt brick" );
+	}
+
+	// Differences to the previous value, zigzag-encoded (at most 17 bits).
+	void encode_delta_pack_( std::vector<std::uint16_t> const& aValues, std::vector<std::uint8_t>& aOut )
+	{
+		std::int32_t previous = 0;
+		for( std::size_t first = 0; first < aValues.size(); first += kGroupSize_ )
+		{
+			std::size_t const count = std::min( kGroupSize_, aValues.size() - first );
+
+			std::uint32_t deltas[kGroupSize_];
+			std::uint32_t bits = 0;
+			for( std::size_t i = 0; i < count; ++i )
+			{
+				deltas[i] = zigzag_( std::int32_t(aValues[first+i]) - previous );
+				previous = aValues[first+i];
+
+				while( (deltas[i] >> bits) != 0 )
+					++bits;
+			}
+
+			aOut.push_back( std::uint8_t(bits) );
+			if( 0 == bits )
+				continue;
+
+			std::uint64_t acc = 0;
+			std::uint32_t fill = 0;
+			for( std::size_t i = 0; i < count; ++i )
+			{
+				acc |= std::uint64_t(deltas[i]) << fill;
+				for( fill += bits; fill >= 8; fill -= 8, acc >>= 8 )
+					aOut.push_back( std::uint8_t(acc) );
+			}
+			if( fill )
+				aOut.push_back( std::uint8_t(acc) );
+		}
+	}
+	void decode_delta_pack_( std::uint8_t const* aIn, std::uint8_t const* aEnd, std::uint16_t* aValues, std::size_t aCount )
+	{
+		std::int32_t previous = 0;
+		for( std::size_t first = 0; first < aCount; first += kGroupSize_ )
+		{
+			std::size_t const count = std::min( kGroupSize_, aCount - first );
+
+			if( aIn == aEnd )
+				corrupt_();
+
+			std::uint32_t const bits = *aIn++;
+			if( bits > 17 || std::size_t(aEnd - aIn) < (count*bits + 7) / 8 )
+				corrupt_();
+
+			std::uint32_t const mask = (std::uint32_t(1) << bits) - 1;
+			std::uint64_t acc = 0;
+			std::uint32_t fill = 0;
+			for( std::size_t i = 0; i < count; ++i )
+			{
+				for( ; fill < bits; fill += 8 )
+					acc |= std::uint64_t(*aIn++) << fill;
+
+				previous += unzigzag_( std::uint32_t(acc) & mask );
+				acc >>= bits;
+				fill -= bits;
+
+				aValues[first+i] = std::uint16_t(previous);
+			}
+		}
+	}
+
+	// Differences to the previous value (modulo 2^16), deflated.
+	void encode_deflate_( std::vector<std::uint16_t> const& aValues, std::vector<std::uint8_t>& aOut )
+	{
+		std::vector<std::uint16_t> deltas( aValues.size() );
+		std::uint16_t previous = 0;
+		for( std::size_t i = 0; i < aValues.size(); ++i )
+		{
+			deltas[i] = std::uint16_t(aValues[i] - previous);
+			previous = aValues[i];
+		}
+
+		mz_ulong const bytes = mz_ulong(deltas.size() * sizeof(std::uint16_t));
+		mz_ulong size = mz_compressBound( bytes );
+		aOut.resize( size );
+
+		int const ret = mz_compress2( aOut.data(), &size, reinterpret_cast<std::uint8_t const*>(deltas.data()), bytes, MZ_BEST_SPEED );
+		if( MZ_OK != ret )
+			throw std::runtime_error( std::string( "miniz: compression failed: " ) + mz_error(ret) );
+
+		aOut.resize( size );
+	}
+	void decode_deflate_( std::uint8_t const* aIn, std::uint8_t const* aEnd, std::uint16_t* aValues, std::size_t aCount )
+	{
+		mz_ulong size = mz_ulong(aCount * sizeof(std::uint16_t));
+		int const ret = mz_uncompress( reinterpret_cast<std::uint8_t*>(aValues), &size, aIn, mz_ulong(aEnd - aIn) );
+		if( MZ_OK != ret || size != aCount * sizeof(std::uint16_t) )
+			corrupt_();
+
+		std::uint16_t previous = 0;
+		for( std::size_t i = 0; i < aCount; ++i )
+			previous = aValues[i] = std::uint16_t(previous + aValues[i]);
+	}
+}
+
+
+CompressedVolume::CompressedVolume( Volume const& aVolume, EBrickCodec aCodec, std::size_t aBrickSize )
+	: mBrickSize(aBrickSize)
+	, mCodec(aCodec)
+	, mStatistics(aVolume.statistics_handle())
+{
+	if( 0 == aBrickSize )
+		throw std::runtime_error( "Compressed volume: invalid brick size" );
+
+	mSize[0] = aVolume.width();
+	mSize[1] = aVolume.height();
+	mSize[2] = aVolume.depth();
+	for( int d = 0; d < 3; ++d )
+		mBrickCounts[d] = (mSize[d] + aBrickSize-1) / aBrickSize;
+
+	std::size_t const brickCount = mBrickCounts[0] * mBrickCounts[1] * mBrickCounts[2];
+	if( 0 == brickCount )
+	{
+		mOffsets.assign( 1, 0 );
+		return;
+	}
+
+	// Compress the bricks in parallel, then pack them back to back.
+	std::vector<std::vector<std::uint8_t>> bricks( brickCount );
+	concurrency::parallel_for( std::size_t(0), brickCount, [&] (std::size_t aBrick) {
+		std::size_t const bx = aBrick % mBrickCounts[0];
+		std::size_t const by = aBrick / mBrickCounts[0] % mBrickCounts[1];
+		std::size_t const bz = aBrick / (mBrickCounts[0] * mBrickCounts[1]);
+
+		std::vector<std::uint16_t> values( aBrickSize * aBrickSize * aBrickSize );
+		auto out = values.begin();
+		for( std::size_t k = 0; k < aBrickSize; ++k )
+		{
+			std::size_t const z = std::min( bz*aBrickSize + k, mSize[2]-1 );
+			for( std::size_t j = 0; j < aBrickSize; ++j )
+			{
+				std::size_t const y = std::min( by*aBrickSize + j, mSize[1]-1 );
+				for( std::size_t i = 0; i < aBrickSize; ++i )
+					*out++ = quantize_( aVolume( std::min( bx*aBrickSize + i, mSize[0]-1 ), y, z ) );
+			}
+		}
+
+		switch( aCodec )
+		{
+			case EBrickCodec::deltaPack: encode_delta_pack_( values, bricks[aBrick] ); break;
+			case EBrickCodec::miniz: encode_deflate_( values, bricks[aBrick] ); break;
+		}
+	} );
+
+	mOffsets.resize( brickCount + 1 );
+	mOffsets[0] = 0;
+	for( std::size_t i = 0; i < brickCount; ++i )
+		mOffsets[i+1] = mOffsets[i] + bricks[i].size();
+
+	mData.resize( mOffsets.back() );
+	for( std::size_t i = 0; i < brickCount; ++i )
+		std::copy( bricks[i].begin(), bricks[i].end(), mData.begin() + mOffsets[i] );
+}
+
+Volume CompressedVolume::decompress() const
+{
+	Volume ret( mSize[0], mSize[1], mSize[2] );
+
+	std::size_t const brickCount = mOffsets.size() - 1;
+	concurrency::parallel_for( std::size_t(0), brickCount, [&] (std::size_t aBrick) {
+		std::size_t const bx = aBrick % mBrickCounts[0];
+		std::size_t const by = aBrick / mBrickCounts[0] % mBrickCounts[1];
+		std::size_t const bz = aBrick / (mBrickCounts[0] * mBrickCounts[1]);
+
+		std::vector<float> decoded( mBrickSize * mBrickSize * mBrickSize );
+		decode_( aBrick, decoded.data() );
+
+		std::size_t const x0 = bx*mBrickSize, y0 = by*mBrickSize, z0 = bz*mBrickSize;
+		std::size_t const nx = std::min( mBrickSize, mSize[0] - x0 );
+		std::size_t const ny = std::min( mBrickSize, mSize[1] - y0 );
+		std::size_t const nz = std::min( mBrickSize, mSize[2] - z0 );
+		for( std::size_t k = 0; k < nz; ++k )
+		{
+			for( std::size_t j = 0; j < ny; ++j )
+			{
+				float const* src = decoded.data() + (k*mBrickSize + j)*mBrickSize;
+				std::copy( src, src + nx, &ret( x0, y0+j, z0+k ) );
+			}
+		}
+	} );
+
+	ret.set_statistics( mStatistics );
+	return ret;
+}
+
+void CompressedVolume::decode_( std::size_t aBrick, float* aOut ) const
+{
+	std::size_t const count = mBrickSize * mBrickSize * mBrickSize;
+	std::uint8_t const* begin = mData.data() + mOffsets[aBrick];
+	std::uint8_t const* end = mData.data() + mOffsets[aBrick+1];
+
+	std::vector<std::uint16_t> values( count );
+	switch( mCodec )
+	{
+		case EBrickCodec::deltaPack: decode_delta_pack_( begin, end, values.data(), count ); break;
+		case EBrickCodec::miniz: decode_deflate_( begin, end, values.data(), count ); break;
+	}
+
+	for( std::size_t i = 0; i < count; ++i )
+		aOut[i] = values[i] * (1.f / kQuantScale_);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "volume.hpp"
+
+/* Compressed volumes
+ *
+ * `CompressedVolume` keeps a volume in memory in compressed form: the volume
+ * is split into cubic bricks of aBrickSize^3 voxels (padded at the border by
+ * repeating the last voxel), and each brick is compressed on its own. The
+ * densities are quantized to 16 bits first; the error is below 1/131070,
+ * and the densities of 8- and 16-bit datasets survive this (almost) exactly.
+ *
+ * Two codecs are available:
+ *   - `EBrickCodec::deltaPack`: the difference of each voxel to the previous
+ *     one (x fastest), bit-packed in groups of 64 with the bit width that the
+ *     group needs. Very fast, and constant regions cost one byte per group.
+ *   - `EBrickCodec::miniz`: the same differences, compressed with miniz at
+ *     its fastest level. Slower, but smaller for noisy data.
+ *
+ * The volume is only ever restored as a whole: decompress() decodes all
+ * bricks (in parallel) into a Volume, including its statistics. There is no
+ * access to individual bricks or voxels; the renderer only ever reads dense
+ * volumes. The project uses this to keep the datasets that aren't shown in
+ * memory (see compressDataset() in project.cpp), and restores a dataset when
+ * it is selected again:
+ *
+ *   CompressedVolume compressed( volume );
+ *   Volume restored = compressed.decompress();
+ *
+ * Errors (e.g., corrupt data in the decoder) are reported with
+ * std::runtime_error.
+ */
+
+enum class EBrickCodec
+{
+	deltaPack,
+	miniz
+};
+
+class CompressedVolume
+{
+	public:
+		explicit CompressedVolume( Volume const&, EBrickCodec = EBrickCodec::deltaPack, std::size_t aBrickSize = 32 );
+
+		CompressedVolume( CompressedVolume const& ) = delete;
+		CompressedVolume& operator= (CompressedVolume const&) = delete;
+
+	public:
+		std::size_t width() const;
+		std::size_t height() const;
+		std::size_t depth() const;
+
+		std::size_t brick_size() const;
+		std::size_t brick_count( int aAxis ) const;
+
+		EBrickCodec codec() const;
+
+		// Size of the compressed bricks
+		std::size_t compressed_bytes() const;
+
+	public:
+		// Decodes all bricks (in parallel) into a Volume.
+		Volume decompress() const;
+
+	private:
+		void decode_( std::size_t aBrick, float* aOut ) const;
+
+	private:
+		std::size_t mSize[3];
+		std::size_t mBrickSize;
+		std::size_t mBrickCounts[3];
+		EBrickCodec mCodec;
+
+		// The compressed bricks, back to back; brick i is at
+		// [mOffsets[i], mOffsets[i+1]).
+		std::vector<std::uint8_t> mData;
+		std::vector<std::size_t> mOffsets;
+
+		std::shared_ptr<VolumeStatistics const> mStatistics;
+};
+
+
+// Implementation:
+inline
+std::size_t CompressedVolume::width() const
+{
+	return mSize[0];
+}
+inline
+std::size_t CompressedVolume::height() const
+{
+	return mSize[1];
+}
+inline
+std::size_t CompressedVolume::depth() const
+{
+	return mSize[2];
+}
+
+inline
+std::size_t CompressedVolume::brick_size() const
+{
+	return mBrickSize;
+}
+inline
+std::size_t CompressedVolume::brick_count( int aAxis ) const
+{
+	assert( aAxis >= 0 && aAxis < 3 );
+	return mBrickCounts[aAxis];
+}
+
+inline
+EBrickCodec CompressedVolume::codec() const
+{
+	return mCodec;
+}
+
+inline
+std::size_t CompressedVolume::compressed_bytes() const
+{
+	return mData.size();
+}
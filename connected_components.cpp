@@ -0,0 +1,221 @@
+#include "connected_components.hpp"
+
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
+
+#include "parallel.hpp"
+
+std::size_t const ComponentLabels::kSlabDepth;
+
+namespace
+{
+	// Parent of the voxels outside of the range
+	std::uint32_t const kBackground = std::numeric_limits<std::uint32_t>::max();
+
+	// Root of aIndex; halves the path on the way.
+	std::uint32_t find_( std::uint32_t* aParent, std::uint32_t aIndex )
+	{
+		while( aParent[aIndex] != aIndex )
+		{
+			aParent[aIndex] = aParent[aParent[aIndex]];
+			aIndex = aParent[aIndex];
+		}
+		return aIndex;
+	}
+
+	// Root of aIndex, without modifying the forest (so it can run
+	// concurrently with other lookups).
+	std::uint32_t find_root_( std::uint32_t const* aParent, std::uint32_t aIndex )
+	{
+		while( aParent[aIndex] != aIndex )
+			aIndex = aParent[aIndex];
+		return aIndex;
+	}
+
+	// Joins the trees of aA and aB. The smaller index becomes the root, so the
+	// root of each component is its first voxel.
+	void union_( std::uint32_t* aParent, std::uint32_t aA, std::uint32_t aB )
+	{
+		std::uint32_t const ra = find_( aParent, aA );
+		std::uint32_t const rb = find_( aParent, aB );
+		if( ra < rb )
+			aParent[rb] = ra;
+		else if( rb < ra )
+			aParent[ra] = rb;
+	}
+}
+
+ComponentLabels ComponentLabels::from_volume( Volume const& aVolume, float aLo, float aHi )
+{
+	ComponentLabels ret;
+	ret.mWidth = aVolume.width();
+	ret.mHeight = aVolume.height();
+	ret.mDepth = aVolume.depth();
+	ret.mLow = aLo;
+	ret.mHigh = aHi;
+
+	std::size_t const width = ret.mWidth, height = ret.mHeight, depth = ret.mDepth;
+	std::size_t const sliceSize = width * height;
+	std::size_t const total = sliceSize * depth;
+	if( total >= kBackground )
+		throw std::runtime_error( "ComponentLabels: volume has too many voxels" );
+
+	std::size_t const slabs = (depth + kSlabDepth-1) / kSlabDepth;
+
+	// Union-find forest over the voxel indices, with one tree per component.
+	std::vector<std::uint32_t> forest( total );
+	std::uint32_t* const parent = forest.data();
+	float const* const density = aVolume.data();
+
+	// Each slab on its own.
+	concurrency::parallel_for( std::size_t(0), slabs, [&] (std::size_t aSlab) {
+		std::size_t const z0 = aSlab * kSlabDepth;
+		std::size_t const z1 = std::min( z0 + kSlabDepth, depth );
+		for( std::size_t z = z0; z < z1; ++z )
+		{
+			for( std::size_t y = 0; y < height; ++y )
+			{
+				std::uint32_t i = std::uint32_t((z*height + y)*width);
+				for( std::size_t x = 0; x < width; ++x, ++i )
+				{
+					if( density[i] < aLo || density[i] > aHi )
+					{
+						parent[i] = kBackground;
+						continue;
+					}
+
+					// The voxel starts a new tree, or hangs directly off the root of its
+					// neighbour along x.
+					parent[i] = x > 0 && kBackground != parent[i-1] ? find_( parent, i-1 ) : i;
+					if( y > 0 && kBackground != parent[i-width] )
+						union_( parent, std::uint32_t(i-width), i );
+					if( z > z0 && kBackground != parent[i-sliceSize] )
+						union_( parent, std::uint32_t(i-sliceSize), i );
+				}
+			}
+		}
+	} );
+
+	// Merge: join the components across the boundaries between the slabs.
+	for( std::size_t slab = 1; slab < slabs; ++slab )
+	{
+		std::uint32_t const first = std::uint32_t(slab * kSlabDepth * sliceSize);
+		for( std::uint32_t i = first; i < first + sliceSize; ++i )
+		{
+			if( kBackground != parent[i] && kBackground != parent[i-sliceSize] )
+				union_( parent, std::uint32_t(i-sliceSize), i );
+		}
+	}
+
+	// Number the roots in order, with an offset per slab.
+	std::vector<std::uint32_t> firstLabels( slabs+1, 0 );
+	concurrency::parallel_for( std::size_t(0), slabs, [&] (std::size_t aSlab) {
+		std::size_t const begin = aSlab * kSlabDepth * sliceSize;
+		std::size_t const end = std::min( (aSlab+1) * kSlabDepth, depth ) * sliceSize;
+
+		std::uint32_t roots = 0;
+		for( std::size_t i = begin; i < end; ++i )
+			roots += parent[i] == i ? 1 : 0;
+		firstLabels[aSlab+1] = roots;
+	} );
+
+	for( std::size_t slab = 0; slab < slabs; ++slab )
+		firstLabels[slab+1] += firstLabels[slab];
+
+	ret.mLabels.resize( total );
+	std::uint32_t* const labels = ret.mLabels.data();
+	concurrency::parallel_for( std::size_t(0), slabs, [&] (std::size_t aSlab) {
+		std::size_t const begin = aSlab * kSlabDepth * sliceSize;
+		std::size_t const end = std::min( (aSlab+1) * kSlabDepth, depth ) * sliceSize;
+
+		std::uint32_t next = firstLabels[aSlab];
+		for( std::size_t i = begin; i < end; ++i )
+		{
+			if( parent[i] == i )
+				labels[i] = ++next;
+		}
+	} );
+
+	// Label the other voxels with the label of their root, and gather the
+	// statistics of the components. The root is the first voxel of a
+	// component, so the components that start in a slab only extend into the
+	// slabs after it. Each slab updates the statistics of the components that
+	// start in it directly, and collects the ones of earlier components in a
+	// map, which are merged afterwards.
+	ComponentStatistics const empty = {
+		0,
+		{ std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), std::numeric_limits<int>::max() },
+		{ std::numeric_limits<int>::min(), std::numeric_limits<int>::min(), std::numeric_limits<int>::min() }
+	};
+	ret.mStatistics.assign( firstLabels[slabs], empty );
+
+	std::vector<std::unordered_map<std::uint32_t, ComponentStatistics>> slabStatistics( slabs );
+	concurrency::parallel_for( std::size_t(0), slabs, [&] (std::size_t aSlab) {
+		auto& earlier = slabStatistics[aSlab];
+		std::uint32_t const firstOwn = firstLabels[aSlab];
+
+		// Neighbouring voxels mostly share their label, so remember the last
+		// entry. (References into the map stay valid when it grows.)
+		std::uint32_t lastLabel = 0;
+		ComponentStatistics* last = nullptr;
+
+		std::size_t const z0 = aSlab * kSlabDepth;
+		std::size_t const z1 = std::min( z0 + kSlabDepth, depth );
+		for( std::size_t z = z0; z < z1; ++z )
+		{
+			for( std::size_t y = 0; y < height; ++y )
+			{
+				std::uint32_t i = std::uint32_t((z*height + y)*width);
+				for( std::size_t x = 0; x < width; ++x, ++i )
+				{
+					if( kBackground == parent[i] )
+					{
+						labels[i] = 0;
+						continue;
+					}
+
+					if( parent[i] != i )
+						labels[i] = labels[find_root_( parent, i )];
+
+					std::uint32_t const label = labels[i];
+					if( label != lastLabel )
+					{
+						if( label > firstOwn )
+							last = &ret.mStatistics[label-1];
+						else
+							last = &earlier.emplace( label, empty ).first->second;
+
+						lastLabel = label;
+					}
+
+					ComponentStatistics& s = *last;
+					++s.count;
+					int const c[3] = { int(x), int(y), int(z) };
+					for( int axis = 0; axis < 3; ++axis )
+					{
+						s.min[axis] = std::min( s.min[axis], c[axis] );
+						s.max[axis] = std::max( s.max[axis], c[axis] );
+					}
+				}
+			}
+		}
+	} );
+
+	for( auto const& earlier : slabStatistics )
+	{
+		for( auto const& entry : earlier )
+		{
+			ComponentStatistics& s = ret.mStatistics[entry.first-1];
+			s.count += entry.second.count;
+			for( int axis = 0; axis < 3; ++axis )
+			{
+				s.min[axis] = std::min( s.min[axis], entry.second.min[axis] );
+				s.max[axis] = std::max( s.max[axis], entry.second.max[axis] );
+			}
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vector>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "volume.hpp"
+
+/* Connected components
+ *
+ * `ComponentLabels` labels the connected components (via the six face
+ * neighbours) of the voxels whose density lies in the range [aLo, aHi].
+ * Labels are compact: voxels outside of the range get label 0, and the
+ * components are numbered 1..component_count() in the order of their first
+ * voxel (x fastest, then y, then z). Looking up the label of a voxel is a
+ * single array access:
+ *
+ *   ComponentLabels labels = ComponentLabels::from_volume( volume, lo, hi );
+ *   std::uint32_t const component = labels.label( x, y, z );
+ *   if( component )
+ *      std::size_t voxels = labels.statistics( component ).count;
+ *
+ * from_volume() splits the volume into slabs of kSlabDepth slices and runs a
+ * union-find over each slab in parallel. A (sequential) merge step then
+ * joins the components across the slab boundaries, after which the labels
+ * and the statistics of the components are again computed in parallel.
+ *
+ * The volume may have at most 2^32-1 voxels.
+ */
+struct ComponentStatistics
+{
+	std::size_t count; // voxels
+
+	// Bounding box (inclusive)
+	int min[3];
+	int max[3];
+};
+
+class ComponentLabels
+{
+	public:
+		static std::size_t const kSlabDepth = 16;
+
+	public:
+		ComponentLabels() = default;
+
+		static ComponentLabels from_volume( Volume const&, float aLo, float aHi );
+
+	public:
+		std::size_t width() const;
+		std::size_t height() const;
+		std::size_t depth() const;
+
+		// The range of densities that was labeled
+		float low() const;
+		float high() const;
+
+		std::size_t component_count() const;
+
+	public:
+		// Label of the voxel; 0 if it isn't part of any component.
+		std::uint32_t label( std::size_t aX, std::size_t aY, std::size_t aZ ) const;
+
+		// Statistics of component aLabel, 1 <= aLabel <= component_count()
+		ComponentStatistics const& statistics( std::uint32_t aLabel ) const;
+
+		std::uint32_t const* data() const;
+
+	private:
+		std::size_t mWidth = 0, mHeight = 0, mDepth = 0;
+		float mLow = 0.f, mHigh = 0.f;
+
+		std::vector<std::uint32_t> mLabels;
+		std::vector<ComponentStatistics> mStatistics; // of label i+1
+};
+
+
+// Implementation:
+inline
+std::size_t ComponentLabels::width() const
+{
+	return mWidth;
+}
+inline
+std::size_t ComponentLabels::height() const
+{
+	return mHeight;
+}
+inline
+std::size_t ComponentLabels::depth() const
+{
+	return mDepth;
+}
+
+inline
+float ComponentLabels::low() const
+{
+	return mLow;
+}
+inline
+float ComponentLabels::high() const
+{
+	return mHigh;
+}
+
+inline
+std::size_t ComponentLabels::component_count() const
+{
+	return mStatistics.size();
+}
+
+inline
+std::uint32_t ComponentLabels::label( std::size_t aX, std::size_t aY, std::size_t aZ ) const
+{
+	assert( aX < mWidth && aY < mHeight && aZ < mDepth );
+	return mLabels[(aZ*mHeight + aY)*mWidth + aX];
+}
+
+inline
+ComponentStatistics const& ComponentLabels::statistics( std::uint32_t aLabel ) const
+{
+	assert( aLabel >= 1 && aLabel <= mStatistics.size() );
+	return mStatistics[aLabel-1];
+}
+
+inline
+std::uint32_t const* ComponentLabels::data() const
+{
+	return mLabels.data();
+}
@@ -0,0 +1,46 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+
+#include <cassert>
+
+FrameArena::FrameArena( std::size_t aInitialCapacity )
+	: mBlock( new unsigned char[aInitialCapacity] )
+	, mCapacity(aInitialCapacity)
+{}
+
+void* FrameArena::allocate( std::size_t aBytes, std::size_t aAlignment )
+{
+	assert( aAlignment > 0 && 0 == (aAlignment & (aAlignment-1)) );
+	assert( aAlignment <= alignof(std::max_align_t) );
+
+	// The blocks from new[] are aligned to max_align_t, so aligning the
+	// offset aligns the address.
+	std::size_t const offset = (mOffset + aAlignment-1) & ~(aAlignment-1);
+	if( offset + aBytes <= mCapacity )
+	{
+		mOffset = offset + aBytes;
+		mHighWater = std::max( mHighWater, used() );
+		return mBlock.get() + offset;
+	}
+
+	// Doesn't fit: use a separate block until the next reset().
+	mOverflow.emplace_back( new unsigned char[std::max( aBytes, std::size_t(1) )] );
+	mOverflowBytes += aBytes;
+	mHighWater = std::max( mHighWater, used() );
+	return mOverflow.back().get();
+}
+
+void FrameArena::reset()
+{
+	if( !mOverflow.empty() )
+	{
+		// Grow the block so that the next frame of the same size fits.
+		mOverflow.clear();
+		mCapacity = mHighWater + mHighWater/4;
+		mBlock.reset( new unsigned char[mCapacity] );
+	}
+
+	mOffset = 0;
+	mOverflowBytes = 0;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <type_traits>
+
+#include <cstddef>
+
+/* Per-frame bump allocator
+ *
+ * `FrameArena` hands out memory for transient data that only lives until the
+ * end of the current frame. Allocating is a pointer bump in a single block;
+ * nothing is freed individually. reset() releases everything at once:
+ *
+ *   gFrameArena.reset(); // start of the frame
+ *   ...
+ *   StreamVertex* vertices = gFrameArena.allocate<StreamVertex>( count );
+ *   ArenaVector<PackedPoint> points( ArenaAllocator<PackedPoint>( gFrameArena ) );
+ *
+ * When a frame needs more than the block holds, the arena falls back to extra
+ * blocks from the heap. The next reset() frees these and regrows the block to
+ * the high-water mark of the frame (plus some headroom), so that after the
+ * first few frames, a steady-state frame doesn't touch the heap at all.
+ *
+ * Only trivially destructible objects may be placed in the arena, as no
+ * destructors are run, and only with alignments up to that of
+ * std::max_align_t (so no Packs, which are over-aligned; see vec3DPack.hpp).
+ * The arena is not thread safe; use it from the rendering thread only.
+ */
+class FrameArena
+{
+	public:
+		explicit FrameArena( std::size_t aInitialCapacity = 64*1024 );
+
+		FrameArena( FrameArena const& ) = delete;
+		FrameArena& operator= (FrameArena const&) = delete;
+
+	public:
+		void* allocate( std::size_t aBytes, std::size_t aAlignment = alignof(std::max_align_t) );
+
+		template< typename tType >
+		tType* allocate( std::size_t aCount );
+
+		// Ends the frame: releases all allocations. Pointers into the arena
+		// must not be used afterwards.
+		void reset();
+
+	public:
+		// Bytes allocated in the current frame.
+		std::size_t used() const;
+
+		// Largest number of bytes allocated in a single frame so far.
+		std::size_t high_water() const;
+
+		// Size of the block; frames up to this size don't allocate.
+		std::size_t capacity() const;
+
+		// Allocations in the current frame that didn't fit into the block,
+		// i.e., that went to the heap.
+		std::size_t spills() const;
+
+	private:
+		std::unique_ptr<unsigned char[]> mBlock;
+		std::size_t mCapacity;
+		std::size_t mOffset = 0;
+
+		// Blocks for the allocations that didn't fit into mBlock.
+		std::vector<std::unique_ptr<unsigned char[]>> mOverflow;
+		std::size_t mOverflowBytes = 0;
+
+		std::size_t mHighWater = 0;
+};
+
+/* Standard allocator that allocates from a FrameArena, e.g., for a std::vector
+ * that only lives for a frame (see ArenaVector). Deallocation is a no-op; the
+ * memory is released by the arena's reset().
+ */
+template< typename tType >
+class ArenaAllocator
+{
+	public:
+		using value_type = tType;
+
+	public:
+		explicit ArenaAllocator( FrameArena& ) noexcept;
+
+		template< typename tOther >
+		ArenaAllocator( ArenaAllocator<tOther> const& ) noexcept;
+
+	public:
+		tType* allocate( std::size_t );
+		void deallocate( tType*, std::size_t ) noexcept;
+
+	public:
+		FrameArena* arena() const noexcept;
+
+	private:
+		FrameArena* mArena;
+};
+
+template< typename tType, typename tOther >
+bool operator== (ArenaAllocator<tType> const&, ArenaAllocator<tOther> const&);
+template< typename tType, typename tOther >
+bool operator!= (ArenaAllocator<tType> const&, ArenaAllocator<tOther> const&);
+
+template< typename tType >
+using ArenaVector = std::vector<tType, ArenaAllocator<tType>>;
+
+
+// Implementation:
+template< typename tType > inline
+tType* FrameArena::allocate( std::size_t aCount )
+{
+	static_assert( std::is_trivially_destructible<tType>::value, "FrameArena: objects in the arena are never destroyed" );
+	static_assert( alignof(tType) <= alignof(std::max_align_t), "FrameArena: over-aligned types (e.g. Packs) aren't supported" );
+	return static_cast<tType*>(allocate( aCount * sizeof(tType), alignof(tType) ));
+}
+
+inline
+std::size_t FrameArena::used() const
+{
+	return mOffset + mOverflowBytes;
+}
+inline
+std::size_t FrameArena::high_water() const
+{
+	return mHighWater;
+}
+inline
+std::size_t FrameArena::capacity() const
+{
+	return mCapacity;
+}
+inline
+std::size_t FrameArena::spills() const
+{
+	return mOverflow.size();
+}
+
+template< typename tType > inline
+ArenaAllocator<tType>::ArenaAllocator( FrameArena& aArena ) noexcept
+	: mArena(&aArena)
+{}
+
+template< typename tType > template< typename tOther > inline
+ArenaAllocator<tType>::ArenaAllocator( ArenaAllocator<tOther> const& aOther ) noexcept
+	: mArena(aOther.arena())
+{}
+
+template< typename tType > inline
+tType* ArenaAllocator<tType>::allocate( std::size_t aCount )
+{
+	return mArena->allocate<tType>( aCount );
+}
+template< typename tType > inline
+void ArenaAllocator<tType>::deallocate( tType*, std::size_t ) noexcept
+{}
+
+template< typename tType > inline
+FrameArena* ArenaAllocator<tType>::arena() const noexcept
+{
+	return mArena;
+}
+
+template< typename tType, typename tOther > inline
+bool operator== (ArenaAllocator<tType> const& aX, ArenaAllocator<tOther> const& aY)
+{
+	return aX.arena() == aY.arena();
+}
+template< typename tType, typename tOther > inline
+bool operator!= (ArenaAllocator<tType> const& aX, ArenaAllocator<tOther> const& aY)
+{
+	return !(aX == aY);
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/* A lookup table for classifying voxels by their label
+ *
+ * `LabelLUT` maps each 16-bit label (see Volume::label()) to a color and a
+ * visibility flag. Label 0 means "unlabeled"; its entry is visible and has
+ * no color of its own, i.e., such voxels keep the color of the transfer
+ * function. The other labels start out visible, with distinct colors (hues
+ * spaced by the golden ratio).
+ *
+ *   LabelLUT lut;
+ *   lut.toggle( 3 );                  // hide label 3
+ *   if( lut.visible( volume.label( x, y, z ) ) )
+ *      std::uint8_t const* rgb = lut.color( volume.label( x, y, z ) );
+ *
+ * Every change increments version(), so that data derived from the table
+ * (e.g., colors of points) can be brought up to date lazily.
+ */
+class LabelLUT
+{
+	public:
+		static std::size_t const kLabelCount = 65536;
+
+	public:
+		LabelLUT();
+
+	public:
+		bool visible( std::uint16_t aLabel ) const;
+
+		// RGB of the label
+		std::uint8_t const* color( std::uint16_t aLabel ) const;
+
+		void set_visible( std::uint16_t aLabel, bool aVisible );
+		void set_color( std::uint16_t aLabel, std::uint8_t aR, std::uint8_t aG, std::uint8_t aB );
+
+		void toggle( std::uint16_t aLabel );
+		void show_all();
+
+		unsigned version() const;
+
+	private:
+		struct Entry_
+		{
+			std::uint8_t rgb[3];
+			std::uint8_t visible;
+		};
+
+	private:
+		std::vector<Entry_> mEntries;
+		unsigned mVersion = 0;
+};
+
+
+// Implementation:
+inline
+LabelLUT::LabelLUT()
+	: mEntries( kLabelCount )
+{
+	mEntries[0] = Entry_{ { 255, 255, 255 }, 1 };
+
+	// HSV to RGB with saturation 0.65 and value 0.95
+	for( std::size_t label = 1; label < kLabelCount; ++label )
+	{
+		float const hue = 6.f * std::fmod( 0.618034f * float(label), 1.f );
+		float const f = hue - std::floor( hue );
+		float const v = 0.95f, p = v * (1.f - 0.65f), q = v * (1.f - 0.65f*f), t = v * (1.f - 0.65f*(1.f - f));
+
+		float rgb[3];
+		switch( int(hue) % 6 )
+		{
+			case 0: rgb[0] = v; rgb[1] = t; rgb[2] = p; break;
+			case 1: rgb[0] = q; rgb[1] = v; rgb[2] = p; break;
+			case 2: rgb[0] = p; rgb[1] = v; rgb[2] = t; break;
+			case 3: rgb[0] = p; rgb[1] = q; rgb[2] = v; break;
+			case 4: rgb[0] = t; rgb[1] = p; rgb[2] = v; break;
+			default: rgb[0] = v; rgb[1] = p; rgb[2] = q; break;
+		}
+
+		Entry_& entry = mEntries[label];
+		for( int i = 0; i < 3; ++i )
+			entry.rgb[i] = std::uint8_t(rgb[i] * 255.f + 0.5f);
+		entry.visible = 1;
+	}
+}
+
+inline
+bool LabelLUT::visible( std::uint16_t aLabel ) const
+{
+	return 0 != mEntries[aLabel].visible;
+}
+inline
+std::uint8_t const* LabelLUT::color( std::uint16_t aLabel ) const
+{
+	return mEntries[aLabel].rgb;
+}
+
+inline
+void LabelLUT::set_visible( std::uint16_t aLabel, bool aVisible )
+{
+	mEntries[aLabel].visible = aVisible ? 1 : 0;
+	++mVersion;
+}
+inline
+void LabelLUT::set_color( std::uint16_t aLabel, std::uint8_t aR, std::uint8_t aG, std::uint8_t aB )
+{
+	Entry_& entry = mEntries[aLabel];
+	entry.rgb[0] = aR;
+	entry.rgb[1] = aG;
+	entry.rgb[2] = aB;
+	++mVersion;
+}
+
+inline
+void LabelLUT::toggle( std::uint16_t aLabel )
+{
+	set_visible( aLabel, !visible( aLabel ) );
+}
+inline
+void LabelLUT::show_all()
+{
+	for( auto& entry : mEntries )
+		entry.visible = 1;
+	++mVersion;
+}
+
+inline
+unsigned LabelLUT::version() const
+{
+	return mVersion;
+}
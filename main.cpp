@@ -100,6 +100,13 @@ void mouse( int button, int state, int x, int y )
 		project_interact_mouse_wheel( true );
 	else if( 4 == button )
 		project_interact_mouse_wheel( false );
+	else if( GLUT_LEFT_BUTTON == button && GLUT_DOWN == state && (glutGetModifiers() & GLUT_ACTIVE_SHIFT) )
+	{
+		// Shift-click: pick the voxel under the mouse.
+		Vec3Df origin, direction;
+		getWorldRayOfPixel( x, y, origin, direction );
+		project_pick( origin, direction );
+	}
 	else
 		tbMouseFunc( button, state, x, y );
 
@@ -0,0 +1,428 @@
+#include "marching_cubes.hpp"
+
+#include <algorithm>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "parallel.hpp"
+
+#include "volume_sampler.hpp"
+
+namespace
+{
+	/* Corner i of a cell is at the offset (i&1, (i>>1)&1, (i>>2)&1) from the
+	 * cell's lowest corner. Edge e connects the corners kEdgeCorners[e][0] and
+	 * kEdgeCorners[e][1], where the first corner is the one with the lower
+	 * coordinates. Edges 0-3 run along x, 4-7 along y and 8-11 along z.
+	 */
+	int const kEdgeCorners[12][2] = {
+		{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+		{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+		{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+	};
+
+	// The corners of the six faces of a cell, in cyclic order. Face f is
+	// perpendicular to axis f/2, on the low (even f) or high (odd f) side.
+	int const kFaceCorners[6][4] = {
+		{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+		{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+		{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }
+	};
+
+	std::size_t const kMaxCaseTriangles = 16;
+
+	struct CaseEntry_
+	{
+		std::size_t triangleCount;
+		std::int8_t edges[kMaxCaseTriangles*3];
+	};
+
+	int edge_between_( int aA, int aB )
+	{
+		for( int e = 0; e < 12; ++e )
+		{
+			if( (kEdgeCorners[e][0] == aA && kEdgeCorners[e][1] == aB) || (kEdgeCorners[e][0] == aB && kEdgeCorners[e][1] == aA) )
+				return e;
+		}
+
+		assert( false );
+		return -1;
+	}
+
+	int corner_offset_( int aCorner, int aAxis )
+	{
+		return (aCorner >> aAxis) & 1;
+	}
+
+	// Do the edges aA and aB lie in a common face of the cell?
+	bool share_face_( int aA, int aB )
+	{
+		for( int f = 0; f < 6; ++f )
+		{
+			int const* corners = kFaceCorners[f];
+			auto in_face = [&] (int aEdge) {
+				return std::count( corners, corners+4, kEdgeCorners[aEdge][0] ) && std::count( corners, corners+4, kEdgeCorners[aEdge][1] );
+			};
+
+			if( in_face( aA ) && in_face( aB ) )
+				return true;
+		}
+		return false;
+	}
+
+	/* Generates the triangles for one of the 256 inside/outside configurations
+	 * of the corners of a cell.
+	 *
+	 * On each face, the surface crosses the edges between inside and outside
+	 * corners. Walking around the face (counter-clockwise when seen from the
+	 * outside), each run of consecutive inside corners is entered through one
+	 * crossed edge and left through the next; the surface cuts off the run with
+	 * a segment from the entry to the exit edge. Faces with two diagonally
+	 * opposite inside corners thus always separate these corners. The decision
+	 * only depends on the face itself, so the two cells that share the face
+	 * agree on it, which keeps the mesh watertight.
+	 *
+	 * Every crossed edge is shared by two faces, and traversed in opposite
+	 * directions by them: it's the exit of a run on one face and the entry of a
+	 * run on the other. The segments therefore link up into closed loops, which
+	 * are triangulated as fans.
+	 */
+	CaseEntry_ make_case_( unsigned aConfig )
+	{
+		auto inside = [&] (int aCorner) { return 0 != ((aConfig >> aCorner) & 1); };
+
+		int next[12];
+		std::fill( next, next+12, -1 );
+
+		for( int f = 0; f < 6; ++f )
+		{
+			// Orient the face counter-clockwise when seen from the outside.
+			int corners[4];
+			std::copy( kFaceCorners[f], kFaceCorners[f]+4, corners );
+
+			int const axis = f / 2;
+			int const outward = (f & 1) ? 1 : -1;
+			int const u = (axis+1) % 3, v = (axis+2) % 3;
+			int const du0 = corner_offset_( corners[1], u ) - corner_offset_( corners[0], u );
+			int const dv0 = corner_offset_( corners[1], v ) - corner_offset_( corners[0], v );
+			int const du1 = corner_offset_( corners[2], u ) - corner_offset_( corners[1], u );
+			int const dv1 = corner_offset_( corners[2], v ) - corner_offset_( corners[1], v );
+			if( (du0*dv1 - dv0*du1) * outward < 0 )
+				std::reverse( corners, corners+4 );
+
+			for( int i = 0; i < 4; ++i )
+			{
+				// Entry into a run of inside corners?
+				if( inside( corners[i] ) || !inside( corners[(i+1)%4] ) )
+					continue;
+
+				// Find the exit of this run.
+				for( int j = 1; j < 4; ++j )
+				{
+					int const a = corners[(i+j)%4], b = corners[(i+j+1)%4];
+					if( inside( a ) && !inside( b ) )
+					{
+						next[edge_between_( corners[i], corners[(i+1)%4] )] = edge_between_( a, b );
+						break;
+					}
+				}
+			}
+		}
+
+		CaseEntry_ entry{};
+
+		bool visited[12] = {};
+		for( int e = 0; e < 12; ++e )
+		{
+			if( next[e] < 0 || visited[e] )
+				continue;
+
+			int loop[12];
+			int loopSize = 0;
+			for( int cur = e; !visited[cur]; cur = next[cur] )
+			{
+				assert( next[cur] >= 0 );
+				visited[cur] = true;
+				loop[loopSize++] = cur;
+			}
+
+			// Start the fan where none of its diagonals lies in a face of the
+			// cell. (Such a diagonal joins two different segments of a face;
+			// the cell on the other side of the face then has a triangle in
+			// the face as well, and the two fold onto each other.)
+			int apex = 0, apexFaceDiagonals = loopSize;
+			for( int k = 0; k < loopSize && apexFaceDiagonals > 0; ++k )
+			{
+				int faceDiagonals = 0;
+				for( int i = 2; i+1 < loopSize; ++i )
+					faceDiagonals += share_face_( loop[k], loop[(k+i)%loopSize] ) ? 1 : 0;
+
+				if( faceDiagonals < apexFaceDiagonals )
+				{
+					apex = k;
+					apexFaceDiagonals = faceDiagonals;
+				}
+			}
+
+			for( int i = 1; i+1 < loopSize; ++i )
+			{
+				assert( entry.triangleCount < kMaxCaseTriangles );
+				std::int8_t* tri = entry.edges + 3*entry.triangleCount++;
+				tri[0] = std::int8_t(loop[apex]);
+				tri[1] = std::int8_t(loop[(apex+i)%loopSize]);
+				tri[2] = std::int8_t(loop[(apex+i+1)%loopSize]);
+			}
+		}
+
+		// Each edge between an inside and an outside corner got a vertex.
+		for( int e = 0; e < 12; ++e )
+			assert( visited[e] == (inside( kEdgeCorners[e][0] ) != inside( kEdgeCorners[e][1] )) );
+
+		return entry;
+	}
+
+	struct CaseTable_
+	{
+		CaseEntry_ cases[256];
+
+		CaseTable_()
+		{
+			for( unsigned config = 0; config < 256; ++config )
+				cases[config] = make_case_( config );
+		}
+	};
+
+	CaseTable_ const& case_table_()
+	{
+		static CaseTable_ const table;
+		return table;
+	}
+
+
+	unsigned const kNoVertex = ~0u;
+
+	Vertex make_vertex_( Volume const& aVolume, float aIso, int aX, int aY, int aZ, int aAxis, float aV0, float aV1 )
+	{
+		int const dx = 0 == aAxis, dy = 1 == aAxis, dz = 2 == aAxis;
+
+		float const t = (aIso - aV0) / (aV1 - aV0);
+
+		Vec3Df const p0 = Vec3Df( float(aX), float(aY), float(aZ) );
+		Vec3Df const p1 = Vec3Df( float(aX+dx), float(aY+dy), float(aZ+dz) );
+
+		Vec3Df const g0 = gradient( aVolume, aX, aY, aZ );
+		Vec3Df const g1 = gradient( aVolume, aX+dx, aY+dy, aZ+dz );
+
+		Vec3Df n = -Vec3Df::interpolate( g0, g1, t );
+		n.normalize();
+
+		return Vertex( Vec3Df::interpolate( p0, p1, t ), n );
+	}
+
+	/* Extracts the cells [aX0,aX1) x [aY0,aY1) x [aZ0,aZ1) and appends the
+	 * result to aVertices/aTriangles.
+	 */
+	void extract_cells_( Volume const& aVolume, float aIso, std::size_t aX0, std::size_t aX1, std::size_t aY0, std::size_t aY1, std::size_t aZ0, std::size_t aZ1, std::vector<Vertex>& aVertices, std::vector<Triangle>& aTriangles )
+	{
+		CaseTable_ const& table = case_table_();
+
+		// Number of grid points per row/column of the box
+		std::size_t const width = aX1 - aX0 + 1;
+		std::size_t const height = aY1 - aY0 + 1;
+
+		// Vertex indices of the edges of the current layer of cells: the x- and
+		// y-edges of its lower and upper planes, and the z-edges in between.
+		// The buffers are kept per thread and reused by the next call, so
+		// that re-extracting bricks doesn't allocate once they have grown.
+		static thread_local std::vector<unsigned> planes[2], zEdges;
+		planes[0].assign( width*height*2, kNoVertex );
+		planes[1].assign( width*height*2, kNoVertex );
+		zEdges.assign( width*height, kNoVertex );
+
+		int lower = 0;
+		for( std::size_t z = aZ0; z < aZ1; ++z )
+		{
+			for( std::size_t y = aY0; y < aY1; ++y )
+			{
+				for( std::size_t x = aX0; x < aX1; ++x )
+				{
+					float values[8];
+					unsigned config = 0;
+					for( int i = 0; i < 8; ++i )
+					{
+						values[i] = aVolume( x + (i&1), y + ((i>>1)&1), z + ((i>>2)&1) );
+						if( values[i] >= aIso )
+							config |= 1u << i;
+					}
+
+					CaseEntry_ const& entry = table.cases[config];
+					if( 0 == entry.triangleCount )
+						continue;
+
+					unsigned indices[12];
+					std::fill( indices, indices+12, kNoVertex );
+
+					auto vertex_index = [&] (int aEdge) {
+						if( kNoVertex != indices[aEdge] )
+							return indices[aEdge];
+
+						int const a = kEdgeCorners[aEdge][0], b = kEdgeCorners[aEdge][1];
+						int const axis = aEdge / 4;
+						std::size_t const ex = x + (a&1), ey = y + ((a>>1)&1), ez = z + ((a>>2)&1);
+						std::size_t const local = (ey-aY0)*width + (ex-aX0);
+
+						unsigned& slot = 2 == axis
+							? zEdges[local]
+							: planes[((a>>2)&1) ? 1-lower : lower][local*2 + axis]
+						;
+
+						if( kNoVertex == slot )
+						{
+							slot = unsigned(aVertices.size());
+							aVertices.emplace_back( make_vertex_( aVolume, aIso, int(ex), int(ey), int(ez), axis, values[a], values[b] ) );
+						}
+
+						return indices[aEdge] = slot;
+					};
+
+					for( std::size_t t = 0; t < entry.triangleCount; ++t )
+					{
+						std::int8_t const* tri = entry.edges + 3*t;
+						aTriangles.emplace_back( vertex_index( tri[0] ), vertex_index( tri[1] ), vertex_index( tri[2] ) );
+					}
+				}
+			}
+
+			// The upper plane becomes the lower plane of the next layer.
+			std::fill( planes[lower].begin(), planes[lower].end(), kNoVertex );
+			std::fill( zEdges.begin(), zEdges.end(), kNoVertex );
+			lower = 1-lower;
+		}
+	}
+}
+
+BrickedIsosurface::BrickedIsosurface( std::size_t aBrickCells )
+	: mBrickCells(aBrickCells)
+{
+	assert( mBrickCells > 0 );
+}
+
+void BrickedIsosurface::reset( Volume const& aVolume )
+{
+	mExtracted = false;
+	mChunks.clear();
+
+	std::size_t const size[3] = { aVolume.width(), aVolume.height(), aVolume.depth() };
+	if( size[0] < 2 || size[1] < 2 || size[2] < 2 )
+	{
+		mBrickCounts[0] = mBrickCounts[1] = mBrickCounts[2] = 0;
+		return;
+	}
+
+	for( int d = 0; d < 3; ++d )
+		mBrickCounts[d] = (size[d]-1 + mBrickCells-1) / mBrickCells;
+
+	mChunks.resize( mBrickCounts[0] * mBrickCounts[1] * mBrickCounts[2] );
+
+	concurrency::parallel_for( std::size_t(0), mChunks.size(), [&] (std::size_t b) {
+		std::size_t const bx = b % mBrickCounts[0];
+		std::size_t const by = (b / mBrickCounts[0]) % mBrickCounts[1];
+		std::size_t const bz = b / (mBrickCounts[0] * mBrickCounts[1]);
+
+		// The cells of the brick use the grid points [b*cells, (b+1)*cells].
+		float lo = aVolume( bx*mBrickCells, by*mBrickCells, bz*mBrickCells ), hi = lo;
+		for( std::size_t z = bz*mBrickCells; z <= std::min( (bz+1)*mBrickCells, size[2]-1 ); ++z )
+		{
+			for( std::size_t y = by*mBrickCells; y <= std::min( (by+1)*mBrickCells, size[1]-1 ); ++y )
+			{
+				for( std::size_t x = bx*mBrickCells; x <= std::min( (bx+1)*mBrickCells, size[0]-1 ); ++x )
+				{
+					float const density = aVolume( x, y, z );
+					lo = std::min( lo, density );
+					hi = std::max( hi, density );
+				}
+			}
+		}
+
+		mChunks[b].minDensity = lo;
+		mChunks[b].maxDensity = hi;
+	} );
+}
+
+std::size_t BrickedIsosurface::update( Volume const& aVolume, float aIsoValue )
+{
+	if( mExtracted && aIsoValue == mIsoValue )
+		return 0;
+
+	// Cells with all corners >= the isovalue or all corners < the isovalue
+	// don't produce any triangles.
+	auto crosses = [] (MeshChunk const& aChunk, float aIso) {
+		return aChunk.minDensity < aIso && aChunk.maxDensity >= aIso;
+	};
+
+	std::vector<std::size_t>& dirty = mDirty;
+	dirty.clear();
+	for( std::size_t b = 0; b < mChunks.size(); ++b )
+	{
+		MeshChunk& chunk = mChunks[b];
+
+		bool const wasCrossing = mExtracted && crosses( chunk, mIsoValue );
+		if( crosses( chunk, aIsoValue ) )
+		{
+			dirty.push_back( b );
+		}
+		else if( wasCrossing )
+		{
+			chunk.vertices.clear();
+			chunk.triangles.clear();
+		}
+	}
+
+	// Make sure the table is built before the parallel section.
+	case_table_();
+
+	std::size_t const cells[3] = { aVolume.width()-1, aVolume.height()-1, aVolume.depth()-1 };
+	concurrency::parallel_for( std::size_t(0), dirty.size(), [&] (std::size_t i) {
+		std::size_t const b = dirty[i];
+		std::size_t const bx = b % mBrickCounts[0];
+		std::size_t const by = (b / mBrickCounts[0]) % mBrickCounts[1];
+		std::size_t const bz = b / (mBrickCounts[0] * mBrickCounts[1]);
+
+		MeshChunk& chunk = mChunks[b];
+		chunk.vertices.clear();
+		chunk.triangles.clear();
+
+		extract_cells_( aVolume, aIsoValue,
+			bx*mBrickCells, std::min( (bx+1)*mBrickCells, cells[0] ),
+			by*mBrickCells, std::min( (by+1)*mBrickCells, cells[1] ),
+			bz*mBrickCells, std::min( (bz+1)*mBrickCells, cells[2] ),
+			chunk.vertices, chunk.triangles
+		);
+	} );
+
+	mIsoValue = aIsoValue;
+	mExtracted = true;
+	return dirty.size();
+}
+
+std::vector<MeshChunk> const& BrickedIsosurface::chunks() const
+{
+	return mChunks;
+}
+
+std::size_t BrickedIsosurface::vertex_count() const
+{
+	std::size_t count = 0;
+	for( auto const& chunk : mChunks )
+		count += chunk.vertices.size();
+	return count;
+}
+std::size_t BrickedIsosurface::triangle_count() const
+{
+	std::size_t count = 0;
+	for( auto const& chunk : mChunks )
+		count += chunk.triangles.size();
+	return count;
+}
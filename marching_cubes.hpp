@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+
+#include "vertex.hpp"
+#include "triangle.hpp"
+#include "volume.hpp"
+
+/* The triangles of one brick of a `BrickedIsosurface`, with their own
+ * (brick-local) vertex indices.
+ */
+struct MeshChunk
+{
+	std::vector<Vertex> vertices;
+	std::vector<Triangle> triangles;
+
+	// Range of the densities of the grid points of the brick
+	float minDensity, maxDensity;
+};
+
+/* Iso-surface extraction with marching cubes
+ *
+ * `BrickedIsosurface` extracts the surface where the density of the volume
+ * crosses an isovalue. Voxels with a density >= the isovalue are considered
+ * to be inside the surface. The result is a set of indexed triangle meshes:
+ *
+ *   - the vertex positions are in grid (voxel) coordinates, i.e., in
+ *     [0,width-1] x [0,height-1] x [0,depth-1];
+ *   - the vertex normals are the normalized negative density gradient, so
+ *     that they point out of the surface (towards lower densities);
+ *   - the triangles are wound counter-clockwise when seen from the outside.
+ *
+ * Within a chunk, each vertex lies on an edge of the voxel grid and is shared
+ * by all triangles that use that edge.
+ *
+ * The per-configuration triangle table is generated on first use (instead of
+ * the usual hard-coded 256-entry table), see case_table_() in
+ * marching_cubes.cpp.
+ *
+ * The surface is updated incrementally: the cells of the volume are split
+ * into bricks of `aBrickCells`^3 cells, with a separate mesh chunk per brick.
+ * A brick can only contain part of the iso-surface if its density range
+ * crosses the isovalue, i.e., if minDensity < isovalue <= maxDensity. When the isovalue
+ * changes, update() therefore only re-extracts the bricks whose range crosses
+ * the old or the new isovalue; all other bricks are (and stay) empty.
+ *
+ *   BrickedIsosurface surface;
+ *   surface.reset( volume );        // once per volume
+ *   surface.update( volume, iso );  // whenever the isovalue changes
+ *
+ *   for( auto const& chunk : surface.chunks() )
+ *      ... draw chunk.vertices / chunk.triangles ...
+ *
+ * The vertices on the faces between two bricks are created by both bricks
+ * (with identical positions and normals), so the chunks fit together without
+ * gaps.
+ */
+class BrickedIsosurface
+{
+	public:
+		explicit BrickedIsosurface( std::size_t aBrickCells = 16 );
+
+	public:
+		// Computes the density ranges of the bricks and drops all chunks.
+		void reset( Volume const& );
+
+		// Brings the chunks up to date for aIsoValue. Returns the number of
+		// bricks that were re-extracted.
+		std::size_t update( Volume const&, float aIsoValue );
+
+	public:
+		std::vector<MeshChunk> const& chunks() const;
+
+		std::size_t vertex_count() const;
+		std::size_t triangle_count() const;
+
+	private:
+		std::size_t mBrickCells;
+		std::size_t mBrickCounts[3] = { 0, 0, 0 };
+
+		std::vector<MeshChunk> mChunks;
+
+		// Indices of the bricks to re-extract; kept to reuse its storage.
+		std::vector<std::size_t> mDirty;
+
+		float mIsoValue = 0.f;
+		bool mExtracted = false;
+};
@@ -0,0 +1,109 @@
+#include "minmax_pyramid.hpp"
+
+#include "parallel.hpp"
+
+int const MinMaxPyramid::kBrickLog2;
+int const MinMaxPyramid::kBrickSize;
+
+void MinMaxPyramid::rebuild( Volume const& aVolume )
+{
+	mSize[0] = aVolume.width();
+	mSize[1] = aVolume.height();
+	mSize[2] = aVolume.depth();
+	mLevels.clear();
+
+	if( 0 == aVolume.total_element_count() )
+		return;
+
+	// Level 0: the bricks, including the adjacent voxels.
+	Level_ bricks;
+	for( int axis = 0; axis < 3; ++axis )
+		bricks.size[axis] = (mSize[axis] + kBrickSize-1) / kBrickSize;
+	bricks.ranges.resize( bricks.size[0] * bricks.size[1] * bricks.size[2] );
+
+	// The voxels are read row by row (sequentially); each row updates the
+	// bricks that contain it, or are adjacent to it.
+	concurrency::parallel_for( std::size_t(0), bricks.size[2], [&] (std::size_t aBz) {
+		Range_* const slab = bricks.ranges.data() + aBz*bricks.size[1]*bricks.size[0];
+		std::fill( slab, slab + bricks.size[1]*bricks.size[0], Range_{ std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest() } );
+
+		std::vector<Range_> row( bricks.size[0] );
+
+		std::size_t const z0 = aBz*kBrickSize > 0 ? aBz*kBrickSize - 1 : 0;
+		std::size_t const z1 = std::min( (aBz+1)*kBrickSize + 1, mSize[2] );
+		for( std::size_t z = z0; z < z1; ++z )
+		{
+			for( std::size_t y = 0; y < mSize[1]; ++y )
+			{
+				float const* const data = &aVolume( 0, y, z );
+				for( std::size_t bx = 0; bx < bricks.size[0]; ++bx )
+				{
+					std::size_t const x0 = bx*kBrickSize > 0 ? bx*kBrickSize - 1 : 0;
+					std::size_t const x1 = std::min( (bx+1)*kBrickSize + 1, mSize[0] );
+
+					float lo = data[x0], hi = data[x0];
+					for( std::size_t x = x0+1; x < x1; ++x )
+					{
+						lo = data[x] < lo ? data[x] : lo;
+						hi = data[x] > hi ? data[x] : hi;
+					}
+					row[bx] = Range_{ lo, hi };
+				}
+
+				// Row y belongs to brick y/kBrickSize, and to the apron of its
+				// neighbour if it is the first or last row of the brick.
+				std::size_t const by = y / kBrickSize;
+				std::size_t const first = (0 == y % kBrickSize && by > 0) ? by-1 : by;
+				std::size_t const last = (kBrickSize-1 == y % kBrickSize && by+1 < bricks.size[1]) ? by+1 : by;
+				for( std::size_t b = first; b <= last; ++b )
+				{
+					Range_* const ranges = slab + b*bricks.size[0];
+					for( std::size_t bx = 0; bx < bricks.size[0]; ++bx )
+					{
+						ranges[bx].lo = std::min( ranges[bx].lo, row[bx].lo );
+						ranges[bx].hi = std::max( ranges[bx].hi, row[bx].hi );
+					}
+				}
+			}
+		}
+	} );
+
+	mLevels.emplace_back( std::move(bricks) );
+
+	// Further levels: combine 2x2x2 nodes, up to a single node.
+	while( mLevels.back().ranges.size() > 1 )
+	{
+		Level_ const& below = mLevels.back();
+
+		Level_ level;
+		for( int axis = 0; axis < 3; ++axis )
+			level.size[axis] = (below.size[axis] + 1) / 2;
+		level.ranges.resize( level.size[0] * level.size[1] * level.size[2] );
+
+		concurrency::parallel_for( std::size_t(0), level.size[2], [&] (std::size_t aZ) {
+			for( std::size_t y = 0; y < level.size[1]; ++y )
+			{
+				for( std::size_t x = 0; x < level.size[0]; ++x )
+				{
+					Range_ r{ std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest() };
+					for( std::size_t k = 2*aZ; k < std::min( 2*aZ+2, below.size[2] ); ++k )
+					{
+						for( std::size_t j = 2*y; j < std::min( 2*y+2, below.size[1] ); ++j )
+						{
+							for( std::size_t i = 2*x; i < std::min( 2*x+2, below.size[0] ); ++i )
+							{
+								Range_ const& child = below.ranges[(k*below.size[1] + j)*below.size[0] + i];
+								r.lo = std::min( r.lo, child.lo );
+								r.hi = std::max( r.hi, child.hi );
+							}
+						}
+					}
+
+					level.ranges[(aZ*level.size[1] + y)*level.size[0] + x] = r;
+				}
+			}
+		} );
+
+		mLevels.emplace_back( std::move(level) );
+	}
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <cmath>
+#include <cassert>
+#include <cstddef>
+
+#include "volume.hpp"
+
+/* A min/max pyramid for skipping empty space
+ *
+ * `MinMaxPyramid` stores the range of densities of blocks of a volume. At
+ * level 0, each node covers a brick of kBrickSize^3 voxels; each further
+ * level halves the number of nodes along each axis, up to a single node for
+ * the whole volume. The range of a brick also includes the voxels adjacent
+ * to it, so it bounds the densities that are interpolated (trilinearly) in
+ * the brick as well.
+ *
+ * cast() finds the first voxel along a ray for which a predicate holds. It
+ * descends the pyramid front-to-back, and skips every node whose range
+ * can't contain a voxel of interest; only the bricks that remain are
+ * traversed voxel by voxel (3D DDA):
+ *
+ *   MinMaxPyramid pyramid;
+ *   pyramid.rebuild( volume );
+ *
+ *   int hit[3];
+ *   bool const found = pyramid.cast( origin, direction,
+ *      [&] (float lo, float hi) { return hi >= iso; },
+ *      [&] (int x, int y, int z) { return volume( x, y, z ) >= iso; },
+ *      hit
+ *   );
+ *
+ * The ray is given in cell coordinates, where voxel (x,y,z) is the unit cube
+ * [x,x+1) x [y,y+1) x [z,z+1). Only the part of the ray with t >= 0 counts.
+ */
+class MinMaxPyramid
+{
+	public:
+		static int const kBrickLog2 = 3;
+		static int const kBrickSize = 1 << kBrickLog2;
+
+	public:
+		MinMaxPyramid() = default;
+
+	public:
+		void rebuild( Volume const& );
+
+		std::size_t level_count() const;
+
+		// Density range of node (aX,aY,aZ) of level aLevel
+		std::pair<float,float> range( std::size_t aLevel, std::size_t aX, std::size_t aY, std::size_t aZ ) const;
+
+		/* Returns whether a voxel along the ray aOrigin + t*aDirection (t >= 0)
+		 * satisfies aVoxelHit(x, y, z); if so, aHit receives the first one.
+		 * aNodeMayHit(lo, hi) must return true if a voxel with a density in
+		 * [lo, hi] might satisfy aVoxelHit.
+		 */
+		template< typename tNodeMayHit, typename tVoxelHit >
+		bool cast( float const aOrigin[3], float const aDirection[3], tNodeMayHit&& aNodeMayHit, tVoxelHit&& aVoxelHit, int aHit[3] ) const;
+
+	private:
+		struct Range_
+		{
+			float lo, hi;
+		};
+
+		struct Level_
+		{
+			std::size_t size[3]; // nodes
+			std::vector<Range_> ranges;
+		};
+
+		struct Ray_
+		{
+			float origin[3];
+			float direction[3];
+			float inverse[3];
+		};
+
+	private:
+		// Parameter interval [aT0, aT1] in which the ray is inside the box
+		// [aLo, aHi); false if it misses the box.
+		static bool clip_( Ray_ const&, float const aLo[3], float const aHi[3], float& aT0, float& aT1 );
+
+		template< typename tNodeMayHit, typename tVoxelHit >
+		bool cast_node_( Ray_ const&, std::size_t aLevel, std::size_t const aNode[3], float aT0, float aT1, tNodeMayHit&, tVoxelHit&, int aHit[3] ) const;
+
+		template< typename tVoxelHit >
+		bool cast_brick_( Ray_ const&, std::size_t const aBrick[3], float aT0, float aT1, tVoxelHit&, int aHit[3] ) const;
+
+	private:
+		std::size_t mSize[3] = { 0, 0, 0 };
+		std::vector<Level_> mLevels;
+};
+
+
+// Implementation:
+inline
+std::size_t MinMaxPyramid::level_count() const
+{
+	return mLevels.size();
+}
+
+inline
+std::pair<float,float> MinMaxPyramid::range( std::size_t aLevel, std::size_t aX, std::size_t aY, std::size_t aZ ) const
+{
+	assert( aLevel < mLevels.size() );
+	Level_ const& level = mLevels[aLevel];
+	assert( aX < level.size[0] && aY < level.size[1] && aZ < level.size[2] );
+
+	Range_ const& r = level.ranges[(aZ*level.size[1] + aY)*level.size[0] + aX];
+	return std::make_pair( r.lo, r.hi );
+}
+
+inline
+bool MinMaxPyramid::clip_( Ray_ const& aRay, float const aLo[3], float const aHi[3], float& aT0, float& aT1 )
+{
+	for( int axis = 0; axis < 3; ++axis )
+	{
+		float ta = (aLo[axis] - aRay.origin[axis]) * aRay.inverse[axis];
+		float tb = (aHi[axis] - aRay.origin[axis]) * aRay.inverse[axis];
+		if( ta > tb )
+			std::swap( ta, tb );
+
+		aT0 = std::max( aT0, ta );
+		aT1 = std::min( aT1, tb );
+	}
+
+	return aT0 <= aT1;
+}
+
+template< typename tNodeMayHit, typename tVoxelHit > inline
+bool MinMaxPyramid::cast( float const aOrigin[3], float const aDirection[3], tNodeMayHit&& aNodeMayHit, tVoxelHit&& aVoxelHit, int aHit[3] ) const
+{
+	if( mLevels.empty() )
+		return false;
+
+	Ray_ ray;
+	for( int axis = 0; axis < 3; ++axis )
+	{
+		ray.origin[axis] = aOrigin[axis];
+
+		// Avoid 0 * inf in clip_() for rays parallel to an axis.
+		float const d = aDirection[axis];
+		ray.direction[axis] = std::fabs( d ) < 1e-20f ? (d < 0.f ? -1e-20f : 1e-20f) : d;
+		ray.inverse[axis] = 1.f / ray.direction[axis];
+	}
+
+	float const lo[3] = { 0.f, 0.f, 0.f };
+	float const hi[3] = { float(mSize[0]), float(mSize[1]), float(mSize[2]) };
+
+	float t0 = 0.f, t1 = std::numeric_limits<float>::max();
+	if( !clip_( ray, lo, hi, t0, t1 ) )
+		return false;
+
+	std::size_t const root[3] = { 0, 0, 0 };
+	return cast_node_( ray, mLevels.size()-1, root, t0, t1, aNodeMayHit, aVoxelHit, aHit );
+}
+
+template< typename tNodeMayHit, typename tVoxelHit > inline
+bool MinMaxPyramid::cast_node_( Ray_ const& aRay, std::size_t aLevel, std::size_t const aNode[3], float aT0, float aT1, tNodeMayHit& aNodeMayHit, tVoxelHit& aVoxelHit, int aHit[3] ) const
+{
+	Level_ const& level = mLevels[aLevel];
+	Range_ const& r = level.ranges[(aNode[2]*level.size[1] + aNode[1])*level.size[0] + aNode[0]];
+	if( !aNodeMayHit( r.lo, r.hi ) )
+		return false;
+
+	if( 0 == aLevel )
+		return cast_brick_( aRay, aNode, aT0, aT1, aVoxelHit, aHit );
+
+	// Visit the (up to eight) children that the ray passes through, front to
+	// back. The children don't overlap, so the first hit is the nearest one.
+	Level_ const& below = mLevels[aLevel-1];
+	std::size_t const cells = std::size_t(kBrickSize) << (aLevel-1);
+
+	struct Child_
+	{
+		float t0, t1;
+		std::size_t node[3];
+	} children[8];
+	int count = 0;
+
+	for( int i = 0; i < 8; ++i )
+	{
+		Child_ child;
+		child.node[0] = 2*aNode[0] + (i & 1);
+		child.node[1] = 2*aNode[1] + ((i >> 1) & 1);
+		child.node[2] = 2*aNode[2] + ((i >> 2) & 1);
+		if( child.node[0] >= below.size[0] || child.node[1] >= below.size[1] || child.node[2] >= below.size[2] )
+			continue;
+
+		float lo[3], hi[3];
+		for( int axis = 0; axis < 3; ++axis )
+		{
+			lo[axis] = float(child.node[axis] * cells);
+			hi[axis] = float(std::min( (child.node[axis]+1) * cells, mSize[axis] ));
+		}
+
+		child.t0 = aT0;
+		child.t1 = aT1;
+		if( !clip_( aRay, lo, hi, child.t0, child.t1 ) )
+			continue;
+
+		// Insertion sort by entry parameter
+		int at = count++;
+		for( ; at > 0 && children[at-1].t0 > child.t0; --at )
+			children[at] = children[at-1];
+		children[at] = child;
+	}
+
+	for( int i = 0; i < count; ++i )
+	{
+		if( cast_node_( aRay, aLevel-1, children[i].node, children[i].t0, children[i].t1, aNodeMayHit, aVoxelHit, aHit ) )
+			return true;
+	}
+
+	return false;
+}
+
+template< typename tVoxelHit > inline
+bool MinMaxPyramid::cast_brick_( Ray_ const& aRay, std::size_t const aBrick[3], float aT0, float aT1, tVoxelHit& aVoxelHit, int aHit[3] ) const
+{
+	// 3D DDA (Amanatides & Woo) through the voxels of the brick, starting
+	// where the ray enters it.
+	int voxel[3], step[3], lo[3], hi[3];
+	float tNext[3], tDelta[3];
+	float const tMid = 0.5f * (aT0 + aT1);
+	for( int axis = 0; axis < 3; ++axis )
+	{
+		lo[axis] = int(aBrick[axis] * kBrickSize);
+		hi[axis] = int(std::min( (aBrick[axis]+1) * kBrickSize, mSize[axis] )) - 1;
+
+		// The entry point lies on the boundary of the brick; pick the voxel
+		// from a point slightly inside, and clamp against rounding.
+		float const p = aRay.origin[axis] + aRay.direction[axis] * std::min( aT0 + 1e-4f, tMid );
+		voxel[axis] = std::min( std::max( int(std::floor( p )), lo[axis] ), hi[axis] );
+
+		step[axis] = aRay.direction[axis] < 0.f ? -1 : 1;
+		float const boundary = float(voxel[axis] + (step[axis] > 0 ? 1 : 0));
+		tNext[axis] = (boundary - aRay.origin[axis]) * aRay.inverse[axis];
+		tDelta[axis] = std::fabs( aRay.inverse[axis] );
+	}
+
+	for( ;; )
+	{
+		if( aVoxelHit( voxel[0], voxel[1], voxel[2] ) )
+		{
+			std::copy( voxel, voxel+3, aHit );
+			return true;
+		}
+
+		int const axis = tNext[0] < tNext[1]
+			? (tNext[0] < tNext[2] ? 0 : 2)
+			: (tNext[1] < tNext[2] ? 1 : 2);
+
+		if( tNext[axis] > aT1 )
+			return false;
+
+		voxel[axis] += step[axis];
+		if( voxel[axis] < lo[axis] || voxel[axis] > hi[axis] )
+			return false;
+
+		tNext[axis] += tDelta[axis];
+	}
+}
@@ -276,4 +276,25 @@ Vec3Df getWorldPositionOfPixel(unsigned int px, unsigned int py)
 
 	return Vec3Df((float)x, (float)y, (float)z);
 }
+
+/** Ray through the pixel (px, py), in window coordinates as GLUT reports them
+ * (origin at the top left), in the coordinate system of the scene, i.e.,
+ * before the view transformation (tb_matrix). The ray starts on the near
+ * plane; the direction is not normalized (it ends on the far plane). */
+void getWorldRayOfPixel(int px, int py, Vec3Df& origin, Vec3Df& direction)
+{
+	double pr[16];
+	int vp[4];
+	glGetDoublev(GL_PROJECTION_MATRIX,pr);
+	glGetIntegerv(GL_VIEWPORT,vp);
+
+	double const wx = double(px), wy = double(vp[3] - 1 - py);
+
+	double nx,ny,nz, fx,fy,fz;
+	gluUnProject(wx,wy,0,tb_matrix,pr,vp,&nx,&ny,&nz);
+	gluUnProject(wx,wy,1,tb_matrix,pr,vp,&fx,&fy,&fz);
+
+	origin = Vec3Df((float)nx, (float)ny, (float)nz);
+	direction = Vec3Df((float)(fx-nx), (float)(fy-ny), (float)(fz-nz));
+}
 #endif
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "parallel.hpp"
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#endif
+
+#include "volume.hpp"
+
+class SparseVolume;
+
+/* A 1-bit-per-voxel occupancy mask
+ *
+ * The `OccupancyMask` records for each voxel of a volume whether a transfer
+ * function can produce anything for it. Traversals then only classify the
+ * voxels whose bit is set, instead of every voxel of the volume.
+ *
+ * The bits of a row (fixed y and z) are stored in consecutive 64-bit words,
+ * with bit (x % 64) of word (x / 64) corresponding to voxel x. Rows are
+ * padded to a whole number of words; the padding bits are always zero. This
+ * allows iterating over the set bits of a row a word at a time:
+ *
+ *   OccupancyMask mask;
+ *   mask.rebuild( volume, [&] (std::size_t x, std::size_t y, std::size_t z) {
+ *      return volume( x, y, z ) > 0.5f;
+ *   } );
+ *
+ *   mask.for_each_in_row( y, z, 0, int(volume.width())-1, true, [&] (int x) {
+ *      ...
+ *   } );
+ *
+ * rebuild() evaluates the predicate for all voxels in parallel (one slice per
+ * task), so the predicate must be safe to call concurrently.
+ */
+class OccupancyMask
+{
+	public:
+		OccupancyMask() = default;
+
+	public:
+		template< typename tPredicate >
+		void rebuild( Volume const&, tPredicate&& );
+
+		/* Only evaluates the predicate for the active voxels of the sparse
+		 * volume; all other bits are cleared. (Defined in sparse_volume.hpp.)
+		 */
+		template< typename tPredicate >
+		void rebuild( SparseVolume const&, tPredicate&& );
+
+		/* Takes over the bits of an aWidth x aHeight x aDepth volume, in the
+		 * layout described above (rows padded to whole words, padding bits
+		 * zero).
+		 */
+		void assign( std::size_t aWidth, std::size_t aHeight, std::size_t aDepth, std::vector<std::uint64_t> aWords );
+
+	public:
+		bool test( std::size_t aX, std::size_t aY, std::size_t aZ ) const;
+
+		/* Calls aFunc(x) for each set bit x in [aLo, aHi] of the row (aY, aZ),
+		 * in increasing order if aForward is true, in decreasing order
+		 * otherwise.
+		 */
+		template< typename tFunc >
+		void for_each_in_row( std::size_t aY, std::size_t aZ, int aLo, int aHi, bool aForward, tFunc&& aFunc ) const;
+
+	public:
+		std::size_t width() const;
+		std::size_t height() const;
+		std::size_t depth() const;
+
+		// Number of set bits (occupied voxels)
+		std::size_t count() const;
+
+	private:
+		std::uint64_t const* row_( std::size_t aY, std::size_t aZ ) const;
+
+	private:
+		std::vector<std::uint64_t> mWords;
+		std::size_t mWidth = 0, mHeight = 0, mDepth = 0;
+		std::size_t mWordsPerRow = 0;
+		std::size_t mCount = 0;
+};
+
+
+// Implementation:
+namespace detail
+{
+	// Index of the lowest set bit; aWord must not be zero.
+	inline
+	unsigned occupancy_lowest_bit( std::uint64_t aWord )
+	{
+#		if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward64( &index, aWord );
+		return unsigned(index);
+#		else
+		return unsigned(__builtin_ctzll( aWord ));
+#		endif
+	}
+
+	// Index of the highest set bit; aWord must not be zero.
+	inline
+	unsigned occupancy_highest_bit( std::uint64_t aWord )
+	{
+#		if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse64( &index, aWord );
+		return unsigned(index);
+#		else
+		return 63u - unsigned(__builtin_clzll( aWord ));
+#		endif
+	}
+
+	inline
+	std::size_t occupancy_popcount( std::uint64_t aWord )
+	{
+#		if defined(_MSC_VER)
+		return std::size_t(__popcnt64( aWord ));
+#		else
+		return std::size_t(__builtin_popcountll( aWord ));
+#		endif
+	}
+}
+
+template< typename tPredicate > inline
+void OccupancyMask::rebuild( Volume const& aVolume, tPredicate&& aPredicate )
+{
+	mWidth = aVolume.width();
+	mHeight = aVolume.height();
+	mDepth = aVolume.depth();
+	mWordsPerRow = (mWidth + 63) / 64;
+
+	mWords.assign( mWordsPerRow * mHeight * mDepth, 0 );
+
+	std::vector<std::size_t> sliceCounts( mDepth, 0 );
+	concurrency::parallel_for( std::size_t(0), mDepth, [&] (std::size_t z) {
+		std::size_t count = 0;
+		for( std::size_t y = 0; y < mHeight; ++y )
+		{
+			std::uint64_t* row = mWords.data() + (z*mHeight + y) * mWordsPerRow;
+			for( std::size_t w = 0; w < mWordsPerRow; ++w )
+			{
+				std::uint64_t word = 0;
+				std::size_t const end = std::min( mWidth - w*64, std::size_t(64) );
+				for( std::size_t b = 0; b < end; ++b )
+				{
+					if( aPredicate( w*64 + b, y, z ) )
+						word |= std::uint64_t(1) << b;
+				}
+
+				row[w] = word;
+				count += detail::occupancy_popcount( word );
+			}
+		}
+		sliceCounts[z] = count;
+	} );
+
+	mCount = 0;
+	for( auto const count : sliceCounts )
+		mCount += count;
+}
+
+inline
+void OccupancyMask::assign( std::size_t aWidth, std::size_t aHeight, std::size_t aDepth, std::vector<std::uint64_t> aWords )
+{
+	mWidth = aWidth;
+	mHeight = aHeight;
+	mDepth = aDepth;
+	mWordsPerRow = (mWidth + 63) / 64;
+
+	assert( aWords.size() == mWordsPerRow * mHeight * mDepth );
+	mWords = std::move( aWords );
+
+	mCount = 0;
+	for( auto const word : mWords )
+		mCount += detail::occupancy_popcount( word );
+}
+
+inline
+bool OccupancyMask::test( std::size_t aX, std::size_t aY, std::size_t aZ ) const
+{
+	assert( aX < mWidth && aY < mHeight && aZ < mDepth );
+	return 0 != ((row_( aY, aZ )[aX / 64] >> (aX % 64)) & 1);
+}
+
+template< typename tFunc > inline
+void OccupancyMask::for_each_in_row( std::size_t aY, std::size_t aZ, int aLo, int aHi, bool aForward, tFunc&& aFunc ) const
+{
+	if( aLo > aHi )
+		return;
+
+	assert( aLo >= 0 && std::size_t(aHi) < mWidth );
+
+	std::uint64_t const* row = row_( aY, aZ );
+	int const firstWord = aLo / 64;
+	int const lastWord = aHi / 64;
+
+	// Masks off the bits outside of [aLo, aHi] in the first and last words.
+	auto word_at = [&] (int aW) {
+		std::uint64_t word = row[aW];
+		if( aW == firstWord ) word &= ~std::uint64_t(0) << (aLo % 64);
+		if( aW == lastWord ) word &= ~std::uint64_t(0) >> (63 - aHi % 64);
+		return word;
+	};
+
+	if( aForward )
+	{
+		for( int w = firstWord; w <= lastWord; ++w )
+		{
+			for( std::uint64_t word = word_at( w ); word; word &= word - 1 )
+				aFunc( w*64 + int(detail::occupancy_lowest_bit( word )) );
+		}
+	}
+	else
+	{
+		for( int w = lastWord; w >= firstWord; --w )
+		{
+			for( std::uint64_t word = word_at( w ); word; )
+			{
+				unsigned const bit = detail::occupancy_highest_bit( word );
+				aFunc( w*64 + int(bit) );
+				word &= ~(std::uint64_t(1) << bit);
+			}
+		}
+	}
+}
+
+inline
+std::size_t OccupancyMask::width() const
+{
+	return mWidth;
+}
+inline
+std::size_t OccupancyMask::height() const
+{
+	return mHeight;
+}
+inline
+std::size_t OccupancyMask::depth() const
+{
+	return mDepth;
+}
+
+inline
+std::size_t OccupancyMask::count() const
+{
+	return mCount;
+}
+
+inline
+std::uint64_t const* OccupancyMask::row_( std::size_t aY, std::size_t aZ ) const
+{
+	return mWords.data() + (aZ*mHeight + aY) * mWordsPerRow;
+}
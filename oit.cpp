@@ -0,0 +1,218 @@
+#include "oit.hpp"
+
+#include <cstdio>
+
+namespace
+{
+	char const* const kCompositeVS =
+		"#version 120\n"
+		"void main() {\n"
+		"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+		"	gl_Position = gl_Vertex;\n"
+		"}\n";
+
+	char const* const kCompositeFS =
+		"#version 120\n"
+		"uniform sampler2D accumTex;\n"
+		"uniform sampler2D revealTex;\n"
+		"void main() {\n"
+		"	vec4 accum = texture2D( accumTex, gl_TexCoord[0].xy );\n"
+		"	float reveal = texture2D( revealTex, gl_TexCoord[0].xy ).r;\n"
+		"	if( accum.a <= 1e-5 ) discard;\n"
+		"	gl_FragColor = vec4( accum.rgb / accum.a, 1.0 - reveal );\n"
+		"}\n";
+
+	GLuint compile_shader_( GLenum aType, char const* aSource )
+	{
+		GLuint shader = glCreateShader( aType );
+		glShaderSource( shader, 1, &aSource, nullptr );
+		glCompileShader( shader );
+
+		GLint ok = GL_FALSE;
+		glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+		if( GL_TRUE != ok )
+		{
+			char log[1024] = "";
+			glGetShaderInfoLog( shader, sizeof(log), nullptr, log );
+			std::fprintf( stderr, "OIT: shader compilation failed:\n%s\n", log );
+			glDeleteShader( shader );
+			return 0;
+		}
+
+		return shader;
+	}
+
+	GLuint make_target_( GLsizei aWidth, GLsizei aHeight, GLuint& aTexture )
+	{
+		glGenTextures( 1, &aTexture );
+		glBindTexture( GL_TEXTURE_2D, aTexture );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA16F, aWidth, aHeight, 0, GL_RGBA, GL_FLOAT, nullptr );
+		glBindTexture( GL_TEXTURE_2D, 0 );
+
+		GLuint fbo = 0;
+		glGenFramebuffers( 1, &fbo );
+		glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, aTexture, 0 );
+
+		GLenum const status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+		if( GL_FRAMEBUFFER_COMPLETE != status )
+		{
+			std::fprintf( stderr, "OIT: framebuffer incomplete (0x%x)\n", unsigned(status) );
+			glDeleteFramebuffers( 1, &fbo );
+			glDeleteTextures( 1, &aTexture );
+			aTexture = 0;
+			return 0;
+		}
+
+		return fbo;
+	}
+}
+
+bool BlendedOIT::render( std::function<void()> const& aDrawGeometry )
+{
+	if( !mInitialized )
+	{
+		mInitialized = true;
+		mSupported = initialize_();
+	}
+
+	if( !mSupported )
+		return false;
+
+	GLint viewport[4];
+	glGetIntegerv( GL_VIEWPORT, viewport );
+	if( viewport[2] != mWidth || viewport[3] != mHeight )
+	{
+		if( !resize_( viewport[2], viewport[3] ) )
+		{
+			mSupported = false;
+			return false;
+		}
+	}
+
+	GLint prevFBO = 0;
+	glGetIntegerv( GL_FRAMEBUFFER_BINDING, &prevFBO );
+
+	glPushAttrib( GL_COLOR_BUFFER_BIT | GL_ENABLE_BIT );
+	glEnable( GL_BLEND );
+	glDisable( GL_DEPTH_TEST );
+
+	// Pass 1: accum.rgb += color*alpha, accum.a += alpha
+	glBindFramebuffer( GL_FRAMEBUFFER, mAccumFBO );
+	glClearColor( 0.f, 0.f, 0.f, 0.f );
+	glClear( GL_COLOR_BUFFER_BIT );
+	glBlendFuncSeparate( GL_SRC_ALPHA, GL_ONE, GL_ONE, GL_ONE );
+	aDrawGeometry();
+
+	// Pass 2: revealage *= (1-alpha)
+	glBindFramebuffer( GL_FRAMEBUFFER, mRevealFBO );
+	glClearColor( 1.f, 1.f, 1.f, 1.f );
+	glClear( GL_COLOR_BUFFER_BIT );
+	glBlendFunc( GL_ZERO, GL_ONE_MINUS_SRC_ALPHA );
+	aDrawGeometry();
+
+	// Composite over the original framebuffer
+	glBindFramebuffer( GL_FRAMEBUFFER, GLuint(prevFBO) );
+	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+	glUseProgram( mProgram );
+	glActiveTexture( GL_TEXTURE1 );
+	glBindTexture( GL_TEXTURE_2D, mRevealTex );
+	glActiveTexture( GL_TEXTURE0 );
+	glBindTexture( GL_TEXTURE_2D, mAccumTex );
+
+	glBegin( GL_QUADS );
+		glTexCoord2f( 0.f, 0.f ); glVertex2f( -1.f, -1.f );
+		glTexCoord2f( 1.f, 0.f ); glVertex2f(  1.f, -1.f );
+		glTexCoord2f( 1.f, 1.f ); glVertex2f(  1.f,  1.f );
+		glTexCoord2f( 0.f, 1.f ); glVertex2f( -1.f,  1.f );
+	glEnd();
+
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	glActiveTexture( GL_TEXTURE1 );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	glActiveTexture( GL_TEXTURE0 );
+	glUseProgram( 0 );
+
+	glPopAttrib();
+	return true;
+}
+
+bool BlendedOIT::initialize_()
+{
+	// Shaders, FBOs, and the RGBA16F render targets (float textures)
+	bool const fbo = GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+	bool const floatTextures = GLEW_VERSION_3_0 || GLEW_ARB_texture_float;
+	if( !GLEW_VERSION_2_0 || !fbo || !floatTextures )
+	{
+		std::fprintf( stderr, "OIT: required OpenGL features are not available\n" );
+		return false;
+	}
+
+	GLuint vs = compile_shader_( GL_VERTEX_SHADER, kCompositeVS );
+	GLuint fs = compile_shader_( GL_FRAGMENT_SHADER, kCompositeFS );
+	if( !vs || !fs )
+	{
+		if( vs ) glDeleteShader( vs );
+		if( fs ) glDeleteShader( fs );
+		return false;
+	}
+
+	mProgram = glCreateProgram();
+	glAttachShader( mProgram, vs );
+	glAttachShader( mProgram, fs );
+	glLinkProgram( mProgram );
+
+	// The program keeps the shaders alive as long as they're attached.
+	glDeleteShader( vs );
+	glDeleteShader( fs );
+
+	GLint ok = GL_FALSE;
+	glGetProgramiv( mProgram, GL_LINK_STATUS, &ok );
+	if( GL_TRUE != ok )
+	{
+		std::fprintf( stderr, "OIT: could not link composite program\n" );
+		glDeleteProgram( mProgram );
+		mProgram = 0;
+		return false;
+	}
+
+	glUseProgram( mProgram );
+	glUniform1i( glGetUniformLocation( mProgram, "accumTex" ), 0 );
+	glUniform1i( glGetUniformLocation( mProgram, "revealTex" ), 1 );
+	glUseProgram( 0 );
+
+	return true;
+}
+
+bool BlendedOIT::resize_( GLsizei aWidth, GLsizei aHeight )
+{
+	release_();
+
+	mAccumFBO = make_target_( aWidth, aHeight, mAccumTex );
+	mRevealFBO = make_target_( aWidth, aHeight, mRevealTex );
+	if( !mAccumFBO || !mRevealFBO )
+		return false;
+
+	mWidth = aWidth;
+	mHeight = aHeight;
+	return true;
+}
+
+void BlendedOIT::release_()
+{
+	if( mAccumFBO ) glDeleteFramebuffers( 1, &mAccumFBO );
+	if( mRevealFBO ) glDeleteFramebuffers( 1, &mRevealFBO );
+	if( mAccumTex ) glDeleteTextures( 1, &mAccumTex );
+	if( mRevealTex ) glDeleteTextures( 1, &mRevealTex );
+
+	mAccumFBO = mRevealFBO = 0;
+	mAccumTex = mRevealTex = 0;
+	mWidth = mHeight = 0;
+}
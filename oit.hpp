@@ -0,0 +1,67 @@
+#pragma once
+
+#define GLEW_STATIC 1
+#include <GL/glew.h>
+
+#include <functional>
+
+/* Order-independent compositing of translucent geometry
+ *
+ * `BlendedOIT` implements the blended order-independent transparency approach
+ * by Bavoil & Myers ("weighted average"), which is the equal-weight special
+ * case of McGuire & Bavoil's "Weighted Blended OIT". Instead of blending the
+ * fragments back-to-front, two order-independent quantities are accumulated
+ * in offscreen buffers:
+ *
+ *   - accum.rgb = sum( color_i * alpha_i ), accum.a = sum( alpha_i )
+ *   - revealage = product( 1 - alpha_i )
+ *
+ * and then composited over the framebuffer as
+ *
+ *   color = accum.rgb / accum.a,  alpha = 1 - revealage
+ *
+ * Neither quantity depends on the order in which fragments arrive, so the
+ * same vertex buffer can be drawn from every viewing direction.
+ *
+ * Usage:
+ *
+ *   BlendedOIT oit;
+ *   ...
+ *   if( !oit.render( [&] { drawMyPoints(); } ) )
+ *      ... fall back to sorted blending ...
+ *
+ * The geometry callback is invoked twice per frame (once per accumulation
+ * buffer). It must not change the blend state. render() returns false if the
+ * required OpenGL features (framebuffer objects, float textures, GLSL) are
+ * unavailable.
+ */
+class BlendedOIT
+{
+	public:
+		/* Note: the GL objects are not released on destruction, since
+		 * there is no guarantee that the GL context is still alive when
+		 * static objects are destroyed.
+		 */
+		BlendedOIT() = default;
+
+		BlendedOIT( BlendedOIT const& ) = delete;
+		BlendedOIT& operator= (BlendedOIT const&) = delete;
+
+	public:
+		bool render( std::function<void()> const& aDrawGeometry );
+
+	private:
+		bool initialize_();
+		bool resize_( GLsizei, GLsizei );
+		void release_();
+
+	private:
+		bool mInitialized = false;
+		bool mSupported = true;
+
+		GLsizei mWidth = 0, mHeight = 0;
+
+		GLuint mAccumFBO = 0, mRevealFBO = 0;
+		GLuint mAccumTex = 0, mRevealTex = 0;
+		GLuint mProgram = 0;
+};
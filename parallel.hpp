@@ -0,0 +1,91 @@
+#pragma once
+
+/* Parallel loops
+ *
+ * The code uses `concurrency::parallel_for()` from the Parallel Patterns
+ * Library for its parallel loops:
+ *
+ *   concurrency::parallel_for( std::size_t(0), count, [&] (std::size_t i) {
+ *      ...
+ *   } );
+ *
+ * The PPL (<ppl.h>) ships with MSVC only. Other toolchains get a stand-in
+ * with the same interface, which runs the iterations on a set of std::threads
+ * (one per hardware thread); each thread repeatedly claims the next
+ * iteration. As with the PPL, the first exception thrown by an iteration is
+ * rethrown by parallel_for() once all threads have finished.
+ */
+#if defined(_MSC_VER)
+#	include <ppl.h>
+#else
+#	include <mutex>
+#	include <atomic>
+#	include <thread>
+#	include <vector>
+#	include <algorithm>
+#	include <exception>
+
+namespace concurrency
+{
+	template< typename tIndex, typename tFunc >
+	void parallel_for( tIndex aFirst, tIndex aLast, tIndex aStep, tFunc const& aFunc );
+
+	template< typename tIndex, typename tFunc >
+	void parallel_for( tIndex aFirst, tIndex aLast, tFunc const& aFunc );
+}
+
+
+// Implementation:
+namespace concurrency
+{
+	template< typename tIndex, typename tFunc > inline
+	void parallel_for( tIndex aFirst, tIndex aLast, tIndex aStep, tFunc const& aFunc )
+	{
+		if( aLast <= aFirst )
+			return;
+
+		tIndex const count = (aLast - aFirst + aStep-1) / aStep;
+
+		std::atomic<tIndex> next( 0 );
+		std::exception_ptr error;
+		std::mutex errorMutex;
+
+		auto work = [&] {
+			for( tIndex i; (i = next.fetch_add( 1 )) < count; )
+			{
+				try
+				{
+					aFunc( tIndex(aFirst + i*aStep) );
+				}
+				catch( ... )
+				{
+					std::lock_guard<std::mutex> lock( errorMutex );
+					if( !error )
+						error = std::current_exception();
+				}
+			}
+		};
+
+		unsigned const hardware = std::max( std::thread::hardware_concurrency(), 1u );
+		std::size_t const threadCount = std::size_t(count) < hardware ? std::size_t(count) : hardware;
+
+		// The calling thread works on the loop as well.
+		std::vector<std::thread> threads;
+		for( std::size_t t = 1; t < threadCount; ++t )
+			threads.emplace_back( work );
+		work();
+
+		for( auto& thread : threads )
+			thread.join();
+
+		if( error )
+			std::rethrow_exception( error );
+	}
+
+	template< typename tIndex, typename tFunc > inline
+	void parallel_for( tIndex aFirst, tIndex aLast, tFunc const& aFunc )
+	{
+		parallel_for( aFirst, aLast, tIndex(1), aFunc );
+	}
+}
+#endif
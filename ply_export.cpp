@@ -0,0 +1,332 @@
+#include "ply_export.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+#include <memory>
+#include <sstream>
+#include <utility>
+#include <stdexcept>
+
+#include "miniz.h"
+
+namespace
+{
+	/* Buffered output to a file, optionally compressed into the gzip format.
+	 *
+	 * Data is collected in a kPlyChunkSize buffer; when the buffer is full, it
+	 * is written to the file (or deflated and then written) in one go.
+	 */
+	class ChunkedOutput_
+	{
+		public:
+			ChunkedOutput_( std::string const& aFileName, bool aCompress );
+			~ChunkedOutput_();
+
+			ChunkedOutput_( ChunkedOutput_ const& ) = delete;
+			ChunkedOutput_& operator= (ChunkedOutput_ const&) = delete;
+
+		public:
+			void write( void const*, std::size_t );
+
+			template< typename tType >
+			void put( tType const& aValue )
+			{
+				write( &aValue, sizeof(tType) );
+			}
+
+			void text( std::string const& aText )
+			{
+				write( aText.data(), aText.size() );
+			}
+
+			// Writes all remaining data (and the gzip trailer). Must be
+			// called to complete the file.
+			void finish();
+
+			std::size_t bytes_written() const { return mBytesWritten; }
+
+		private:
+			void flush_( bool aFinal );
+			void write_file_( void const*, std::size_t );
+
+		private:
+			FILE* mFile = nullptr;
+			std::vector<std::uint8_t> mBuffer;
+			std::size_t mFill = 0;
+			std::size_t mBytesWritten = 0;
+
+			// gzip state
+			tdefl_compressor* mDeflate = nullptr;
+			std::vector<std::uint8_t> mCompressed;
+			mz_ulong mCrc = MZ_CRC32_INIT;
+			std::uint32_t mInputSize = 0;
+	};
+
+	ChunkedOutput_::ChunkedOutput_( std::string const& aFileName, bool aCompress )
+		: mBuffer( kPlyChunkSize )
+	{
+		mFile = std::fopen( aFileName.c_str(), "wb" );
+		if( !mFile )
+			throw std::runtime_error( "Could not open file for writing" );
+
+		if( aCompress )
+		{
+			mDeflate = tdefl_compressor_alloc();
+			mCompressed.resize( kPlyChunkSize );
+
+			// Negative window bits: raw deflate data, the gzip header and
+			// trailer are written by us.
+			mz_uint const flags = tdefl_create_comp_flags_from_zip_params( MZ_DEFAULT_LEVEL, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY );
+			if( !mDeflate || TDEFL_STATUS_OKAY != tdefl_init( mDeflate, nullptr, nullptr, int(flags) ) )
+			{
+				tdefl_compressor_free( mDeflate );
+				std::fclose( mFile );
+				throw std::runtime_error( "miniz: could not initialize compressor" );
+			}
+
+			// gzip header: magic, method = deflate, no flags, no mtime, unknown OS
+			std::uint8_t const header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+			write_file_( header, sizeof(header) );
+		}
+	}
+
+	ChunkedOutput_::~ChunkedOutput_()
+	{
+		if( mDeflate )
+			tdefl_compressor_free( mDeflate );
+
+		if( mFile )
+			std::fclose( mFile );
+	}
+
+	void ChunkedOutput_::write( void const* aData, std::size_t aSize )
+	{
+		auto const* data = static_cast<std::uint8_t const*>(aData);
+		while( aSize )
+		{
+			std::size_t const count = std::min( aSize, mBuffer.size() - mFill );
+			std::memcpy( mBuffer.data() + mFill, data, count );
+
+			mFill += count;
+			data += count;
+			aSize -= count;
+
+			if( mBuffer.size() == mFill )
+				flush_( false );
+		}
+	}
+
+	void ChunkedOutput_::finish()
+	{
+		flush_( true );
+
+		if( mDeflate )
+		{
+			// gzip trailer: CRC-32 and size of the uncompressed data (mod 2^32), little endian
+			std::uint8_t trailer[8];
+			for( int i = 0; i < 4; ++i )
+			{
+				trailer[i] = std::uint8_t(mCrc >> (8*i));
+				trailer[4+i] = std::uint8_t(mInputSize >> (8*i));
+			}
+			write_file_( trailer, sizeof(trailer) );
+		}
+
+		if( 0 != std::fclose( mFile ) )
+		{
+			mFile = nullptr;
+			throw std::runtime_error( "Could not close file" );
+		}
+
+		mFile = nullptr;
+	}
+
+	void ChunkedOutput_::flush_( bool aFinal )
+	{
+		if( !mDeflate )
+		{
+			write_file_( mBuffer.data(), mFill );
+			mFill = 0;
+			return;
+		}
+
+		mCrc = mz_crc32( mCrc, mBuffer.data(), mFill );
+		mInputSize += std::uint32_t(mFill);
+
+		std::uint8_t const* in = mBuffer.data();
+		std::size_t remaining = mFill;
+		for( ;; )
+		{
+			std::size_t inSize = remaining;
+			std::size_t outSize = mCompressed.size();
+			tdefl_status const status = tdefl_compress( mDeflate, in, &inSize, mCompressed.data(), &outSize, aFinal ? TDEFL_FINISH : TDEFL_NO_FLUSH );
+
+			if( status < 0 )
+				throw std::runtime_error( "miniz: compression failed" );
+
+			in += inSize;
+			remaining -= inSize;
+			write_file_( mCompressed.data(), outSize );
+
+			if( aFinal ? TDEFL_STATUS_DONE == status : 0 == remaining )
+				break;
+		}
+
+		mFill = 0;
+	}
+
+	void ChunkedOutput_::write_file_( void const* aData, std::size_t aSize )
+	{
+		if( aSize != std::fwrite( aData, 1, aSize, mFile ) )
+			throw std::runtime_error( "Could not write to file" );
+
+		mBytesWritten += aSize;
+	}
+
+
+	/* Note: PLY's binary_little_endian format matches the in-memory layout of
+	 * the values on the (x86/x64) platforms that the project supports, so the
+	 * values are written as-is.
+	 */
+	void write_points_( std::string const& aFileName, std::vector<PlyPoint> const& aPoints, bool aCompress )
+	{
+		ChunkedOutput_ out( aFileName, aCompress );
+
+		std::ostringstream header;
+		header << "ply\n"
+			<< "format binary_little_endian 1.0\n"
+			<< "element vertex " << aPoints.size() << "\n"
+			<< "property float x\n"
+			<< "property float y\n"
+			<< "property float z\n"
+			<< "property uchar red\n"
+			<< "property uchar green\n"
+			<< "property uchar blue\n"
+			<< "property uchar alpha\n"
+			<< "end_header\n"
+		;
+		out.text( header.str() );
+
+		static_assert( sizeof(PlyPoint) == 3*sizeof(float) + 4, "PlyPoint must be tightly packed" );
+		out.write( aPoints.data(), aPoints.size() * sizeof(PlyPoint) );
+
+		out.finish();
+		std::printf( "PLY: wrote %zu points to '%s' (%zu bytes)\n", aPoints.size(), aFileName.c_str(), out.bytes_written() );
+	}
+
+	void write_mesh_( std::string const& aFileName, std::vector<Vertex> const& aVertices, std::vector<Triangle> const& aTriangles, bool aCompress )
+	{
+		ChunkedOutput_ out( aFileName, aCompress );
+
+		std::ostringstream header;
+		header << "ply\n"
+			<< "format binary_little_endian 1.0\n"
+			<< "element vertex " << aVertices.size() << "\n"
+			<< "property float x\n"
+			<< "property float y\n"
+			<< "property float z\n"
+			<< "property float nx\n"
+			<< "property float ny\n"
+			<< "property float nz\n"
+			<< "element face " << aTriangles.size() << "\n"
+			<< "property list uchar int vertex_indices\n"
+			<< "end_header\n"
+		;
+		out.text( header.str() );
+
+		static_assert( sizeof(Vertex) == 6*sizeof(float), "Vertex must be tightly packed" );
+		out.write( aVertices.data(), aVertices.size() * sizeof(Vertex) );
+
+		for( auto const& tri : aTriangles )
+		{
+			out.put( std::uint8_t(3) );
+			for( int i = 0; i < 3; ++i )
+				out.put( std::int32_t(tri.v[i]) );
+		}
+
+		out.finish();
+		std::printf( "PLY: wrote %zu vertices, %zu triangles to '%s' (%zu bytes)\n", aVertices.size(), aTriangles.size(), aFileName.c_str(), out.bytes_written() );
+	}
+}
+
+PlyExporter::~PlyExporter()
+{
+	{
+		std::unique_lock<std::mutex> lock( mMutex );
+		mQuit = true;
+	}
+	mWakeUp.notify_all();
+
+	if( mThread.joinable() )
+		mThread.join();
+}
+
+void PlyExporter::export_points( std::string aFileName, std::vector<PlyPoint> aPoints, bool aCompress )
+{
+	auto data = std::make_shared<std::vector<PlyPoint>>( std::move(aPoints) );
+	enqueue_( [aFileName, data, aCompress] {
+		write_points_( aFileName, *data, aCompress );
+	} );
+}
+
+void PlyExporter::export_mesh( std::string aFileName, std::vector<Vertex> aVertices, std::vector<Triangle> aTriangles, bool aCompress )
+{
+	auto vertices = std::make_shared<std::vector<Vertex>>( std::move(aVertices) );
+	auto triangles = std::make_shared<std::vector<Triangle>>( std::move(aTriangles) );
+	enqueue_( [aFileName, vertices, triangles, aCompress] {
+		write_mesh_( aFileName, *vertices, *triangles, aCompress );
+	} );
+}
+
+std::size_t PlyExporter::pending() const
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	return mJobs.size() + mRunning;
+}
+
+void PlyExporter::enqueue_( std::function<void()> aJob )
+{
+	{
+		std::unique_lock<std::mutex> lock( mMutex );
+		mJobs.emplace_back( std::move(aJob) );
+
+		// Start the worker on first use.
+		if( !mThread.joinable() )
+			mThread = std::thread( [this] { run_(); } );
+	}
+
+	mWakeUp.notify_one();
+}
+
+void PlyExporter::run_()
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	for( ;; )
+	{
+		mWakeUp.wait( lock, [this] { return mQuit || !mJobs.empty(); } );
+
+		// Finish the pending exports before quitting.
+		if( mJobs.empty() )
+			return;
+
+		auto job = std::move( mJobs.front() );
+		mJobs.pop_front();
+		++mRunning;
+
+		lock.unlock();
+		try
+		{
+			job();
+		}
+		catch( std::exception const& eError )
+		{
+			std::fprintf( stderr, "PLY: export failed: %s\n", eError.what() );
+		}
+		lock.lock();
+
+		--mRunning;
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "vertex.hpp"
+#include "triangle.hpp"
+
+/* Binary PLY export
+ *
+ * `PlyExporter` writes point clouds and triangle meshes to binary (little
+ * endian) PLY files. The exports run on a background thread, so that the
+ * caller (the rendering thread) only pays for handing over the data:
+ *
+ *   PlyExporter exporter;
+ *   exporter.export_mesh( "mesh.ply", vertices, triangles, false );
+ *
+ * The data is passed by value; move it in if the caller doesn't need it
+ * anymore. The worker formats the file into large (kPlyChunkSize) buffers
+ * and writes each buffer with a single fwrite().
+ *
+ * With aCompress, the file is deflated with miniz and written in the gzip
+ * format (append ".gz" to the file name), which `gunzip` and many mesh tools
+ * read directly.
+ *
+ * Errors are reported on stderr; they don't affect the caller. Pending
+ * exports are completed when the exporter is destroyed.
+ */
+
+std::size_t const kPlyChunkSize = 4*1024*1024;
+
+// A point of a point cloud: position and RGBA8 color
+struct PlyPoint
+{
+	float x, y, z;
+	std::uint8_t color[4];
+};
+
+class PlyExporter
+{
+	public:
+		PlyExporter() = default;
+		~PlyExporter();
+
+		PlyExporter( PlyExporter const& ) = delete;
+		PlyExporter& operator= (PlyExporter const&) = delete;
+
+	public:
+		void export_points( std::string aFileName, std::vector<PlyPoint> aPoints, bool aCompress );
+		void export_mesh( std::string aFileName, std::vector<Vertex> aVertices, std::vector<Triangle> aTriangles, bool aCompress );
+
+		// Number of exports that haven't finished yet
+		std::size_t pending() const;
+
+	private:
+		void enqueue_( std::function<void()> );
+		void run_();
+
+	private:
+		std::thread mThread;
+
+		mutable std::mutex mMutex;
+		std::condition_variable mWakeUp;
+		std::deque<std::function<void()>> mJobs;
+		std::size_t mRunning = 0;
+		bool mQuit = false;
+};
@@ -35,6 +35,11 @@ workspace "CGMinor2018_BscProject"
 		}
 	};
 
+	newoption {
+		trigger = "profiling",
+		description = "Compile in the hot-path profiler (overlay + Chrome trace dump)"
+	};
+
 	-- Workaround empty "toolset"
 	filter "system:linux or system:macos"
 		toolset( _OPTIONS["toolset"] or "gcc" );
@@ -48,6 +53,9 @@ workspace "CGMinor2018_BscProject"
 		linkoptions { "-pthread" }
 		buildoptions { "-march=native", "-Wall", "-pthread" }
 
+	filter "options:profiling"
+		defines { "PROJECT_PROFILING=1" }
+
 	filter "toolset:msc"
 		defines { "_CRT_SECURE_NO_WARNINGS=1" }
 		defines { "_SCL_SECURE_NO_WARNINGS=1" }
@@ -120,6 +128,17 @@ project( "Project" )
 	local sources = { "*.cpp", "*.hpp", "*.inl", "miniz.c" }
 	files( sources )
 
+-- One executable per test in tests/. The tests only need the volume code,
+-- which doesn't depend on OpenGL. Run them from a writable directory (some
+-- write temporary files).
+for _, test in ipairs { "volume_sequence_test", "marching_cubes_test", "frame_arena_test" } do
+	project( test )
+		kind "ConsoleApp"
+		location "build/"
+
+		files { "tests/" .. test .. ".cpp", "volume.cpp", "volume_stats.cpp", "volume_sequence.cpp", "marching_cubes.cpp", "frame_arena.cpp", "miniz.c" }
+end
+
 	
 	--includedirs( 
 	--links
@@ -0,0 +1,260 @@
+#include "profiler.hpp"
+
+#if PROJECT_PROFILING
+
+#include <new>
+#include <atomic>
+#include <chrono>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define GLEW_STATIC 1
+#include <GL/glew.h>
+#include <GL/glut.h>
+
+std::uint64_t gProfileCounters[std::size_t(EProfileCounter::count)] = {};
+
+namespace
+{
+	char const* const kCounterNames[] = {
+		"voxels scanned",
+		"voxels rejected by region",
+		"voxels skipped (empty)",
+		"points emitted",
+		"quads emitted",
+		"triangles drawn",
+		"bytes uploaded",
+		"rebuild triggers",
+		"heap allocations",
+		"frame arena bytes",
+		"frame arena spills"
+	};
+
+	static_assert( sizeof(kCounterNames)/sizeof(kCounterNames[0]) == std::size_t(EProfileCounter::count), "Counter name missing" );
+
+	// Ring buffer of recorded frames. `gFrameCount` is the total number of
+	// frames recorded so far; frame N lives in gFrames[N % kProfileFrameCount].
+	ProfileFrame gFrames[kProfileFrameCount];
+	std::uint64_t gFrameCount = 0;
+
+	ProfileFrame gCurrent{};
+	bool gInFrame = false;
+	int gScopeDepth = 0;
+
+	bool gOverlayVisible = false;
+
+	// Number of calls to operator new so far, from all threads; see below.
+	std::atomic<std::uint64_t> gHeapAllocations{ 0 };
+	std::uint64_t gHeapAllocationsAtFrameBegin = 0;
+
+	std::chrono::steady_clock::time_point const gEpoch = std::chrono::steady_clock::now();
+
+	void draw_text_( float aX, float aY, char const* aText )
+	{
+		glRasterPos2f( aX, aY );
+		for( ; *aText; ++aText )
+			glutBitmapCharacter( GLUT_BITMAP_8_BY_13, *aText );
+	}
+}
+
+double profile_now_us()
+{
+	auto const delta = std::chrono::steady_clock::now() - gEpoch;
+	return std::chrono::duration<double, std::micro>( delta ).count();
+}
+
+ProfileScope::ProfileScope( char const* aName )
+	: mName(aName)
+	, mStartUs(profile_now_us())
+	, mDepth(gScopeDepth++)
+{}
+
+ProfileScope::~ProfileScope()
+{
+	--gScopeDepth;
+
+	if( !gInFrame || gCurrent.eventCount >= kProfileMaxEventsPerFrame )
+		return;
+
+	auto& ev = gCurrent.events[gCurrent.eventCount++];
+	ev.name = mName;
+	ev.startUs = mStartUs;
+	ev.durationUs = profile_now_us() - mStartUs;
+	ev.depth = mDepth;
+}
+
+void profile_frame_begin()
+{
+	gCurrent.index = gFrameCount;
+	gCurrent.startUs = profile_now_us();
+	gCurrent.durationUs = 0.0;
+	gCurrent.eventCount = 0;
+
+	std::memset( gProfileCounters, 0, sizeof(gProfileCounters) );
+	gHeapAllocationsAtFrameBegin = gHeapAllocations.load( std::memory_order_relaxed );
+
+	gInFrame = true;
+}
+
+void profile_frame_end()
+{
+	if( !gInFrame )
+		return;
+
+	gCurrent.durationUs = profile_now_us() - gCurrent.startUs;
+
+	gProfileCounters[std::size_t(EProfileCounter::heapAllocations)] = gHeapAllocations.load( std::memory_order_relaxed ) - gHeapAllocationsAtFrameBegin;
+	std::memcpy( gCurrent.counters, gProfileCounters, sizeof(gProfileCounters) );
+
+	gFrames[gFrameCount % kProfileFrameCount] = gCurrent;
+	++gFrameCount;
+
+	gInFrame = false;
+}
+
+/* Replacements of the global allocation functions that count the allocations
+ * (for EProfileCounter::heapAllocations). The array and nothrow forms of the
+ * standard library forward to these.
+ */
+void* operator new( std::size_t aSize )
+{
+	gHeapAllocations.fetch_add( 1, std::memory_order_relaxed );
+
+	if( void* ptr = std::malloc( aSize ? aSize : 1 ) )
+		return ptr;
+
+	throw std::bad_alloc();
+}
+
+void operator delete( void* aPtr ) noexcept
+{
+	std::free( aPtr );
+}
+void operator delete( void* aPtr, std::size_t ) noexcept
+{
+	std::free( aPtr );
+}
+
+ProfileFrame const* profile_last_frame()
+{
+	if( 0 == gFrameCount )
+		return nullptr;
+
+	return &gFrames[(gFrameCount-1) % kProfileFrameCount];
+}
+
+void profile_toggle_overlay()
+{
+	gOverlayVisible = !gOverlayVisible;
+}
+
+void profile_draw_overlay()
+{
+	ProfileFrame const* last = profile_last_frame();
+	if( !gOverlayVisible || !last )
+		return;
+
+	// Average frame time over the frames in the ring buffer.
+	std::size_t const frames = gFrameCount < kProfileFrameCount ? std::size_t(gFrameCount) : kProfileFrameCount;
+	double totalUs = 0.0;
+	for( std::size_t i = 0; i < frames; ++i )
+		totalUs += gFrames[i].durationUs;
+
+	GLint viewport[4];
+	glGetIntegerv( GL_VIEWPORT, viewport );
+
+	glPushAttrib( GL_ENABLE_BIT | GL_CURRENT_BIT );
+	glDisable( GL_DEPTH_TEST );
+	glDisable( GL_BLEND );
+	glDisable( GL_LIGHTING );
+
+	glMatrixMode( GL_PROJECTION );
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho( 0.0, viewport[2], 0.0, viewport[3], -1.0, 1.0 );
+	glMatrixMode( GL_MODELVIEW );
+	glPushMatrix();
+	glLoadIdentity();
+
+	glColor3f( 1.f, 1.f, 0.f );
+
+	float const lineHeight = 15.f;
+	float y = float(viewport[3]) - lineHeight;
+	char line[128];
+
+	std::snprintf( line, sizeof(line), "frame %llu: %.2f ms (avg %.2f ms over %zu)",
+		(unsigned long long)last->index, last->durationUs / 1000.0,
+		totalUs / 1000.0 / double(frames), frames
+	);
+	draw_text_( 8.f, y, line );
+	y -= lineHeight;
+
+	for( std::size_t i = 0; i < std::size_t(EProfileCounter::count); ++i )
+	{
+		std::snprintf( line, sizeof(line), "  %-26s %llu", kCounterNames[i], (unsigned long long)last->counters[i] );
+		draw_text_( 8.f, y, line );
+		y -= lineHeight;
+	}
+
+	for( std::size_t i = 0; i < last->eventCount; ++i )
+	{
+		auto const& ev = last->events[i];
+		std::snprintf( line, sizeof(line), "  %*s%-24s %.3f ms", 2*ev.depth, "", ev.name, ev.durationUs / 1000.0 );
+		draw_text_( 8.f, y, line );
+		y -= lineHeight;
+	}
+
+	glPopMatrix();
+	glMatrixMode( GL_PROJECTION );
+	glPopMatrix();
+	glMatrixMode( GL_MODELVIEW );
+
+	glPopAttrib();
+}
+
+bool profile_dump_chrome_trace( char const* aFileName )
+{
+	FILE* out = std::fopen( aFileName, "wb" );
+	if( !out )
+	{
+		std::fprintf( stderr, "Profiler: could not open '%s' for writing\n", aFileName );
+		return false;
+	}
+
+	std::fprintf( out, "{\"traceEvents\":[\n" );
+
+	bool first = true;
+	std::uint64_t const begin = gFrameCount < kProfileFrameCount ? 0 : gFrameCount - kProfileFrameCount;
+	for( std::uint64_t f = begin; f < gFrameCount; ++f )
+	{
+		auto const& frame = gFrames[f % kProfileFrameCount];
+
+		std::fprintf( out, "%s{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"index\":%llu}}",
+			first ? "" : ",\n", frame.startUs, frame.durationUs, (unsigned long long)frame.index
+		);
+		first = false;
+
+		for( std::size_t i = 0; i < frame.eventCount; ++i )
+		{
+			auto const& ev = frame.events[i];
+			std::fprintf( out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+				ev.name, ev.startUs, ev.durationUs
+			);
+		}
+
+		std::fprintf( out, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"args\":{", frame.startUs );
+		for( std::size_t i = 0; i < std::size_t(EProfileCounter::count); ++i )
+			std::fprintf( out, "%s\"%s\":%llu", i ? "," : "", kCounterNames[i], (unsigned long long)frame.counters[i] );
+		std::fprintf( out, "}}" );
+	}
+
+	std::fprintf( out, "\n]}\n" );
+	std::fclose( out );
+
+	std::printf( "Profiler: wrote %llu frames to '%s'\n", (unsigned long long)(gFrameCount - begin), aFileName );
+	return true;
+}
+
+#endif // ~ PROJECT_PROFILING
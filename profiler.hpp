@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/* Hot-path instrumentation
+ *
+ * The profiler provides scoped timers and a handful of per-frame counters.
+ * Both feed a ring buffer that holds the last `kProfileFrameCount` frames.
+ * The recorded data can be shown as an on-screen overlay (see
+ * `profile_draw_overlay()`) or dumped in the Chrome trace-event JSON format
+ * (see `profile_dump_chrome_trace()`), which can be loaded in
+ * chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Use the macros in the hot paths:
+ *
+ *   PROFILE_SCOPE( "rebuild arrays" );
+ *   PROFILE_COUNT( EProfileCounter::voxelsScanned, 1 );
+ *
+ * The instrumentation is only compiled in when PROJECT_PROFILING is defined to
+ * a non-zero value (premake5 --profiling). Otherwise, the macros expand to
+ * nothing and the remaining functions are empty inline stubs, so that the
+ * profiler compiles away completely.
+ *
+ * Note: the counters are plain (non-atomic) integers. They must only be
+ * updated from the rendering thread. The exception is heapAllocations, which
+ * the profiler counts itself (by replacing the global operator new), in all
+ * threads; it should stay at zero for frames that don't rebuild anything.
+ */
+
+enum class EProfileCounter
+{
+	voxelsScanned,
+	voxelsRejectedByRegion,
+	voxelsSkippedEmpty,
+	pointsEmitted,
+	quadsEmitted,
+	trianglesDrawn,
+	bytesUploaded,
+	rebuildTriggers,
+	heapAllocations, // all threads; see profiler.cpp
+	frameArenaBytes,
+	frameArenaSpills,
+
+	count // Must be last
+};
+
+#if !defined(PROJECT_PROFILING)
+#	define PROJECT_PROFILING 0
+#endif
+
+#if PROJECT_PROFILING
+
+std::size_t const kProfileFrameCount = 128;
+std::size_t const kProfileMaxEventsPerFrame = 64;
+
+struct ProfileEvent
+{
+	char const* name;
+	double startUs;
+	double durationUs;
+	int depth;
+};
+
+struct ProfileFrame
+{
+	std::uint64_t index;
+	double startUs;
+	double durationUs;
+
+	std::uint64_t counters[std::size_t(EProfileCounter::count)];
+
+	ProfileEvent events[kProfileMaxEventsPerFrame];
+	std::size_t eventCount;
+};
+
+// Counters of the frame that is currently being recorded.
+extern std::uint64_t gProfileCounters[std::size_t(EProfileCounter::count)];
+
+double profile_now_us();
+
+class ProfileScope
+{
+	public:
+		explicit ProfileScope( char const* aName );
+		~ProfileScope();
+
+		ProfileScope( ProfileScope const& ) = delete;
+		ProfileScope& operator= (ProfileScope const&) = delete;
+
+	private:
+		char const* mName;
+		double mStartUs;
+		int mDepth;
+};
+
+void profile_frame_begin();
+void profile_frame_end();
+
+ProfileFrame const* profile_last_frame();
+
+void profile_toggle_overlay();
+void profile_draw_overlay();
+
+bool profile_dump_chrome_trace( char const* aFileName );
+
+#	define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT_(profileScope,__LINE__)( name )
+#	define PROFILE_COUNT(counter,n) (gProfileCounters[std::size_t(counter)] += std::uint64_t(n))
+
+#	define PROFILE_CONCAT_(a,b) PROFILE_CONCAT0_(a,b)
+#	define PROFILE_CONCAT0_(a,b) a##b
+
+#else // !PROJECT_PROFILING
+
+#	define PROFILE_SCOPE(name) ((void)0)
+#	define PROFILE_COUNT(counter,n) ((void)0)
+
+inline void profile_frame_begin() {}
+inline void profile_frame_end() {}
+
+inline void profile_toggle_overlay() {}
+inline void profile_draw_overlay() {}
+
+inline bool profile_dump_chrome_trace( char const* ) { return false; }
+
+#endif // ~ PROJECT_PROFILING
@@ -1,13 +1,38 @@
 #include "project.hpp"
 
 #include <chrono>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <memory>
+#include <string>
 #include <vector>
 #include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <random>
-#include <ppl.h>
+#include "parallel.hpp"
+
+#include "bricked_volume.hpp"
+#include "compressed_volume.hpp"
+#include "connected_components.hpp"
+#include "frame_arena.hpp"
+#include "label_lut.hpp"
+#include "marching_cubes.hpp"
+#include "minmax_pyramid.hpp"
+#include "occupancy.hpp"
+#include "oit.hpp"
+#include "ply_export.hpp"
+#include "profiler.hpp"
+#include "region_growing.hpp"
+#include "sparse_volume.hpp"
+#include "vec3DPack.hpp"
+#include "volume_sampler.hpp"
+#include "volume_sequence.hpp"
+#include "volume_stats.hpp"
+
+#include <GL/glut.h>
 
 
 /* The following defines the different visualization modes that you will
@@ -29,7 +54,8 @@ enum class EVisualizeMode {
 	billboards,                // Optional Task 2a
 	billboardsWithLOD,         // Optional Task 2b
 	drawAsArray,               // Optional Task 3a
-	drawAsArrayFromVRAM        // Optional Task 3b, 3c, and 3d
+	drawAsArrayFromVRAM,       // Optional Task 3b, 3c, and 3d
+	isosurfaceMesh             // marching cubes mesh, see BrickedIsosurface
 };
 
 // gVisualizeMode defines the currently selected visualization mode. See
@@ -38,13 +64,19 @@ enum class EVisualizeMode {
 EVisualizeMode gVisualizeMode = EVisualizeMode::none;
 
 // gVolume contains the currently loaded volume. See volume.hpp for an overview
-// on how to access the data in the Volume class.
-Volume gVolume(0, 0, 0);
+// on how to access the data in the Volume class. The volume is shared with
+// gDatasets, so switching between datasets or levels of detail doesn't copy
+// any densities.
+VolumeHandle gVolume = make_volume_handle(Volume(0, 0, 0));
 
 // gVolumeLargestDimension is set to the largest dimensions of the volume. The
 // volumes are not cubic...
 std::size_t gVolumeLargestDimension = 0;
 
+// gVolumeVersion is incremented whenever gVolume is replaced (different dataset or level of detail). Data derived
+// from the volume (see e.g. occupancyFor()) is rebuilt when the version changes.
+unsigned gVolumeVersion = 0;
+
 // gLightPosition contains the light position. This will be used for
 // EVisualizeMode::phongPoints and latter visualization modes. You can change
 // the light position to the current camera position by pressing 'l'. Return it
@@ -62,13 +94,15 @@ bool gLightChanged = false;
 enum class ESelectiveRegionType {
 	sphere,
 	cube,
-	slab
+	slab,
+	grown, // region grown from the picked voxel; see growSelection()
+	component // a connected component; see labelComponents()
 };
 
 // gSelectiveRegionType is the currently selected region type by which to
 // restrict which parts of the volume should be drawn in Task 5. You can
-// switch the volume type using the keys 't' (sphere), 'g' (cube) and 'b'
-// (slab).  See project_on_key_press() for details.
+// switch the volume type using the keys 't' (sphere), 'g' (cube), 'b'
+// (slab), 'R' (grown) and 'L' (component).  See project_on_key_press() for details.
 ESelectiveRegionType gSelectiveRegionType = ESelectiveRegionType::cube;
 
 // TODO: if you need store other information between frames or between the
@@ -99,25 +133,136 @@ float global_radius = 1.0f;
 AXIS global_slab_axis = AXIS::X;
 float global_slab_length = 0.5f;
 
+// gFrameArena provides the transient memory of a frame (see frame_arena.hpp); it is reset at the start of
+// project_draw_window(). Allocations from it must not be kept across frames.
+FrameArena gFrameArena;
+
 // billboards
 BILLBOARDSHAPE bbShape = BILLBOARDSHAPE::QUAD;
-Volume gVolumeSmall(0, 0, 0);
 
-std::vector<Volume> vols = std::vector<Volume>();
+// gVolumeSource says where gVolume comes from: one of the datasets (global_files), a frame of the time series
+// (gSequence), or the resident bricks of an out-of-core volume (gBricked).
+enum class EVolumeSource {
+	dataset,
+	sequence,
+	bricked
+};
+EVolumeSource gVolumeSource = EVolumeSource::dataset;
+
+// The levels of detail of each dataset in global_files: the volume itself (level 0) and the reduced volume of
+// load_lod_volume() (level 1). Datasets are loaded on first use, see selectDataset(); gVolume refers to level
+// global_vols_idx of dataset global_files_idx.
+//
+// With gCompressDatasets ('C'), the datasets that aren't shown are kept as CompressedVolumes instead: their levels
+// are compressed when another dataset is selected, and decompressed when they are selected again.
+struct Dataset {
+	VolumeHandle levels[2];
+	std::unique_ptr<CompressedVolume> compressed[2];
+	std::vector<std::uint16_t> compressedLabels[2]; // labels of the compressed levels (CompressedVolume drops them)
+};
+std::vector<Dataset> gDatasets;
 int global_vols_idx = 0;
+bool gCompressDatasets = false;
+
+// Playback of a time series (see VolumeSequence), whose frames are the files matching kSequencePattern. 'P' starts
+// and pauses the playback, 'j' steps to the next frame. While a frame of the sequence is shown, gVolume refers to it;
+// 'p' goes back to the datasets.
+char const* const kSequencePattern = "data/sequence/frame_%03d.mhd";
+float const kSequenceFramesPerSecond = 10.f;
+std::unique_ptr<VolumeSequence> gSequence;
+std::size_t gSequenceFrame = 0;
+bool gSequencePlaying = false;
+std::chrono::steady_clock::time_point gSequenceFrameTime;
+
+// Out-of-core volume (see BrickedVolume), opened from kBrickedFile with 'O'; 'B' writes the current volume to this
+// file. gVolume shows level gBrickedLevel of it, assembled from the resident bricks: bricks that haven't been loaded
+// yet are filled in from coarser levels, and gVolume is re-assembled as they arrive. '{' and '}' select a finer or
+// coarser level; levels that don't fit into kBrickedDisplayVoxels (or the cache budget) are not shown.
+char const* const kBrickedFile = "data/volume.bvol";
+std::size_t const kBrickCacheBudget = std::size_t(1) << 30;
+std::size_t const kBrickedDisplayVoxels = 256 * 256 * 256;
+std::unique_ptr<BrickedVolume> gBricked;
+std::size_t gBrickedLevel = 0;
+std::uint64_t gBrickedGeneration = 0;
+bool gBrickedComplete = false;
+std::chrono::steady_clock::time_point gBrickedAssembleTime;
+
+// 'M' saves the current volume (e.g., a reduced level or an out-of-core level) as a compressed 16-bit MHD file.
+char const* const kSavedVolumeFile = "data/saved.mhd";
 
 // drawAsArray
-std::vector<float> gDrawPositions = std::vector<float>();
-std::vector<float> gDrawColors = std::vector<float>();
+// A point in the compact interleaved format used by the array modes: the grid (voxel) coordinates as 16-bit integers,
+// the label of the voxel (0 without labels), and an RGBA8 color; 12 bytes per point instead of 28 bytes for separate
+// float positions and colors. The voxel coordinates also identify the voxel that the point was generated from, which
+// is used to recolor the points when the light or the label classification changes. The grid coordinates are mapped
+// to [-1,1] by the modelview matrix (see drawPointArrays()).
+struct PackedPoint {
+	std::int16_t x, y, z;
+	std::uint16_t label;
+	std::uint8_t color[4];
+};
+static_assert(sizeof(PackedPoint) == 12, "PackedPoint should be 12 bytes");
+
+std::vector<PackedPoint> gDrawPoints = std::vector<PackedPoint>();
+AXIS current_axis = AXIS::Z;
 DIRECTION current_dir = DIRECTION::POS;
-GLuint gColorVBO;
-GLuint gPositionVBO;
+// set when the point set itself has to be rebuilt (e.g., a different volume was loaded).
+bool gDrawArraysDirty = true;
+
+// The points are grouped into bricks of kSlicesPerBrick consecutive slices along the dominant axis. Each brick is a
+// contiguous range of points; when the light changes, only the bricks whose colors changed are re-uploaded.
+struct PointBrick {
+	std::size_t first;
+	std::size_t count;
+	bool dirty;
+};
+const int kSlicesPerBrick = 8;
+std::vector<PointBrick> gDrawBricks = std::vector<PointBrick>();
+unsigned gDrawRegionVersion = 0; // region version (see gRegionVersion) that the arrays were built for
+
+// With gUseOIT, the array modes composite the points with order-independent transparency (toggle with 'u'). The
+// point arrays are then built once in a fixed order and reused from every viewing direction.
+bool gUseOIT = false;
+BlendedOIT gOIT;
+
+// Classification by label (toggle with 'T'): if the volume has labels (see Volume::label()), the colors and the
+// visibility of the voxels are taken from gLabelLUT. '-' and '=' (or shift + click) select gCurrentLabel, 'H' hides or
+// shows it, and 'A' shows all labels. The array modes apply the table when they color their points, and hide points
+// with alpha 0, so a change of the table only recolors the points and never rebuilds the point set. The other modes
+// skip hidden voxels in traverseRegion().
+bool gClassifyByLabel = false;
+LabelLUT gLabelLUT;
+std::uint16_t gCurrentLabel = 1;
+unsigned gDrawLabelVersion = 0; // LUT version (see LabelLUT::version()) that the point colors were computed for
+bool gDrawClassifyByLabel = false; // gClassifyByLabel when the point colors were computed
+
+// Label files are found next to the datasets: "data/backpack.mhd" has its labels in "data/backpack_labels.mhd".
+char const* const kLabelFileSuffix = "_labels.mhd";
+
+inline bool classifyByLabel() {
+	return gClassifyByLabel && gVolume->has_labels();
+}
+
+// drawAsArrayFromVRAM
+GLuint gPointVBO;
+std::size_t gVBOCapacity = 0; // in points
+bool gVBOValid = false; // whether the VBO holds the current point array
+
+// isosurfaceMesh
+// The triangle mesh extracted with marching cubes for the isovalue gMeshIsoValue (change it with 'c' and 'v'). The
+// mesh is kept per brick; when the isovalue changes, only the bricks whose density range crosses the old or the new
+// isovalue are re-extracted (see BrickedIsosurface).
+BrickedIsosurface gMeshBricks;
+float gMeshIsoValue = -1.f; // negative: use the default isovalue of the dataset (see defaultIsoValue())
+unsigned gMeshVolumeVersion = 0;
+bool gMeshValid = false; // whether gMeshBricks was reset() for the current volume
+
+// Writes the point set and the mesh to PLY files in the background (see exportPly()).
+PlyExporter gExporter;
 
 // declaration of functions beforehand:
 bool checkIntersection(float X, float Y, float Z);
 float linearInterPolation(float x, float x1, float x2, float q00, float q01);
-float triLinearInterpolation(float x, float y, float z, float p000, float p001, float p010, float p011,
-	float p100, float p101, float p110, float p111, float x1, float x2, float y1, float y2, float z1, float z2);
 
 // inner classes
 class IsoSurface {
@@ -126,12 +271,18 @@ public:
 		low = l;
 		high = h;
 	}
-	bool hasAfter(float density) {
+	bool hasAfter(float density) const {
 		return density >= low;
 	}
-	bool hasBetween(float density) {
+	bool hasBetween(float density) const {
 		return density >= low && density <= high;
 	}
+	float getLow() const {
+		return low;
+	}
+	float getHigh() const {
+		return high;
+	}
 private:
 	float low;
 	float high;
@@ -140,40 +291,135 @@ private:
 // TODO: if you want to declare and define additional functions, you may add
 // them here.
 
+// The point modes and the billboards don't draw in immediate mode: they append their vertices to a chunk of
+// kStreamVertices vertices from gFrameArena (the vertex stream), which is drawn with glDrawArrays() whenever it is
+// full, and by endStream(). Use beginStream()/endStream() instead of glBegin()/glEnd().
+struct StreamVertex {
+	float position[3];
+	float color[4];
+};
+
+// A multiple of 4, so that the quads of the billboards never straddle two chunks.
+std::size_t const kStreamVertices = 16384;
+
+struct VertexStream {
+	GLenum mode = GL_POINTS;
+	StreamVertex* vertices = nullptr;
+	std::size_t count = 0;
+};
+VertexStream gStream;
+
+void beginStream(GLenum mode) {
+	gStream.mode = mode;
+	gStream.vertices = gFrameArena.allocate<StreamVertex>(kStreamVertices);
+	gStream.count = 0;
+}
+
+// drawStream() draws the vertices in the stream so far, and empties it.
+void drawStream() {
+	if (0 == gStream.count) return;
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(StreamVertex), gStream.vertices[0].position);
+	glColorPointer(4, GL_FLOAT, sizeof(StreamVertex), gStream.vertices[0].color);
+	glDrawArrays(gStream.mode, 0, GLsizei(gStream.count));
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	gStream.count = 0;
+}
+
+void endStream() {
+	drawStream();
+	gStream.vertices = nullptr;
+}
+
+inline void streamVertex(float X, float Y, float Z, float r, float g, float b, float a) {
+	assert(gStream.vertices);
+	if (gStream.count == kStreamVertices) drawStream();
+
+	StreamVertex& vertex = gStream.vertices[gStream.count++];
+	vertex.position[0] = X;
+	vertex.position[1] = Y;
+	vertex.position[2] = Z;
+	vertex.color[0] = r;
+	vertex.color[1] = g;
+	vertex.color[2] = b;
+	vertex.color[3] = a;
+}
+
+// emits a single point between beginStream(GL_POINTS) and endStream(), counting it for the profiler.
+inline void emitPoint(float X, float Y, float Z, Vec3Df const& color, float alpha = 1.f) {
+	PROFILE_COUNT(EProfileCounter::pointsEmitted, 1);
+	streamVertex(X, Y, Z, color[0], color[1], color[2], alpha);
+}
+
 // http://www.lighthouse3d.com/opengl/billboarding/index.php
-void billboard(Vec3Df right, Vec3Df up, Vec3Df center, Vec3Df color, float alpha, float size) {
-	Vec3Df leftbot = Vec3Df(center.p[0] - (right.p[0] + up.p[0]) * size,
-		center.p[1] - (right.p[1] + up.p[1]) * size,
-		center.p[2] - (right.p[2] + up.p[2]) * size);
+// The billboards are emitted in batches: billboard() only records the quad, and the corners of kBillboardLanes quads
+// are computed at once (one quad per lane of a Vec3DfPack) when the batch is full or flushBillboards() is called. The
+// quads are emitted in the order in which they were recorded, between beginStream(GL_QUADS) and endStream(). Call
+// flushBillboards() before endStream().
+std::size_t const kBillboardLanes = Packf::kLanes;
+
+struct BillboardBatch {
+	Vec3Df right, up;
+	float size = 0.f;
+
+	Vec3DfPack centers, colors;
+	Packf alphas;
+	std::size_t count = 0;
+};
+BillboardBatch gBillboards;
+
+void flushBillboards() {
+	BillboardBatch& batch = gBillboards;
+	if (0 == batch.count) return;
+
+	// The same arithmetic as for a single quad: center -/+ (right -/+ up) * size.
+	Vec3DfPack const sum(batch.right + batch.up), difference(batch.right - batch.up);
+	Vec3DfPack const leftbot = batch.centers - sum * batch.size;
+	Vec3DfPack const rightbot = batch.centers + difference * batch.size;
+	Vec3DfPack const rightup = batch.centers + sum * batch.size;
+	Vec3DfPack const leftup = batch.centers - difference * batch.size;
+
+	for (std::size_t i = 0; i < batch.count; ++i) {
+		PROFILE_COUNT(EProfileCounter::quadsEmitted, 1);
+		float const r = batch.colors.x[i], g = batch.colors.y[i], b = batch.colors.z[i], a = batch.alphas[i];
+		streamVertex(leftbot.x[i], leftbot.y[i], leftbot.z[i], r, g, b, a);
+		streamVertex(rightbot.x[i], rightbot.y[i], rightbot.z[i], r, g, b, a);
+		streamVertex(rightup.x[i], rightup.y[i], rightup.z[i], r, g, b, a);
+		streamVertex(leftup.x[i], leftup.y[i], leftup.z[i], r, g, b, a);
+	}
 
-	Vec3Df rightbot = Vec3Df(center.p[0] + (right.p[0] - up.p[0]) * size,
-		center.p[1] + (right.p[1] - up.p[1]) * size,
-		center.p[2] + (right.p[2] - up.p[2]) * size);
+	batch.count = 0;
+}
+
+void billboard(Vec3Df right, Vec3Df up, Vec3Df center, Vec3Df color, float alpha, float size) {
+	BillboardBatch& batch = gBillboards;
+	if (batch.count && (right != batch.right || up != batch.up || size != batch.size)) flushBillboards();
 
-	Vec3Df rightup = Vec3Df(center.p[0] + (right.p[0] + up.p[0]) * size,
-		center.p[1] + (right.p[1] + up.p[1]) * size,
-		center.p[2] + (right.p[2] + up.p[2]) * size);
+	batch.right = right;
+	batch.up = up;
+	batch.size = size;
 
-	Vec3Df leftup = Vec3Df(center.p[0] - (right.p[0] - up.p[0]) * size,
-		center.p[1] - (right.p[1] - up.p[1]) * size,
-		center.p[2] - (right.p[2] - up.p[2]) * size);
+	batch.centers.set(batch.count, center);
+	batch.colors.set(batch.count, color);
+	batch.alphas[batch.count] = alpha;
 
-	glColor4f(color.p[0], color.p[1], color.p[2], alpha);
-	glVertex3f(leftbot.p[0], leftbot.p[1], leftbot.p[2]);
-	glVertex3f(rightbot.p[0], rightbot.p[1], rightbot.p[2]);
-	glVertex3f(rightup.p[0], rightup.p[1], rightup.p[2]);
-	glVertex3f(leftup.p[0], leftup.p[1], leftup.p[2]);
+	if (++batch.count == kBillboardLanes) flushBillboards();
 }
 
-Volume load_lod_volume(Volume& vol) {
+// load_lod_volume() returns a reduced copy of vol with half the resolution along each axis.
+Volume load_lod_volume(Volume const& vol) {
 	Volume res(vol.width() / 2 + 1, vol.height() / 2 + 1, vol.depth() / 2 + 1);
 
 	std::cout << "Creating reduced volume version of size: " << res.width() << "x" << res.height() << "x" << res.depth() << std::endl;
 
-	//for (int z = 0; z < gVolume.depth(); z += 2) {
+	//for (int z = 0; z < gVolume->depth(); z += 2) {
 	concurrency::parallel_for(size_t(0), size_t(vol.depth()), size_t(2), [&](size_t z) {
-		for (int y = 0; y < gVolume.height(); y += 2) {
-			for (int x = 0; x < gVolume.width(); x += 2) {
+		for (int y = 0; y < vol.height(); y += 2) {
+			for (int x = 0; x < vol.width(); x += 2) {
 				float density = vol(x, y, z);
 
 				if (x != 0 && y != 0 && z != 0 && x != vol.width() - 1 && y != vol.height() - 1 && z != vol.depth() - 1) {
@@ -196,832 +442,1159 @@ Volume load_lod_volume(Volume& vol) {
 			}
 		}
 	});
+	res.set_statistics(std::make_shared<VolumeStatistics const>(compute_volume_statistics(res)));
+
+	// Labels can't be averaged; take the label of the voxel that the density is centered on.
+	if (vol.has_labels()) {
+		std::vector<std::uint16_t> labels(res.total_element_count());
+		concurrency::parallel_for(size_t(0), res.depth(), [&](size_t z) {
+			for (size_t y = 0; y < res.height(); ++y) {
+				for (size_t x = 0; x < res.width(); ++x) {
+					labels[res.to_linear_index(x, y, z)] = vol.label(std::min(2 * x, vol.width() - 1),
+						std::min(2 * y, vol.height() - 1), std::min(2 * z, vol.depth() - 1));
+				}
+			}
+		});
+		res.set_labels(std::move(labels));
+	}
 	return res;
 }
 
-void performTransfer(AXIS axis, int i, int j, int k) {
-	float XT;
-	float YT;
-	float ZT;
-
-	int x, y, z;
-
-	if (axis == AXIS::X) {
-		XT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		x = k;
-		y = j;
-		z = i;
-	} else if (axis == AXIS::Y) {
-		XT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		x = i;
-		y = k;
-		z = j;
+// gradientPack() is the packed version of gradient(): it computes the gradients at the voxels aPoints[0..aCount) (at
+// most Packf::kLanes) at once, one per lane, from the same central differences (see central_difference()). Lanes
+// beyond aCount are zero.
+Vec3DfPack gradientPack(Volume const& aVolume, PackedPoint const* aPoints, std::size_t aCount) {
+	assert(aCount <= Packf::kLanes);
+
+	// Gather the neighbours; the differences are then computed for all lanes at once.
+	Vec3DfPack lo, hi, step(Vec3Df(1.f, 1.f, 1.f));
+	Packf* const loAxis[3] = { &lo.x, &lo.y, &lo.z };
+	Packf* const hiAxis[3] = { &hi.x, &hi.y, &hi.z };
+	Packf* const stepAxis[3] = { &step.x, &step.y, &step.z };
+
+	for (std::size_t i = 0; i < aCount; ++i) {
+		for (int axis = 0; axis < 3; ++axis) {
+			central_difference(aVolume, aPoints[i].x, aPoints[i].y, aPoints[i].z, axis,
+				(*loAxis[axis])[i], (*hiAxis[axis])[i], (*stepAxis[axis])[i]);
+		}
+	}
+
+	return (hi - lo) / step;
+}
+
+// The lit modes light kPointLanes voxels at once, one per lane of a Vec3DfPack (see litDots()).
+std::size_t const kPointLanes = Packf::kLanes;
+
+// litDots() computes the dot products of the normals (the negated, normalized gradients) at the voxels
+// aPoints[0..aCount) (at most kPointLanes) with lightdir, for all voxels at once.
+Packf litDots(PackedPoint const* aPoints, std::size_t aCount, Vec3Df const& lightdir) {
+	Vec3DfPack normal = -gradientPack(*gVolume, aPoints, aCount);
+	normal.normalize();
+
+	return Vec3DfPack::dotProduct(normal, Vec3DfPack(lightdir));
+}
+
+// isInterior() returns true if the voxel (x, y, z) isn't on the border of the volume, i.e., if all its neighbours
+// exist.
+inline bool isInterior(int x, int y, int z) {
+	return x > 0 && y > 0 && z > 0 &&
+		x < int(gVolume->width()) - 1 && y < int(gVolume->height()) - 1 && z < int(gVolume->depth()) - 1;
+}
+
+// The transfer functions of the different visualization modes, as far as deciding which voxels produce anything is
+// concerned. Each has its own occupancy mask (see occupancyFor()).
+enum class ETransferFunction {
+	unlit,         // solidPoints, additivePoints
+	colorAlpha,    // performTransfer()
+	lit,           // performTransferWithLighting(), the array modes
+	litTrilinear,  // performTransferWithTrilinearInterpolation(), performTransferWithBillboards()
+	count
+};
+
+// An iso-surface of a transfer function, and the (unlit) color of the points that it classifies.
+struct TransferSurface {
+	IsoSurface surface;
+	Vec3Df color;
+};
+
+// The iso-surfaces of the transfer functions; see transferSurfaces().
+std::vector<TransferSurface> const kUnlitBonsaiSurfaces = {
+	{ IsoSurface(0.2f, 0.6f), Vec3Df(.33f, .21f, .1f) },       // trunk: brown
+	{ IsoSurface(0.15f, 0.17f), Vec3Df(.3f, .66f, .23f) }      // leaves: green
+};
+std::vector<TransferSurface> const kUnlitBackpackSurfaces = {
+	{ IsoSurface(0.25f, 0.3f), Vec3Df(0.85f, 0.85f, 0.85f) },  // lightgrey
+	{ IsoSurface(0.23f, 0.25f), Vec3Df(0.66f, 0.66f, 0.66f) }, // darkgrey
+	{ IsoSurface(0.9f, 1.0f), Vec3Df(1.0f, 0.0f, 0.0f) },      // red
+	{ IsoSurface(0.6f, 0.9f), Vec3Df(0.0f, 1.0f, 1.0f) },      // lightblue
+	{ IsoSurface(0.5f, 0.55f), Vec3Df(1.0f, 1.0f, 0.0f) }      // yellow
+};
+std::vector<TransferSurface> const kColorAlphaBonsaiSurfaces = {
+	{ IsoSurface(0.5f, 0.6f), Vec3Df(.33f, .21f, .1f) },       // trunk: brown
+	{ IsoSurface(0.13f, 0.2f), Vec3Df(0.0f, 1.0f, 0.0f) }      // leaves: green
+};
+std::vector<TransferSurface> const kLitBonsaiSurfaces = {
+	{ IsoSurface(0.5f, 0.9f), Vec3Df(.33f, .21f, .1f) },       // trunk: brown
+	{ IsoSurface(0.13f, 0.2f), Vec3Df(0.0f, 1.0f, 0.0f) }      // leaves: green
+};
+std::vector<TransferSurface> const kBackpackSurfaces = {
+	{ IsoSurface(0.25f, 0.3f), Vec3Df(0.85f, 0.85f, 0.85f) },  // lightgrey
+	{ IsoSurface(0.18f, 0.25f), Vec3Df(0.66f, 0.66f, 0.66f) }, // darkgrey
+	{ IsoSurface(0.9f, 1.0f), Vec3Df(1.0f, 0.0f, 0.0f) },      // red
+	{ IsoSurface(0.61f, 0.9f), Vec3Df(0.0f, 1.0f, 1.0f) },     // lightblue
+	{ IsoSurface(0.4f, 0.55f), Vec3Df(1.0f, 1.0f, 0.0f) }      // yellow
+};
+
+// transferSurfaces() returns the iso-surfaces that the transfer function tf uses for the given dataset, in order of
+// precedence: a density belongs to the first iso-surface that contains it (see classifyDensity()). This is the only
+// definition of the iso-surfaces; the modes, the occupancy masks, the mesh and picking all read it.
+std::vector<TransferSurface> const& transferSurfaces(ETransferFunction tf, TRANSFERTYPE ttype) {
+	bool const bonsai = ttype == TRANSFERTYPE::BONSAI;
+	switch (tf) {
+	case ETransferFunction::unlit:
+		return bonsai ? kUnlitBonsaiSurfaces : kUnlitBackpackSurfaces;
+	case ETransferFunction::colorAlpha:
+		return bonsai ? kColorAlphaBonsaiSurfaces : kBackpackSurfaces;
+	default:
+		// the BACKPACK iso-surfaces are the same for all other modes.
+		return bonsai ? kLitBonsaiSurfaces : kBackpackSurfaces;
+	}
+}
+
+// classifyDensity() returns the first of the iso-surfaces that contains the density, or nullptr if there is none.
+inline TransferSurface const* classifyDensity(std::vector<TransferSurface> const& surfaces, float density) {
+	for (auto const& surface : surfaces) {
+		if (surface.surface.hasBetween(density)) return &surface;
+	}
+	return nullptr;
+}
+
+// One cached occupancy mask per transfer function; see occupancyFor().
+struct OccupancyEntry {
+	OccupancyMask mask;
+	TRANSFERTYPE ttype;
+	unsigned volumeVersion;
+	bool valid;
+};
+OccupancyEntry gOccupancy[std::size_t(ETransferFunction::count)] = {};
+
+// With gSparseOccupancy, the occupancy masks are rebuilt from the active voxels of gSparseVolume, which records where
+// the current volume isn't empty (see sparseVolume()), instead of from all voxels of the volume. The masks stay the
+// same; only the empty parts of the volume are skipped. Toggled with 'S'.
+bool gSparseOccupancy = false;
+SparseVolume gSparseVolume;
+unsigned gSparseVolumeVersion = 0; // volume version (see gVolumeVersion) that gSparseVolume was built from
+bool gSparseVolumeValid = false;
+
+// sparseThreshold() returns the threshold of gSparseVolume: the lowest density that the transfer functions classify,
+// so that every voxel that they can produce a point for is active. (litTrilinear isn't included, as it also classifies
+// interpolated densities; its mask is always rebuilt from the dense volume.)
+float sparseThreshold() {
+	float threshold = 1.f;
+	for (ETransferFunction tf : { ETransferFunction::unlit, ETransferFunction::colorAlpha, ETransferFunction::lit }) {
+		for (auto const& surface : transferSurfaces(tf, global_ttype)) {
+			threshold = std::min(threshold, surface.surface.getLow());
+		}
+	}
+	return threshold;
+}
+
+// sparseVolume() returns gSparseVolume, which is rebuilt when the volume (or the threshold, i.e., the dataset type)
+// changes.
+SparseVolume const& sparseVolume() {
+	float const threshold = sparseThreshold();
+	if (!gSparseVolumeValid || gSparseVolumeVersion != gVolumeVersion || gSparseVolume.threshold() != threshold) {
+		PROFILE_SCOPE("build sparse volume");
+		gSparseVolume = SparseVolume::from_volume(*gVolume, threshold);
+		gSparseVolumeVersion = gVolumeVersion;
+		gSparseVolumeValid = true;
+	}
+	return gSparseVolume;
+}
+
+// occupancyFor() returns the occupancy mask of the transfer function tf for the current volume: a bit is set for
+// each voxel for which the transfer function might produce a point (or billboard). The mask is only rebuilt when the
+// dataset (gVolume, global_ttype) changes; switching between modes reuses the cached masks.
+OccupancyMask const& occupancyFor(ETransferFunction tf) {
+	OccupancyEntry& entry = gOccupancy[std::size_t(tf)];
+	if (entry.valid && entry.ttype == global_ttype && entry.volumeVersion == gVolumeVersion) {
+		return entry.mask;
+	}
+
+	PROFILE_SCOPE("rebuild occupancy");
+
+	std::vector<TransferSurface> const& surfaces = transferSurfaces(tf, global_ttype);
+	auto classified = [&](float density) {
+		return classifyDensity(surfaces, density) != nullptr;
+	};
+
+	if (tf == ETransferFunction::litTrilinear) {
+		// Interior voxels also produce a point if the interpolated density is part of an iso-surface (when the camera
+		// is close to the volume).
+		VolumeSampler const sampler(*gVolume);
+		entry.mask.rebuild(*gVolume, [&](std::size_t sx, std::size_t sy, std::size_t sz) {
+			int const x = int(sx), y = int(sy), z = int(sz);
+			if (classified((*gVolume)(x, y, z))) return true;
+			if (!isInterior(x, y, z)) return false;
+
+			return classified(sampler.sample_centered(x, y, z, 1));
+		});
+	} else if (gSparseOccupancy) {
+		// Inactive voxels are below all iso-surfaces (see sparseThreshold()).
+		entry.mask.rebuild(sparseVolume(), [&](std::size_t x, std::size_t y, std::size_t z) {
+			return classified((*gVolume)(x, y, z));
+		});
 	} else {
-		XT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		x = j;
-		y = i;
-		z = k;
-	}
-
-	// Don't do anything if the coords are outside the ESelectiveRegionType::{shape}
-	if (!checkIntersection(XT, YT, ZT)) return;
-
-	float density = gVolume(x, y, z);
-
-	// BONSAI:
-	// trunk:
-	IsoSurface trunk = IsoSurface(0.5f, 0.6f);
-	//IsoSurface trunk = IsoSurface(0.2f, 0.6f);
-	//IsoSurface trunk = IsoSurface(FLT_MAX, FLT_MIN); // ignores trunk when this line is uncommented
-
-	// leaves:
-	IsoSurface leaves = IsoSurface(0.13f, 0.2f);
-	//IsoSurface leaves = IsoSurface(FLT_MAX, FLT_MIN); // ignores leaves when this line is uncommented
-
-	// BACKPACK:
-	IsoSurface lightgrey = IsoSurface(0.25f, 0.3f);
-	//IsoSurface lightgrey = IsoSurface(FLT_MAX, FLT_MIN);
-	IsoSurface darkgrey = IsoSurface(0.18f, 0.25);
-	//IsoSurface darkgrey = IsoSurface(FLT_MAX, FLT_MIN);
-	IsoSurface red = IsoSurface(0.9f, 1.0f);
-	//IsoSurface red = IsoSurface(FLT_MAX, FLT_MIN);
-	IsoSurface lightblue = IsoSurface(0.61f, 0.9f);
-	//IsoSurface lightblue = IsoSurface(FLT_MAX, FLT_MIN);
-	IsoSurface yellow = IsoSurface(0.4f, 0.55f);
-	//IsoSurface yellow = IsoSurface(FLT_MAX, FLT_MIN);
+		entry.mask.rebuild(*gVolume, [&](std::size_t x, std::size_t y, std::size_t z) {
+			return classified((*gVolume)(x, y, z));
+		});
+	}
 
-	// points with low density have a low alpha and vice versa
-	float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
-	Vec3Df c = Vec3Df();
-
-	switch (global_ttype) {
-	case TRANSFERTYPE::BONSAI:
-		if (trunk.hasBetween(density)) {
-			c = Vec3Df(.33f, .21f, .1f); // brown
-			c *= density;
-			glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-			glVertex3f(XT, YT, ZT);
-		} else if (leaves.hasBetween(density)) {
-			c = Vec3Df(0.0f, 1.0f, 0.0f); // green
-			c *= density;
-			glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-			glVertex3f(XT, YT, ZT);
+	entry.ttype = global_ttype;
+	entry.volumeVersion = gVolumeVersion;
+	entry.valid = true;
+	return entry.mask;
+}
+
+// activeTransferFunction() returns the transfer function of the current visualization mode.
+ETransferFunction activeTransferFunction() {
+	switch (gVisualizeMode) {
+	case EVisualizeMode::solidPoints:
+	case EVisualizeMode::additivePoints:
+		return ETransferFunction::unlit;
+	case EVisualizeMode::colorAlphaPoints:
+		return ETransferFunction::colorAlpha;
+	case EVisualizeMode::enhanceSelectedPoints:
+	case EVisualizeMode::billboards:
+	case EVisualizeMode::billboardsWithLOD:
+		return ETransferFunction::litTrilinear;
+	default:
+		return ETransferFunction::lit;
+	}
+}
+
+// The selective region in voxel space. Instead of testing every voxel with checkIntersection(), the traversal only
+// iterates over the (inclusive) bounding range [min, max] of the region, and for each row of the innermost loop over
+// the exact span of voxels inside the region (see regionRowSpan()). The bounds are only recomputed when one of the
+// region parameters (or the volume) changes.
+struct RegionBounds {
+	int min[3];
+	int max[3];
+	bool empty;
+};
+
+// snapshot of everything that the region depends on; see updateRegionBounds().
+struct RegionParams {
+	ESelectiveRegionType type;
+	float position[3];
+	float width, height, depth;
+	float radius;
+	AXIS slabAxis;
+	float slabLength;
+	std::size_t dims[4];
+	unsigned grownVersion;
+	unsigned componentVersion;
+
+	bool operator==(RegionParams const& other) const {
+		return type == other.type && std::equal(position, position + 3, other.position) &&
+			width == other.width && height == other.height && depth == other.depth && radius == other.radius &&
+			slabAxis == other.slabAxis && slabLength == other.slabLength && std::equal(dims, dims + 4, other.dims) &&
+			grownVersion == other.grownVersion && componentVersion == other.componentVersion;
+	}
+};
+
+RegionBounds gRegionBounds = RegionBounds{ { 0, 0, 0 }, { -1, -1, -1 }, true };
+RegionParams gRegionParams = RegionParams();
+bool gRegionParamsValid = false;
+unsigned gRegionVersion = 0; // incremented whenever the region changes
+
+// The last voxel picked with project_pick(), which seeds the grown region.
+int gPickedVoxel[3] = { -1, -1, -1 };
+bool gHasPickedVoxel = false;
+
+// The region of ESelectiveRegionType::grown: the voxels connected to gPickedVoxel whose density is within
+// gGrowTolerance of the density of gPickedVoxel. It is grown again when the volume changes.
+GrownRegion gGrownRegion = GrownRegion();
+float gGrowTolerance = 0.05f;
+unsigned gGrownRegionVersion = 0; // incremented whenever the grown region changes
+unsigned gGrownRegionVolumeVersion = 0; // volume version (see gVolumeVersion) that the region was grown in
+
+// The connected components of the voxels in a density range, and the one of them that ESelectiveRegionType::component
+// shows (0 for none). The components are labeled again when the volume changes.
+ComponentLabels gComponents;
+std::uint32_t gSelectedComponent = 0;
+unsigned gComponentVersion = 0; // incremented whenever the labels or the selected component change
+unsigned gComponentsVolumeVersion = 0; // volume version (see gVolumeVersion) that the components were labeled in
+
+// converts a coordinate in [-1,1] to a (fractional) voxel coordinate; inverse of 2*v/L - 1.
+inline float worldToVoxel(float X) {
+	return (X + 1.f) * 0.5f * float(gVolumeLargestDimension);
+}
+
+inline int volumeDim(int dim) {
+	return int(dim == 0 ? gVolume->width() : dim == 1 ? gVolume->height() : gVolume->depth());
+}
+
+// conservative (one voxel larger) voxel range for the coordinate range [lo, hi] in [-1,1] along dimension dim.
+inline void conservativeRange(int dim, float lo, float hi, int& vmin, int& vmax) {
+	vmin = std::max(int(std::floor(worldToVoxel(lo))) - 1, 0);
+	vmax = std::min(int(std::ceil(worldToVoxel(hi))) + 1, volumeDim(dim) - 1);
+}
+
+// pickedVoxelInVolume() returns whether there is a picked voxel, and it lies inside of the current volume.
+inline bool pickedVoxelInVolume() {
+	int const* v = gPickedVoxel;
+	return gHasPickedVoxel && v[0] >= 0 && v[1] >= 0 && v[2] >= 0 &&
+		v[0] < volumeDim(0) && v[1] < volumeDim(1) && v[2] < volumeDim(2);
+}
+
+// growSelection() grows gGrownRegion from gPickedVoxel (see grow_region()).
+void growSelection() {
+	int const* seed = gPickedVoxel;
+	float const density = pickedVoxelInVolume() ? (*gVolume)(seed[0], seed[1], seed[2]) : 0.f;
+
+	auto const start = std::chrono::steady_clock::now();
+	{
+		PROFILE_SCOPE("grow region");
+		gGrownRegion = grow_region(*gVolume, std::size_t(seed[0]), std::size_t(seed[1]), std::size_t(seed[2]),
+			density - gGrowTolerance, density + gGrowTolerance);
+	}
+	double const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	++gGrownRegionVersion;
+	gGrownRegionVolumeVersion = gVolumeVersion;
+	std::printf("Grown region: %zu voxels, density %.3f +- %.3f (%.1f ms)\n", gGrownRegion.mask.count(), density,
+		gGrowTolerance, ms);
+}
+
+// selectComponent() shows the component with the given label (0 for none) in ESelectiveRegionType::component.
+void selectComponent(std::uint32_t label) {
+	gSelectedComponent = label;
+	++gComponentVersion;
+
+	if (!label) {
+		std::printf("No component selected\n");
+		return;
+	}
+
+	ComponentStatistics const& stats = gComponents.statistics(label);
+	std::printf("Component %u: %zu voxels, bounds (%d, %d, %d) - (%d, %d, %d)\n", label, stats.count, stats.min[0],
+		stats.min[1], stats.min[2], stats.max[0], stats.max[1], stats.max[2]);
+}
+
+// labelComponents() labels the connected components of the voxels with densities in [lo, hi] (see
+// ComponentLabels), and selects the one of gPickedVoxel (none if it isn't part of any), or the largest one if there
+// is no picked voxel.
+void labelComponents(float lo, float hi) {
+	auto const start = std::chrono::steady_clock::now();
+	{
+		PROFILE_SCOPE("label components");
+		gComponents = ComponentLabels::from_volume(*gVolume, lo, hi);
+	}
+	double const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	gComponentsVolumeVersion = gVolumeVersion;
+	std::printf("%zu components in [%.3f, %.3f] (%.1f ms)\n", gComponents.component_count(), lo, hi, ms);
+
+	int const* seed = gPickedVoxel;
+	bool const picked = pickedVoxelInVolume();
+	std::uint32_t label = picked ? gComponents.label(seed[0], seed[1], seed[2]) : 0;
+	for (std::uint32_t i = 1; !picked && i <= gComponents.component_count(); ++i) {
+		if (!label || gComponents.statistics(i).count > gComponents.statistics(label).count) label = i;
+	}
+	selectComponent(label);
+}
+
+// inMaskedRegion() tests a voxel against the regions that are given per voxel (grown, component) rather than by a
+// shape. Both lookups are O(1).
+inline bool inMaskedRegion(int x, int y, int z) {
+	if (gSelectiveRegionType == ESelectiveRegionType::grown) return gGrownRegion.mask.test(x, y, z);
+	return gComponents.label(x, y, z) == gSelectedComponent;
+}
+
+inline bool isMaskedRegion() {
+	return gSelectiveRegionType == ESelectiveRegionType::grown || gSelectiveRegionType == ESelectiveRegionType::component;
+}
+
+void updateRegionBounds() {
+	if (gSelectiveRegionType == ESelectiveRegionType::grown && gGrownRegionVolumeVersion != gVolumeVersion) {
+		growSelection();
+	}
+	if (gSelectiveRegionType == ESelectiveRegionType::component && gComponentsVolumeVersion != gVolumeVersion) {
+		labelComponents(gComponents.low(), gComponents.high());
+	}
+
+	RegionParams params;
+	params.type = gSelectiveRegionType;
+	std::copy(global_position.p, global_position.p + 3, params.position);
+	params.width = global_width;
+	params.height = global_height;
+	params.depth = global_depth;
+	params.radius = global_radius;
+	params.slabAxis = global_slab_axis;
+	params.slabLength = global_slab_length;
+	params.dims[0] = gVolume->width();
+	params.dims[1] = gVolume->height();
+	params.dims[2] = gVolume->depth();
+	params.dims[3] = gVolumeLargestDimension;
+	params.grownVersion = gGrownRegionVersion;
+	params.componentVersion = gComponentVersion;
+
+	if (gRegionParamsValid && params == gRegionParams) return;
+	gRegionParams = params;
+	gRegionParamsValid = true;
+	++gRegionVersion;
+
+	RegionBounds& rb = gRegionBounds;
+	for (int d = 0; d < 3; ++d) {
+		rb.min[d] = 0;
+		rb.max[d] = volumeDim(d) - 1;
+	}
+
+	switch (gSelectiveRegionType) {
+	case ESelectiveRegionType::sphere:
+		for (int d = 0; d < 3; ++d) {
+			conservativeRange(d, global_position.p[d] - global_radius, global_position.p[d] + global_radius, rb.min[d], rb.max[d]);
 		}
 		break;
-	case TRANSFERTYPE::BACKPACK:
-		if (lightgrey.hasBetween(density)) {
-			c = Vec3Df(0.85f, 0.85f, 0.85f); // lightgrey
-			c *= density;
-			glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-			glVertex3f(XT, YT, ZT);
-		} else if (darkgrey.hasBetween(density)) {
-			c = Vec3Df(0.66f, 0.66f, 0.66f); // darkgrey
-			c *= density;
-			glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-			glVertex3f(XT, YT, ZT);
-		} else if (red.hasBetween(density)) {
-			c = Vec3Df(1.0f, 0.0f, 0.0f); // red
-			c *= density;
-			glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-			glVertex3f(XT, YT, ZT);
-		} else if (lightblue.hasBetween(density)) {
-			c = Vec3Df(0.0f, 1.0f, 1.0f); // lightblue
-			c *= density;
-			glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-			glVertex3f(XT, YT, ZT);
-		} else if (yellow.hasBetween(density)) {
-			c = Vec3Df(1.0f, 1.0f, 0.0f); // yellow
-			c *= density;
-			glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-			glVertex3f(XT, YT, ZT);
+	case ESelectiveRegionType::cube: {
+		float const size[3] = { global_width, global_height, global_depth };
+		for (int d = 0; d < 3; ++d) {
+			conservativeRange(d, global_position.p[d], global_position.p[d] + size[d], rb.min[d], rb.max[d]);
+		}
+	} break;
+	case ESelectiveRegionType::slab: {
+		int const d = int(global_slab_axis);
+		conservativeRange(d, global_position.p[d], global_position.p[d] + global_slab_length, rb.min[d], rb.max[d]);
+	} break;
+	case ESelectiveRegionType::grown:
+		std::copy(gGrownRegion.min, gGrownRegion.min + 3, rb.min);
+		std::copy(gGrownRegion.max, gGrownRegion.max + 3, rb.max);
+		break;
+	case ESelectiveRegionType::component:
+		if (gSelectedComponent) {
+			ComponentStatistics const& stats = gComponents.statistics(gSelectedComponent);
+			std::copy(stats.min, stats.min + 3, rb.min);
+			std::copy(stats.max, stats.max + 3, rb.max);
+		} else {
+			rb.max[0] = rb.min[0] - 1;
 		}
 		break;
 	default:
 		break;
 	}
+
+	rb.empty = rb.min[0] > rb.max[0] || rb.min[1] > rb.max[1] || rb.min[2] > rb.max[2];
 }
 
-void performTransferWithLighting(AXIS axis, int i, int j, int k, int p, int q, int r, Vec3Df lightdir) {
-	float XT;
-	float YT;
-	float ZT;
-
-	int x, y, z;
-
-	if (axis == AXIS::X) {
-		XT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		x = k;
-		y = j;
-		z = i;
-	} else if (axis == AXIS::Y) {
-		XT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		x = i;
-		y = k;
-		z = j;
-	} else {
-		XT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		x = j;
-		y = i;
-		z = k;
-	}
-
-	// Don't do anything if the coords are outside the ESelectiveRegionType::{shape}
-	if (!checkIntersection(XT, YT, ZT)) return;
-
-	float density = gVolume(x, y, z);
-
-	if (k != 0 && j != 0 && i != 0 && k != p - 1 && j != q - 1 && i != r - 1) {
-		const int XBack = x - 1;
-		const int YBack = y - 1;
-		const int ZBack = z - 1;
-		const int XFront = x + 1;
-		const int YFront = y + 1;
-		const int ZFront = z + 1;
-
-		// partial derivative
-		float partDerX = (gVolume(XFront, y, z) - gVolume(XBack, y, z)) / 2.0f;
-		float partDerY = (gVolume(x, YFront, z) - gVolume(x, YBack, z)) / 2.0f;
-		float partDerZ = (gVolume(x, y, ZFront) - gVolume(x, y, ZBack)) / 2.0f;
-
-		Vec3Df normal = Vec3Df(-partDerX, -partDerY, -partDerZ);
-		normal.normalize();
-
-		float dot = Vec3Df::dotProduct(normal, lightdir);
-
-		// BONSAI:
-		// trunk:
-		IsoSurface trunk = IsoSurface(0.5f, 0.9f);
-		//IsoSurface trunk = IsoSurface(0.2f, 0.6f);
-		//IsoSurface trunk = IsoSurface(FLT_MAX, FLT_MIN); // ignores trunk when this line is uncommented
-
-		// leaves:
-		IsoSurface leaves = IsoSurface(0.13f, 0.2f);
-		//IsoSurface leaves = IsoSurface(FLT_MAX, FLT_MIN); // ignores leaves when this line is uncommented
-
-		// BACKPACK:
-		IsoSurface lightgrey = IsoSurface(0.25f, 0.3f);
-		//IsoSurface lightgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface darkgrey = IsoSurface(0.18f, 0.25);
-		//IsoSurface darkgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface red = IsoSurface(0.9f, 1.0f);
-		//IsoSurface red = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface lightblue = IsoSurface(0.61f, 0.9f);
-		//IsoSurface lightblue = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface yellow = IsoSurface(0.4f, 0.55f);
-		//IsoSurface yellow = IsoSurface(FLT_MAX, FLT_MIN);
+// regionRowSpan() computes the exact span [lo, hi] of voxels inside the region along dimension dim, with the other
+// two coordinates taken from c. Returns false if the row doesn't intersect the region. The sphere, cube and slab are
+// convex, so the voxels inside the region form a single interval along each row: we start from a conservative
+// estimate and shrink it with checkIntersection() at its ends, so that the result matches the per-voxel test. The
+// masked regions (see inMaskedRegion()) aren't convex; their spans may contain gaps, which traverseRegion() skips.
+bool regionRowSpan(int dim, int const c[3], int& lo, int& hi) {
+	RegionBounds const& rb = gRegionBounds;
+	lo = rb.min[dim];
+	hi = rb.max[dim];
+
+	if (gSelectiveRegionType == ESelectiveRegionType::sphere) {
+		float dist2 = global_radius * global_radius;
+		for (int d = 0; d < 3; ++d) {
+			if (d == dim) continue;
+			float const delta = 2.f*float(c[d]) / gVolumeLargestDimension - 1.f - global_position.p[d];
+			dist2 -= delta * delta;
+		}
 
-		// points with low density have a low alpha and vice versa
-		float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
+		if (dist2 < -1e-4f) return false;
 
-		Vec3Df c = Vec3Df();
-		switch (global_ttype) {
-		case TRANSFERTYPE::BONSAI:
-			if (trunk.hasBetween(density)) {
-				c = Vec3Df(.33f, .21f, .1f); // brown
-				c *= density * dot;
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (leaves.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 0.0f); // green
-				c *= density * dot;
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			}
-			break;
-		case TRANSFERTYPE::BACKPACK: {
-			if (lightgrey.hasBetween(density)) {
-				c = Vec3Df(0.85f, 0.85f, 0.85f); // lightgrey
-				c *= density * dot;
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (darkgrey.hasBetween(density)) {
-				c = Vec3Df(0.66f, 0.66f, 0.66f); // darkgrey
-				c *= density * dot;
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (red.hasBetween(density)) {
-				c = Vec3Df(1.0f, 0.0f, 0.0f); // red
-				c *= density * dot;
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (lightblue.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 1.0f); // lightblue
-				c *= density * dot;
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (yellow.hasBetween(density)) {
-				c = Vec3Df(1.0f, 1.0f, 0.0f); // yellow
-				c *= density * dot;
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
+		float const halfChord = std::sqrt(std::max(dist2, 0.f));
+		int vmin, vmax;
+		conservativeRange(dim, global_position.p[dim] - halfChord, global_position.p[dim] + halfChord, vmin, vmax);
+		lo = std::max(lo, vmin);
+		hi = std::min(hi, vmax);
+	}
+
+	auto inside = [&](int v) {
+		if (isMaskedRegion()) {
+			int const x = dim == 0 ? v : c[0], y = dim == 1 ? v : c[1], z = dim == 2 ? v : c[2];
+			return inMaskedRegion(x, y, z);
+		}
+
+		float X[3];
+		for (int d = 0; d < 3; ++d) {
+			X[d] = 2.f*float(d == dim ? v : c[d]) / gVolumeLargestDimension - 1.f;
+		}
+		return checkIntersection(X[0], X[1], X[2]);
+	};
+
+	while (lo <= hi && !inside(lo)) ++lo;
+	while (hi >= lo && !inside(hi)) --hi;
+	return lo <= hi;
+}
+
+// traverseRegion() calls func(x, y, z) for every occupied voxel (see occupancyFor()) inside the selected region, slice
+// by slice along the given axis, in the given direction (i.e., back to front if the direction is the viewing
+// direction). Within a slice, the innermost loop runs along x where possible, in which case the set bits of the mask
+// are visited a word at a time. Slices of constant x test the bits along z one by one. With hideLabels, voxels whose
+// label is hidden (see gLabelLUT) are skipped as well.
+template <typename tFunc>
+void traverseRegion(OccupancyMask const& mask, AXIS axis, DIRECTION dir, tFunc&& func, bool hideLabels = true) {
+	RegionBounds const& rb = gRegionBounds;
+	if (rb.empty) {
+		PROFILE_COUNT(EProfileCounter::voxelsRejectedByRegion, gVolume->total_element_count());
+		return;
+	}
+
+	int const outer = axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2;
+	int const middle = axis == AXIS::X ? 1 : axis == AXIS::Y ? 2 : 1;
+	int const inner = axis == AXIS::X ? 2 : 0;
+	bool const forward = dir == DIRECTION::POS;
+	bool const masked = isMaskedRegion();
+	bool const hidden = hideLabels && classifyByLabel();
+
+	std::size_t inside = 0, visited = 0;
+	int c[3];
+	for (int s = 0; s <= rb.max[outer] - rb.min[outer]; ++s) {
+		c[outer] = forward ? rb.min[outer] + s : rb.max[outer] - s;
+		for (int t = 0; t <= rb.max[middle] - rb.min[middle]; ++t) {
+			c[middle] = forward ? rb.min[middle] + t : rb.max[middle] - t;
+
+			int lo, hi;
+			if (!regionRowSpan(inner, c, lo, hi)) continue;
+
+			inside += std::size_t(hi - lo + 1);
+			if (inner == 0) {
+				mask.for_each_in_row(c[1], c[2], lo, hi, forward, [&](int x) {
+					if (masked && !inMaskedRegion(x, c[1], c[2])) return;
+					if (hidden && !gLabelLUT.visible(gVolume->label(x, c[1], c[2]))) return;
+
+					++visited;
+					func(x, c[1], c[2]);
+				});
+			} else {
+				for (int u = 0; u <= hi - lo; ++u) {
+					c[inner] = forward ? lo + u : hi - u;
+					if (!mask.test(c[0], c[1], c[2])) continue;
+					if (masked && !inMaskedRegion(c[0], c[1], c[2])) continue;
+					if (hidden && !gLabelLUT.visible(gVolume->label(c[0], c[1], c[2]))) continue;
+
+					++visited;
+					func(c[0], c[1], c[2]);
+				}
 			}
-		} break;
-		default:
-			break;
 		}
-	} else {
-		performTransfer(axis, i, j, k);
 	}
+
+	PROFILE_COUNT(EProfileCounter::voxelsScanned, visited);
+	PROFILE_COUNT(EProfileCounter::voxelsSkippedEmpty, inside - visited);
+	PROFILE_COUNT(EProfileCounter::voxelsRejectedByRegion, gVolume->total_element_count() - inside);
 }
 
-void performTransferWithTrilinearInterpolation(AXIS axis, int i, int j, int k, int p, int q, int r,
-	Vec3Df lightdir, bool checkTrilinearInterpolation) {
-	float XT;
-	float YT;
-	float ZT;
-
-	int x, y, z;
-
-	if (axis == AXIS::X) {
-		XT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		x = k;
-		y = j;
-		z = i;
-	} else if (axis == AXIS::Y) {
-		XT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		x = i;
-		y = k;
-		z = j;
-	} else {
-		XT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		x = j;
-		y = i;
-		z = k;
-	}
+// traverseRegionBatched() is traverseRegion(), but hands the voxels to func(points, count) kPointLanes at a time (the
+// last batch may be smaller), in the order of the traversal. This lets the lit modes light a whole batch at once. The
+// batch is scratch memory of the frame (from gFrameArena).
+template<typename tFunc>
+void traverseRegionBatched(OccupancyMask const& mask, AXIS axis, DIRECTION dir, tFunc&& func) {
+	// PackedPoint stores the grid coordinates as 16-bit integers.
+	assert(gVolumeLargestDimension <= 32767);
+
+	PackedPoint* const batch = gFrameArena.allocate<PackedPoint>(kPointLanes);
+	std::fill(batch, batch + kPointLanes, PackedPoint());
+	std::size_t pending = 0;
+	traverseRegion(mask, axis, dir, [&](int x, int y, int z) {
+		PackedPoint& point = batch[pending];
+		point.x = std::int16_t(x);
+		point.y = std::int16_t(y);
+		point.z = std::int16_t(z);
+		if (++pending == kPointLanes) {
+			func(batch, pending);
+			pending = 0;
+		}
+	});
+	if (pending) func(batch, pending);
+}
 
-	// Don't do anything if the coords are outside the ESelectiveRegionType::{shape}
-	if (!checkIntersection(XT, YT, ZT)) return;
+void performTransfer(int x, int y, int z) {
+	// Note: the traversal (see traverseRegion()) only visits voxels inside the ESelectiveRegionType::{shape}.
+	float const XT = 2.f*float(x) / gVolumeLargestDimension - 1.f;
+	float const YT = 2.f*float(y) / gVolumeLargestDimension - 1.f;
+	float const ZT = 2.f*float(z) / gVolumeLargestDimension - 1.f;
 
-	float density = gVolume(x, y, z);
+	float density = (*gVolume)(x, y, z);
 
-	if (k != 0 && j != 0 && i != 0 && k != p - 1 && j != q - 1 && i != r - 1) {
+	std::vector<TransferSurface> const& surfaces = transferSurfaces(ETransferFunction::colorAlpha, global_ttype);
+	TransferSurface const* surface = classifyDensity(surfaces, density);
+	if (!surface) return;
 
-		float p000 = gVolume(x - 1, y - 1, z - 1);
-		float p100 = gVolume(x + 1, y - 1, z - 1);
-		float p110 = gVolume(x + 1, y + 1, z - 1);
-		float p010 = gVolume(x - 1, y + 1, z - 1);
+	// points with low density have a low alpha and vice versa
+	float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
 
-		float p001 = gVolume(x - 1, y - 1, z + 1);
-		float p101 = gVolume(x + 1, y - 1, z + 1);
-		float p111 = gVolume(x + 1, y + 1, z + 1);
-		float p011 = gVolume(x - 1, y + 1, z + 1);
+	emitPoint(XT, YT, ZT, surface->color * density, alpha);
+}
 
-		float trilin = triLinearInterpolation(x, y, z, p000, p001, p010, p011, p100, p101,
-			p110, p111, x - 1, x + 1, y - 1, y + 1, z - 1, z + 1);
+// performTransferWithLighting() draws the points of the voxels aPoints[0..aCount) (at most kPointLanes), in order. The
+// voxels on the border of the volume have no gradient; they are drawn unlit by performTransfer().
+void performTransferWithLighting(PackedPoint const* aPoints, std::size_t aCount, Vec3Df lightdir) {
+	std::vector<TransferSurface> const& surfaces = transferSurfaces(ETransferFunction::lit, global_ttype);
+	Packf const dot = litDots(aPoints, aCount, lightdir);
+
+	for (std::size_t i = 0; i < aCount; ++i) {
+		// Note: the traversal (see traverseRegion()) only visits voxels inside the ESelectiveRegionType::{shape}.
+		int const x = aPoints[i].x, y = aPoints[i].y, z = aPoints[i].z;
+		if (!isInterior(x, y, z)) {
+			performTransfer(x, y, z);
+			continue;
+		}
 
+		float density = (*gVolume)(x, y, z);
 
-		// partial derivative
-		float partDerX = (gVolume(x + 1, y, z) - gVolume(x - 1, y, z)) / 2.0f;
-		float partDerY = (gVolume(x, y + 1, z) - gVolume(x, y - 1, z)) / 2.0f;
-		float partDerZ = (gVolume(x, y, z + 1) - gVolume(x, y, z - 1)) / 2.0f;
+		TransferSurface const* surface = classifyDensity(surfaces, density);
+		if (!surface) continue;
 
-		Vec3Df normal = Vec3Df(-partDerX, -partDerY, -partDerZ);
-		normal.normalize();
+		// points with low density have a low alpha and vice versa
+		float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
+
+		emitPoint(2.f*float(x) / gVolumeLargestDimension - 1.f, 2.f*float(y) / gVolumeLargestDimension - 1.f,
+			2.f*float(z) / gVolumeLargestDimension - 1.f, surface->color * (density * dot[i]), alpha);
+	}
+}
 
-		float dot = Vec3Df::dotProduct(normal, lightdir);
+// performTransferWithTrilinearInterpolation() is performTransferWithLighting(), but when the camera is close to the
+// volume (checkTrilinearInterpolation), each interior voxel also gets a point for the iso-surface of its interpolated
+// density.
+void performTransferWithTrilinearInterpolation(PackedPoint const* aPoints, std::size_t aCount,
+	Vec3Df lightdir, bool checkTrilinearInterpolation) {
+	std::vector<TransferSurface> const& surfaces = transferSurfaces(ETransferFunction::litTrilinear, global_ttype);
+	VolumeSampler const sampler(*gVolume);
+	Packf const dot = litDots(aPoints, aCount, lightdir);
+
+	for (std::size_t i = 0; i < aCount; ++i) {
+		// Note: the traversal (see traverseRegion()) only visits voxels inside the ESelectiveRegionType::{shape}.
+		int const x = aPoints[i].x, y = aPoints[i].y, z = aPoints[i].z;
+		if (!isInterior(x, y, z)) {
+			performTransfer(x, y, z);
+			continue;
+		}
 
-		// BONSAI:
-		// trunk:
-		IsoSurface trunk = IsoSurface(0.5f, 0.9f);
-		//IsoSurface trunk = IsoSurface(0.2f, 0.6f);
-		//IsoSurface trunk = IsoSurface(FLT_MAX, FLT_MIN); // ignores trunk when this line is uncommented
+		float const XT = 2.f*float(x) / gVolumeLargestDimension - 1.f;
+		float const YT = 2.f*float(y) / gVolumeLargestDimension - 1.f;
+		float const ZT = 2.f*float(z) / gVolumeLargestDimension - 1.f;
 
-		// leaves:
-		IsoSurface leaves = IsoSurface(0.13f, 0.2f);
-		//IsoSurface leaves = IsoSurface(FLT_MAX, FLT_MIN); // ignores leaves when this line is uncommented
+		float density = (*gVolume)(x, y, z);
 
-		//// BACKPACK:
-		IsoSurface lightgrey = IsoSurface(0.25f, 0.3f);
-		//IsoSurface lightgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface darkgrey = IsoSurface(0.18f, 0.25);
-		//IsoSurface darkgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface red = IsoSurface(0.9f, 1.0f);
-		//IsoSurface red = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface lightblue = IsoSurface(0.61f, 0.9f);
-		//IsoSurface lightblue = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface yellow = IsoSurface(0.4f, 0.55f);
-		//IsoSurface yellow = IsoSurface(FLT_MAX, FLT_MIN);
+		// A point for the iso-surface of the density, and one for the iso-surface of the interpolated density at the
+		// voxel, from its eight diagonal neighbours. Both are shaded with the density.
+		TransferSurface const* const classified[2] = {
+			classifyDensity(surfaces, density),
+			checkTrilinearInterpolation ? classifyDensity(surfaces, sampler.sample_centered(x, y, z, 1)) : nullptr
+		};
 
 		// points with low density have a low alpha and vice versa
 		float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
 
-		Vec3Df c = Vec3Df();
-		switch (global_ttype) {
-		case TRANSFERTYPE::BONSAI:
-			if (trunk.hasBetween(density)) {
-				c = Vec3Df(.33f, .21f, .1f); // brown
-				c *= density * dot;
-
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (leaves.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 0.0f); // green
-				c *= density * dot;
-
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			}
-			if (checkTrilinearInterpolation) {
-				if (trunk.hasBetween(trilin)) {
-					c = Vec3Df(.33f, .21f, .1f); // brown
-					c *= density * dot;
-
-					glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-					glVertex3f(XT, YT, ZT);
-				} else if (leaves.hasBetween(trilin)) {
-					c = Vec3Df(0.0f, 1.0f, 0.0f); // green
-					c *= density * dot;
-
-					glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-					glVertex3f(XT, YT, ZT);
-				}
-			}
-			break;
-		case TRANSFERTYPE::BACKPACK: {
-			if (lightgrey.hasBetween(density)) {
-				c = Vec3Df(0.85f, 0.85f, 0.85f); // lightgrey
-				c *= density * dot;
-
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (darkgrey.hasBetween(density)) {
-				c = Vec3Df(0.66f, 0.66f, 0.66f); // darkgrey
-				c *= density * dot;
-
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (red.hasBetween(density)) {
-				c = Vec3Df(1.0f, 0.0f, 0.0f); // red
-				c *= density * dot;
-
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (lightblue.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 1.0f); // lightblue
-				c *= density * dot;
-
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
-			} else if (yellow.hasBetween(density)) {
-				c = Vec3Df(1.0f, 1.0f, 0.0f); // yellow
-				c *= density * dot;
-
-				glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-				glVertex3f(XT, YT, ZT);
+		for (TransferSurface const* surface : classified) {
+			if (!surface) continue;
+
+			emitPoint(XT, YT, ZT, surface->color * (density * dot[i]), alpha);
+		}
+	}
+}
+
+// performTransferWithBillboards() is performTransferWithTrilinearInterpolation() with billboards instead of points. The
+// billboards of the voxels on the border of the volume are unlit.
+void performTransferWithBillboards(PackedPoint const* aPoints, std::size_t aCount,
+	Vec3Df lightdir, bool checkTrilinearInterpolation, Vec3Df right, Vec3Df up, float size) {
+	std::vector<TransferSurface> const& surfaces = transferSurfaces(ETransferFunction::litTrilinear, global_ttype);
+	VolumeSampler const sampler(*gVolume);
+	Packf const dot = litDots(aPoints, aCount, lightdir);
+
+	for (std::size_t i = 0; i < aCount; ++i) {
+		// Note: the traversal (see traverseRegion()) only visits voxels inside the ESelectiveRegionType::{shape}.
+		int const x = aPoints[i].x, y = aPoints[i].y, z = aPoints[i].z;
+		float const XT = 2.f*float(x) / gVolumeLargestDimension - 1.f;
+		float const YT = 2.f*float(y) / gVolumeLargestDimension - 1.f;
+		float const ZT = 2.f*float(z) / gVolumeLargestDimension - 1.f;
+
+		float density = (*gVolume)(x, y, z);
+
+		Vec3Df center = Vec3Df(XT, YT, ZT);
+
+		// points with low density have a low alpha and vice versa
+		float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
+
+		if (isInterior(x, y, z)) {
+			TransferSurface const* const classified[2] = {
+				classifyDensity(surfaces, density),
+				checkTrilinearInterpolation ? classifyDensity(surfaces, sampler.sample_centered(x, y, z, 1)) : nullptr
+			};
+			for (TransferSurface const* surface : classified) {
+				if (surface) billboard(right, up, center, surface->color * (density * dot[i]), alpha, size);
 			}
-			if (checkTrilinearInterpolation) {
-				if (lightgrey.hasBetween(trilin)) {
-					c = Vec3Df(0.85f, 0.85f, 0.85f); // lightgrey
-					c *= density * dot;
-
-					glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-					glVertex3f(XT, YT, ZT);
-				} else if (darkgrey.hasBetween(trilin)) {
-					c = Vec3Df(0.66f, 0.66f, 0.66f); // darkgrey
-					c *= density * dot;
-
-					glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-					glVertex3f(XT, YT, ZT);
-				} else if (red.hasBetween(trilin)) {
-					c = Vec3Df(1.0f, 0.0f, 0.0f); // red
-					c *= density * dot;
-
-					glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-					glVertex3f(XT, YT, ZT);
-				} else if (lightblue.hasBetween(trilin)) {
-					c = Vec3Df(0.0f, 1.0f, 1.0f); // lightblue
-					c *= density * dot;
-
-					glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-					glVertex3f(XT, YT, ZT);
-				} else if (yellow.hasBetween(trilin)) {
-					c = Vec3Df(1.0f, 1.0f, 0.0f); // yellow
-					c *= density * dot;
-
-					glColor4f(c.p[0], c.p[1], c.p[2], alpha);
-					glVertex3f(XT, YT, ZT);
-				}
+		} else if (TransferSurface const* surface = classifyDensity(surfaces, density)) {
+			billboard(right, up, center, surface->color * density, alpha, size);
+		}
+	}
+}
+
+// converts a color component to 8 bits (OpenGL clamps float colors to [0,1] as well).
+inline std::uint8_t toUnorm8(float value) {
+	return std::uint8_t(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+// litPointBaseColor() classifies a density for the array modes: if the density is part of one of the iso-surfaces, it
+// sets c to the (unlit) color of that iso-surface and returns true; otherwise it returns false.
+bool litPointBaseColor(float density, Vec3Df& c) {
+	TransferSurface const* surface = classifyDensity(transferSurfaces(ETransferFunction::lit, global_ttype), density);
+	if (!surface) return false;
+
+	c = surface->color;
+	return true;
+}
+
+// litPointColors() computes the lit colors of the points that the array modes draw for the voxels aPoints[0..aCount)
+// (at most kPointLanes), given by their grid coordinates. The gradients, normals, dot products and shaded colors are
+// computed for all points at once (see Vec3DPack); only the classification and the alpha are computed per point.
+// Returns a bit mask with bit i set if aPoints[i] produces a point, i.e., if it isn't on the border of the volume and
+// is part of one of the iso-surfaces; its color is then stored in aColors[i]. Note that whether a point is produced
+// only depends on the density, so changing the light only changes the colors of the points, never the set of points.
+// The same holds for the classification by label: it replaces the color of labeled points by the one of their label,
+// and gives hidden points alpha 0.
+unsigned litPointColors(PackedPoint const* aPoints, std::size_t aCount, Vec3Df const& lightdir,
+	std::uint8_t aColors[][4]) {
+	assert(aCount <= kPointLanes);
+
+	Packf const dot = litDots(aPoints, aCount, lightdir);
+
+	bool const byLabel = classifyByLabel();
+
+	unsigned produced = 0;
+	Packf density;
+	Vec3DfPack c;
+	for (std::size_t i = 0; i < aCount; ++i) {
+		PackedPoint const& point = aPoints[i];
+		if (!isInterior(point.x, point.y, point.z)) continue;
+
+		density[i] = (*gVolume)(point.x, point.y, point.z);
+
+		Vec3Df base;
+		if (!litPointBaseColor(density[i], base)) continue;
+
+		if (byLabel && point.label) {
+			std::uint8_t const* rgb = gLabelLUT.color(point.label);
+			base = Vec3Df(rgb[0] / 255.f, rgb[1] / 255.f, rgb[2] / 255.f);
+		}
+
+		c.set(i, base);
+		produced |= 1u << i;
+	}
+
+	c *= density * dot;
+
+	for (std::size_t i = 0; i < aCount; ++i) {
+		if (!(produced & (1u << i))) continue;
+
+		// points with low density have a low alpha and vice versa
+		float alpha = 1.0f / (1.0f + std::pow(density[i] / (1.0f - density[i]), -1.5f));
+		if (byLabel && !gLabelLUT.visible(aPoints[i].label)) alpha = 0.f;
+
+		aColors[i][0] = toUnorm8(c.x[i]);
+		aColors[i][1] = toUnorm8(c.y[i]);
+		aColors[i][2] = toUnorm8(c.z[i]);
+		aColors[i][3] = toUnorm8(alpha);
+	}
+
+	return produced;
+}
+
+// buildPointArrays() rebuilds the point arrays for the array modes from scratch. The points are generated back to
+// front along the dominant axis; the points of kSlicesPerBrick consecutive slices form a brick (see PointBrick).
+void buildPointArrays(AXIS axis, DIRECTION dir, Vec3Df lightdir) {
+	// PackedPoint stores the grid coordinates as 16-bit integers.
+	assert(gVolumeLargestDimension <= 32767);
+
+	gDrawPoints.clear();
+	gDrawBricks.clear();
+
+	int const outer = axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2;
+	int lastBrick = -1;
+
+	OccupancyMask const& mask = occupancyFor(ETransferFunction::lit);
+	gDrawPoints.reserve(mask.count());
+
+	// The candidate voxels are collected and lit kPointLanes at a time (see litPointColors()).
+	PackedPoint batch[kPointLanes] = {};
+	std::size_t pending = 0;
+	auto flush = [&] {
+		if (0 == pending) return;
+
+		std::uint8_t colors[kPointLanes][4];
+		unsigned const produced = litPointColors(batch, pending, lightdir, colors);
+		for (std::size_t i = 0; i < pending; ++i) {
+			if (!(produced & (1u << i))) continue;
+
+			std::copy(colors[i], colors[i] + 4, batch[i].color);
+			gDrawPoints.push_back(batch[i]);
+		}
+		pending = 0;
+	};
+
+	bool const labels = gVolume->has_labels();
+
+	// Hidden labels stay in the point set (see litPointColors()).
+	traverseRegion(mask, axis, dir, [&](int x, int y, int z) {
+		int const c[3] = { x, y, z };
+		int const brick = c[outer] / kSlicesPerBrick;
+		if (brick != lastBrick) {
+			flush();
+			if (!gDrawBricks.empty()) gDrawBricks.back().count = gDrawPoints.size() - gDrawBricks.back().first;
+			gDrawBricks.push_back(PointBrick{ gDrawPoints.size(), 0, true });
+			lastBrick = brick;
+		}
+
+		PackedPoint& point = batch[pending];
+		point.x = std::int16_t(x);
+		point.y = std::int16_t(y);
+		point.z = std::int16_t(z);
+		point.label = labels ? gVolume->label(x, y, z) : 0;
+		if (++pending == kPointLanes) flush();
+	}, false);
+	flush();
+
+	if (!gDrawBricks.empty()) gDrawBricks.back().count = gDrawPoints.size() - gDrawBricks.back().first;
+
+	gDrawRegionVersion = gRegionVersion;
+	gDrawLabelVersion = gLabelLUT.version();
+	gDrawClassifyByLabel = gClassifyByLabel;
+	gDrawArraysDirty = false;
+	gVBOValid = false;
+}
+
+// recolorPointArrays() updates the colors of the existing points after the light or the label classification has
+// changed. Only bricks in which at least one color actually changed are marked as dirty. Returns the number of dirty
+// bricks.
+std::size_t recolorPointArrays(Vec3Df lightdir) {
+	gDrawLabelVersion = gLabelLUT.version();
+	gDrawClassifyByLabel = gClassifyByLabel;
+
+	std::size_t dirtyBricks = 0;
+	for (auto& brick : gDrawBricks) {
+		std::size_t const end = brick.first + brick.count;
+		for (std::size_t n = brick.first; n < end; n += kPointLanes) {
+			std::size_t const count = std::min(kPointLanes, end - n);
+
+			std::uint8_t colors[kPointLanes][4];
+			litPointColors(&gDrawPoints[n], count, lightdir, colors);
+
+			for (std::size_t i = 0; i < count; ++i) {
+				std::uint8_t* dst = gDrawPoints[n + i].color;
+				if (std::equal(colors[i], colors[i] + 4, dst)) continue;
+
+				std::copy(colors[i], colors[i] + 4, dst);
+				brick.dirty = true;
 			}
-		} break;
-		default:
-			break;
 		}
-	} else {
-		performTransfer(axis, i, j, k);
+
+		if (brick.dirty) ++dirtyBricks;
+	}
+
+	return dirtyBricks;
+}
+
+// syncPointVBOs() makes sure that the VBO holds the current point array. The VBO is persistent: it is only
+// (re-)allocated when it is too small, and is orphaned when the point set was rebuilt. Otherwise, only the points of
+// dirty bricks are re-uploaded with glBufferSubData(), and adjacent dirty bricks are merged into a single upload.
+void syncPointVBOs() {
+	std::size_t const pointCount = gDrawPoints.size();
+
+	if (!gVBOValid) {
+		PROFILE_SCOPE("upload all");
+
+		// Orphan the old storage; grow with some headroom so that small changes in the point count don't reallocate.
+		if (pointCount > gVBOCapacity || 0 == gVBOCapacity) {
+			gVBOCapacity = std::max<std::size_t>(pointCount + pointCount / 4, 1);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, gPointVBO);
+		glBufferData(GL_ARRAY_BUFFER, gVBOCapacity * sizeof(PackedPoint), nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, pointCount * sizeof(PackedPoint), gDrawPoints.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		PROFILE_COUNT(EProfileCounter::bytesUploaded, pointCount * sizeof(PackedPoint));
+
+		for (auto& brick : gDrawBricks) brick.dirty = false;
+		gVBOValid = true;
+		return;
+	}
+
+	PROFILE_SCOPE("upload dirty bricks");
+	glBindBuffer(GL_ARRAY_BUFFER, gPointVBO);
+	for (std::size_t b = 0; b < gDrawBricks.size(); ) {
+		if (!gDrawBricks[b].dirty) {
+			++b;
+			continue;
+		}
+
+		std::size_t const first = gDrawBricks[b].first;
+		std::size_t count = 0;
+		for (; b < gDrawBricks.size() && gDrawBricks[b].dirty; ++b) {
+			count += gDrawBricks[b].count;
+			gDrawBricks[b].dirty = false;
+		}
+
+		if (0 == count) continue;
+
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(PackedPoint), count * sizeof(PackedPoint), gDrawPoints.data() + first);
+		PROFILE_COUNT(EProfileCounter::bytesUploaded, count * sizeof(PackedPoint));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// drawPointArrays() draws the point array, either from the CPU-side array or from the VBO. The grid coordinates of
+// the points are mapped to [-1,1] by the modelview matrix.
+void drawPointArrays(bool fromVRAM) {
+	// With a VBO bound, the "pointers" are offsets into the buffer.
+	std::uintptr_t const base = fromVRAM ? 0 : reinterpret_cast<std::uintptr_t>(gDrawPoints.data());
+	if (fromVRAM) glBindBuffer(GL_ARRAY_BUFFER, gPointVBO);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(3, GL_SHORT, sizeof(PackedPoint), reinterpret_cast<void const*>(base + offsetof(PackedPoint, x)));
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(PackedPoint), reinterpret_cast<void const*>(base + offsetof(PackedPoint, color)));
+
+	if (fromVRAM) glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	float const scale = 2.f / gVolumeLargestDimension;
+	glPushMatrix();
+	glTranslatef(-1.f, -1.f, -1.f);
+	glScalef(scale, scale, scale);
+
+	// Points of hidden labels have alpha 0 (see litPointColors()); they must not write depth either.
+	bool const byLabel = classifyByLabel();
+	if (byLabel) {
+		glEnable(GL_ALPHA_TEST);
+		glAlphaFunc(GL_GREATER, 0.f);
+	}
+
+	PROFILE_COUNT(EProfileCounter::pointsEmitted, gDrawPoints.size());
+	glDrawArrays(GL_POINTS, 0, GLsizei(gDrawPoints.size()));
+
+	if (byLabel) glDisable(GL_ALPHA_TEST);
+	glPopMatrix();
+
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// compositePointArrays() draws the point arrays with the current compositing method: back-to-front alpha blending,
+// or order-independent transparency if gUseOIT is set.
+void compositePointArrays(bool fromVRAM) {
+	if (gUseOIT) {
+		PROFILE_SCOPE("oit");
+		if (gOIT.render([&] { drawPointArrays(fromVRAM); })) return;
+
+		// Not supported; points are in the wrong order for sorted blending this frame, but will be rebuilt next frame.
+		gUseOIT = false;
+	}
+
+	drawPointArrays(fromVRAM);
+}
+
+// updatePointArrays() brings the point arrays up to date for the array modes. The arrays are rebuilt completely
+// when the point set changes (new volume, new direction); a change of the light or of the label classification only
+// recolors the existing points.
+void updatePointArrays(AXIS axis, DIRECTION dir) {
+	// With order-independent compositing, the order of the points doesn't matter, so we always use the same one and
+	// no longer rebuild when the viewing direction changes.
+	if (gUseOIT) {
+		axis = AXIS::Z;
+		dir = DIRECTION::POS;
+	}
+
+	if (gDrawArraysDirty || axis != current_axis || dir != current_dir || gDrawRegionVersion != gRegionVersion) {
+		PROFILE_SCOPE("rebuild arrays");
+		PROFILE_COUNT(EProfileCounter::rebuildTriggers, 1);
+		current_axis = axis;
+		current_dir = dir;
+		gLightChanged = false;
+		buildPointArrays(axis, dir, gLightPosition);
+	} else if (gLightChanged || gDrawLabelVersion != gLabelLUT.version() || gDrawClassifyByLabel != gClassifyByLabel) {
+		PROFILE_SCOPE("recolor arrays");
+		gLightChanged = false;
+		recolorPointArrays(gLightPosition);
+	}
+}
+
+// printVolumeStatistics() prints a summary of the density statistics that were computed when the volume was loaded
+// (see VolumeStatistics): the percentiles give a data-driven starting point for the windows of the transfer
+// functions, and the joint histogram the densities at which the gradient (i.e., a material boundary) peaks.
+void printVolumeStatistics(Volume const& aVolume) {
+	if (!aVolume.has_statistics()) {
+		std::printf("No statistics for the current volume\n");
+		return;
+	}
+
+	VolumeStatistics const& stats = aVolume.statistics();
+	std::printf("Volume %zux%zux%zu: %llu voxels, mean %.3f, sd %.3f, max |gradient| %.3f\n", aVolume.width(),
+		aVolume.height(), aVolume.depth(), (unsigned long long)stats.count(), stats.mean(), stats.standard_deviation(),
+		stats.max_gradient_magnitude());
+	std::printf("  percentiles: 1%% %.3f, 5%% %.3f, 25%% %.3f, 50%% %.3f, 75%% %.3f, 95%% %.3f, 99%% %.3f\n",
+		stats.percentile(0.01f), stats.percentile(0.05f), stats.percentile(0.25f), stats.percentile(0.5f),
+		stats.percentile(0.75f), stats.percentile(0.95f), stats.percentile(0.99f));
+
+	// Mean gradient magnitude per density bin of the joint histogram; report the densities where it is largest.
+	std::size_t const bins = VolumeStatistics::kJointBins;
+	std::vector<float> meanGradient(bins, 0.f);
+	for (std::size_t d = 0; d < bins; ++d) {
+		double sum = 0.0, count = 0.0;
+		for (std::size_t g = 0; g < bins; ++g) {
+			double const n = stats.joint_histogram()[d * bins + g];
+			sum += n * (g + 0.5) * VolumeStatistics::kMaxGradientMagnitude / bins;
+			count += n;
+		}
+		meanGradient[d] = count > 0.0 ? float(sum / count) : 0.f;
+	}
+
+	std::vector<std::size_t> order(bins);
+	for (std::size_t i = 0; i < bins; ++i) order[i] = i;
+	std::partial_sort(order.begin(), order.begin() + 3, order.end(), [&](std::size_t a, std::size_t b) {
+		return meanGradient[a] > meanGradient[b];
+	});
+	std::printf("  boundaries (largest mean |gradient|): %.3f, %.3f, %.3f\n",
+		VolumeStatistics::bin_density(order[0], bins), VolumeStatistics::bin_density(order[1], bins),
+		VolumeStatistics::bin_density(order[2], bins));
+
+	// Share of the voxels that the iso-surfaces of the lit modes select.
+	for (auto const& entry : transferSurfaces(ETransferFunction::lit, global_ttype)) {
+		IsoSurface const& surface = entry.surface;
+		std::printf("  iso-surface [%.3f, %.3f]: %.2f%% of the voxels\n", surface.getLow(), surface.getHigh(),
+			100.0 * stats.count_between(surface.getLow(), surface.getHigh()) / std::max<std::uint64_t>(stats.count(), 1));
 	}
 }
 
-void performTransferWithBillboards(AXIS axis, int i, int j, int k, int p, int q, int r,
-	Vec3Df lightdir, bool checkTrilinearInterpolation, Vec3Df right, Vec3Df up, float size) {
-	float XT;
-	float YT;
-	float ZT;
-
-	int x, y, z;
-
-	if (axis == AXIS::X) {
-		XT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		x = k;
-		y = j;
-		z = i;
-	} else if (axis == AXIS::Y) {
-		XT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		x = i;
-		y = k;
-		z = j;
-	} else {
-		XT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		x = j;
-		y = i;
-		z = k;
-	}
-
-	// Don't do anything if the coords are outside the ESelectiveRegionType::{shape}
-	if (!checkIntersection(XT, YT, ZT)) return;
-
-	float density = gVolume(x, y, z);
-
-	// BONSAI:
-	// trunk:
-	IsoSurface trunk = IsoSurface(0.5f, 0.9f);
-	//IsoSurface trunk = IsoSurface(0.2f, 0.6f);
-	//IsoSurface trunk = IsoSurface(FLT_MAX, FLT_MIN); // ignores trunk when this line is uncommented
-
-	// leaves:
-	IsoSurface leaves = IsoSurface(0.13f, 0.2f);
-	//IsoSurface leaves = IsoSurface(FLT_MAX, FLT_MIN); // ignores leaves when this line is uncommented
-
-	//// BACKPACK:
-	IsoSurface lightgrey = IsoSurface(0.25f, 0.3f);
-	//IsoSurface lightgrey = IsoSurface(FLT_MAX, FLT_MIN);
-	IsoSurface darkgrey = IsoSurface(0.18f, 0.25);
-	//IsoSurface darkgrey = IsoSurface(FLT_MAX, FLT_MIN);
-	IsoSurface red = IsoSurface(0.9f, 1.0f);
-	//IsoSurface red = IsoSurface(FLT_MAX, FLT_MIN);
-	IsoSurface lightblue = IsoSurface(0.61f, 0.9f);
-	//IsoSurface lightblue = IsoSurface(FLT_MAX, FLT_MIN);
-	IsoSurface yellow = IsoSurface(0.4f, 0.55f);
-	//IsoSurface yellow = IsoSurface(FLT_MAX, FLT_MIN);
-
-	Vec3Df center = Vec3Df(XT, YT, ZT);
-
-	if (k != 0 && j != 0 && i != 0 && k != p - 1 && j != q - 1 && i != r - 1) {
-		float p000 = gVolume(x - 1, y - 1, z - 1);
-		float p100 = gVolume(x + 1, y - 1, z - 1);
-		float p110 = gVolume(x + 1, y + 1, z - 1);
-		float p010 = gVolume(x - 1, y + 1, z - 1);
-
-		float p001 = gVolume(x - 1, y - 1, z + 1);
-		float p101 = gVolume(x + 1, y - 1, z + 1);
-		float p111 = gVolume(x + 1, y + 1, z + 1);
-		float p011 = gVolume(x - 1, y + 1, z + 1);
-
-		float trilin = triLinearInterpolation(x, y, z, p000, p001, p010, p011, p100, p101,
-			p110, p111, x - 1, x + 1, y - 1, y + 1, z - 1, z + 1);
-
-		// partial derivative
-		float partDerX = (gVolume(x + 1, y, z) - gVolume(x - 1, y, z)) / 2.0f;
-		float partDerY = (gVolume(x, y + 1, z) - gVolume(x, y - 1, z)) / 2.0f;
-		float partDerZ = (gVolume(x, y, z + 1) - gVolume(x, y, z - 1)) / 2.0f;
-
-		Vec3Df normal = Vec3Df(-partDerX, -partDerY, -partDerZ);
-		normal.normalize();
-
-		float dot = Vec3Df::dotProduct(normal, lightdir);
+// printSparseStatistics() reports how much of the current volume gSparseVolume marks as active: for mostly-empty
+// datasets, only the leaves around the material are stored.
+void printSparseStatistics() {
+	auto const start = std::chrono::steady_clock::now();
+	SparseVolume const& sparse = sparseVolume();
+	double const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::size_t const voxels = gVolume->width() * gVolume->height() * gVolume->depth();
+	std::size_t const denseBytes = voxels * sizeof(float);
+	std::printf("Sparse volume (threshold %.3f): %zu leaves, %zu active voxels (%.2f%%), %.1f MiB vs %.1f MiB dense, "
+		"built in %.1f ms\n", sparse.threshold(), sparse.leaf_count(), sparse.active_count(),
+		100.0 * sparse.active_count() / std::max<std::size_t>(voxels, 1), sparse.memory_bytes() / 1048576.0,
+		denseBytes / 1048576.0, ms);
+}
 
-		// points with low density have a low alpha and vice versa
-		float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
+// defaultIsoValue() returns the isovalue of the mesh for the current dataset: the lowest density that the lit modes
+// show, so that the mesh encloses all of their iso-surfaces.
+float defaultIsoValue() {
+	float iso = 1.f;
+	for (auto const& surface : transferSurfaces(ETransferFunction::lit, global_ttype)) {
+		iso = std::min(iso, surface.surface.getLow());
+	}
+	return iso;
+}
 
-		Vec3Df c = Vec3Df();
-		switch (global_ttype) {
-		case TRANSFERTYPE::BONSAI:
-			if (trunk.hasBetween(density)) {
-				c = Vec3Df(.33f, .21f, .1f); // brown
-				c *= density * dot;
+// updateIsosurfaceMesh() brings the mesh up to date with the isovalue and the volume. A different volume requires a
+// full extraction; a different isovalue only re-extracts the affected bricks.
+void updateIsosurfaceMesh() {
+	if (gMeshIsoValue < 0.f) gMeshIsoValue = defaultIsoValue();
 
-				billboard(right, up, center, c, alpha, size);
-			} else if (leaves.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 0.0f); // green
-				c *= density * dot;
+	if (!gMeshValid || gMeshVolumeVersion != gVolumeVersion) {
+		PROFILE_SCOPE("brick ranges");
+		gMeshBricks.reset(*gVolume);
+		gMeshVolumeVersion = gVolumeVersion;
+		gMeshValid = true;
+	}
 
-				billboard(right, up, center, c, alpha, size);
-			}
-			if (checkTrilinearInterpolation) {
-				if (trunk.hasBetween(trilin)) {
-					c = Vec3Df(.33f, .21f, .1f); // brown
-					c *= density * dot;
+	PROFILE_SCOPE("extract isosurface");
+	std::size_t const bricks = gMeshBricks.update(*gVolume, gMeshIsoValue);
+	if (0 == bricks) return;
 
-					billboard(right, up, center, c, alpha, size);
-				} else if (leaves.hasBetween(trilin)) {
-					c = Vec3Df(0.0f, 1.0f, 0.0f); // green
-					c *= density * dot;
+	PROFILE_COUNT(EProfileCounter::rebuildTriggers, 1);
+	std::printf("Isosurface %.3f: re-extracted %zu of %zu bricks; %zu vertices, %zu triangles\n", gMeshIsoValue,
+		bricks, gMeshBricks.chunks().size(), gMeshBricks.vertex_count(), gMeshBricks.triangle_count());
+}
 
-					billboard(right, up, center, c, alpha, size);
-				}
-			}
-			break;
-		case TRANSFERTYPE::BACKPACK: {
-			if (lightgrey.hasBetween(density)) {
-				c = Vec3Df(0.85f, 0.85f, 0.85f); // lightgrey
-				c *= density * dot;
-
-				billboard(right, up, center, c, alpha, size);
-			} else if (darkgrey.hasBetween(density)) {
-				c = Vec3Df(0.66f, 0.66f, 0.66f); // darkgrey
-				c *= density * dot;
-
-				billboard(right, up, center, c, alpha, size);
-			} else if (red.hasBetween(density)) {
-				c = Vec3Df(1.0f, 0.0f, 0.0f); // red
-				c *= density * dot;
-
-				billboard(right, up, center, c, alpha, size);
-			} else if (lightblue.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 1.0f); // lightblue
-				c *= density * dot;
-
-				billboard(right, up, center, c, alpha, size);
-			} else if (yellow.hasBetween(density)) {
-				c = Vec3Df(1.0f, 1.0f, 0.0f); // yellow
-				c *= density * dot;
-
-				billboard(right, up, center, c, alpha, size);
-			}
-			if (checkTrilinearInterpolation) {
-				if (lightgrey.hasBetween(trilin)) {
-					c = Vec3Df(0.85f, 0.85f, 0.85f); // lightgrey
-					c *= density * dot;
-
-					billboard(right, up, center, c, alpha, size);
-				} else if (darkgrey.hasBetween(trilin)) {
-					c = Vec3Df(0.66f, 0.66f, 0.66f); // darkgrey
-					c *= density * dot;
-
-					billboard(right, up, center, c, alpha, size);
-				} else if (red.hasBetween(trilin)) {
-					c = Vec3Df(1.0f, 0.0f, 0.0f); // red
-					c *= density * dot;
-
-					billboard(right, up, center, c, alpha, size);
-				} else if (lightblue.hasBetween(trilin)) {
-					c = Vec3Df(0.0f, 1.0f, 1.0f); // lightblue
-					c *= density * dot;
-
-					billboard(right, up, center, c, alpha, size);
-				} else if (yellow.hasBetween(trilin)) {
-					c = Vec3Df(1.0f, 1.0f, 0.0f); // yellow
-					c *= density * dot;
-
-					billboard(right, up, center, c, alpha, size);
-				}
-			}
-		} break;
-		default:
-			break;
-		}
-	} else {
-		// points with low density have a low alpha and vice versa
-		float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
-		Vec3Df c = Vec3Df();
-		switch (global_ttype) {
-		case TRANSFERTYPE::BONSAI:
-			if (trunk.hasBetween(density)) {
-				c = Vec3Df(.33f, .21f, .1f); // brown
-				c *= density;
-
-				billboard(right, up, center, c, alpha, size);
-			} else if (leaves.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 0.0f); // green
-				c *= density;
-				
-				billboard(right, up, center, c, alpha, size);
-			}
-			break;
-		case TRANSFERTYPE::BACKPACK:
-			if (lightgrey.hasBetween(density)) {
-				c = Vec3Df(0.85f, 0.85f, 0.85f); // lightgrey
-				c *= density;
-				
-				billboard(right, up, center, c, alpha, size);
-			} else if (darkgrey.hasBetween(density)) {
-				c = Vec3Df(0.66f, 0.66f, 0.66f); // darkgrey
-				c *= density;
-				
-				billboard(right, up, center, c, alpha, size);
-			} else if (red.hasBetween(density)) {
-				c = Vec3Df(1.0f, 0.0f, 0.0f); // red
-				c *= density;
-		
-				billboard(right, up, center, c, alpha, size);
-			} else if (lightblue.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 1.0f); // lightblue
-				c *= density;
+// drawIsosurfaceMesh() draws the mesh chunks as indexed triangles with fixed-function lighting. Like the point arrays,
+// the vertices are in grid coordinates, which are mapped to [-1,1] by the modelview matrix.
+void drawIsosurfaceMesh() {
+	static_assert(sizeof(Vertex) == 6 * sizeof(float), "Vertex should be tightly packed");
+	static_assert(sizeof(Triangle) == 3 * sizeof(GLuint), "Triangle should be tightly packed");
 
-				billboard(right, up, center, c, alpha, size);
-			} else if (yellow.hasBetween(density)) {
-				c = Vec3Df(1.0f, 1.0f, 0.0f); // yellow
-				c *= density;
+	glPushAttrib(GL_ENABLE_BIT | GL_LIGHTING_BIT);
+	glEnable(GL_LIGHTING);
+	glEnable(GL_LIGHT0);
+	glEnable(GL_NORMALIZE);
+	glEnable(GL_COLOR_MATERIAL);
+	glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
 
-				billboard(right, up, center, c, alpha, size);
-			}
-			break;
-		default:
-			break;
-		}
+	GLfloat const lightPosition[4] = { gLightPosition[0], gLightPosition[1], gLightPosition[2], 1.f };
+	glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+
+	glColor3f(0.85f, 0.85f, 0.85f);
+
+	float const scale = 2.f / gVolumeLargestDimension;
+	glPushMatrix();
+	glTranslatef(-1.f, -1.f, -1.f);
+	glScalef(scale, scale, scale);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	for (auto const& chunk : gMeshBricks.chunks()) {
+		if (chunk.triangles.empty()) continue;
+
+		glVertexPointer(3, GL_FLOAT, sizeof(Vertex), &chunk.vertices[0].p);
+		glNormalPointer(GL_FLOAT, sizeof(Vertex), &chunk.vertices[0].n);
+
+		PROFILE_COUNT(EProfileCounter::trianglesDrawn, chunk.triangles.size());
+		glDrawElements(GL_TRIANGLES, GLsizei(3 * chunk.triangles.size()), GL_UNSIGNED_INT, chunk.triangles.data());
 	}
-}
 
-void performTransferWithArrays(AXIS axis, int i, int j, int k, int p, int q, int r, Vec3Df lightdir) {
-	float XT;
-	float YT;
-	float ZT;
-
-	int x, y, z;
-
-	if (axis == AXIS::X) {
-		XT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		x = k;
-		y = j;
-		z = i;
-	} else if (axis == AXIS::Y) {
-		XT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		x = i;
-		y = k;
-		z = j;
-	} else {
-		XT = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-		YT = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-		ZT = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-		x = j;
-		y = i;
-		z = k;
-	}
-
-	// Don't do anything if the coords are outside the ESelectiveRegionType::{shape}
-	if (!checkIntersection(XT, YT, ZT)) return;
-
-	float density = gVolume(x, y, z);
-
-	if (k != 0 && j != 0 && i != 0 && k != p - 1 && j != q - 1 && i != r - 1) {
-		const int XBack = x - 1;
-		const int YBack = y - 1;
-		const int ZBack = z - 1;
-		const int XFront = x + 1;
-		const int YFront = y + 1;
-		const int ZFront = z + 1;
-
-		// partial derivative
-		float partDerX = (gVolume(XFront, y, z) - gVolume(XBack, y, z)) / 2.0f;
-		float partDerY = (gVolume(x, YFront, z) - gVolume(x, YBack, z)) / 2.0f;
-		float partDerZ = (gVolume(x, y, ZFront) - gVolume(x, y, ZBack)) / 2.0f;
-
-		Vec3Df normal = Vec3Df(-partDerX, -partDerY, -partDerZ);
-		normal.normalize();
-
-		float dot = Vec3Df::dotProduct(normal, lightdir);
-
-		// BONSAI:
-		// trunk:
-		IsoSurface trunk = IsoSurface(0.5f, 0.9f);
-		//IsoSurface trunk = IsoSurface(0.2f, 0.6f);
-		//IsoSurface trunk = IsoSurface(FLT_MAX, FLT_MIN); // ignores trunk when this line is uncommented
-
-		// leaves:
-		IsoSurface leaves = IsoSurface(0.13f, 0.2f);
-		//IsoSurface leaves = IsoSurface(FLT_MAX, FLT_MIN); // ignores leaves when this line is uncommented
-
-		//// BACKPACK:
-		IsoSurface lightgrey = IsoSurface(0.25f, 0.3f);
-		//IsoSurface lightgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface darkgrey = IsoSurface(0.18f, 0.25);
-		//IsoSurface darkgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface red = IsoSurface(0.9f, 1.0f);
-		//IsoSurface red = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface lightblue = IsoSurface(0.61f, 0.9f);
-		//IsoSurface lightblue = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface yellow = IsoSurface(0.4f, 0.55f);
-		//IsoSurface yellow = IsoSurface(FLT_MAX, FLT_MIN);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
 
-		// points with low density have a low alpha and vice versa
-		float alpha = 1.0f / (1.0f + std::pow(density / (1.0f - density), -1.5f));
+	glPopMatrix();
+	glPopAttrib();
+}
 
-		Vec3Df c = Vec3Df();
-		switch (global_ttype) {
-		case TRANSFERTYPE::BONSAI:
-			if (trunk.hasBetween(density)) {
-				c = Vec3Df(.33f, .21f, .1f); // brown
-				c *= density * dot;
-
-				gDrawColors.push_back(c.p[0]);
-				gDrawColors.push_back(c.p[1]);
-				gDrawColors.push_back(c.p[2]);
-				gDrawColors.push_back(alpha);
-				gDrawPositions.push_back(XT);
-				gDrawPositions.push_back(YT);
-				gDrawPositions.push_back(ZT);
-			} else if (leaves.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 0.0f); // green
-				c *= density * dot;
-
-				gDrawColors.push_back(c.p[0]);
-				gDrawColors.push_back(c.p[1]);
-				gDrawColors.push_back(c.p[2]);
-				gDrawColors.push_back(alpha);
-				gDrawPositions.push_back(XT);
-				gDrawPositions.push_back(YT);
-				gDrawPositions.push_back(ZT);
-			}
-			break;
-		case TRANSFERTYPE::BACKPACK: {
-			if (lightgrey.hasBetween(density)) {
-				c = Vec3Df(0.85f, 0.85f, 0.85f); // lightgrey
-				c *= density * dot;
-
-				gDrawColors.push_back(c.p[0]);
-				gDrawColors.push_back(c.p[1]);
-				gDrawColors.push_back(c.p[2]);
-				gDrawColors.push_back(alpha);
-				gDrawPositions.push_back(XT);
-				gDrawPositions.push_back(YT);
-				gDrawPositions.push_back(ZT);
-			} else if (darkgrey.hasBetween(density)) {
-				c = Vec3Df(0.66f, 0.66f, 0.66f); // darkgrey
-				c *= density * dot;
-
-				gDrawColors.push_back(c.p[0]);
-				gDrawColors.push_back(c.p[1]);
-				gDrawColors.push_back(c.p[2]);
-				gDrawColors.push_back(alpha);
-				gDrawPositions.push_back(XT);
-				gDrawPositions.push_back(YT);
-				gDrawPositions.push_back(ZT);
-			} else if (red.hasBetween(density)) {
-				c = Vec3Df(1.0f, 0.0f, 0.0f); // red
-				c *= density * dot;
-
-				gDrawColors.push_back(c.p[0]);
-				gDrawColors.push_back(c.p[1]);
-				gDrawColors.push_back(c.p[2]);
-				gDrawColors.push_back(alpha);
-				gDrawPositions.push_back(XT);
-				gDrawPositions.push_back(YT);
-				gDrawPositions.push_back(ZT);
-			} else if (lightblue.hasBetween(density)) {
-				c = Vec3Df(0.0f, 1.0f, 1.0f); // lightblue
-				c *= density * dot;
-
-				gDrawColors.push_back(c.p[0]);
-				gDrawColors.push_back(c.p[1]);
-				gDrawColors.push_back(c.p[2]);
-				gDrawColors.push_back(alpha);
-				gDrawPositions.push_back(XT);
-				gDrawPositions.push_back(YT);
-				gDrawPositions.push_back(ZT);
-			} else if (yellow.hasBetween(density)) {
-				c = Vec3Df(1.0f, 1.0f, 0.0f); // yellow
-				c *= density * dot;
-
-				gDrawColors.push_back(c.p[0]);
-				gDrawColors.push_back(c.p[1]);
-				gDrawColors.push_back(c.p[2]);
-				gDrawColors.push_back(alpha);
-				gDrawPositions.push_back(XT);
-				gDrawPositions.push_back(YT);
-				gDrawPositions.push_back(ZT);
-			}
-		} break;
-		default:
-			break;
+// exportPly() hands copies of the current point set (of the array modes) and of the iso-surface mesh to gExporter,
+// which writes them to points.ply and mesh.ply (with ".gz" appended if aCompress is set). Both are exported in grid
+// coordinates. Whatever hasn't been built yet (by visiting the respective mode) is skipped.
+void exportPly(bool aCompress) {
+	char const* const suffix = aCompress ? ".ply.gz" : ".ply";
+
+	if (!gDrawPoints.empty()) {
+		std::vector<PlyPoint> points(gDrawPoints.size());
+		for (std::size_t i = 0; i < gDrawPoints.size(); ++i) {
+			PackedPoint const& in = gDrawPoints[i];
+			PlyPoint& out = points[i];
+			out.x = float(in.x);
+			out.y = float(in.y);
+			out.z = float(in.z);
+			std::copy(in.color, in.color + 4, out.color);
+		}
+		gExporter.export_points(std::string("points") + suffix, std::move(points), aCompress);
+	}
+
+	if (gMeshBricks.triangle_count()) {
+		std::vector<Vertex> vertices;
+		std::vector<Triangle> triangles;
+		vertices.reserve(gMeshBricks.vertex_count());
+		triangles.reserve(gMeshBricks.triangle_count());
+		for (auto const& chunk : gMeshBricks.chunks()) {
+			unsigned const base = unsigned(vertices.size());
+			vertices.insert(vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+			for (auto const& tri : chunk.triangles)
+				triangles.emplace_back(base + tri.v[0], base + tri.v[1], base + tri.v[2]);
 		}
+		gExporter.export_mesh(std::string("mesh") + suffix, std::move(vertices), std::move(triangles), aCompress);
 	}
+
+	if (gDrawPoints.empty() && !gMeshBricks.triangle_count())
+		std::printf("Nothing to export; build the point arrays ('9'/'0') or the mesh ('m') first\n");
 }
 
 void drawSphere(float radius, Vec3Df position) {
@@ -1118,9 +1691,9 @@ void drawSlab(float length, AXIS axis) {
 	float const minY = -1.f;
 	float const minZ = -1.f;
 
-	float const maxX = 2.f*float(gVolume.width()) / gVolumeLargestDimension - 1.f;
-	float const maxY = 2.f*float(gVolume.height()) / gVolumeLargestDimension - 1.f;
-	float const maxZ = 2.f*float(gVolume.depth()) / gVolumeLargestDimension - 1.f;
+	float const maxX = 2.f*float(gVolume->width()) / gVolumeLargestDimension - 1.f;
+	float const maxY = 2.f*float(gVolume->height()) / gVolumeLargestDimension - 1.f;
+	float const maxZ = 2.f*float(gVolume->depth()) / gVolumeLargestDimension - 1.f;
 
 	glColor4f(0.f, 0.f, 1.0f, 0.5f);
 	switch (axis) {
@@ -1235,6 +1808,14 @@ bool checkSlabIntersection(float x, float y, float z) {
 	return false;
 }
 
+bool checkMaskedIntersection(float X, float Y, float Z) {
+	int const x = int(std::lround(worldToVoxel(X)));
+	int const y = int(std::lround(worldToVoxel(Y)));
+	int const z = int(std::lround(worldToVoxel(Z)));
+	return x >= 0 && y >= 0 && z >= 0 && x < volumeDim(0) && y < volumeDim(1) && z < volumeDim(2) &&
+		inMaskedRegion(x, y, z);
+}
+
 bool checkIntersection(float X, float Y, float Z) {
 	switch (gSelectiveRegionType) {
 	case ESelectiveRegionType::sphere:
@@ -1243,6 +1824,9 @@ bool checkIntersection(float X, float Y, float Z) {
 		return checkCubeIntersection(X, Y, Z);
 	case ESelectiveRegionType::slab:
 		return checkSlabIntersection(X, Y, Z);
+	case ESelectiveRegionType::grown:
+	case ESelectiveRegionType::component:
+		return checkMaskedIntersection(X, Y, Z);
 	default:
 		return false;
 	}
@@ -1259,23 +1843,173 @@ float biLinearInterplationp(float x, float y, float q11, float q12, float q21, f
 	return linearInterPolation(y, y1, y2, r1, r2);
 }
 
-/*
-Trilinear interpolation.
-https://en.wikipedia.org/wiki/Trilinear_interpolation
+// compressDataset() replaces the levels of a (loaded) dataset by CompressedVolumes. The densities are freed as soon as
+// gVolume no longer refers to them.
+void compressDataset(Dataset& dataset) {
+	for (int level = 0; level < 2; ++level) {
+		if (!dataset.levels[level]) continue;
+		Volume const& volume = *dataset.levels[level];
+		dataset.compressed[level].reset(new CompressedVolume(volume));
+		if (volume.has_labels()) {
+			dataset.compressedLabels[level].assign(volume.labels(), volume.labels() + volume.total_element_count());
+		}
+		dataset.levels[level].reset();
+	}
+}
+
+// printDatasetMemory() prints how much memory the loaded datasets take, and how much of it is compressed.
+void printDatasetMemory() {
+	std::size_t dense = 0, compressed = 0, original = 0;
+	for (Dataset const& dataset : gDatasets) {
+		for (int level = 0; level < 2; ++level) {
+			if (dataset.levels[level]) dense += dataset.levels[level]->total_element_count() * sizeof(float);
+			if (CompressedVolume const* volume = dataset.compressed[level].get()) {
+				compressed += volume->compressed_bytes();
+				original += volume->width() * volume->height() * volume->depth() * sizeof(float);
+			}
+		}
+	}
+	std::printf("Datasets: %.1f MiB dense, %.1f MiB compressed (%.1f MiB uncompressed)\n", dense / 1048576.0,
+		compressed / 1048576.0, original / 1048576.0);
+}
+
+// loadLabels() loads the labels of a dataset from the label file next to it (see kLabelFileSuffix), if there is one.
+void loadLabels(Volume& volume, std::string const& fileName) {
+	std::string const mhd = ".mhd";
+	if (fileName.size() < mhd.size() || 0 != fileName.compare(fileName.size() - mhd.size(), mhd.size(), mhd)) return;
+
+	std::string const labelFile = fileName.substr(0, fileName.size() - mhd.size()) + kLabelFileSuffix;
+	std::ifstream probe(labelFile);
+	if (!probe) return;
+	probe.close();
+
+	if (load_mhd_labels(labelFile.c_str(), volume)) std::printf("Loaded labels from '%s'\n", labelFile.c_str());
+}
+
+// selectDataset() makes global_files[idx] the current dataset: gVolume is set to its full-resolution volume. Each
+// dataset (and its reduced version) is loaded only once; switching back to it later only swaps the handle. Returns
+// false, and leaves the current dataset as-is, if the volume couldn't be loaded.
+bool selectDataset(int idx) {
+	Dataset& dataset = gDatasets[idx];
+	if (dataset.compressed[0]) {
+		for (int level = 0; level < 2; ++level) {
+			Volume volume = dataset.compressed[level]->decompress();
+			volume.set_labels(std::move(dataset.compressedLabels[level]));
+			dataset.levels[level] = make_volume_handle(std::move(volume));
+			dataset.compressed[level].reset();
+			dataset.compressedLabels[level].clear();
+		}
+	} else if (!dataset.levels[0]) {
+		Volume volume = load_mhd_volume(global_files[idx]);
+		if (0 == volume.total_element_count()) return false;
+		loadLabels(volume, global_files[idx]);
+
+		dataset.levels[1] = make_volume_handle(load_lod_volume(volume));
+		dataset.levels[0] = make_volume_handle(std::move(volume));
+	}
+
+	if (gCompressDatasets && idx != global_files_idx) compressDataset(gDatasets[global_files_idx]);
+
+	global_files_idx = idx;
+	global_vols_idx = 0;
+	gSequencePlaying = false;
+	gVolumeSource = EVolumeSource::dataset;
+	gVolume = dataset.levels[0];
+	gVolumeLargestDimension = std::max(gVolume->width(), std::max(gVolume->height(), gVolume->depth()));
+	++gVolumeVersion;
+	return true;
+}
+
+// showSequenceFrame() replaces gVolume by frame idx of gSequence. Returns false if the frame isn't available (yet).
+// Frames that failed to load are skipped.
+bool showSequenceFrame(std::size_t idx, VolumeHandle frame) {
+	if (!frame) return false;
+
+	gSequenceFrame = idx;
+	if (0 == frame->total_element_count()) {
+		std::fprintf(stderr, "Skipping frame %zu ('%s')\n", idx, gSequence->file(idx).c_str());
+		return true;
+	}
+
+	gVolume = std::move(frame);
+	gVolumeLargestDimension = std::max(gVolume->width(), std::max(gVolume->height(), gVolume->depth()));
+	gVolumeSource = EVolumeSource::sequence;
+	++gVolumeVersion;
+	gDrawArraysDirty = true;
+	return true;
+}
+
+// updateSequence() advances the playback: once the current frame has been shown for 1/kSequenceFramesPerSecond
+// seconds, the next frame replaces it if it has been decoded by the workers of gSequence. The rendering thread never
+// waits for a frame; if the next one isn't ready, the current one stays on screen a bit longer. The derived data of
+// the new frame is rebuilt on demand, i.e., only the occupancy mask (or mesh) of the current mode.
+void updateSequence() {
+	if (!gSequence || !gSequencePlaying) return;
+
+	// Keep drawing while playing.
+	glutPostRedisplay();
+
+	auto const now = std::chrono::steady_clock::now();
+	if (now - gSequenceFrameTime < std::chrono::duration<float>(1.f / kSequenceFramesPerSecond)) return;
+
+	std::size_t const next = (gSequenceFrame + 1) % gSequence->frame_count();
+	if (showSequenceFrame(next, gSequence->request(next))) gSequenceFrameTime = now;
+}
+
+// brickedLevelFits() returns whether level of gBricked can be shown: it must fit into kBrickedDisplayVoxels, and its
+// bricks must fit into the cache.
+bool brickedLevelFits(std::size_t level) {
+	std::size_t const brick = gBricked->brick_size();
+	std::size_t const bricks = gBricked->brick_count(level, 0) * gBricked->brick_count(level, 1) *
+		gBricked->brick_count(level, 2);
+	return gBricked->width(level) * gBricked->height(level) * gBricked->depth(level) <= kBrickedDisplayVoxels &&
+		bricks * brick * brick * brick * sizeof(float) <= kBrickCacheBudget;
+}
+
+// updateBricked() re-assembles gVolume from gBricked when new bricks have arrived (at most four times per second, as
+// each assembly rebuilds the derived data). While bricks are missing, it keeps the window redrawing to pick them up.
+void updateBricked(bool force = false) {
+	if (gVolumeSource != EVolumeSource::bricked) return;
+
+	auto const now = std::chrono::steady_clock::now();
+	if (!force) {
+		if (gBrickedComplete) return;
+
+		glutPostRedisplay();
+		if (gBricked->generation() == gBrickedGeneration || now - gBrickedAssembleTime < std::chrono::milliseconds(250)) {
+			return;
+		}
+	}
+
+	PROFILE_SCOPE("assemble bricks");
+	gBrickedGeneration = gBricked->generation();
+	gBrickedAssembleTime = now;
+
+	std::size_t missing = 0;
+	gVolume = make_volume_handle(gBricked->assemble(gBrickedLevel, missing));
+	gVolumeLargestDimension = std::max(gVolume->width(), std::max(gVolume->height(), gVolume->depth()));
+	gBrickedComplete = 0 == missing;
+	++gVolumeVersion;
+	gDrawArraysDirty = true;
+
+	if (force || gBrickedComplete) {
+		std::printf("Out-of-core level %zu (%zux%zux%zu): %zu bricks missing, %.1f MiB resident\n", gBrickedLevel,
+			gVolume->width(), gVolume->height(), gVolume->depth(), missing, gBricked->resident_bytes() / 1048576.0);
+	}
+}
 
-a trilinear interpolation is identical to two bilinear interpolation combined with a linear interpolation.
-*/
-float triLinearInterpolation(float x, float y, float z, float p000, float p001, float p010, float p011,
-	float p100, float p101, float p110, float p111, float x1, float x2, float y1, float y2, float z1, float z2) {
+// showBrickedLevel() switches gVolume to level of gBricked. Returns false if the level can't be shown.
+bool showBrickedLevel(std::size_t level) {
+	if (level >= gBricked->level_count() || !brickedLevelFits(level)) return false;
 
-	float x00 = linearInterPolation(x, x1, x2, p000, p100);
-	float x10 = linearInterPolation(x, x1, x2, p010, p110);
-	float x01 = linearInterPolation(x, x1, x2, p001, p101);
-	float x11 = linearInterPolation(x, x1, x2, p011, p111);
-	float r0 = linearInterPolation(y, y1, y2, x00, x01);
-	float r1 = linearInterPolation(y, y1, y2, x10, x11);
+	// The bricks of the previous level aren't needed anymore.
+	if (level != gBrickedLevel) gBricked->cancel_requests();
 
-	return linearInterPolation(z, z1, z2, r0, r1);
+	gBrickedLevel = level;
+	gVolumeSource = EVolumeSource::bricked;
+	gSequencePlaying = false;
+	updateBricked(true);
+	return true;
 }
 
 // project_initialize() is called once when the application is started. You may
@@ -1288,6 +2022,7 @@ bool project_initialize() {
 
 	// push all possible data-files; 
 	// IMPORTANT! should be pushed in the same order as the order of the enum TRANSFERTYPE
+	// (The datasets may also be bundled into a single .zip, e.g., "data/datasets.zip/bonsai_small.mhd".)
 	global_files.push_back("data/bonsai_small.mhd");
 	global_files.push_back("data/backpack_small.mhd");
 
@@ -1295,27 +2030,17 @@ bool project_initialize() {
 	//global_ttype = TRANSFERTYPE::BACKPACK;
 	global_files_idx = 0;
 	global_ttype = TRANSFERTYPE::BONSAI;
-	gVolume = load_mhd_volume(global_files[global_files_idx]);
-
-	if (0 == gVolume.total_element_count()) {
+	gDatasets.resize(global_files.size());
+	if (!selectDataset(global_files_idx)) {
 		std::fprintf(stderr, "Error: couldn't load volume\n");
 		return false;
 	}
 
-	gVolumeLargestDimension = std::max(gVolume.width(), std::max(gVolume.height(), gVolume.depth()));
-
 	// TODO: if you have other initialization code that needs to run once when
 	// the program starts, you can place it here. (For example, Optional Tasks
 	// 3{a,b,c,d} require such one-time initialization.)
-	gLightChanged = true;
-	glGenBuffers(1, &gColorVBO);
-	glGenBuffers(1, &gPositionVBO);
-
-	
-	// 2b
-	gVolumeSmall = load_lod_volume(gVolume);
-	vols.push_back(gVolume);
-	vols.push_back(gVolumeSmall);
+	gDrawArraysDirty = true;
+	glGenBuffers(1, &gPointVBO);
 
 	// Check for OpenGL errors.
 	auto err = glGetError();
@@ -1334,6 +2059,13 @@ bool project_initialize() {
 // project_draw_window() is where you will implement the various visualization
 // modes.
 void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3Df const& aCameraPos) {
+	profile_frame_begin();
+
+	// Release the transient memory of the previous frame.
+	gFrameArena.reset();
+
+	updateSequence();
+	updateBricked();
 
 	// We start by resetting the state that will eventually be modified.  If
 	// you want to manage the OpenGL state by yourself more explicitly, you may
@@ -1344,11 +2076,14 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 	glDisable(GL_BLEND);
 	glEnable(GL_DEPTH_TEST);
 
+	// Restrict the traversals to the selected region.
+	updateRegionBounds();
+
 	// Make sure the volume is centered.
 	Vec3Df volumeTranslation(
-		float(gVolumeLargestDimension - gVolume.width()),
-		float(gVolumeLargestDimension - gVolume.height()),
-		float(gVolumeLargestDimension - gVolume.depth())
+		float(gVolumeLargestDimension - gVolume->width()),
+		float(gVolumeLargestDimension - gVolume->height()),
+		float(gVolumeLargestDimension - gVolume->depth())
 	);
 
 	volumeTranslation /= float(gVolumeLargestDimension);
@@ -1361,9 +2096,9 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 
 	case EVisualizeMode::none: {
 		// Draw a placeholder for the volume.
-		float const maxX = 2.f*float(gVolume.width()) / gVolumeLargestDimension - 1.f;
-		float const maxY = 2.f*float(gVolume.height()) / gVolumeLargestDimension - 1.f;
-		float const maxZ = 2.f*float(gVolume.depth()) / gVolumeLargestDimension - 1.f;
+		float const maxX = 2.f*float(gVolume->width()) / gVolumeLargestDimension - 1.f;
+		float const maxY = 2.f*float(gVolume->height()) / gVolumeLargestDimension - 1.f;
+		float const maxZ = 2.f*float(gVolume->depth()) / gVolumeLargestDimension - 1.f;
 
 		// draw outer cube
 		global_width = maxX + 1.0f;
@@ -1376,90 +2111,36 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 	} break;
 
 	case EVisualizeMode::solidPoints: {
+		PROFILE_SCOPE("solidPoints");
 		// code for Task 1: (uncomment code to get results of images in report).
-
-		// BONSAI:
-		// trunk:
-		//IsoSurface trunk = IsoSurface(0.5f, 0.6f);
-		IsoSurface trunk = IsoSurface(0.2f, 0.6f);
-		//IsoSurface trunk = IsoSurface(FLT_MAX, FLT_MIN); // ignores trunk when this line is uncommented
-
-		// leaves:
-		IsoSurface leaves = IsoSurface(0.15f, 0.17f);
-		//IsoSurface leaves = IsoSurface(FLT_MAX, FLT_MIN); // ignores leaves when this line is uncommented
-
-		// BACKPACK:
-		IsoSurface lightgrey = IsoSurface(0.25f, 0.3f);
-		//IsoSurface lightgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface darkgrey = IsoSurface(0.23f, 0.25f);
-		//IsoSurface darkgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface red = IsoSurface(0.9f, 1.0f);
-		//IsoSurface red = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface lightblue = IsoSurface(0.6f, 0.9f);
-		//IsoSurface lightblue = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface yellow = IsoSurface(0.5f, 0.55f);
-		//IsoSurface yellow = IsoSurface(FLT_MAX, FLT_MIN);
+		std::vector<TransferSurface> const& surfaces = transferSurfaces(ETransferFunction::unlit, global_ttype);
 
 		glPointSize(2.f);
-		glBegin(GL_POINTS);
-		for (int i = 0; i < gVolume.width(); i++) {
-			for (int j = 0; j < gVolume.height(); j++) {
-				for (int k = 0; k < gVolume.depth(); k++) {
-
-					float const X = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-					float const Y = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-					float const Z = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-
-					// Don't do anything if the coords are outside the ESelectiveRegionType::{shape}
-					if (!checkIntersection(X, Y, Z)) continue;
-
-					float density = gVolume(i, j, k);
-
-					switch (global_ttype) {
-					case TRANSFERTYPE::BONSAI:
-						// Task 1.a: (comment 1.b and uncomment 1.a)
-						// if (trunk.hasAfter(density)) {
-						// 	 glVertex3f(X, Y, Z);
-						// }
-
-						// Task 1.b:
-						if (trunk.hasBetween(density)) {
-							glColor3f(.33f, .21f, .1f); // brown
-							glVertex3f(X, Y, Z);
-						} else if (leaves.hasBetween(density)) {
-							glColor3f(.3f, .66f, .23f); // green
-							glVertex3f(X, Y, Z);
-						}
-						break;
-					case TRANSFERTYPE::BACKPACK:
-						// Backpack was not asked for Task 1.
-						if (lightgrey.hasBetween(density)) {
-							glColor3f(0.85f * 0.05f, 0.85f* 0.05f, 0.85f* 0.05f);
-							glVertex3f(X, Y, Z);
-						} else if (darkgrey.hasBetween(density)) {
-							glColor3f(0.66f* 0.05f, 0.66f* 0.05f, 0.66f* 0.05f);
-							glVertex3f(X, Y, Z);
-						} else if (red.hasBetween(density)) {
-							glColor3f(1.0f, 0.0f, 0.0f); // red
-							glVertex3f(X, Y, Z);
-						} else if (lightblue.hasBetween(density)) {
-							glColor3f(0.0f, 1.0, 1.0f); // lightblue
-							glVertex3f(X, Y, Z);
-						} else if (yellow.hasBetween(density)) {
-							glColor3f(1.0f, 1.0f, 0.0f); // yellow
-							glVertex3f(X, Y, Z);
-						}
-						break;
-					default:
-						break;
-					}
-				}
-			}
-		}
-		glEnd();
+		beginStream(GL_POINTS);
+		// the order doesn't matter here (depth test or additive blending)
+		traverseRegion(occupancyFor(ETransferFunction::unlit), AXIS::Z, DIRECTION::POS, [&](int i, int j, int k) {
+			float const X = 2.f*float(i) / gVolumeLargestDimension - 1.f;
+			float const Y = 2.f*float(j) / gVolumeLargestDimension - 1.f;
+			float const Z = 2.f*float(k) / gVolumeLargestDimension - 1.f;
+
+			float density = (*gVolume)(i, j, k);
+
+			// Task 1.a: every density >= 0.5 (IsoSurface::hasAfter()), in a single color.
+			// Task 1.b:
+			TransferSurface const* surface = classifyDensity(surfaces, density);
+			if (!surface) return;
+
+			Vec3Df c = surface->color;
+			// Backpack was not asked for Task 1; its greys are drawn darker.
+			if (global_ttype == TRANSFERTYPE::BACKPACK && c[0] == c[1] && c[1] == c[2]) c *= 0.05f;
+
+			emitPoint(X, Y, Z, c);
+		});
+		endStream();
 	} break;
 
 	case EVisualizeMode::additivePoints: {
+		PROFILE_SCOPE("additivePoints");
 		// code for Task 2:
 
 		// add additive blending
@@ -1469,91 +2150,31 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 		glDisable(GL_DEPTH_TEST);
 		glPointSize(2.f);
 
-		// example from pdf:
-		IsoSurface all = IsoSurface(0.15f, 1.0f);
-
-		// BONSAI:
-		IsoSurface trunk = IsoSurface(0.2f, 0.6f);
-		IsoSurface leaves = IsoSurface(0.15f, 0.17f);
-
-		// BACKPACK:
-		IsoSurface lightgrey = IsoSurface(0.25f, 0.3f);
-		//IsoSurface lightgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface darkgrey = IsoSurface(0.23f, 0.25f);
-		//IsoSurface darkgrey = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface red = IsoSurface(0.9f, 1.0f);
-		//IsoSurface red = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface lightblue = IsoSurface(0.6f, 0.9f);
-		//IsoSurface lightblue = IsoSurface(FLT_MAX, FLT_MIN);
-		IsoSurface yellow = IsoSurface(0.5f, 0.55f);
-		//IsoSurface yellow = IsoSurface(FLT_MAX, FLT_MIN);
-
-		glBegin(GL_POINTS);
-		for (int i = 0; i < gVolume.width(); i++) {
-			for (int j = 0; j < gVolume.height(); j++) {
-				for (int k = 0; k < gVolume.depth(); k++) {
-					float const X = 2.f*float(i) / gVolumeLargestDimension - 1.f;
-					float const Y = 2.f*float(j) / gVolumeLargestDimension - 1.f;
-					float const Z = 2.f*float(k) / gVolumeLargestDimension - 1.f;
-
-					// Don't do anything if the coords are outside the ESelectiveRegionType::{shape}
-					if (!checkIntersection(X, Y, Z)) continue;
-
-					// this point is a point of the volume itself.
-					float density = gVolume(i, j, k);
-
-					//You can experiment with values around 0.001 to 0.05
-					switch (global_ttype) {
-					case TRANSFERTYPE::BONSAI:
-						// Example from PDF (monotone):
-						// if (all.hasAfter(density)) {
-						//	 glColor3f(density * 0.05f, density * 0.05f, density * 0.05f);
-						//	 glVertex3f(X, Y, Z);
-						// }
-
-						if (trunk.hasBetween(density)) {
-							glColor3f(density *.33f* 0.1f, density *.21f* 0.1f, density * .1f* 0.1f); // brown
-							glVertex3f(X, Y, Z);
-						} else if (leaves.hasBetween(density)) {
-							glColor3f(density *.3f* 0.1f, density * .66f* 0.1f, density * .23f* 0.1f); // green
-							glVertex3f(X, Y, Z);
-						}
-						break;
-					case TRANSFERTYPE::BACKPACK:
-						// Example from PDF (monotone):
-						// if (all.hasAfter(density)) {
-						//	 glColor3f(density * 0.05f, density * 0.05f, density * 0.05f);
-						//	 glVertex3f(X, Y, Z);
-						// }
-
-						if (lightgrey.hasBetween(density)) {
-							glColor3f(density * 0.85f * 0.1f, density * 0.85f* 0.1f, density * 0.85f* 0.1f);
-							glVertex3f(X, Y, Z);
-						} else if (darkgrey.hasBetween(density)) {
-							glColor3f(density * 0.66f * 0.1f, density * 0.66f* 0.1f, density * 0.66f* 0.1f);
-							glVertex3f(X, Y, Z);
-						} else if (red.hasBetween(density)) {
-							glColor3f(density *1.0f* 0.1f, 0.0f, 0.0f); // red
-							glVertex3f(X, Y, Z);
-						} else if (lightblue.hasBetween(density)) {
-							glColor3f(0.0f, density *1.0f* 0.1f, density * 1.0f* 0.1f); // lightblue
-							glVertex3f(X, Y, Z);
-						} else if (yellow.hasBetween(density)) {
-							glColor3f(density *1.0f* 0.1f, density *1.0f* 0.1f, 0.0f); // yellow
-							glVertex3f(X, Y, Z);
-						}
-						break;
-					default:
-						break;
-					}
-				}
-			}
-		}
-		glEnd();
+		std::vector<TransferSurface> const& surfaces = transferSurfaces(ETransferFunction::unlit, global_ttype);
+
+		beginStream(GL_POINTS);
+		// the order doesn't matter here (depth test or additive blending)
+		traverseRegion(occupancyFor(ETransferFunction::unlit), AXIS::Z, DIRECTION::POS, [&](int i, int j, int k) {
+			float const X = 2.f*float(i) / gVolumeLargestDimension - 1.f;
+			float const Y = 2.f*float(j) / gVolumeLargestDimension - 1.f;
+			float const Z = 2.f*float(k) / gVolumeLargestDimension - 1.f;
+
+			// this point is a point of the volume itself.
+			float density = (*gVolume)(i, j, k);
+
+			// Example from PDF (monotone): every density >= 0.15, with color density * 0.05.
+			// You can experiment with values around 0.001 to 0.05
+			TransferSurface const* surface = classifyDensity(surfaces, density);
+			if (!surface) return;
+
+			emitPoint(X, Y, Z, surface->color * (density * 0.1f));
+		});
+		endStream();
 
 	} break;
 
 	case EVisualizeMode::colorAlphaPoints: {
+		PROFILE_SCOPE("colorAlphaPoints");
 		// code for Task 3 goes here!
 		// Note: start with Task 3a and then update it for Task 3b.
 
@@ -1563,37 +2184,21 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 
 		glDisable(GL_DEPTH_TEST);
 		glPointSize(2.f);
-		glBegin(GL_POINTS);
+		beginStream(GL_POINTS);
 
 		AXIS axis = (abs(aCameraFwd[0]) >= abs(aCameraFwd[1]) && abs(aCameraFwd[0]) >= abs(aCameraFwd[2])) ? AXIS::X : (abs(aCameraFwd[1]) >= abs(aCameraFwd[0]) && abs(aCameraFwd[1]) >= abs(aCameraFwd[2])) ? AXIS::Y : AXIS::Z;
 
-		int p = axis == AXIS::X ? gVolume.width() : axis == AXIS::Y ? gVolume.height() : gVolume.depth(); // x y z
-		int q = axis == AXIS::X ? gVolume.height() : axis == AXIS::Y ? gVolume.depth() : gVolume.width(); // y z x
-		int r = axis == AXIS::X ? gVolume.depth() : axis == AXIS::Y ? gVolume.width() : gVolume.height(); // z x y
 		DIRECTION dir = aCameraFwd[axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2] > 0 ? DIRECTION::POS : DIRECTION::NEG;
 
-		if (dir == DIRECTION::POS) {
-			for (int k = 0; k < p; k += 1) {
-				for (int j = 0; j < q; j += 1) {
-					for (int i = 0; i < r; i += 1) {
-						performTransfer(axis, i, j, k);
-					}
-				}
-			}
-		} else if (dir == DIRECTION::NEG) {
-			for (int k = p - 1; k >= 0; k -= 1) {
-				for (int j = q - 1; j >= 0; j -= 1) {
-					for (int i = r - 1; i >= 0; i -= 1) {
-						performTransfer(axis, i, j, k);
-					}
-				}
-			}
-		}
-		glEnd();
+		traverseRegion(occupancyFor(ETransferFunction::colorAlpha), axis, dir, [&](int x, int y, int z) {
+			performTransfer(x, y, z);
+		});
+		endStream();
 
 	} break;
 
 	case EVisualizeMode::phongPoints: {
+		PROFILE_SCOPE("phongPoints");
 		// code for Task 4 goes here!
 		// add blending + alpha
 		glEnable(GL_BLEND);
@@ -1601,36 +2206,20 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 
 		glDisable(GL_DEPTH_TEST);
 		glPointSize(2.f);
-		glBegin(GL_POINTS);
+		beginStream(GL_POINTS);
 
 		AXIS axis = (abs(aCameraFwd[0]) >= abs(aCameraFwd[1]) && abs(aCameraFwd[0]) >= abs(aCameraFwd[2])) ? AXIS::X : (abs(aCameraFwd[1]) >= abs(aCameraFwd[0]) && abs(aCameraFwd[1]) >= abs(aCameraFwd[2])) ? AXIS::Y : AXIS::Z;
 
-		int p = axis == AXIS::X ? gVolume.width() : axis == AXIS::Y ? gVolume.height() : gVolume.depth(); // x y z
-		int q = axis == AXIS::X ? gVolume.height() : axis == AXIS::Y ? gVolume.depth() : gVolume.width(); // y z x
-		int r = axis == AXIS::X ? gVolume.depth() : axis == AXIS::Y ? gVolume.width() : gVolume.height(); // z x y
 		DIRECTION dir = aCameraFwd[axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2] > 0 ? DIRECTION::POS : DIRECTION::NEG;
 
 		// use gLightPosition and gLightChanged
 		Vec3Df lightpos = gLightPosition;
 
-		if (dir == DIRECTION::POS) {
-			for (int k = 0; k < p; k += 1) {
-				for (int j = 0; j < q; j += 1) {
-					for (int i = 0; i < r; i += 1) {
-						performTransferWithLighting(axis, i, j, k, p, q, r, lightpos);
-					}
-				}
-			}
-		} else if (dir == DIRECTION::NEG) {
-			for (int k = p - 1; k >= 0; k -= 1) {
-				for (int j = q - 1; j >= 0; j -= 1) {
-					for (int i = r - 1; i >= 0; i -= 1) {
-						performTransferWithLighting(axis, i, j, k, p, q, r, lightpos);
-					}
-				}
-			}
-		}
-		glEnd();
+		OccupancyMask const& mask = occupancyFor(ETransferFunction::lit);
+		traverseRegionBatched(mask, axis, dir, [&](PackedPoint const* points, std::size_t count) {
+			performTransferWithLighting(points, count, lightpos);
+		});
+		endStream();
 	} break;
 
 	case EVisualizeMode::selectedPointsOnly: {
@@ -1654,6 +2243,7 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 	} break;
 
 	case EVisualizeMode::enhanceSelectedPoints: {
+		PROFILE_SCOPE("enhanceSelectedPoints");
 		// code for Optional Task 1 goes here!
 		// add blending + alpha
 		glEnable(GL_BLEND);
@@ -1661,13 +2251,10 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 
 		glDisable(GL_DEPTH_TEST);
 		glPointSize(2.f);
-		glBegin(GL_POINTS);
+		beginStream(GL_POINTS);
 
 		AXIS axis = (abs(aCameraFwd[0]) >= abs(aCameraFwd[1]) && abs(aCameraFwd[0]) >= abs(aCameraFwd[2])) ? AXIS::X : (abs(aCameraFwd[1]) >= abs(aCameraFwd[0]) && abs(aCameraFwd[1]) >= abs(aCameraFwd[2])) ? AXIS::Y : AXIS::Z;
 
-		int p = axis == AXIS::X ? gVolume.width() : axis == AXIS::Y ? gVolume.height() : gVolume.depth(); // x y z
-		int q = axis == AXIS::X ? gVolume.height() : axis == AXIS::Y ? gVolume.depth() : gVolume.width(); // y z x
-		int r = axis == AXIS::X ? gVolume.depth() : axis == AXIS::Y ? gVolume.width() : gVolume.height(); // z x y
 		DIRECTION dir = aCameraFwd[axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2] > 0 ? DIRECTION::POS : DIRECTION::NEG;
 
 		// use gLightPosition and gLightChanged
@@ -1677,28 +2264,16 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 		Vec3Df center = Vec3Df(0, 0, 0);
 		float distance = Vec3Df::distance(center, cameraPos);
 
-		if (dir == DIRECTION::POS) {
-			for (int k = 0; k < p; k += 1) {
-				for (int j = 0; j < q; j += 1) {
-					for (int i = 0; i < r; i += 1) {
-						performTransferWithTrilinearInterpolation(axis, i, j, k, p, q, r, lightpos, distance < 2.0f);
-					}
-				}
-			}
-		} else if (dir == DIRECTION::NEG) {
-			for (int k = p - 1; k >= 0; k -= 1) {
-				for (int j = q - 1; j >= 0; j -= 1) {
-					for (int i = r - 1; i >= 0; i -= 1) {
-						performTransferWithTrilinearInterpolation(axis, i, j, k, p, q, r, lightpos, distance < 2.0f);
-					}
-				}
-			}
-		}
-		glEnd();
+		OccupancyMask const& mask = occupancyFor(ETransferFunction::litTrilinear);
+		traverseRegionBatched(mask, axis, dir, [&](PackedPoint const* points, std::size_t count) {
+			performTransferWithTrilinearInterpolation(points, count, lightpos, distance < 2.0f);
+		});
+		endStream();
 
 	} break;
 
 	case EVisualizeMode::billboards: {
+		PROFILE_SCOPE("billboards");
 		// code for Optional Task 2a goes here!
 		//TODO: your code for Optional Task 1 goes here!
 		// add blending + alpha
@@ -1709,9 +2284,6 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 
 		AXIS axis = (abs(aCameraFwd[0]) >= abs(aCameraFwd[1]) && abs(aCameraFwd[0]) >= abs(aCameraFwd[2])) ? AXIS::X : (abs(aCameraFwd[1]) >= abs(aCameraFwd[0]) && abs(aCameraFwd[1]) >= abs(aCameraFwd[2])) ? AXIS::Y : AXIS::Z;
 
-		int p = axis == AXIS::X ? gVolume.width() : axis == AXIS::Y ? gVolume.height() : gVolume.depth(); // x y z
-		int q = axis == AXIS::X ? gVolume.height() : axis == AXIS::Y ? gVolume.depth() : gVolume.width(); // y z x
-		int r = axis == AXIS::X ? gVolume.depth() : axis == AXIS::Y ? gVolume.width() : gVolume.height(); // z x y
 		DIRECTION dir = aCameraFwd[axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2] > 0 ? DIRECTION::POS : DIRECTION::NEG;
 
 		// use gLightPosition and gLightChanged
@@ -1726,28 +2298,17 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 		Vec3Df up = aCameraUp;
 		float size = 0.004f;
 
-		glBegin(GL_QUADS);
-		if (dir == DIRECTION::POS) {
-			for (int k = 0; k < p; k += 1) {
-				for (int j = 0; j < q; j += 1) {
-					for (int i = 0; i < r; i += 1) {
-						performTransferWithBillboards(axis, i, j, k, p, q, r, lightpos, distance < 2.0f, right, up, size);
-					}
-				}
-			}
-		} else if (dir == DIRECTION::NEG) {
-			for (int k = p - 1; k >= 0; k -= 1) {
-				for (int j = q - 1; j >= 0; j -= 1) {
-					for (int i = r - 1; i >= 0; i -= 1) {						
-						performTransferWithBillboards(axis, i, j, k, p, q, r, lightpos, distance < 2.0f, right, up, size);
-					}
-				}
-			}
-		}
-		glEnd();
+		beginStream(GL_QUADS);
+		OccupancyMask const& mask = occupancyFor(ETransferFunction::litTrilinear);
+		traverseRegionBatched(mask, axis, dir, [&](PackedPoint const* points, std::size_t count) {
+			performTransferWithBillboards(points, count, lightpos, distance < 2.0f, right, up, size);
+		});
+		flushBillboards();
+		endStream();
 	} break;
 
 	case EVisualizeMode::billboardsWithLOD: {
+		PROFILE_SCOPE("billboardsWithLOD");
 		//TODO: your code for Optional Task 2b goes here!
 		// IMPORTANT: Task 2b is not fully working properly.
 		glEnable(GL_BLEND);
@@ -1757,9 +2318,6 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 
 		AXIS axis = (abs(aCameraFwd[0]) >= abs(aCameraFwd[1]) && abs(aCameraFwd[0]) >= abs(aCameraFwd[2])) ? AXIS::X : (abs(aCameraFwd[1]) >= abs(aCameraFwd[0]) && abs(aCameraFwd[1]) >= abs(aCameraFwd[2])) ? AXIS::Y : AXIS::Z;
 
-		int p = axis == AXIS::X ? gVolume.width() : axis == AXIS::Y ? gVolume.height() : gVolume.depth(); // x y z
-		int q = axis == AXIS::X ? gVolume.height() : axis == AXIS::Y ? gVolume.depth() : gVolume.width(); // y z x
-		int r = axis == AXIS::X ? gVolume.depth() : axis == AXIS::Y ? gVolume.width() : gVolume.height(); // z x y
 		DIRECTION dir = aCameraFwd[axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2] > 0 ? DIRECTION::POS : DIRECTION::NEG;
 
 		// use gLightPosition and gLightChanged
@@ -1774,38 +2332,32 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 		Vec3Df up = aCameraUp;
 		float size = 0.004f;
 
-		if (distance > 8.0f && global_vols_idx == 0) {
+		// (Only the datasets have a reduced version.)
+		if (gVolumeSource == EVolumeSource::dataset && distance > 8.0f && global_vols_idx == 0) {
 			global_vols_idx = 1;
-			gVolume = vols[global_vols_idx];
+			gVolume = gDatasets[global_files_idx].levels[global_vols_idx];
+			++gVolumeVersion;
+			gDrawArraysDirty = true;
 			size *= 2.0f;
-		} else if (distance < 8.0f && global_vols_idx == 1) {
+		} else if (gVolumeSource == EVolumeSource::dataset && distance < 8.0f && global_vols_idx == 1) {
 			global_vols_idx = 0;
-			gVolume = vols[global_vols_idx];
+			gVolume = gDatasets[global_files_idx].levels[global_vols_idx];
+			++gVolumeVersion;
+			gDrawArraysDirty = true;
 			size /= 2.0f;
 		}
 
-		glBegin(GL_QUADS);
-		if (dir == DIRECTION::POS) {
-			for (int k = 0; k < p; k += 1) {
-				for (int j = 0; j < q; j += 1) {
-					for (int i = 0; i < r; i += 1) {
-						performTransferWithBillboards(axis, i, j, k, p, q, r, lightpos, distance < 2.0f, right, up, size);
-					}
-				}
-			}
-		} else if (dir == DIRECTION::NEG) {
-			for (int k = p - 1; k >= 0; k -= 1) {
-				for (int j = q - 1; j >= 0; j -= 1) {
-					for (int i = r - 1; i >= 0; i -= 1) {
-						performTransferWithBillboards(axis, i, j, k, p, q, r, lightpos, distance < 2.0f, right, up, size);
-					}
-				}
-			}
-		}
-		glEnd();
+		beginStream(GL_QUADS);
+		OccupancyMask const& mask = occupancyFor(ETransferFunction::litTrilinear);
+		traverseRegionBatched(mask, axis, dir, [&](PackedPoint const* points, std::size_t count) {
+			performTransferWithBillboards(points, count, lightpos, distance < 2.0f, right, up, size);
+		});
+		flushBillboards();
+		endStream();
 	} break;
 
 	case EVisualizeMode::drawAsArray: {
+		PROFILE_SCOPE("drawAsArray");
 		//TODO: your code for Optional Task 3a goes here!
 
 		// determine whether or not you need to update the data when the visualization
@@ -1818,53 +2370,16 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 		AXIS axis = (abs(aCameraFwd[0]) >= abs(aCameraFwd[1]) && abs(aCameraFwd[0]) >= abs(aCameraFwd[2])) ? AXIS::X : (abs(aCameraFwd[1]) >= abs(aCameraFwd[0]) && abs(aCameraFwd[1]) >= abs(aCameraFwd[2])) ? AXIS::Y : AXIS::Z;
 		DIRECTION dir = aCameraFwd[axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2] > 0 ? DIRECTION::POS : DIRECTION::NEG;
 		
-		if (gLightChanged || dir != current_dir) {
-			current_dir = dir;
-			gLightChanged = false;
-			gDrawColors.clear();
-			gDrawPositions.clear();
-
-			int p = axis == AXIS::X ? gVolume.width() : axis == AXIS::Y ? gVolume.height() : gVolume.depth(); // x y z
-			int q = axis == AXIS::X ? gVolume.height() : axis == AXIS::Y ? gVolume.depth() : gVolume.width(); // y z x
-			int r = axis == AXIS::X ? gVolume.depth() : axis == AXIS::Y ? gVolume.width() : gVolume.height(); // z x y
-
-			Vec3Df lightpos = gLightPosition;
-
-			if (dir == DIRECTION::POS) {
-				for (int k = 0; k < p; k += 1) {
-					for (int j = 0; j < q; j += 1) {
-						for (int i = 0; i < r; i += 1) {
-							performTransferWithArrays(axis, i, j, k, p, q, r, lightpos);
-						}
-					}
-				}
-			} else if (dir == DIRECTION::NEG) {
-				for (int k = p - 1; k >= 0; k -= 1) {
-					for (int j = q - 1; j >= 0; j -= 1) {
-						for (int i = r - 1; i >= 0; i -= 1) {
-							performTransferWithArrays(axis, i, j, k, p, q, r, lightpos);
-						}
-					}
-				}
-			}
-		}
-
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glEnableClientState(GL_COLOR_ARRAY);
+		updatePointArrays(axis, dir);
 
-		glColorPointer(4, GL_FLOAT, 0, gDrawColors.data());
-		glVertexPointer(3, GL_FLOAT, 0, gDrawPositions.data());
-		glDrawArrays(GL_POINTS, 0, int(gDrawPositions.size() / 3));
-		glDisableClientState(GL_COLOR_ARRAY);
-		glDisableClientState(GL_VERTEX_ARRAY);
+		compositePointArrays(false);
 	} break;
 
 	case EVisualizeMode::drawAsArrayFromVRAM: {
+		PROFILE_SCOPE("drawAsArrayFromVRAM");
 		//TODO: your code for Optional Task 3b goes here!
 		// Note: change this code for Optional Task 3d
 
-		// You cannot call this function after calling 9:
-
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -1872,62 +2387,40 @@ void project_draw_window(Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3
 		AXIS axis = (abs(aCameraFwd[0]) >= abs(aCameraFwd[1]) && abs(aCameraFwd[0]) >= abs(aCameraFwd[2])) ? AXIS::X : (abs(aCameraFwd[1]) >= abs(aCameraFwd[0]) && abs(aCameraFwd[1]) >= abs(aCameraFwd[2])) ? AXIS::Y : AXIS::Z;
 		DIRECTION dir = aCameraFwd[axis == AXIS::X ? 0 : axis == AXIS::Y ? 1 : 2] > 0 ? DIRECTION::POS : DIRECTION::NEG;
 
-		if (gLightChanged || dir != current_dir) {
-			current_dir = dir;
-			gLightChanged = false;
-			gDrawColors.clear();
-			gDrawPositions.clear();
-
-			int p = axis == AXIS::X ? gVolume.width() : axis == AXIS::Y ? gVolume.height() : gVolume.depth(); // x y z
-			int q = axis == AXIS::X ? gVolume.height() : axis == AXIS::Y ? gVolume.depth() : gVolume.width(); // y z x
-			int r = axis == AXIS::X ? gVolume.depth() : axis == AXIS::Y ? gVolume.width() : gVolume.height(); // z x y
-
-			Vec3Df lightpos = gLightPosition;
-
-			if (dir == DIRECTION::POS) {
-				for (int k = 0; k < p; k += 1) {
-					for (int j = 0; j < q; j += 1) {
-						for (int i = 0; i < r; i += 1) {
-							performTransferWithArrays(axis, i, j, k, p, q, r, lightpos);
-						}
-					}
-				}
-			} else if (dir == DIRECTION::NEG) {
-				for (int k = p - 1; k >= 0; k -= 1) {
-					for (int j = q - 1; j >= 0; j -= 1) {
-						for (int i = r - 1; i >= 0; i -= 1) {
-							performTransferWithArrays(axis, i, j, k, p, q, r, lightpos);
-						}
-					}
-				}
-			}
+		updatePointArrays(axis, dir);
+		syncPointVBOs();
 
-			glBindBuffer(GL_ARRAY_BUFFER, gPositionVBO);
-			glBufferData(GL_ARRAY_BUFFER, gDrawPositions.size() * sizeof(float), gDrawPositions.data(), GL_STREAM_DRAW);
-			glBindBuffer(GL_ARRAY_BUFFER, gColorVBO);
-			glBufferData(GL_ARRAY_BUFFER, gDrawColors.size() * sizeof(float), gDrawColors.data(), GL_STREAM_DRAW);
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-		}
 		// At run-time:
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glEnableClientState(GL_COLOR_ARRAY);
-
-		glBindBuffer(GL_ARRAY_BUFFER, gColorVBO);
-		glColorPointer(4, GL_FLOAT, 0, nullptr);
-		glBindBuffer(GL_ARRAY_BUFFER, gPositionVBO);
-		glVertexPointer(3, GL_FLOAT, 0, nullptr);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glDrawArrays(GL_POINTS, 0, int(gDrawPositions.size() / 3));
+		compositePointArrays(true);
 
-		glDisableClientState(GL_COLOR_ARRAY);
-		glDisableClientState(GL_VERTEX_ARRAY);
+	} break;
 
+	case EVisualizeMode::isosurfaceMesh: {
+		PROFILE_SCOPE("isosurfaceMesh");
+		updateIsosurfaceMesh();
+		drawIsosurfaceMesh();
 	} break;
 	}
 
+	// Show the profiler overlay (only available in builds with PROJECT_PROFILING).
+	profile_draw_overlay();
+
+	// The arena's use in this frame; spills (and thus heap allocations) should only occur in the first few frames.
+	PROFILE_COUNT(EProfileCounter::frameArenaBytes, gFrameArena.used());
+	PROFILE_COUNT(EProfileCounter::frameArenaSpills, gFrameArena.spills());
+
 	auto err = glGetError();
 	if (GL_NO_ERROR != err)
 		std::fprintf(stderr, "OpenGL Error: %s\n", gluErrorString(err));
+
+	profile_frame_end();
+}
+
+// printCurrentLabel() prints gCurrentLabel and its entry of gLabelLUT.
+void printCurrentLabel() {
+	std::uint8_t const* rgb = gLabelLUT.color(gCurrentLabel);
+	std::printf("Label %u: %s, color (%u, %u, %u)\n", unsigned(gCurrentLabel),
+		gLabelLUT.visible(gCurrentLabel) ? "visible" : "hidden", unsigned(rgb[0]), unsigned(rgb[1]), unsigned(rgb[2]));
 }
 
 void project_on_key_press(int aKey, Vec3Df const& aCameraPos) {
@@ -1945,12 +2438,27 @@ void project_on_key_press(int aKey, Vec3Df const& aCameraPos) {
 	case '9': gVisualizeMode = EVisualizeMode::drawAsArray; break;
 	case '0': gVisualizeMode = EVisualizeMode::drawAsArrayFromVRAM; break;
 	case 'n': gVisualizeMode = EVisualizeMode::none; break;
+	case 'm': gVisualizeMode = EVisualizeMode::isosurfaceMesh; break;
+		// Change the isovalue of the mesh (EVisualizeMode::isosurfaceMesh).
+	case 'c':
+		if (gMeshIsoValue < 0.f) gMeshIsoValue = defaultIsoValue();
+		gMeshIsoValue = std::max(gMeshIsoValue - 0.01f, 0.01f);
+		std::printf("Isovalue: %.3f\n", gMeshIsoValue);
+		break;
+	case 'v':
+		if (gMeshIsoValue < 0.f) gMeshIsoValue = defaultIsoValue();
+		gMeshIsoValue = std::min(gMeshIsoValue + 0.01f, 1.f);
+		std::printf("Isovalue: %.3f\n", gMeshIsoValue);
+		break;
 	case 'p':
 		gVisualizeMode = EVisualizeMode::none;
-		gLightChanged = true; // h4ck
-		global_files_idx = (global_files_idx + 1) % global_files.size();
-		gVolume = load_mhd_volume(global_files[global_files_idx]);
+		gDrawArraysDirty = true;
+		if (!selectDataset((global_files_idx + 1) % global_files.size())) {
+			std::fprintf(stderr, "Error: couldn't load volume\n");
+			break;
+		}
 		global_ttype = TRANSFERTYPE(global_files_idx);
+		gMeshIsoValue = -1.f;
 		break;
 
 		// Keys 'l' and 'k' are used to change the light position. The light
@@ -2001,6 +2509,35 @@ void project_on_key_press(int aKey, Vec3Df const& aCameraPos) {
 		global_position.p[2] -= 1.0f;
 		break;
 	case 'b': gSelectiveRegionType = ESelectiveRegionType::slab; break;
+	case 'R': // grown from the voxel picked last (shift + click)
+		if (!gHasPickedVoxel) {
+			std::printf("Pick a seed voxel first (shift + click)\n");
+			break;
+		}
+		gSelectiveRegionType = ESelectiveRegionType::grown;
+		growSelection();
+		break;
+	case 'L': { // connected component of the picked voxel (shift + click selects another one)
+		// Label the voxels of the iso-surface that contains the picked voxel (or the first one), or those above the
+		// isovalue of the mesh.
+		float lo = gMeshIsoValue < 0.f ? defaultIsoValue() : gMeshIsoValue, hi = 1.f;
+		if (gVisualizeMode != EVisualizeMode::isosurfaceMesh) {
+			std::vector<TransferSurface> const& surfaces = transferSurfaces(activeTransferFunction(), global_ttype);
+			if (surfaces.empty()) break;
+
+			IsoSurface const* surface = &surfaces[0].surface;
+			if (pickedVoxelInVolume()) {
+				float const density = (*gVolume)(gPickedVoxel[0], gPickedVoxel[1], gPickedVoxel[2]);
+				for (auto const& s : surfaces) {
+					if (s.surface.hasBetween(density)) surface = &s.surface;
+				}
+			}
+			lo = surface->getLow();
+			hi = surface->getHigh();
+		}
+		gSelectiveRegionType = ESelectiveRegionType::component;
+		labelComponents(lo, hi);
+	} break;
 	case 'w': // move z+ (towards you)
 		switch (gSelectiveRegionType) {
 		case ESelectiveRegionType::sphere:
@@ -2125,9 +2662,150 @@ void project_on_key_press(int aKey, Vec3Df const& aCameraPos) {
 			break;
 		}
 		break;
+		// Classification by label (see gClassifyByLabel).
+	case 'T':
+		gClassifyByLabel = !gClassifyByLabel;
+		std::printf("Classification by label: %s%s\n", gClassifyByLabel ? "on" : "off",
+			gVolume->has_labels() ? "" : " (the volume has no labels)");
+		break;
+	case '-':
+	case '=':
+		// The keys step through the labels 1..65535 without wrapping around; label 0 means "unlabeled" (see
+		// LabelLUT).
+		if (aKey == '=' && gCurrentLabel < LabelLUT::kLabelCount - 1) ++gCurrentLabel;
+		if (aKey == '-' && gCurrentLabel > 1) --gCurrentLabel;
+		printCurrentLabel();
+		break;
+	case 'H':
+		gLabelLUT.toggle(gCurrentLabel);
+		printCurrentLabel();
+		break;
+	case 'A':
+		gLabelLUT.show_all();
+		std::printf("All labels visible\n");
+		break;
+		// Change the density tolerance of the grown region.
+	case '<':
+	case '>':
+		gGrowTolerance = std::max(gGrowTolerance + (aKey == '>' ? 0.01f : -0.01f), 0.f);
+		if (gSelectiveRegionType == ESelectiveRegionType::grown) {
+			growSelection();
+		} else {
+			std::printf("Grow tolerance: %.3f\n", gGrowTolerance);
+		}
+		break;
 	case 'o':
 		global_slab_axis = AXIS((static_cast<int>(global_slab_axis) + 1) % 3);
 		break;
+		// Toggle order-independent compositing of the array modes.
+	case 'u':
+		gUseOIT = !gUseOIT;
+		std::printf("Order-independent transparency: %s\n", gUseOIT ? "on" : "off");
+		break;
+		// Profiler: toggle the overlay with 'f', dump a Chrome trace with 'F'.
+	case 'f': profile_toggle_overlay(); break;
+	case 'F': profile_dump_chrome_trace("trace.json"); break;
+		// Print the density statistics of the current volume.
+	case 'h': printVolumeStatistics(*gVolume); break;
+		// Keep the datasets that aren't shown compressed (see gCompressDatasets).
+	case 'C':
+		gCompressDatasets = !gCompressDatasets;
+		if (gCompressDatasets) {
+			for (std::size_t i = 0; i < gDatasets.size(); ++i) {
+				if (int(i) != global_files_idx) compressDataset(gDatasets[i]);
+			}
+		}
+		std::printf("Compressed datasets: %s\n", gCompressDatasets ? "on" : "off");
+		printDatasetMemory();
+		break;
+		// Toggle rebuilding the occupancy masks from the sparse occupancy of the volume (see gSparseOccupancy), and print
+		// how much of the current volume is active.
+	case 'S':
+		gSparseOccupancy = !gSparseOccupancy;
+		std::printf("Sparse occupancy: %s\n", gSparseOccupancy ? "on" : "off");
+		if (gSparseOccupancy) {
+			printSparseStatistics();
+		} else {
+			gSparseVolume = SparseVolume();
+			gSparseVolumeValid = false;
+		}
+		break;
+		// Play/pause the time series (see kSequencePattern), or step to its next frame.
+	case 'P':
+		if (!gSequence) {
+			std::vector<std::string> files = VolumeSequence::files_from_pattern(kSequencePattern);
+			if (files.empty()) {
+				std::fprintf(stderr, "No frames matching '%s'\n", kSequencePattern);
+				break;
+			}
+
+			std::printf("Sequence: %zu frames\n", files.size());
+			gSequence.reset(new VolumeSequence(std::move(files)));
+		}
+
+		if (gVolumeSource != EVolumeSource::sequence) showSequenceFrame(gSequenceFrame, gSequence->wait(gSequenceFrame));
+		gSequencePlaying = !gSequencePlaying;
+		gSequenceFrameTime = std::chrono::steady_clock::now();
+		break;
+	case 'O':
+		if (!gBricked) {
+			try {
+				gBricked.reset(new BrickedVolume(kBrickedFile, kBrickCacheBudget));
+			} catch (std::exception const& eError) {
+				std::fprintf(stderr, "Couldn't open '%s': %s\n", kBrickedFile, eError.what());
+				break;
+			}
+
+			// Start with the finest level that fits.
+			gBrickedLevel = gBricked->level_count() - 1;
+			while (gBrickedLevel > 0 && brickedLevelFits(gBrickedLevel - 1)) --gBrickedLevel;
+		}
+		showBrickedLevel(gBrickedLevel);
+		break;
+	case '{':
+		if (gVolumeSource == EVolumeSource::bricked && !showBrickedLevel(gBrickedLevel - 1)) {
+			std::printf("Level %zu is the finest level that can be shown\n", gBrickedLevel);
+		}
+		break;
+	case '}':
+		if (gVolumeSource == EVolumeSource::bricked) showBrickedLevel(gBrickedLevel + 1);
+		break;
+	case 'B':
+		if (gVolumeSource == EVolumeSource::bricked) {
+			std::fprintf(stderr, "Can't overwrite the out-of-core volume that is shown\n");
+			break;
+		}
+
+		gBricked.reset();
+		try {
+			save_bricked_volume(*gVolume, kBrickedFile);
+			std::printf("Wrote '%s'\n", kBrickedFile);
+		} catch (std::exception const& eError) {
+			std::fprintf(stderr, "Couldn't write '%s': %s\n", kBrickedFile, eError.what());
+		}
+		break;
+	case 'M': {
+		auto const start = std::chrono::steady_clock::now();
+		try {
+			save_mhd_volume(*gVolume, kSavedVolumeFile);
+		} catch (std::exception const& eError) {
+			std::fprintf(stderr, "Couldn't write '%s': %s\n", kSavedVolumeFile, eError.what());
+			break;
+		}
+		std::printf("Wrote '%s' in %.1f ms\n", kSavedVolumeFile,
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		break;
+	}
+	case 'j':
+		if (gVolumeSource == EVolumeSource::sequence) {
+			std::size_t const next = (gSequenceFrame + 1) % gSequence->frame_count();
+			showSequenceFrame(next, gSequence->wait(next));
+			std::printf("Frame %zu\n", gSequenceFrame);
+		}
+		break;
+		// Export the point set and the mesh to PLY: 'y' uncompressed, 'Y' gzip-compressed.
+	case 'y': exportPly(false); break;
+	case 'Y': exportPly(true); break;
 		// Any remaining keys, you may use as you wish.
 		// Suggestion: for Task 5 (Intersection), use e.g., 'w', 's', 'a', 'd',
 		// 'e', 'q' to move the sphere/cube along the three axes, 'x' 'z' to
@@ -2136,6 +2814,74 @@ void project_on_key_press(int aKey, Vec3Df const& aCameraPos) {
 	}
 }
 
+// The min/max pyramid of the current volume for project_pick(); rebuilt when the volume changes.
+MinMaxPyramid gPickPyramid;
+unsigned gPickPyramidVersion = 0;
+bool gPickPyramidValid = false;
+
+// project_pick() prints the first voxel along the ray (in the coordinates of the scene, see getWorldRayOfPixel()) that
+// the current mode shows: a voxel of its occupancy mask, or, for the mesh, a voxel at or above the isovalue. The ray
+// skips the empty parts of the volume through gPickPyramid, whose ranges are compared against the iso-surfaces of the
+// transfer function; only the bricks that might contain such a voxel are traversed voxel by voxel.
+void project_pick(Vec3Df const& aRayOrigin, Vec3Df const& aRayDirection) {
+	if (!gPickPyramidValid || gPickPyramidVersion != gVolumeVersion) {
+		PROFILE_SCOPE("rebuild pick pyramid");
+		gPickPyramid.rebuild(*gVolume);
+		gPickPyramidVersion = gVolumeVersion;
+		gPickPyramidValid = true;
+	}
+
+	bool const mesh = gVisualizeMode == EVisualizeMode::isosurfaceMesh;
+	float const iso = gMeshIsoValue < 0.f ? defaultIsoValue() : gMeshIsoValue;
+	ETransferFunction const tf = activeTransferFunction();
+	std::vector<TransferSurface> const& surfaces = transferSurfaces(tf, global_ttype);
+	OccupancyMask const& mask = occupancyFor(tf);
+
+	auto const start = std::chrono::steady_clock::now();
+
+	// Scene to cell coordinates: undo the centering of the volume (see project_draw_window()) and map [-1,1] to
+	// voxels (see worldToVoxel()). The point of voxel v lies at the center of cell v, i.e., at v + 0.5.
+	float const largest = float(gVolumeLargestDimension);
+	float origin[3], direction[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		float const translation = (largest - float(volumeDim(axis))) / largest;
+		origin[axis] = worldToVoxel(aRayOrigin[axis] - translation) + 0.5f;
+		direction[axis] = aRayDirection[axis] * 0.5f * largest;
+	}
+
+	auto nodeMayHit = [&](float lo, float hi) {
+		if (mesh) return hi >= iso;
+		for (auto const& entry : surfaces) {
+			if (entry.surface.getLow() <= hi && lo <= entry.surface.getHigh()) return true;
+		}
+		return false;
+	};
+	auto voxelHit = [&](int x, int y, int z) {
+		return mesh ? (*gVolume)(x, y, z) >= iso : mask.test(x, y, z);
+	};
+
+	int hit[3];
+	bool const found = gPickPyramid.cast(origin, direction, nodeMayHit, voxelHit, hit);
+	double const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	if (found) {
+		std::copy(hit, hit + 3, gPickedVoxel);
+		gHasPickedVoxel = true;
+		std::printf("Picked voxel (%d, %d, %d), density %.3f (%.3f ms)\n", hit[0], hit[1], hit[2],
+			(*gVolume)(hit[0], hit[1], hit[2]), ms);
+
+		if (gVolume->has_labels()) {
+			gCurrentLabel = gVolume->label(hit[0], hit[1], hit[2]);
+			printCurrentLabel();
+		}
+		if (gSelectiveRegionType == ESelectiveRegionType::component && gComponentsVolumeVersion == gVolumeVersion) {
+			selectComponent(gComponents.label(hit[0], hit[1], hit[2]));
+		}
+	} else {
+		std::printf("Nothing picked (%.3f ms)\n", ms);
+	}
+}
+
 void project_interact_mouse_wheel(bool aUp) {
 	// You can use this function however you wish. Make sure it receives the
 	// mouse wheel events.
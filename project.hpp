@@ -11,7 +11,5 @@ bool project_initialize();
 void project_draw_window( Vec3Df const& aCameraFwd, Vec3Df const& aCameraUp, Vec3Df const& aCameraPos);
 
 void project_interact_mouse_wheel( bool aUp );
+void project_pick( Vec3Df const& aRayOrigin, Vec3Df const& aRayDirection );
 void project_on_key_press( int, Vec3Df const& aCameraPos );
-
-Vec3Df gradient( Volume const&, int, int, int );
-
@@ -0,0 +1,156 @@
+#include "region_growing.hpp"
+
+#include <limits>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include <cstdint>
+
+#include "parallel.hpp"
+
+namespace
+{
+	struct Voxel_
+	{
+		std::uint32_t x, y, z;
+	};
+
+	struct Bounds_
+	{
+		int min[3];
+		int max[3];
+	};
+
+	// Number of frontier voxels that one task expands
+	std::size_t const kChunkSize = 4096;
+
+	void reset_bounds_( Bounds_& aBounds )
+	{
+		for( int axis = 0; axis < 3; ++axis )
+		{
+			aBounds.min[axis] = std::numeric_limits<int>::max();
+			aBounds.max[axis] = std::numeric_limits<int>::min();
+		}
+	}
+}
+
+GrownRegion grow_region( Volume const& aVolume, std::size_t aX, std::size_t aY, std::size_t aZ, float aLo, float aHi )
+{
+	std::size_t const size[3] = { aVolume.width(), aVolume.height(), aVolume.depth() };
+	std::size_t const wordsPerRow = (size[0] + 63) / 64;
+	std::size_t const wordCount = wordsPerRow * size[1] * size[2];
+
+	Bounds_ total;
+	reset_bounds_( total );
+
+	GrownRegion region;
+	std::copy( total.min, total.min+3, region.min );
+	std::copy( total.max, total.max+3, region.max );
+
+	auto in_range = [&] (std::size_t x, std::size_t y, std::size_t z) {
+		float const density = aVolume( x, y, z );
+		return density >= aLo && density <= aHi;
+	};
+
+	if( aX >= size[0] || aY >= size[1] || aZ >= size[2] || !in_range( aX, aY, aZ ) )
+	{
+		region.mask.assign( size[0], size[1], size[2], std::vector<std::uint64_t>( wordCount, 0 ) );
+		return region;
+	}
+
+	// The region so far, in the layout of OccupancyMask. (The vector value-
+	// initializes the atomics, i.e., clears all bits.)
+	std::vector<std::atomic<std::uint64_t>> bits( wordCount );
+	auto word_of = [&] (std::size_t x, std::size_t y, std::size_t z) -> std::atomic<std::uint64_t>& {
+		return bits[(z*size[1] + y)*wordsPerRow + x/64];
+	};
+
+	std::vector<Voxel_> frontier( 1, Voxel_{ std::uint32_t(aX), std::uint32_t(aY), std::uint32_t(aZ) } );
+	word_of( aX, aY, aZ ).fetch_or( std::uint64_t(1) << (aX % 64), std::memory_order_relaxed );
+
+	std::vector<std::vector<Voxel_>> queues;
+	std::vector<Bounds_> bounds;
+	while( !frontier.empty() )
+	{
+		std::size_t const chunks = (frontier.size() + kChunkSize-1) / kChunkSize;
+		if( queues.size() < chunks )
+		{
+			queues.resize( chunks );
+			bounds.resize( chunks );
+		}
+
+		concurrency::parallel_for( std::size_t(0), chunks, [&] (std::size_t aChunk) {
+			std::vector<Voxel_>& queue = queues[aChunk];
+			queue.clear();
+
+			Bounds_& b = bounds[aChunk];
+			reset_bounds_( b );
+
+			// Adds the voxel to the queue if it is in range, and no other
+			// task claimed it first. The plain load skips the atomic
+			// read-modify-write for voxels that are already in the region.
+			auto visit = [&] (std::size_t x, std::size_t y, std::size_t z) {
+				std::atomic<std::uint64_t>& word = word_of( x, y, z );
+				std::uint64_t const bit = std::uint64_t(1) << (x % 64);
+				if( word.load( std::memory_order_relaxed ) & bit )
+					return;
+				if( !in_range( x, y, z ) )
+					return;
+				if( word.fetch_or( bit, std::memory_order_relaxed ) & bit )
+					return;
+
+				queue.push_back( Voxel_{ std::uint32_t(x), std::uint32_t(y), std::uint32_t(z) } );
+			};
+
+			std::size_t const end = std::min( (aChunk+1)*kChunkSize, frontier.size() );
+			for( std::size_t i = aChunk*kChunkSize; i < end; ++i )
+			{
+				Voxel_ const v = frontier[i];
+
+				std::uint32_t const c[3] = { v.x, v.y, v.z };
+				for( int axis = 0; axis < 3; ++axis )
+				{
+					b.min[axis] = std::min( b.min[axis], int(c[axis]) );
+					b.max[axis] = std::max( b.max[axis], int(c[axis]) );
+				}
+
+				if( v.x > 0 ) visit( v.x-1, v.y, v.z );
+				if( v.x+1 < size[0] ) visit( v.x+1, v.y, v.z );
+				if( v.y > 0 ) visit( v.x, v.y-1, v.z );
+				if( v.y+1 < size[1] ) visit( v.x, v.y+1, v.z );
+				if( v.z > 0 ) visit( v.x, v.y, v.z-1 );
+				if( v.z+1 < size[2] ) visit( v.x, v.y, v.z+1 );
+			}
+		} );
+
+		// The queues form the next frontier.
+		std::size_t next = 0;
+		for( std::size_t i = 0; i < chunks; ++i )
+		{
+			next += queues[i].size();
+			for( int axis = 0; axis < 3; ++axis )
+			{
+				total.min[axis] = std::min( total.min[axis], bounds[i].min[axis] );
+				total.max[axis] = std::max( total.max[axis], bounds[i].max[axis] );
+			}
+		}
+
+		frontier.clear();
+		frontier.reserve( next );
+		for( std::size_t i = 0; i < chunks; ++i )
+			frontier.insert( frontier.end(), queues[i].begin(), queues[i].end() );
+	}
+
+	std::vector<std::uint64_t> words( wordCount );
+	std::size_t const slice = wordsPerRow * size[1];
+	concurrency::parallel_for( std::size_t(0), size[2], [&] (std::size_t aZ) {
+		for( std::size_t i = aZ*slice; i < (aZ+1)*slice; ++i )
+			words[i] = bits[i].load( std::memory_order_relaxed );
+	} );
+
+	region.mask.assign( size[0], size[1], size[2], std::move( words ) );
+	std::copy( total.min, total.min+3, region.min );
+	std::copy( total.max, total.max+3, region.max );
+	return region;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+#include "volume.hpp"
+#include "occupancy.hpp"
+
+/* Seeded region growing
+ *
+ * grow_region() selects the voxels that are connected to a seed voxel (via
+ * their six face neighbours) through voxels whose density lies in the range
+ * [aLo, aHi]:
+ *
+ *   GrownRegion region = grow_region( volume, x, y, z, d - tolerance, d + tolerance );
+ *   if( region.mask.test( x, y, z ) )
+ *      ...
+ *
+ * The region grows breadth-first, one frontier at a time. Each frontier is
+ * split into chunks that are expanded in parallel; every task collects the
+ * voxels that it reaches into its own queue, and the queues form the next
+ * frontier. Voxels are claimed with an atomic test-and-set of their bit, so
+ * each voxel enters exactly one queue.
+ *
+ * If the seed lies outside of the volume, or its density outside of the
+ * range, the region is empty (but its mask still has the size of the volume).
+ */
+struct GrownRegion
+{
+	OccupancyMask mask;
+
+	// Bounding box (inclusive) of the region; min > max if it is empty.
+	int min[3];
+	int max[3];
+};
+
+GrownRegion grow_region( Volume const&, std::size_t aX, std::size_t aY, std::size_t aZ, float aLo, float aHi );
@@ -0,0 +1,19 @@
+#include "sparse_volume.hpp"
+
+int const SparseVolume::kLeafLog2;
+int const SparseVolume::kLeafSize;
+int const SparseVolume::kLeafVoxels;
+
+SparseVolume::SparseVolume() = default;
+
+SparseVolume SparseVolume::from_volume( Volume const& aVolume, float aThreshold )
+{
+	return build( aVolume.width(), aVolume.height(), aVolume.depth(), aThreshold, [&] (std::size_t aX, std::size_t aY, std::size_t aZ) {
+		return aVolume( aX, aY, aZ );
+	} );
+}
+
+std::size_t SparseVolume::memory_bytes() const
+{
+	return mLeaves.size() * sizeof(Leaf) + mSlabFirstLeaf.size() * sizeof(std::size_t);
+}
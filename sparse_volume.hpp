@@ -0,0 +1,278 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "parallel.hpp"
+
+#include "volume.hpp"
+#include "occupancy.hpp"
+
+/* Sparse occupancy of a volume
+ *
+ * Most of the voxels of the sample datasets are (nearly) empty. A
+ * `SparseVolume` records where the active voxels of a volume are, i.e., the
+ * voxels whose density is at least the threshold given when it is built. The
+ * volume is split into leaves of 8^3 voxels; only leaves with at least one
+ * active voxel are stored, each with a bit mask of its active voxels.
+ *
+ * It doesn't store any densities, and doesn't replace the (dense) volume: it
+ * only serves to skip the empty parts of the volume when rebuilding occupancy
+ * masks. OccupancyMask::rebuild() only evaluates its predicate for the active
+ * voxels, which read their densities from the dense volume:
+ *
+ *   SparseVolume sparse = SparseVolume::from_volume( volume, 0.1f );
+ *   mask.rebuild( sparse, [&] (std::size_t x, std::size_t y, std::size_t z) {
+ *      return volume( x, y, z ) > 0.5f;
+ *   } );
+ *
+ * The leaves are stored in increasing z, with the leaves of each 8-slice slab
+ * stored together (see slab_leaves()), so that the slabs can be processed in
+ * parallel.
+ */
+class SparseVolume
+{
+	public:
+		static int const kLeafLog2 = 3;
+		static int const kLeafSize = 1 << kLeafLog2;         // voxels per leaf and axis
+		static int const kLeafVoxels = kLeafSize*kLeafSize*kLeafSize;
+
+		struct Leaf
+		{
+			int origin[3]; // voxel coordinates of the leaf's first voxel
+			std::uint64_t active[kLeafVoxels / 64]; // x fastest
+
+			static int index( int aX, int aY, int aZ ); // local coordinates
+		};
+
+	public:
+		SparseVolume();
+
+		SparseVolume( SparseVolume const& ) = delete;
+		SparseVolume& operator= (SparseVolume const&) = delete;
+
+		SparseVolume( SparseVolume&& ) = default;
+		SparseVolume& operator= (SparseVolume&&) = default;
+
+	public:
+		/* Builds the sparse occupancy of a volume of aWidth x aHeight x aDepth
+		 * voxels with the densities aDensity(x, y, z). aDensity is called
+		 * concurrently.
+		 */
+		template< typename tDensity >
+		static SparseVolume build( std::size_t aWidth, std::size_t aHeight, std::size_t aDepth, float aThreshold, tDensity&& aDensity );
+
+		static SparseVolume from_volume( Volume const&, float aThreshold );
+
+	public:
+		std::size_t width() const;
+		std::size_t height() const;
+		std::size_t depth() const;
+
+		float threshold() const;
+
+		std::size_t leaf_count() const;
+		std::size_t active_count() const;
+
+		// Memory used by the leaves
+		std::size_t memory_bytes() const;
+
+	public:
+		// The leaves of slab aSlab, i.e., with origin[2] == aSlab*kLeafSize.
+		std::size_t slab_count() const;
+		std::pair<Leaf const*, Leaf const*> slab_leaves( std::size_t aSlab ) const;
+
+	private:
+		std::size_t mSize[3] = { 0, 0, 0 };
+		float mThreshold = 0.f;
+
+		std::vector<Leaf> mLeaves;
+		std::vector<std::size_t> mSlabFirstLeaf; // slab_count()+1 entries
+		std::size_t mActiveCount = 0;
+};
+
+
+// Implementation:
+inline
+int SparseVolume::Leaf::index( int aX, int aY, int aZ )
+{
+	return (aZ*kLeafSize + aY)*kLeafSize + aX;
+}
+
+template< typename tDensity > inline
+SparseVolume SparseVolume::build( std::size_t aWidth, std::size_t aHeight, std::size_t aDepth, float aThreshold, tDensity&& aDensity )
+{
+	SparseVolume ret;
+	ret.mSize[0] = aWidth;
+	ret.mSize[1] = aHeight;
+	ret.mSize[2] = aDepth;
+	ret.mThreshold = aThreshold;
+
+	std::size_t const leaves[3] = {
+		(aWidth + kLeafSize-1) / kLeafSize,
+		(aHeight + kLeafSize-1) / kLeafSize,
+		(aDepth + kLeafSize-1) / kLeafSize
+	};
+
+	// Each slab of kLeafSize slices is built into its own list of leaves.
+	std::vector<std::vector<Leaf>> slabs( leaves[2] );
+	std::vector<std::size_t> slabActive( leaves[2], 0 );
+	concurrency::parallel_for( std::size_t(0), leaves[2], [&] (std::size_t bz) {
+		Leaf leaf;
+		for( std::size_t by = 0; by < leaves[1]; ++by )
+		{
+			for( std::size_t bx = 0; bx < leaves[0]; ++bx )
+			{
+				leaf.origin[0] = int(bx * kLeafSize);
+				leaf.origin[1] = int(by * kLeafSize);
+				leaf.origin[2] = int(bz * kLeafSize);
+				std::fill( leaf.active, leaf.active + kLeafVoxels/64, std::uint64_t(0) );
+
+				// Leaves on the border extend beyond the volume; those voxels
+				// are never active.
+				int const extent[3] = {
+					int(std::min<std::size_t>( kLeafSize, aWidth - bx*kLeafSize )),
+					int(std::min<std::size_t>( kLeafSize, aHeight - by*kLeafSize )),
+					int(std::min<std::size_t>( kLeafSize, aDepth - bz*kLeafSize ))
+				};
+
+				std::size_t active = 0;
+				for( int k = 0; k < extent[2]; ++k )
+				{
+					for( int j = 0; j < extent[1]; ++j )
+					{
+						for( int i = 0; i < extent[0]; ++i )
+						{
+							if( aDensity( bx*kLeafSize + i, by*kLeafSize + j, bz*kLeafSize + k ) >= aThreshold )
+							{
+								int const index = Leaf::index( i, j, k );
+								leaf.active[index / 64] |= std::uint64_t(1) << (index % 64);
+								++active;
+							}
+						}
+					}
+				}
+
+				if( active )
+				{
+					slabs[bz].push_back( leaf );
+					slabActive[bz] += active;
+				}
+			}
+		}
+	} );
+
+	std::size_t total = 0;
+	for( auto const& slab : slabs )
+		total += slab.size();
+
+	ret.mLeaves.reserve( total );
+	ret.mSlabFirstLeaf.reserve( slabs.size() + 1 );
+	for( std::size_t bz = 0; bz < slabs.size(); ++bz )
+	{
+		ret.mSlabFirstLeaf.push_back( ret.mLeaves.size() );
+		ret.mLeaves.insert( ret.mLeaves.end(), slabs[bz].begin(), slabs[bz].end() );
+		std::vector<Leaf>().swap( slabs[bz] );
+
+		ret.mActiveCount += slabActive[bz];
+	}
+	ret.mSlabFirstLeaf.push_back( ret.mLeaves.size() );
+
+	return ret;
+}
+
+inline
+std::size_t SparseVolume::width() const
+{
+	return mSize[0];
+}
+inline
+std::size_t SparseVolume::height() const
+{
+	return mSize[1];
+}
+inline
+std::size_t SparseVolume::depth() const
+{
+	return mSize[2];
+}
+
+inline
+float SparseVolume::threshold() const
+{
+	return mThreshold;
+}
+
+inline
+std::size_t SparseVolume::leaf_count() const
+{
+	return mLeaves.size();
+}
+inline
+std::size_t SparseVolume::active_count() const
+{
+	return mActiveCount;
+}
+
+inline
+std::size_t SparseVolume::slab_count() const
+{
+	return mSlabFirstLeaf.empty() ? 0 : mSlabFirstLeaf.size() - 1;
+}
+inline
+std::pair<SparseVolume::Leaf const*, SparseVolume::Leaf const*> SparseVolume::slab_leaves( std::size_t aSlab ) const
+{
+	assert( aSlab < slab_count() );
+	Leaf const* leaves = mLeaves.data();
+	return { leaves + mSlabFirstLeaf[aSlab], leaves + mSlabFirstLeaf[aSlab+1] };
+}
+
+template< typename tPredicate > inline
+void OccupancyMask::rebuild( SparseVolume const& aVolume, tPredicate&& aPredicate )
+{
+	mWidth = aVolume.width();
+	mHeight = aVolume.height();
+	mDepth = aVolume.depth();
+	mWordsPerRow = (mWidth + 63) / 64;
+
+	mWords.assign( mWordsPerRow * mHeight * mDepth, 0 );
+
+	// The slabs cover disjoint sets of rows, so they can be processed in
+	// parallel.
+	std::vector<std::size_t> slabCounts( aVolume.slab_count(), 0 );
+	concurrency::parallel_for( std::size_t(0), aVolume.slab_count(), [&] (std::size_t aSlab) {
+		std::size_t count = 0;
+
+		auto const leaves = aVolume.slab_leaves( aSlab );
+		for( auto const* leaf = leaves.first; leaf != leaves.second; ++leaf )
+		{
+			for( int w = 0; w < SparseVolume::kLeafVoxels/64; ++w )
+			{
+				for( std::uint64_t word = leaf->active[w]; word; word &= word - 1 )
+				{
+					int const index = w*64 + int(detail::occupancy_lowest_bit( word ));
+					std::size_t const x = leaf->origin[0] + index % SparseVolume::kLeafSize;
+					std::size_t const y = leaf->origin[1] + (index / SparseVolume::kLeafSize) % SparseVolume::kLeafSize;
+					std::size_t const z = leaf->origin[2] + index / (SparseVolume::kLeafSize*SparseVolume::kLeafSize);
+
+					if( aPredicate( x, y, z ) )
+					{
+						mWords[(z*mHeight + y) * mWordsPerRow + x/64] |= std::uint64_t(1) << (x % 64);
+						++count;
+					}
+				}
+			}
+		}
+
+		slabCounts[aSlab] = count;
+	} );
+
+	mCount = 0;
+	for( auto const count : slabCounts )
+		mCount += count;
+}
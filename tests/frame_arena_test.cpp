@@ -0,0 +1,131 @@
+/* Allocation counter for FrameArena
+ *
+ * Replaces the global operator new to count heap allocations, and plays
+ * frames that allocate their transient memory the way project.cpp does: a
+ * chunk for the vertex stream, point batches, and a vector that grows during
+ * the frame. Once the block has grown to the size of the largest frame (the
+ * frame after one that spilled into the heap regrows it), frames must not
+ * allocate at all.
+ */
+#include <new>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+
+#include "../frame_arena.hpp"
+
+namespace
+{
+	std::size_t gAllocations = 0;
+}
+
+void* operator new( std::size_t aSize )
+{
+	++gAllocations;
+	if( void* ptr = std::malloc( aSize ? aSize : 1 ) )
+		return ptr;
+	throw std::bad_alloc();
+}
+void operator delete( void* aPtr ) noexcept
+{
+	std::free( aPtr );
+}
+void operator delete( void* aPtr, std::size_t ) noexcept
+{
+	std::free( aPtr );
+}
+
+namespace
+{
+	int gFailures = 0;
+
+	void check_( bool aCondition, char const* aWhat, int aFrame )
+	{
+		if( aCondition )
+			return;
+
+		std::fprintf( stderr, "FAILED: %s (frame %d)\n", aWhat, aFrame );
+		++gFailures;
+	}
+
+	// The layout of project.cpp's StreamVertex and PackedPoint
+	struct Vertex_
+	{
+		float position[3];
+		float color[4];
+	};
+	struct Point_
+	{
+		std::int16_t x, y, z;
+		std::uint16_t label;
+		std::uint8_t color[4];
+	};
+
+	// Plays one frame; returns the number of heap allocations it made.
+	std::size_t play_frame_( FrameArena& aArena, std::size_t aPoints, int aFrame )
+	{
+		std::size_t const before = gAllocations;
+
+		aArena.reset();
+
+		Vertex_* const vertices = aArena.allocate<Vertex_>( 16384 );
+		check_( 0 == reinterpret_cast<std::uintptr_t>(vertices) % alignof(Vertex_), "vertices are aligned", aFrame );
+
+		for( int mode = 0; mode < 3; ++mode )
+		{
+			Point_* const batch = aArena.allocate<Point_>( 8 );
+			check_( 0 == reinterpret_cast<std::uintptr_t>(batch) % alignof(Point_), "batch is aligned", aFrame );
+			batch[7] = Point_();
+		}
+
+		ArenaVector<Point_> points{ ArenaAllocator<Point_>( aArena ) };
+		for( std::size_t i = 0; i < aPoints; ++i )
+			points.push_back( Point_{ std::int16_t(i), 0, 0, 0, { 0, 0, 0, 0 } } );
+
+		vertices[16383].color[3] = 1.f;
+
+		std::size_t const allocations = gAllocations - before;
+		check_( 0 == aArena.spills() || 0 != allocations, "spills go to the heap", aFrame );
+		return allocations;
+	}
+}
+
+int main()
+{
+	FrameArena arena;
+
+	// The first frame spills into the heap; the reset() at the start of the
+	// second one grows the block to fit.
+	// (That the first frame allocates also shows that the counter works.)
+	int frame = 0;
+	check_( 0 != play_frame_( arena, 10000, frame ), "the first frame spills into the heap", frame );
+	check_( 0 != arena.spills(), "the first frame spills into the heap", frame );
+	++frame;
+	play_frame_( arena, 10000, frame++ );
+	for( ; frame < 10; ++frame )
+	{
+		check_( 0 == play_frame_( arena, 10000, frame ), "steady-state frame doesn't allocate", frame );
+		check_( 0 == arena.spills(), "steady-state frame doesn't spill", frame );
+	}
+
+	// Likewise for a larger frame. Afterwards, frames up to that size fit.
+	play_frame_( arena, 50000, frame++ );
+	play_frame_( arena, 50000, frame++ );
+	for( int i = 0; i < 10; ++i, ++frame )
+	{
+		std::size_t const points = i % 2 ? 50000 : 10000;
+		check_( 0 == play_frame_( arena, points, frame ), "steady-state frame doesn't allocate", frame );
+		check_( 0 == arena.spills(), "steady-state frame doesn't spill", frame );
+	}
+
+	check_( arena.high_water() <= arena.capacity(), "the block holds the largest frame", frame );
+
+	if( gFailures )
+	{
+		std::fprintf( stderr, "%d failure(s)\n", gFailures );
+		return 1;
+	}
+
+	std::printf( "frame_arena_test: OK (block of %zu bytes)\n", arena.capacity() );
+	return 0;
+}
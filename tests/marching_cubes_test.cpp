@@ -0,0 +1,263 @@
+/* Sanity checks for the generated marching cubes tables
+ *
+ * The triangle table is generated from the inside/outside configuration of
+ * the corners of a cell (see make_case_() in marching_cubes.cpp). This test
+ * extracts
+ *
+ *   - each of the 256 configurations on its own: every edge between an inside
+ *     and an outside corner has exactly one vertex, the mesh is closed except
+ *     on the faces of the cell, and a configuration and its complement produce
+ *     the same number of triangles unless a face has two diagonally opposite
+ *     inside corners (these faces always separate the inside corners, so the
+ *     complement joins the pieces that the configuration keeps apart);
+ *   - a random volume, split into several bricks: the mesh is closed and
+ *     consistently oriented, i.e., each edge is used once in each direction,
+ *     except on the border of the volume;
+ *   - a sphere: the triangles face outwards, and enclose the right volume.
+ */
+#include <map>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include "../marching_cubes.hpp"
+
+namespace
+{
+	int gFailures = 0;
+
+	void check_( bool aCondition, char const* aWhat, char const* aTest, unsigned aCase )
+	{
+		if( aCondition )
+			return;
+
+		std::fprintf( stderr, "FAILED: %s (%s, case %u)\n", aWhat, aTest, aCase );
+		++gFailures;
+	}
+
+	// The chunks of a BrickedIsosurface as a single mesh; vertices that are
+	// created by several bricks (at identical positions) are merged.
+	struct Mesh_
+	{
+		std::vector<Vec3Df> positions, normals;
+		std::vector<std::array<unsigned,3>> triangles;
+	};
+
+	Mesh_ merge_chunks_( BrickedIsosurface const& aSurface )
+	{
+		Mesh_ ret;
+		std::map<std::array<float,3>, unsigned> indices;
+		for( auto const& chunk : aSurface.chunks() )
+		{
+			std::vector<unsigned> remap;
+			for( auto const& vertex : chunk.vertices )
+			{
+				std::array<float,3> const key = { vertex.p[0], vertex.p[1], vertex.p[2] };
+				auto const it = indices.emplace( key, unsigned(ret.positions.size()) );
+				if( it.second )
+				{
+					ret.positions.push_back( vertex.p );
+					ret.normals.push_back( vertex.n );
+				}
+				remap.push_back( it.first->second );
+			}
+
+			for( auto const& tri : chunk.triangles )
+				ret.triangles.push_back( { remap[tri.v[0]], remap[tri.v[1]], remap[tri.v[2]] } );
+		}
+		return ret;
+	}
+
+	// Vertex on the face of the box [0,aSize-1]^3 perpendicular to aAxis, on
+	// the low (aSide = 0) or high (aSide = 1) side? (The coordinates along the
+	// edge that a vertex lies on are interpolated, and not necessarily exact.)
+	bool on_face_( Vec3Df const& aP, std::size_t const* aSize, int aAxis, int aSide )
+	{
+		return std::fabs( aP[aAxis] - (aSide ? float(aSize[aAxis]-1) : 0.f) ) < 1e-4f;
+	}
+
+	/* Checks that the mesh is closed and consistently oriented: each edge is
+	 * used by one triangle in each direction. Edges whose vertices lie on the
+	 * same face of the volume (of size aSize) are where the mesh is cut off,
+	 * and may be used in one direction only.
+	 */
+	void check_closed_( Mesh_ const& aMesh, std::size_t const* aSize, char const* aTest, unsigned aCase )
+	{
+		std::map<std::pair<unsigned,unsigned>, int> edges;
+		for( auto const& tri : aMesh.triangles )
+		{
+			bool const degenerate = tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0];
+			check_( !degenerate, "triangles are not degenerate", aTest, aCase );
+
+			for( int i = 0; i < 3; ++i )
+				++edges[std::make_pair( tri[i], tri[(i+1)%3] )];
+		}
+
+		for( auto const& edge : edges )
+		{
+			check_( 1 == edge.second, "each edge is used once per direction", aTest, aCase );
+
+			if( edges.count( std::make_pair( edge.first.second, edge.first.first ) ) )
+				continue;
+
+			Vec3Df const& a = aMesh.positions[edge.first.first];
+			Vec3Df const& b = aMesh.positions[edge.first.second];
+
+			bool border = false;
+			for( int axis = 0; axis < 3; ++axis )
+			{
+				for( int side = 0; side < 2; ++side )
+					border = border || (on_face_( a, aSize, axis, side ) && on_face_( b, aSize, axis, side ));
+			}
+
+			check_( border, "the mesh is closed", aTest, aCase );
+		}
+	}
+
+	void test_cases_()
+	{
+		int const edgeCorners[12][2] = {
+			{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+			{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+			{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+		};
+		int const faceCorners[6][4] = {
+			{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+			{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+			{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }
+		};
+
+		std::size_t const size[3] = { 2, 2, 2 };
+
+		std::size_t triangles[256];
+		for( unsigned config = 0; config < 256; ++config )
+		{
+			auto inside = [&] (int aCorner) { return 0 != ((config >> aCorner) & 1); };
+
+			Volume volume( 2, 2, 2 );
+			for( int i = 0; i < 8; ++i )
+				volume( i&1, (i>>1)&1, (i>>2)&1 ) = inside( i ) ? 0.75f : 0.25f;
+
+			BrickedIsosurface surface;
+			surface.reset( volume );
+			surface.update( volume, 0.5f );
+
+			Mesh_ const mesh = merge_chunks_( surface );
+			triangles[config] = mesh.triangles.size();
+
+			std::size_t crossed = 0;
+			for( int e = 0; e < 12; ++e )
+				crossed += inside( edgeCorners[e][0] ) != inside( edgeCorners[e][1] ) ? 1 : 0;
+
+			check_( crossed == mesh.positions.size(), "one vertex per crossed edge", "cases", config );
+			check_closed_( mesh, size, "cases", config );
+		}
+
+		for( unsigned config = 0; config < 256; ++config )
+		{
+			bool ambiguous = false;
+			for( int f = 0; f < 6; ++f )
+			{
+				int const* c = faceCorners[f];
+				bool const in[4] = { 0 != ((config >> c[0]) & 1), 0 != ((config >> c[1]) & 1), 0 != ((config >> c[2]) & 1), 0 != ((config >> c[3]) & 1) };
+				ambiguous = ambiguous || (in[0] == in[2] && in[1] == in[3] && in[0] != in[1]);
+			}
+
+			if( !ambiguous )
+				check_( triangles[config] == triangles[255 ^ config], "complementary cases match", "cases", config );
+		}
+	}
+
+	void test_random_volume_()
+	{
+		std::size_t const size[3] = { 12, 11, 10 };
+
+		// Densities (k + 0.5)/1000 are never exactly at the isovalue, so no
+		// vertex coincides with a grid point.
+		Volume volume( size[0], size[1], size[2] );
+		std::uint32_t state = 12345;
+		for( std::size_t z = 0; z < size[2]; ++z )
+		{
+			for( std::size_t y = 0; y < size[1]; ++y )
+			{
+				for( std::size_t x = 0; x < size[0]; ++x )
+				{
+					state = state * 1664525u + 1013904223u;
+					volume( x, y, z ) = (float((state >> 8) % 1000) + 0.5f) / 1000.f;
+				}
+			}
+		}
+
+		// Small bricks, so that the seams between bricks are checked too.
+		BrickedIsosurface surface( 4 );
+		surface.reset( volume );
+		surface.update( volume, 0.5f );
+
+		Mesh_ const mesh = merge_chunks_( surface );
+		check_( !mesh.triangles.empty(), "the surface isn't empty", "random", 0 );
+		check_closed_( mesh, size, "random", 0 );
+	}
+
+	void test_sphere_()
+	{
+		std::size_t const size[3] = { 24, 24, 24 };
+		float const radius = 8.f, center = 11.7f;
+
+		Volume volume( size[0], size[1], size[2] );
+		for( std::size_t z = 0; z < size[2]; ++z )
+		{
+			for( std::size_t y = 0; y < size[1]; ++y )
+			{
+				for( std::size_t x = 0; x < size[0]; ++x )
+				{
+					Vec3Df const d = Vec3Df( float(x), float(y), float(z) ) - Vec3Df( center, center, center );
+					volume( x, y, z ) = radius - d.getLength();
+				}
+			}
+		}
+
+		BrickedIsosurface surface( 8 );
+		surface.reset( volume );
+		surface.update( volume, 0.f );
+
+		Mesh_ const mesh = merge_chunks_( surface );
+		check_closed_( mesh, size, "sphere", 0 );
+
+		// The enclosed volume (divergence theorem) is positive if the triangles
+		// are wound counter-clockwise when seen from the outside.
+		double enclosed = 0.0;
+		for( auto const& tri : mesh.triangles )
+		{
+			Vec3Df const& p0 = mesh.positions[tri[0]];
+			Vec3Df const& p1 = mesh.positions[tri[1]];
+			Vec3Df const& p2 = mesh.positions[tri[2]];
+			enclosed += Vec3Df::dotProduct( p0, Vec3Df::crossProduct( p1, p2 ) ) / 6.0;
+
+			Vec3Df const faceNormal = Vec3Df::crossProduct( p1 - p0, p2 - p0 );
+			Vec3Df const vertexNormal = mesh.normals[tri[0]] + mesh.normals[tri[1]] + mesh.normals[tri[2]];
+			check_( Vec3Df::dotProduct( faceNormal, vertexNormal ) > 0.f, "normals agree with the winding", "sphere", 0 );
+		}
+
+		double const expected = 4.0/3.0 * 3.14159265358979 * radius*radius*radius;
+		check_( std::fabs( enclosed - expected ) < 0.03 * expected, "enclosed volume", "sphere", 0 );
+	}
+}
+
+int main()
+{
+	test_cases_();
+	test_random_volume_();
+	test_sphere_();
+
+	if( gFailures )
+	{
+		std::fprintf( stderr, "%d failure(s)\n", gFailures );
+		return 1;
+	}
+
+	std::printf( "marching_cubes_test: OK\n" );
+	return 0;
+}
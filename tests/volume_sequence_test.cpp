@@ -0,0 +1,111 @@
+/* Regression test for VolumeSequence
+ *
+ * Plays sequences whose frame count isn't a multiple of the ring size (and
+ * one where it is) in a loop, and checks that every frame arrives, and is the
+ * right one. With slots chosen as frame % ring size, the window that wraps
+ * around the end of the sequence evicted one of its own frames, and playback
+ * got stuck there.
+ *
+ * Run from a writable directory; the frames are written to (and removed
+ * from) the current directory.
+ */
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "../volume_sequence.hpp"
+
+namespace
+{
+	int gFailures = 0;
+
+	void check_( bool aCondition, char const* aWhat, std::size_t aFrames, std::size_t aRing, std::size_t aFrame )
+	{
+		if( aCondition )
+			return;
+
+		std::fprintf( stderr, "FAILED: %s (%zu frames, ring %zu, frame %zu)\n", aWhat, aFrames, aRing, aFrame );
+		++gFailures;
+	}
+
+	// Frame i is 3x1x1 voxels: 20*(i+1), 0 and 255. The last two pin the
+	// normalization to [0,255], so the first voxel identifies the frame.
+	std::vector<std::string> write_frames_( std::size_t aCount )
+	{
+		std::vector<std::string> ret;
+		for( std::size_t i = 0; i < aCount; ++i )
+		{
+			std::string const base = "volume_sequence_test_" + std::to_string( i );
+
+			std::uint8_t const data[3] = { std::uint8_t(20*(i+1)), 0, 255 };
+			FILE* raw = std::fopen( (base + ".raw").c_str(), "wb" );
+			std::fwrite( data, 1, sizeof(data), raw );
+			std::fclose( raw );
+
+			FILE* mhd = std::fopen( (base + ".mhd").c_str(), "w" );
+			std::fprintf( mhd, "ObjectType = Image\nNDims = 3\nBinaryData = True\nDimSize = 3 1 1\n" );
+			std::fprintf( mhd, "ElementType = MET_UCHAR\nElementDataFile = %s.raw\n", base.c_str() );
+			std::fclose( mhd );
+
+			ret.push_back( base + ".mhd" );
+		}
+		return ret;
+	}
+
+	void remove_frames_( std::vector<std::string> const& aFiles )
+	{
+		for( auto const& file : aFiles )
+		{
+			std::remove( file.c_str() );
+			std::remove( (file.substr( 0, file.size() - 4 ) + ".raw").c_str() );
+		}
+	}
+
+	void test_playback_( std::size_t aFrames, std::size_t aRing )
+	{
+		std::vector<std::string> const files = write_frames_( aFrames );
+		{
+			VolumeSequence sequence( files, aRing );
+
+			// Three loops, as the player in project.cpp does: request() the
+			// next frame until it is decoded (here: wait() for it).
+			for( std::size_t n = 0; n < 3*aFrames; ++n )
+			{
+				std::size_t const frame = n % aFrames;
+				sequence.request( frame );
+
+				VolumeHandle const volume = sequence.wait( frame );
+				check_( !!volume, "frame arrives", aFrames, aRing, frame );
+				if( !volume )
+					break;
+
+				check_( 3 == volume->total_element_count(), "frame loaded", aFrames, aRing, frame );
+				if( 3 != volume->total_element_count() )
+					continue;
+
+				float const expected = float(20*(frame+1)) / 255.f;
+				check_( std::fabs( (*volume)( 0, 0, 0 ) - expected ) < 1e-5f, "right frame", aFrames, aRing, frame );
+			}
+		}
+		remove_frames_( files );
+	}
+}
+
+int main()
+{
+	test_playback_( 5, 4 ); // frame count % ring != 0
+	test_playback_( 7, 3 );
+	test_playback_( 5, 5 );
+	test_playback_( 3, 4 ); // ring larger than the sequence
+
+	if( gFailures )
+	{
+		std::fprintf( stderr, "%d failure(s)\n", gFailures );
+		return 1;
+	}
+
+	std::printf( "volume_sequence_test: OK\n" );
+	return 0;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+/* Packets of 3D vectors, for processing several vectors at once.
+ *
+ * `Vec3DPack<tType, tLanes>` holds tLanes 3D vectors in a structure-of-arrays
+ * layout: all x components next to each other, followed by all y and all z
+ * components. Each component is a `Pack<tType, tLanes>`, i.e., tLanes values
+ * of type tType that are processed together:
+ *
+ *   Vec3DPack<float,8> normals = ...;
+ *   Pack<float,8> dots = Vec3DPack<float,8>::dotProduct( normals, Vec3DPack<float,8>( lightdir ) );
+ *
+ * computes eight dot products. Each lane computes exactly what the Vec3D
+ * operation would (same operations in the same order), so the results match
+ * the scalar code.
+ *
+ * The operations are written as plain loops over the lanes, which compilers
+ * turn into SIMD instructions: with 8 float lanes and AVX enabled (see
+ * premake5.lua), e.g., the addition of two packs is a single instruction. No
+ * intrinsics are used, so the code stays portable; a platform without (wide
+ * enough) SIMD just gets the scalar loops.
+ *
+ * Vec3DPack provides the same operators as Vec3D (see vec3D.hpp) and the
+ * subset of the Vec3D methods that make sense lane-wise. Individual vectors
+ * are accessed with get() and set(); a Vec3D can be broadcast to all lanes
+ * with the explicit constructor.
+ */
+
+#include <cstddef>
+
+#include "vec3D.hpp"
+
+template< typename tType, std::size_t tLanes >
+class Pack
+{
+	static_assert( tLanes > 0 && 0 == (tLanes & (tLanes-1)), "Pack: the number of lanes must be a power of two" );
+
+	public:
+		using element_type = tType;
+		static std::size_t const kLanes = tLanes;
+
+	public:
+		inline Pack(); // zero-initialized, like Vec3D
+		explicit Pack( tType ); // broadcast
+
+		Pack( Pack const& ) = default;
+		Pack& operator= (Pack const&) = default;
+
+	public:
+		tType& operator[] (std::size_t);
+		tType const& operator[] (std::size_t) const;
+
+	public:
+		alignas(sizeof(tType)*tLanes) tType v[tLanes];
+};
+
+template< typename tType, std::size_t tLanes >
+class Vec3DPack
+{
+	public:
+		using element_type = tType;
+		using lane_type = Pack<tType,tLanes>;
+		static std::size_t const kLanes = tLanes;
+
+	public:
+		Vec3DPack() = default;
+		Vec3DPack( lane_type const&, lane_type const&, lane_type const& );
+		explicit Vec3DPack( Vec3D<tType> const& ); // broadcast
+
+		Vec3DPack( Vec3DPack const& ) = default;
+		Vec3DPack& operator= (Vec3DPack const&) = default;
+
+	public:
+		Vec3D<tType> get( std::size_t aLane ) const;
+		void set( std::size_t aLane, Vec3D<tType> const& );
+
+	public:
+		lane_type getSquaredLength() const;
+		lane_type getLength() const;
+
+		// Normalizes each lane; lanes with zero length are left unchanged.
+		lane_type normalize();
+
+	public:
+		static lane_type dotProduct( Vec3DPack const&, Vec3DPack const& );
+		static lane_type squaredDistance( Vec3DPack const&, Vec3DPack const& );
+		static lane_type distance( Vec3DPack const&, Vec3DPack const& );
+
+		static Vec3DPack crossProduct( Vec3DPack const&, Vec3DPack const& );
+		static Vec3DPack interpolate( Vec3DPack const&, Vec3DPack const&, lane_type const& );
+
+	public:
+		lane_type x, y, z;
+};
+
+// Pack: unary operators
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> operator- (Pack<tType,tLanes> const&);
+
+// Pack: binary operators (lane-wise); the scalar versions broadcast the scalar
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> operator+ (Pack<tType,tLanes> const&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> operator- (Pack<tType,tLanes> const&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> operator* (Pack<tType,tLanes> const&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> operator/ (Pack<tType,tLanes> const&, Pack<tType,tLanes> const&);
+
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> operator* (Pack<tType,tLanes> const&, tType);
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> operator* (tType, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> operator/ (Pack<tType,tLanes> const&, tType);
+
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes>& operator+= (Pack<tType,tLanes>&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes>& operator-= (Pack<tType,tLanes>&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes>& operator*= (Pack<tType,tLanes>&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes>& operator/= (Pack<tType,tLanes>&, Pack<tType,tLanes> const&);
+
+// Pack: lane-wise functions
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> sqrt( Pack<tType,tLanes> const& );
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> min( Pack<tType,tLanes> const&, Pack<tType,tLanes> const& );
+template< typename tType, std::size_t tLanes >
+Pack<tType,tLanes> max( Pack<tType,tLanes> const&, Pack<tType,tLanes> const& );
+
+// Vec3DPack: unary operators
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator+ (Vec3DPack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator- (Vec3DPack<tType,tLanes> const&);
+
+// Vec3DPack: binary operators
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator+ (Vec3DPack<tType,tLanes> const&, Vec3DPack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator- (Vec3DPack<tType,tLanes> const&, Vec3DPack<tType,tLanes> const&);
+
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator* (Vec3DPack<tType,tLanes> const&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator* (Pack<tType,tLanes> const&, Vec3DPack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator* (Vec3DPack<tType,tLanes> const&, tType);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator* (tType, Vec3DPack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator* (Vec3DPack<tType,tLanes> const&, Vec3DPack<tType,tLanes> const&);
+
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator/ (Vec3DPack<tType,tLanes> const&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator/ (Vec3DPack<tType,tLanes> const&, tType);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes> operator/ (Vec3DPack<tType,tLanes> const&, Vec3DPack<tType,tLanes> const&);
+
+// Vec3DPack: binary self-assignment
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes>& operator+= (Vec3DPack<tType,tLanes>&, Vec3DPack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes>& operator-= (Vec3DPack<tType,tLanes>&, Vec3DPack<tType,tLanes> const&);
+
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes>& operator*= (Vec3DPack<tType,tLanes>&, Vec3DPack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes>& operator*= (Vec3DPack<tType,tLanes>&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes>& operator*= (Vec3DPack<tType,tLanes>&, tType);
+
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes>& operator/= (Vec3DPack<tType,tLanes>&, Vec3DPack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes>& operator/= (Vec3DPack<tType,tLanes>&, Pack<tType,tLanes> const&);
+template< typename tType, std::size_t tLanes >
+Vec3DPack<tType,tLanes>& operator/= (Vec3DPack<tType,tLanes>&, tType);
+
+
+/* Default packets: 8 float lanes fill an AVX register.
+ */
+using Packf = Pack<float,8>;
+using Vec3DfPack = Vec3DPack<float,8>;
+
+#include "vec3DPack.inl"
@@ -0,0 +1,331 @@
+/* This file defines the inlinable functions from vec3DPack.hpp.
+ *
+ * All lane-wise operations are simple loops over a compile-time number of
+ * lanes, without branches, so that the compiler can vectorize them.
+ */
+
+#include <cmath>
+
+// Pack
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes>::Pack()
+{
+	for( std::size_t i = 0; i < tLanes; ++i )
+		v[i] = tType();
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes>::Pack( tType aValue )
+{
+	for( std::size_t i = 0; i < tLanes; ++i )
+		v[i] = aValue;
+}
+
+template< typename tType, std::size_t tLanes > inline
+tType& Pack<tType,tLanes>::operator[] (std::size_t aLane)
+{
+	return v[aLane];
+}
+template< typename tType, std::size_t tLanes > inline
+tType const& Pack<tType,tLanes>::operator[] (std::size_t aLane) const
+{
+	return v[aLane];
+}
+
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> operator- (Pack<tType,tLanes> const& aU)
+{
+	Pack<tType,tLanes> ret;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		ret.v[i] = -aU.v[i];
+	return ret;
+}
+
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> operator+ (Pack<tType,tLanes> const& aU, Pack<tType,tLanes> const& aV)
+{
+	Pack<tType,tLanes> ret;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		ret.v[i] = aU.v[i] + aV.v[i];
+	return ret;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> operator- (Pack<tType,tLanes> const& aU, Pack<tType,tLanes> const& aV)
+{
+	Pack<tType,tLanes> ret;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		ret.v[i] = aU.v[i] - aV.v[i];
+	return ret;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> operator* (Pack<tType,tLanes> const& aU, Pack<tType,tLanes> const& aV)
+{
+	Pack<tType,tLanes> ret;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		ret.v[i] = aU.v[i] * aV.v[i];
+	return ret;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> operator/ (Pack<tType,tLanes> const& aU, Pack<tType,tLanes> const& aV)
+{
+	Pack<tType,tLanes> ret;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		ret.v[i] = aU.v[i] / aV.v[i];
+	return ret;
+}
+
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> operator* (Pack<tType,tLanes> const& aU, tType aX)
+{
+	return aU * Pack<tType,tLanes>( aX );
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> operator* (tType aX, Pack<tType,tLanes> const& aU)
+{
+	return Pack<tType,tLanes>( aX ) * aU;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> operator/ (Pack<tType,tLanes> const& aU, tType aX)
+{
+	return aU / Pack<tType,tLanes>( aX );
+}
+
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes>& operator+= (Pack<tType,tLanes>& aU, Pack<tType,tLanes> const& aV)
+{
+	return aU = aU + aV;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes>& operator-= (Pack<tType,tLanes>& aU, Pack<tType,tLanes> const& aV)
+{
+	return aU = aU - aV;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes>& operator*= (Pack<tType,tLanes>& aU, Pack<tType,tLanes> const& aV)
+{
+	return aU = aU * aV;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes>& operator/= (Pack<tType,tLanes>& aU, Pack<tType,tLanes> const& aV)
+{
+	return aU = aU / aV;
+}
+
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> sqrt( Pack<tType,tLanes> const& aU )
+{
+	Pack<tType,tLanes> ret;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		ret.v[i] = std::sqrt( aU.v[i] );
+	return ret;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> min( Pack<tType,tLanes> const& aU, Pack<tType,tLanes> const& aV )
+{
+	Pack<tType,tLanes> ret;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		ret.v[i] = aV.v[i] < aU.v[i] ? aV.v[i] : aU.v[i];
+	return ret;
+}
+template< typename tType, std::size_t tLanes > inline
+Pack<tType,tLanes> max( Pack<tType,tLanes> const& aU, Pack<tType,tLanes> const& aV )
+{
+	Pack<tType,tLanes> ret;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		ret.v[i] = aU.v[i] < aV.v[i] ? aV.v[i] : aU.v[i];
+	return ret;
+}
+
+
+// Vec3DPack
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>::Vec3DPack( lane_type const& aX, lane_type const& aY, lane_type const& aZ )
+	: x(aX)
+	, y(aY)
+	, z(aZ)
+{}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>::Vec3DPack( Vec3D<tType> const& aV )
+	: x(aV[0])
+	, y(aV[1])
+	, z(aV[2])
+{}
+
+template< typename tType, std::size_t tLanes > inline
+Vec3D<tType> Vec3DPack<tType,tLanes>::get( std::size_t aLane ) const
+{
+	return Vec3D<tType>( x.v[aLane], y.v[aLane], z.v[aLane] );
+}
+template< typename tType, std::size_t tLanes > inline
+void Vec3DPack<tType,tLanes>::set( std::size_t aLane, Vec3D<tType> const& aV )
+{
+	x.v[aLane] = aV[0];
+	y.v[aLane] = aV[1];
+	z.v[aLane] = aV[2];
+}
+
+template< typename tType, std::size_t tLanes > inline
+auto Vec3DPack<tType,tLanes>::getSquaredLength() const -> lane_type
+{
+	return x*x + y*y + z*z;
+}
+template< typename tType, std::size_t tLanes > inline
+auto Vec3DPack<tType,tLanes>::getLength() const -> lane_type
+{
+	return sqrt( getSquaredLength() );
+}
+
+template< typename tType, std::size_t tLanes > inline
+auto Vec3DPack<tType,tLanes>::normalize() -> lane_type
+{
+	lane_type const length = getLength();
+
+	// Divide zero-length lanes by one (instead of branching), which
+	// leaves them unchanged, as Vec3D::normalize() does.
+	lane_type divisor;
+	for( std::size_t i = 0; i < tLanes; ++i )
+		divisor.v[i] = tType(0) == length.v[i] ? tType(1) : length.v[i];
+
+	x /= divisor;
+	y /= divisor;
+	z /= divisor;
+	return length;
+}
+
+template< typename tType, std::size_t tLanes > inline
+auto Vec3DPack<tType,tLanes>::dotProduct( Vec3DPack const& aU, Vec3DPack const& aV ) -> lane_type
+{
+	return aU.x*aV.x + aU.y*aV.y + aU.z*aV.z;
+}
+template< typename tType, std::size_t tLanes > inline
+auto Vec3DPack<tType,tLanes>::squaredDistance( Vec3DPack const& aU, Vec3DPack const& aV ) -> lane_type
+{
+	return (aU-aV).getSquaredLength();
+}
+template< typename tType, std::size_t tLanes > inline
+auto Vec3DPack<tType,tLanes>::distance( Vec3DPack const& aU, Vec3DPack const& aV ) -> lane_type
+{
+	return (aU-aV).getLength();
+}
+
+template< typename tType, std::size_t tLanes > inline
+auto Vec3DPack<tType,tLanes>::crossProduct( Vec3DPack const& aU, Vec3DPack const& aV ) -> Vec3DPack
+{
+	return Vec3DPack(
+		aU.y*aV.z - aU.z*aV.y,
+		aU.z*aV.x - aU.x*aV.z,
+		aU.x*aV.y - aU.y*aV.x
+	);
+}
+template< typename tType, std::size_t tLanes > inline
+auto Vec3DPack<tType,tLanes>::interpolate( Vec3DPack const& aU, Vec3DPack const& aV, lane_type const& aAlpha ) -> Vec3DPack
+{
+	return aU * (lane_type( tType(1) ) - aAlpha) + aV * aAlpha;
+}
+
+
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator+ (Vec3DPack<tType,tLanes> const& aU)
+{
+	return aU;
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator- (Vec3DPack<tType,tLanes> const& aU)
+{
+	return { -aU.x, -aU.y, -aU.z };
+}
+
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator+ (Vec3DPack<tType,tLanes> const& aU, Vec3DPack<tType,tLanes> const& aV)
+{
+	return { aU.x+aV.x, aU.y+aV.y, aU.z+aV.z };
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator- (Vec3DPack<tType,tLanes> const& aU, Vec3DPack<tType,tLanes> const& aV)
+{
+	return { aU.x-aV.x, aU.y-aV.y, aU.z-aV.z };
+}
+
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator* (Vec3DPack<tType,tLanes> const& aU, Pack<tType,tLanes> const& aX)
+{
+	return { aU.x*aX, aU.y*aX, aU.z*aX };
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator* (Pack<tType,tLanes> const& aX, Vec3DPack<tType,tLanes> const& aU)
+{
+	return { aX*aU.x, aX*aU.y, aX*aU.z };
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator* (Vec3DPack<tType,tLanes> const& aU, tType aX)
+{
+	return aU * Pack<tType,tLanes>( aX );
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator* (tType aX, Vec3DPack<tType,tLanes> const& aU)
+{
+	return Pack<tType,tLanes>( aX ) * aU;
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator* (Vec3DPack<tType,tLanes> const& aU, Vec3DPack<tType,tLanes> const& aV)
+{
+	return { aU.x*aV.x, aU.y*aV.y, aU.z*aV.z };
+}
+
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator/ (Vec3DPack<tType,tLanes> const& aU, Pack<tType,tLanes> const& aX)
+{
+	return { aU.x/aX, aU.y/aX, aU.z/aX };
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator/ (Vec3DPack<tType,tLanes> const& aU, tType aX)
+{
+	return aU / Pack<tType,tLanes>( aX );
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes> operator/ (Vec3DPack<tType,tLanes> const& aU, Vec3DPack<tType,tLanes> const& aV)
+{
+	return { aU.x/aV.x, aU.y/aV.y, aU.z/aV.z };
+}
+
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>& operator+= (Vec3DPack<tType,tLanes>& aU, Vec3DPack<tType,tLanes> const& aV)
+{
+	return aU = aU + aV;
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>& operator-= (Vec3DPack<tType,tLanes>& aU, Vec3DPack<tType,tLanes> const& aV)
+{
+	return aU = aU - aV;
+}
+
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>& operator*= (Vec3DPack<tType,tLanes>& aU, Vec3DPack<tType,tLanes> const& aV)
+{
+	return aU = aU * aV;
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>& operator*= (Vec3DPack<tType,tLanes>& aU, Pack<tType,tLanes> const& aX)
+{
+	return aU = aU * aX;
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>& operator*= (Vec3DPack<tType,tLanes>& aU, tType aX)
+{
+	return aU = aU * aX;
+}
+
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>& operator/= (Vec3DPack<tType,tLanes>& aU, Vec3DPack<tType,tLanes> const& aV)
+{
+	return aU = aU / aV;
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>& operator/= (Vec3DPack<tType,tLanes>& aU, Pack<tType,tLanes> const& aX)
+{
+	return aU = aU / aX;
+}
+template< typename tType, std::size_t tLanes > inline
+Vec3DPack<tType,tLanes>& operator/= (Vec3DPack<tType,tLanes>& aU, tType aX)
+{
+	return aU = aU / aX;
+}
@@ -1,23 +1,56 @@
 #include "volume.hpp"
 
+#include <cmath>
 #include <cstdio>
+#include <cstdint>
 #include <cstring>
 
-#include <limits>
+#include <memory>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <tuple>
+#include <vector>
 #include <string>
 #include <sstream>
 #include <algorithm>
 #include <stdexcept>
 
+#include "parallel.hpp"
+
 #include "miniz.h"
+#include "volume_stats.hpp"
 
 namespace
 {
 	enum class MHDType
 	{
 		unknown,
+		s8,
 		u8,
-		s16
+		s16,
+		u16,
+		s32,
+		u32,
+		f32,
+		f64
+	};
+
+	struct MHDTypeName
+	{
+		char const* name;
+		MHDType type;
+	};
+
+	MHDTypeName const kMHDTypeNames[] = {
+		{ "MET_CHAR", MHDType::s8 },
+		{ "MET_UCHAR", MHDType::u8 },
+		{ "MET_SHORT", MHDType::s16 },
+		{ "MET_USHORT", MHDType::u16 },
+		{ "MET_INT", MHDType::s32 },
+		{ "MET_UINT", MHDType::u32 },
+		{ "MET_FLOAT", MHDType::f32 },
+		{ "MET_DOUBLE", MHDType::f64 }
 	};
 	
 	struct MHDInfo
@@ -25,6 +58,7 @@ namespace
 		bool typeIsImage     = false;
 		bool dataIsBinary    = false;
 		bool dataCompressed  = false;
+		bool byteOrderMSB    = false;
 
 		int ndims            = -1;
 		int x = -1, y = -1, z = -1;
@@ -35,10 +69,12 @@ namespace
 	};
 
 
+	class DataSource_;
+
 	template< typename tElementType >
-	Volume load_data_raw_( FILE* );
+	std::vector<tElementType> load_data_raw_( DataSource_&, MHDInfo const& );
 	template< typename tElementType >
-	Volume load_data_compressed_( FILE* );
+	std::vector<tElementType> load_data_compressed_( DataSource_&, MHDInfo const& );
 
 
 	// This is a helper class + function for ON_SCOPE_EXIT().
@@ -64,53 +100,234 @@ namespace
 
 namespace
 {
+	/* Where the volume data comes from: a file next to the .mhd, or an entry
+	 * of the same .zip archive as the .mhd.
+	 */
+	class DataSource_
+	{
+		public:
+			virtual ~DataSource_() = default;
+
+			// Reads exactly aSize bytes (all of the data).
+			virtual void read( void* aBuffer, std::size_t aSize ) = 0;
+
+			// Passes all of the data to aConsume, a chunk at a time.
+			virtual void stream( std::function<void (std::uint8_t const*, std::size_t)> const& aConsume ) = 0;
+	};
+
+	class FileSource_ : public DataSource_
+	{
+		public:
+			explicit FileSource_( FILE* aFile ) : mFile(aFile) {}
+
+			void read( void* aBuffer, std::size_t aSize ) override
+			{
+				if( aSize != std::fread( aBuffer, 1, aSize, mFile ) )
+					throw std::runtime_error( "Could not read volume data" );
+			}
+
+			void stream( std::function<void (std::uint8_t const*, std::size_t)> const& aConsume ) override
+			{
+				std::vector<std::uint8_t> chunk( std::size_t(1) << 20 );
+				while( std::size_t const rd = std::fread( chunk.data(), 1, chunk.size(), mFile ) )
+					aConsume( chunk.data(), rd );
+
+				if( std::ferror( mFile ) )
+					throw std::runtime_error( "Could not read compressed volume data" );
+			}
+
+		private:
+			FILE* mFile;
+	};
+
+	class ZipArchive_
+	{
+		public:
+			explicit ZipArchive_( std::string const& aFileName )
+			{
+				if( !mz_zip_reader_init_file( &mZip, aFileName.c_str(), 0 ) )
+					throw std::runtime_error( "Could not open archive '" + aFileName + "': " + mz_zip_get_error_string( mz_zip_get_last_error( &mZip ) ) );
+			}
+			~ZipArchive_()
+			{
+				mz_zip_reader_end( &mZip );
+			}
+
+			ZipArchive_( ZipArchive_ const& ) = delete;
+			ZipArchive_& operator= (ZipArchive_ const&) = delete;
+
+			mz_zip_archive* get()
+			{
+				return &mZip;
+			}
+
+			mz_uint locate( std::string const& aEntry )
+			{
+				int const index = mz_zip_reader_locate_file( &mZip, aEntry.c_str(), nullptr, 0 );
+				if( index < 0 )
+					throw std::runtime_error( "Archive has no entry '" + aEntry + "'" );
+
+				return mz_uint(index);
+			}
+
+			mz_uint64 size( mz_uint aIndex )
+			{
+				mz_zip_archive_file_stat stat;
+				if( !mz_zip_reader_file_stat( &mZip, aIndex, &stat ) )
+					fail( "stat" );
+
+				return stat.m_uncomp_size;
+			}
+
+			[[noreturn]] void fail( char const* aWhat )
+			{
+				throw std::runtime_error( std::string( "miniz: archive " ) + aWhat + " failed: " + mz_zip_get_error_string( mz_zip_get_last_error( &mZip ) ) );
+			}
+
+		private:
+			mz_zip_archive mZip{};
+	};
+
+	/* Stored entries are read straight into the destination; deflated ones
+	 * are inflated by miniz as they are read, either into the destination
+	 * (read()) or in chunks (stream()).
+	 */
+	class ZipSource_ : public DataSource_
+	{
+		public:
+			ZipSource_( ZipArchive_& aArchive, mz_uint aIndex ) : mArchive(aArchive), mIndex(aIndex) {}
+
+			void read( void* aBuffer, std::size_t aSize ) override
+			{
+				if( aSize != mArchive.size( mIndex ) )
+					throw std::runtime_error( "Could not read volume data (size mismatch)" );
+
+				if( !mz_zip_reader_extract_to_mem( mArchive.get(), mIndex, aBuffer, aSize, 0 ) )
+					mArchive.fail( "extraction" );
+			}
+
+			void stream( std::function<void (std::uint8_t const*, std::size_t)> const& aConsume ) override
+			{
+				// Exceptions must not cross miniz; they are rethrown below.
+				struct Context_
+				{
+					std::function<void (std::uint8_t const*, std::size_t)> const* consume;
+					std::exception_ptr error;
+				} context{ &aConsume, nullptr };
+
+				auto write = [] (void* aOpaque, mz_uint64, void const* aBuf, std::size_t aSize) -> std::size_t {
+					auto& ctx = *static_cast<Context_*>(aOpaque);
+					try
+					{
+						(*ctx.consume)( static_cast<std::uint8_t const*>(aBuf), aSize );
+						return aSize;
+					}
+					catch( ... )
+					{
+						ctx.error = std::current_exception();
+						return 0;
+					}
+				};
+
+				mz_bool const ok = mz_zip_reader_extract_to_callback( mArchive.get(), mIndex, write, &context, 0 );
+				if( context.error )
+					std::rethrow_exception( context.error );
+				if( !ok )
+					mArchive.fail( "extraction" );
+			}
+
+		private:
+			ZipArchive_& mArchive;
+			mz_uint mIndex;
+	};
+
+	// Splits "bundle.zip/dir/volume.mhd" into the archive and the entry.
+	bool split_archive_path_( std::string const& aFileName, std::string& aArchive, std::string& aEntry )
+	{
+		std::size_t const pos = aFileName.find( ".zip/" );
+		if( std::string::npos == pos )
+			return false;
+
+		aArchive = aFileName.substr( 0, pos + 4 );
+		aEntry = aFileName.substr( pos + 5 );
+		return true;
+	}
+}
+
+namespace
+{
+	/* Finds the minimum of the raw data and the range that maps the data to
+	 * densities in [0,1]: density = (value - min) / range.
+	 */
 	template< typename tType > inline
-	Volume load_data_raw_( FILE* aFile, MHDInfo const& aInfo )
+	std::pair<float,float> value_range_( std::vector<tType> const& aBuffer, MHDInfo const& aInfo )
 	{
-		std::vector<tType> buffer( aInfo.x*aInfo.y*aInfo.z );
-		auto rd = std::fread( buffer.data(), sizeof(tType), buffer.size(), aFile );
-		if( rd != buffer.size() )
-			throw std::runtime_error( "Could not read volume data" );
-	
+		std::size_t const sliceSize = std::size_t(aInfo.x) * aInfo.y;
+
+		// A plain min/max loop (unlike std::minmax_element, which tracks
+		// positions) is vectorized by the compiler.
+		std::vector<float> sliceMin( aInfo.z ), sliceMax( aInfo.z );
+		concurrency::parallel_for( std::size_t(0), std::size_t(aInfo.z), [&] (std::size_t aZ) {
+			tType const* const slice = aBuffer.data() + aZ*sliceSize;
+
+			tType lo = slice[0], hi = slice[0];
+			for( std::size_t i = 1; i < sliceSize; ++i )
+			{
+				lo = slice[i] < lo ? slice[i] : lo;
+				hi = slice[i] > hi ? slice[i] : hi;
+			}
+
+			sliceMin[aZ] = float(lo);
+			sliceMax[aZ] = float(hi);
+		} );
+
+		float const minf = *std::min_element( sliceMin.begin(), sliceMin.end() );
+		float const maxf = *std::max_element( sliceMax.begin(), sliceMax.end() );
+
+		// A constant volume maps to all zeros (instead of dividing by zero).
+		return std::make_pair( minf, maxf > minf ? maxf - minf : 1.f );
+	}
+
+	/* Converts the raw data to densities in [0,1] and computes the volume's
+	 * statistics in the same (parallel) pass. Only the min/max search needs
+	 * a separate pass over the data.
+	 */
+	template< typename tType > inline
+	Volume normalize_( std::vector<tType> const& aBuffer, MHDInfo const& aInfo )
+	{
+		float minf, range;
+		std::tie( minf, range ) = value_range_( aBuffer, aInfo );
+
 		Volume ret( aInfo.x, aInfo.y, aInfo.z );
+		float* const data = ret.data();
 
-		float minf = float(std::numeric_limits<tType>::max());
-		float maxf = float(std::numeric_limits<tType>::min());
-		for( auto const elem : buffer )
-		{
-			float const elemf = float(elem);
-			if( elemf > maxf ) maxf = elemf;
-			else if( elemf < minf ) minf = elemf;
-		}
-		
-		std::transform( buffer.begin(), buffer.end(), ret.data(), [&] (tType aValue) {
-			return (aValue-minf) / (maxf-minf);
+		auto stats = compute_statistics( aBuffer.data(), aInfo.x, aInfo.y, aInfo.z, minf, range, [data] (std::size_t aIndex, float aDensity) {
+			data[aIndex] = aDensity;
 		} );
+		ret.set_statistics( std::make_shared<VolumeStatistics const>( std::move(stats) ) );
 
 		return ret;
 	}
 
 	template< typename tType > inline
-	Volume load_data_compressed_( FILE* aFile, MHDInfo const& aInfo )
+	std::vector<tType> load_data_raw_( DataSource_& aSource, MHDInfo const& aInfo )
 	{
-		// Figure out size of compressed data
-		std::fseek( aFile, 0, SEEK_END );
-		auto const size = std::ftell( aFile );
-		std::fseek( aFile, 0, SEEK_SET );
-
-		// Read compressed data
-		std::vector<std::uint8_t> compressed( size );
-		auto rd = std::fread( compressed.data(), 1, size, aFile );
-		if( long(rd) != size )
-			throw std::runtime_error( "Could not read compressed volume data" );
-		
-		// Decompress using the "miniz" library.
 		std::vector<tType> buffer( aInfo.x*aInfo.y*aInfo.z );
+		aSource.read( buffer.data(), buffer.size()*sizeof(tType) );
+	
+		return buffer;
+	}
+
+	template< typename tType > inline
+	std::vector<tType> load_data_compressed_( DataSource_& aSource, MHDInfo const& aInfo )
+	{
+		// Decompress using the "miniz" library, as the compressed data comes
+		// in (without keeping all of it in memory).
+		std::vector<tType> buffer( aInfo.x*aInfo.y*aInfo.z );
+		std::size_t const bytes = buffer.size()*sizeof(tType);
 
 		mz_stream mzs{};
-		mzs.avail_in = unsigned(compressed.size());
-		mzs.next_in = compressed.data();
-		mzs.avail_out = unsigned(buffer.size()*sizeof(tType));
+		mzs.avail_out = unsigned(bytes);
 		mzs.next_out = reinterpret_cast<std::uint8_t*>(buffer.data());
 
 		auto iret = mz_inflateInit( &mzs );
@@ -121,177 +338,484 @@ namespace
 			throw std::runtime_error( oss.str() );
 		}
 
-		auto jret = mz_inflate( &mzs, MZ_FINISH );
+		ON_SCOPE_EXIT( [&] { mz_inflateEnd( &mzs ); } );
 
-		mz_inflateEnd( &mzs );
-		
-		if( MZ_OK != jret )
-		{
-			if( MZ_STREAM_END == jret && mzs.total_out == buffer.size()*sizeof(tType) )
-			{
-				/* OK, seems like the some of the compressed streams aren't
-				 * properly finalized or something. So, if the error is
-				 * MZ_STREAM_END but we've got all our data, we're going to
-				 * YOLO it and ignore the error.
-				 */
-			}
-			else
+		bool done = false;
+		aSource.stream( [&] (std::uint8_t const* aData, std::size_t aSize) {
+			mzs.next_in = aData;
+			mzs.avail_in = unsigned(aSize);
+
+			while( !done && mzs.avail_in )
 			{
-				std::ostringstream oss;
-				oss << "miniz: decompression failed: " << mz_error(jret);
-				throw std::runtime_error( oss.str() );
+				auto jret = mz_inflate( &mzs, MZ_NO_FLUSH );
+				if( MZ_STREAM_END == jret )
+					done = true;
+				else if( MZ_BUF_ERROR == jret && 0 == mzs.avail_out )
+				{
+					/* OK, seems like the some of the compressed streams aren't
+					 * properly finalized or something. So, if there is more
+					 * data but we've got all our data, we're going to YOLO it
+					 * and ignore the rest.
+					 */
+					done = true;
+				}
+				else if( MZ_OK != jret )
+				{
+					std::ostringstream oss;
+					oss << "miniz: decompression failed: " << mz_error(jret);
+					throw std::runtime_error( oss.str() );
+				}
 			}
-		}
+		} );
 
-		Volume ret( aInfo.x, aInfo.y, aInfo.z );
+		if( mzs.total_out != bytes )
+			throw std::runtime_error( "miniz: decompression failed: compressed volume data is truncated" );
 
-		float minf = float(std::numeric_limits<tType>::max());
-		float maxf = float(std::numeric_limits<tType>::min());
-		for( auto const elem : buffer )
-		{
-			float const elemf = float(elem);
-			if( elemf > maxf ) maxf = elemf;
-			else if( elemf < minf ) minf = elemf;
-		}
+		return buffer;
+	}
 
-		std::transform( buffer.begin(), buffer.end(), ret.data(), [&] (tType aValue) {
-			return (aValue-minf) / (maxf-minf);
-		} );
+	bool host_is_msb_()
+	{
+		std::uint16_t const probe = 1;
+		std::uint8_t first;
+		std::memcpy( &first, &probe, 1 );
+		return 0 == first;
+	}
+
+	// Unsigned integer of the same size as an element type
+	template< std::size_t tSize > struct SwapType_;
+	template<> struct SwapType_<1> { using Type = std::uint8_t; };
+	template<> struct SwapType_<2> { using Type = std::uint16_t; };
+	template<> struct SwapType_<4> { using Type = std::uint32_t; };
+	template<> struct SwapType_<8> { using Type = std::uint64_t; };
 
+	template< typename tUnsigned > inline
+	tUnsigned byte_swap_( tUnsigned aValue )
+	{
+		tUnsigned ret = 0;
+		for( std::size_t i = 0; i < sizeof(tUnsigned); ++i )
+		{
+			ret = tUnsigned((ret << 8) | (aValue & 0xff));
+			aValue = tUnsigned(aValue >> 8);
+		}
 		return ret;
 	}
-}
-
 
-Volume load_mhd_volume( char const* aFileName ) try
-{
-	// Load the .mhd, which gives us the meta data for the volume.
-	FILE* mhd = std::fopen( aFileName, "rb" );
-	if( !mhd )
-		throw std::runtime_error( "Could not open source file" );
+	/* Reverses the byte order of each element, in parallel chunks. The loop
+	 * works on the unsigned integers with the elements' bits (via memcpy), so
+	 * the shifts (which the compiler turns into bswap or byte shuffles) also
+	 * work for floats.
+	 */
+	template< typename tType > inline
+	void swap_byte_order_( std::vector<tType>& aBuffer )
+	{
+		using Unsigned = typename SwapType_<sizeof(tType)>::Type;
+		if( 1 == sizeof(tType) )
+			return;
+
+		std::size_t const chunk = std::size_t(1) << 16;
+		std::size_t const chunkCount = (aBuffer.size() + chunk-1) / chunk;
+		concurrency::parallel_for( std::size_t(0), chunkCount, [&] (std::size_t aChunk) {
+			std::size_t const end = std::min( (aChunk+1)*chunk, aBuffer.size() );
+			for( std::size_t i = aChunk*chunk; i < end; ++i )
+			{
+				Unsigned bits;
+				std::memcpy( &bits, &aBuffer[i], sizeof(bits) );
+				bits = byte_swap_( bits );
+				std::memcpy( &aBuffer[i], &bits, sizeof(bits) );
+			}
+		} );
+	}
 
-	ON_SCOPE_EXIT( [&] { std::fclose( mhd ); } );
+	// Calls aFunc with a value of the C++ type of aType.
+	template< typename tFunc > inline
+	auto with_element_type_( MHDType aType, tFunc&& aFunc )
+	{
+		switch( aType )
+		{
+			case MHDType::s8: return aFunc( std::int8_t() );
+			case MHDType::u8: return aFunc( std::uint8_t() );
+			case MHDType::s16: return aFunc( std::int16_t() );
+			case MHDType::u16: return aFunc( std::uint16_t() );
+			case MHDType::s32: return aFunc( std::int32_t() );
+			case MHDType::u32: return aFunc( std::uint32_t() );
+			case MHDType::f32: return aFunc( float() );
+			case MHDType::f64: return aFunc( double() );
+			case MHDType::unknown: assert(!"Unkown element type"); break;
+		}
 
-	MHDInfo info;
+		// Should be unreachable.
+		throw std::runtime_error( "Element type of binary data is not recognized" );
+	}
 
-	int line = 1;
-	char name[64] = "";
-	char value[64] = "";
+	void report_error_( char const* aFileName, std::exception const& aError )
+	{
+		std::fprintf( stderr, "Error while loading MHD file \"%s\":\n", aFileName ),
+		std::fprintf( stderr, "  - %s\n", aError.what() );
+	}
 
-	while( 2 == std::fscanf( mhd, "%63s = %63[^\n\r]", name, value ) )
+	/* Parses the .mhd and reads the raw data, which is passed (as a
+	 * std::vector of the file's element type) to aConvert( data, info ).
+	 */
+	template< typename tConvert >
+	auto load_mhd_( char const* aFileName, tConvert&& aConvert )
 	{
-		if( 0 == std::strcmp( "ObjectType", name ) )
-			info.typeIsImage = (0 == std::strcmp( "Image", value ));
-		else if( 0 == std::strcmp( "BinaryData", name ) )
-			info.dataIsBinary = (0 == std::strcmp( "True", value));
-		else if( 0 == std::strcmp( "CompressedData", name ) )
-			info.dataCompressed = (0 == std::strcmp( "True", value));
-		else if( 0 == std::strcmp( "NDims", name ) )
+		/* Load the .mhd, which gives us the meta data for the volume. It is
+		 * either a file, or an entry of a .zip archive ("bundle.zip/x.mhd"),
+		 * in which case the data is read from the same archive.
+		 */
+		std::string archiveName, entryName;
+		bool const fromArchive = split_archive_path_( aFileName, archiveName, entryName );
+
+		std::unique_ptr<ZipArchive_> archive;
+		std::string header;
+		if( fromArchive )
 		{
-			char dummy;
-			if( 1 != std::sscanf( value, "%d%c", &info.ndims, &dummy ) )
-				throw std::runtime_error( "MHD: NDims should be a single integer" );
+			archive.reset( new ZipArchive_( archiveName ) );
+
+			mz_uint const index = archive->locate( entryName );
+			header.resize( std::size_t(archive->size( index )) );
+			ZipSource_( *archive, index ).read( &header[0], header.size() );
 		}
-		else if( 0 == std::strcmp( "DimSize", name ) )
+		else
 		{
-			char dummy;
-			if( 3 != std::sscanf( value, "%d %d %d%c", &info.x, &info.y, &info.z, &dummy ) )
-				throw std::runtime_error( "MHD: DimSize should be three integers" );
+			FILE* mhd = std::fopen( aFileName, "rb" );
+			if( !mhd )
+				throw std::runtime_error( "Could not open source file" );
+
+			ON_SCOPE_EXIT( [&] { std::fclose( mhd ); } );
+
+			char chunk[4096];
+			while( std::size_t const rd = std::fread( chunk, 1, sizeof(chunk), mhd ) )
+				header.append( chunk, rd );
 		}
-		else if( 0 == std::strcmp( "ElementType", name ) )
+
+		MHDInfo info;
+
+		int line = 1;
+		char name[64] = "";
+		char value[64] = "";
+
+		std::istringstream lines( header );
+		std::string text;
+		while( std::getline( lines, text ) )
 		{
-			if( 0 == std::strcmp( "MET_UCHAR", value ) )
-				info.elementType = MHDType::u8;
-			else if( 0 == std::strcmp( "MET_SHORT", value ) )
-				info.elementType = MHDType::s16;
+			if( std::string::npos == text.find_first_not_of( " \t\r" ) )
+				continue;
+
+			if( 2 != std::sscanf( text.c_str(), "%63s = %63[^\n\r]", name, value ) )
+			{
+				std::fprintf( stderr, "MHD (%s): ignored garbage on line %d\n", aFileName, line );
+				break;
+			}
+
+
+			if( 0 == std::strcmp( "ObjectType", name ) )
+				info.typeIsImage = (0 == std::strcmp( "Image", value ));
+			else if( 0 == std::strcmp( "BinaryData", name ) )
+				info.dataIsBinary = (0 == std::strcmp( "True", value));
+			else if( 0 == std::strcmp( "CompressedData", name ) )
+				info.dataCompressed = (0 == std::strcmp( "True", value));
+			else if( 0 == std::strcmp( "NDims", name ) )
+			{
+				char dummy;
+				if( 1 != std::sscanf( value, "%d%c", &info.ndims, &dummy ) )
+					throw std::runtime_error( "MHD: NDims should be a single integer" );
+			}
+			else if( 0 == std::strcmp( "DimSize", name ) )
+			{
+				char dummy;
+				if( 3 != std::sscanf( value, "%d %d %d%c", &info.x, &info.y, &info.z, &dummy ) )
+					throw std::runtime_error( "MHD: DimSize should be three integers" );
+			}
+			else if( 0 == std::strcmp( "BinaryDataByteOrderMSB", name ) || 0 == std::strcmp( "ElementByteOrderMSB", name ) )
+				info.byteOrderMSB = (0 == std::strcmp( "True", value));
+			else if( 0 == std::strcmp( "ElementType", name ) )
+			{
+				auto const known = std::find_if( std::begin(kMHDTypeNames), std::end(kMHDTypeNames), [&] (MHDTypeName const& aType) {
+					return 0 == std::strcmp( aType.name, value );
+				} );
+
+				if( std::end(kMHDTypeNames) != known )
+					info.elementType = known->type;
+				else
+				{
+					std::ostringstream oss;
+					oss << "MHD: ElementType '" << value << "' unknown";
+					throw std::runtime_error( oss.str() );
+				}
+			}
+			else if( 0 == std::strcmp( "ElementDataFile", name ) )
+			{
+				info.dataFile = value;
+			}
 			else
 			{
-				std::ostringstream oss;
-				oss << "MHD: ElementType '" << value << "' unknown";
-				throw std::runtime_error( oss.str() );
+#				if 0
+				std::fprintf( stderr, "Line %d: unused '%s' = '%s'\n", line, name, value );
+#				endif
 			}
+		
+			++line;
 		}
-		else if( 0 == std::strcmp( "ElementDataFile", name ) )
+
+		// Verify that this makes sense
+		if( !info.typeIsImage )
+			throw std::runtime_error( "Only support ObjectType = Image." );
+
+		if( !info.dataIsBinary )
+			throw std::runtime_error( "Only support binary data (BinaryData = True)" );
+
+		if( MHDType::unknown == info.elementType )
+			throw std::runtime_error( "Element type of binary data is not recognized" );
+
+		/* Note: this is unlikely to trigger, since we explicitly try to parse
+		 * DimSize with three integers.
+		 */
+		if( 3 != info.ndims )
+			throw std::runtime_error( "Only support 3D volumes" );
+
+		if( info.x <= 0 || info.y <= 0 || info.z <= 0 )
+			throw std::runtime_error( "Volume size is invalid (DimSize should be three positive integers" );
+
+		// Try to read the volume data, which is next to the .mhd
+		std::string const mhdName = fromArchive ? entryName : std::string( aFileName );
+		std::size_t const lastSlash = mhdName.find_last_of( '/' );
+		std::string const dataName = (std::string::npos != lastSlash ? mhdName.substr( 0, lastSlash+1 ) : std::string()) + info.dataFile;
+
+		std::unique_ptr<DataSource_> source;
+		FILE* dataFile = nullptr;
+		ON_SCOPE_EXIT( [&] { if( dataFile ) std::fclose( dataFile ); } );
+
+		if( fromArchive )
 		{
-			info.dataFile = value;
+			source.reset( new ZipSource_( *archive, archive->locate( dataName ) ) );
 		}
 		else
 		{
-#			if 0
-			std::fprintf( stderr, "Line %d: unused '%s' = '%s'\n", line, name, value );
-#			endif
+			dataFile = std::fopen( dataName.c_str(), "rb" );
+			if( !dataFile )
+			{
+				std::ostringstream emsg;
+				emsg << "Could not open volume data '" << dataName << "' for reading";
+				throw std::runtime_error( emsg.str() );
+			}
+
+			source.reset( new FileSource_( dataFile ) );
 		}
-		
-		++line;
-	}
 
-	if( !std::feof(mhd) )
-	{
-		std::fprintf( stderr, "MHD (%s): ignored garbage on line %d\n", aFileName, line );
+		DataSource_& data = *source;
+
+		return with_element_type_( info.elementType, [&] (auto aElement) {
+			using Element = decltype(aElement);
+
+			std::vector<Element> buffer = info.dataCompressed
+				? load_data_compressed_<Element>( data, info )
+				: load_data_raw_<Element>( data, info );
+
+			if( info.byteOrderMSB != host_is_msb_() )
+				swap_byte_order_( buffer );
+
+			return aConvert( buffer, info );
+		} );
 	}
+}
 
-	// Verify that this makes sense
-	if( !info.typeIsImage )
-		throw std::runtime_error( "Only support ObjectType = Image." );
 
-	if( !info.dataIsBinary )
-		throw std::runtime_error( "Only support binary data (BinaryData = True)" );
+Volume load_mhd_volume( char const* aFileName ) try
+{
+	return load_mhd_( aFileName, [] (auto const& aBuffer, MHDInfo const& aInfo) {
+		return normalize_( aBuffer, aInfo );
+	} );
+}
+catch( std::exception const& eError )
+{
+	report_error_( aFileName, eError );
+	return Volume( 0, 0, 0 );
+}
 
-	if( MHDType::unknown == info.elementType )
-		throw std::runtime_error( "Element type of binary data is not recognized" );
+bool load_mhd_labels( char const* aFileName, Volume& aVolume ) try
+{
+	std::vector<std::uint16_t> labels = load_mhd_( aFileName, [&] (auto const& aBuffer, MHDInfo const& aInfo) {
+		using Element = typename std::decay_t<decltype(aBuffer)>::value_type;
+		using Unsigned = typename std::conditional_t<std::is_integral<Element>::value, std::make_unsigned<Element>, std::common_type<Element>>::type;
+		if( !std::is_integral<Element>::value || sizeof(Element) > 2 )
+			throw std::runtime_error( "Labels must be 8- or 16-bit integers" );
+
+		if( std::size_t(aInfo.x) != aVolume.width() || std::size_t(aInfo.y) != aVolume.height() || std::size_t(aInfo.z) != aVolume.depth() )
+			throw std::runtime_error( "Labels don't have the size of the volume" );
+
+		std::vector<std::uint16_t> ret( aBuffer.size() );
+		concurrency::parallel_for( std::size_t(0), std::size_t(aInfo.z), [&] (std::size_t aZ) {
+			std::size_t const slice = std::size_t(aInfo.x) * aInfo.y;
+			for( std::size_t i = aZ*slice; i < (aZ+1)*slice; ++i )
+				ret[i] = std::uint16_t(Unsigned(aBuffer[i]));
+		} );
+		return ret;
+	} );
+
+	aVolume.set_labels( std::move(labels) );
+	return true;
+}
+catch( std::exception const& eError )
+{
+	report_error_( aFileName, eError );
+	return false;
+}
+
+
+namespace
+{
+	// Chunks of the data that are deflated independently, in parallel.
+	std::size_t const kDeflateChunkBytes_ = std::size_t(1) << 22;
+	int const kDeflateLevel_ = 6;
+
+	// See adler32_combine() in zlib: the Adler-32 of the concatenation of two
+	// blocks, from their Adler-32s and the length of the second block.
+	std::uint32_t adler32_combine_( std::uint32_t aFirst, std::uint32_t aSecond, std::size_t aSecondLength )
+	{
+		std::uint64_t const base = 65521;
+		std::uint64_t const rem = aSecondLength % base;
+
+		std::uint64_t sum1 = aFirst & 0xffff;
+		std::uint64_t sum2 = (rem * sum1) % base;
+		sum1 += (aSecond & 0xffff) + base - 1;
+		sum2 += (aFirst >> 16) + (aSecond >> 16) + base - rem;
 
-	/* Note: this is unlikely to trigger, since we explicitly try to parse
-	 * DimSize with three integers.
+		sum1 %= base;
+		sum2 %= base;
+		return std::uint32_t(sum1 | (sum2 << 16));
+	}
+
+	/* Deflates aData into a zlib stream. Each chunk is compressed on its own
+	 * (raw deflate, without the history of the previous chunks); all but the
+	 * last one end with a sync flush, so that they are byte aligned and none
+	 * of them is marked as the final block. Concatenated, and wrapped in the
+	 * zlib header and the Adler-32 of the data, they form a valid stream.
 	 */
-	if( 3 != info.ndims )
-		throw std::runtime_error( "Only support 3D volumes" );
+	std::vector<std::uint8_t> deflate_parallel_( std::uint8_t const* aData, std::size_t aSize )
+	{
+		std::size_t const chunkCount = std::max( (aSize + kDeflateChunkBytes_-1) / kDeflateChunkBytes_, std::size_t(1) );
+
+		std::vector<std::vector<std::uint8_t>> chunks( chunkCount );
+		std::vector<std::uint32_t> adlers( chunkCount );
+		concurrency::parallel_for( std::size_t(0), chunkCount, [&] (std::size_t aChunk) {
+			std::size_t const begin = aChunk * kDeflateChunkBytes_;
+			std::size_t const size = std::min( kDeflateChunkBytes_, aSize - begin );
+
+			adlers[aChunk] = std::uint32_t(mz_adler32( MZ_ADLER32_INIT, aData + begin, size ));
+
+			auto put = [] (void const* aBuf, int aLength, void* aUser) -> mz_bool {
+				auto& out = *static_cast<std::vector<std::uint8_t>*>(aUser);
+				out.insert( out.end(), static_cast<std::uint8_t const*>(aBuf), static_cast<std::uint8_t const*>(aBuf) + aLength );
+				return MZ_TRUE;
+			};
+
+			std::unique_ptr<tdefl_compressor> compressor( new tdefl_compressor );
+			int const flags = int(tdefl_create_comp_flags_from_zip_params( kDeflateLevel_, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY ));
+			tdefl_init( compressor.get(), put, &chunks[aChunk], flags );
+
+			tdefl_flush const flush = aChunk+1 == chunkCount ? TDEFL_FINISH : TDEFL_SYNC_FLUSH;
+			tdefl_status const status = tdefl_compress_buffer( compressor.get(), aData + begin, size, flush );
+			if( (TDEFL_FINISH == flush ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY) != status )
+				throw std::runtime_error( "miniz: compression failed" );
+		} );
 
-	if( info.x <= 0 || info.y <= 0 || info.z <= 0 )
-		throw std::runtime_error( "Volume size is invalid (DimSize should be three positive integers" );
+		std::uint32_t adler = adlers[0];
+		std::size_t total = 2 + 4;
+		for( std::size_t i = 0; i < chunkCount; ++i )
+		{
+			if( i > 0 )
+				adler = adler32_combine_( adler, adlers[i], std::min( kDeflateChunkBytes_, aSize - i*kDeflateChunkBytes_ ) );
+			total += chunks[i].size();
+		}
 
-	// Try to read the volume data
-	std::ostringstream oss;
-	
-	if( char const* lastSlash = std::strrchr( aFileName, '/' ) )
-		oss << std::string( aFileName, lastSlash ) << "/";
+		std::vector<std::uint8_t> ret;
+		ret.reserve( total );
+		ret.push_back( 0x78 ); // deflate, 32k window
+		ret.push_back( 0x9c ); // default level; (0x789c % 31) == 0
+		for( auto const& chunk : chunks )
+			ret.insert( ret.end(), chunk.begin(), chunk.end() );
+		for( int shift = 24; shift >= 0; shift -= 8 )
+			ret.push_back( std::uint8_t(adler >> shift) );
 
-	oss << info.dataFile; 
+		return ret;
+	}
 
-	FILE* data = std::fopen( oss.str().c_str(), "rb" );
-	if( !data )
+	template< typename tType > inline
+	std::vector<tType> quantize_( Volume const& aVolume, float aScale )
 	{
-		std::ostringstream emsg;
-		emsg << "Could not open volume data '" << oss.str() << "' for reading";
-		throw std::runtime_error( emsg.str() );
+		std::vector<tType> ret( aVolume.total_element_count() );
+
+		std::size_t const sliceSize = aVolume.width() * aVolume.height();
+		float const* const data = aVolume.data();
+		concurrency::parallel_for( std::size_t(0), aVolume.depth(), [&] (std::size_t aZ) {
+			for( std::size_t i = aZ*sliceSize; i < (aZ+1)*sliceSize; ++i )
+				ret[i] = tType(std::lround( std::min( std::max( data[i], 0.f ), 1.f ) * aScale ));
+		} );
+
+		return ret;
 	}
 
-	ON_SCOPE_EXIT( [&] { std::fclose( data ); } );
+	void write_file_( std::string const& aFileName, void const* aData, std::size_t aSize )
+	{
+		FILE* file = std::fopen( aFileName.c_str(), "wb" );
+		if( !file )
+			throw std::runtime_error( "Could not open '" + aFileName + "' for writing" );
+
+		ON_SCOPE_EXIT( [&] { std::fclose( file ); } );
 
-	if( !info.dataCompressed )
+		if( aSize != std::fwrite( aData, 1, aSize, file ) )
+			throw std::runtime_error( "Could not write '" + aFileName + "'" );
+	}
+}
+
+void save_mhd_volume( Volume const& aVolume, char const* aFileName, EMHDElementType aType, bool aCompressed )
+{
+	// The data file goes next to the .mhd, which refers to it by its name.
+	std::string const mhdName = aFileName;
+	std::size_t const slash = mhdName.find_last_of( "/\\" );
+	std::size_t const dot = mhdName.find_last_of( '.' );
+	std::string const stem = mhdName.substr( 0, (std::string::npos != dot && (std::string::npos == slash || dot > slash)) ? dot : std::string::npos );
+	std::string const dataName = stem + (aCompressed ? ".zraw" : ".raw");
+
+	std::vector<std::uint8_t> bytes;
+	char const* elementType = nullptr;
+	switch( aType )
 	{
-		switch( info.elementType )
+		case EMHDElementType::u8:
 		{
-			case MHDType::u8: return load_data_raw_<std::uint8_t>( data, info );
-			case MHDType::s16: return load_data_raw_<std::int16_t>( data, info );
-			case MHDType::unknown: assert(!"Unkown element type"); break;
+			bytes = quantize_<std::uint8_t>( aVolume, 255.f );
+			elementType = "MET_UCHAR";
+			break;
 		}
-	}
-	else
-	{
-		switch( info.elementType )
+		case EMHDElementType::s16:
 		{
-			case MHDType::u8: return load_data_compressed_<std::uint8_t>( data, info );
-			case MHDType::s16: return load_data_compressed_<std::int16_t>( data, info );
-			case MHDType::unknown: assert(!"Unkown element type"); break;
+			auto const values = quantize_<std::int16_t>( aVolume, 32767.f );
+			bytes.resize( values.size() * sizeof(std::int16_t) );
+			std::memcpy( bytes.data(), values.data(), bytes.size() );
+			elementType = "MET_SHORT";
+			break;
 		}
 	}
 
-	// Should be unreachable.
-	return Volume(0,0,0);
-}
-catch( std::exception const& eError )
-{
-	std::fprintf( stderr, "Error while loading MHD file \"%s\":\n", aFileName ),
-	std::fprintf( stderr, "  - %s\n", eError.what() );
-	return Volume( 0, 0, 0 );
+	if( aCompressed )
+		bytes = deflate_parallel_( bytes.data(), bytes.size() );
+
+	write_file_( dataName, bytes.data(), bytes.size() );
+
+	std::ostringstream mhd;
+	mhd << "ObjectType = Image\n"
+		<< "NDims = 3\n"
+		<< "BinaryData = True\n"
+		<< "BinaryDataByteOrderMSB = " << (host_is_msb_() ? "True" : "False") << "\n"
+		<< "CompressedData = " << (aCompressed ? "True" : "False") << "\n";
+	if( aCompressed )
+		mhd << "CompressedDataSize = " << bytes.size() << "\n";
+	mhd << "DimSize = " << aVolume.width() << " " << aVolume.height() << " " << aVolume.depth() << "\n"
+		<< "ElementType = " << elementType << "\n"
+		<< "ElementDataFile = " << dataName.substr( std::string::npos == slash ? 0 : slash+1 ) << "\n";
+
+	std::string const header = mhd.str();
+	write_file_( mhdName, header.data(), header.size() );
 }
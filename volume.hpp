@@ -1,9 +1,12 @@
 #pragma once
 
+#include <memory>
 #include <vector>
+#include <utility>
 
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 
 /* A 3D volume
  *
@@ -33,12 +36,46 @@
  *
  * The total number of elements in the volume is given by
  * `total_element_count()`, which is equal to `width()*height()*depth()`.
+ *
+ * A volume may carry `VolumeStatistics` (histograms, percentiles; see
+ * volume_stats.hpp) of its densities. Volumes loaded with `load_mhd_volume()`
+ * always have them. They must be recomputed (or dropped) if the densities
+ * are modified.
+ *
+ * A volume may also have a second channel: a 16-bit label per voxel, e.g.,
+ * from a segmentation. The labels are stored next to the densities, in an
+ * array of their own with the same layout, so passes over the densities
+ * don't pay for the labels and vice versa:
+ *
+ *   if( myVolume.has_labels() )
+ *      std::uint16_t label = myVolume.label( 1, 3, 8 );
+ *
+ * Use `load_mhd_labels()` to load them from an MHD file.
+ *
+ * Volumes are large, so they can't be copied by accident: a Volume can only be
+ * moved. To share a volume, e.g., between the current dataset and a list of
+ * loaded datasets, wrap it into a `VolumeHandle`:
+ *
+ *   VolumeHandle volume = make_volume_handle( load_mhd_volume( "..." ) );
+ *   VolumeHandle current = volume; // O(1), refers to the same densities
+ *
+ * The handle is reference-counted and refers to an immutable (const) volume,
+ * so holders of a handle don't need to worry about others modifying it. The
+ * volume is freed together with its last handle.
  */
+class VolumeStatistics;
+
 class Volume
 {
 	public:
 		Volume( std::size_t aWidth, std::size_t aHeight, std::size_t aDepth );
 
+		Volume( Volume const& ) = delete;
+		Volume& operator= (Volume const&) = delete;
+
+		Volume( Volume&& ) = default;
+		Volume& operator= (Volume&&) = default;
+
 	public:
 		float& operator() (std::size_t aI, std::size_t aJ, std::size_t aK);
 		float const& operator() (std::size_t aI, std::size_t aJ, std::size_t aK) const;
@@ -54,16 +91,68 @@ class Volume
 
 		std::size_t to_linear_index( std::size_t, std::size_t, std::size_t ) const;
 
+	public:
+		bool has_statistics() const;
+		VolumeStatistics const& statistics() const;
+		std::shared_ptr<VolumeStatistics const> const& statistics_handle() const;
+
+		void set_statistics( std::shared_ptr<VolumeStatistics const> );
+
+	public:
+		bool has_labels() const;
+		std::uint16_t label( std::size_t aI, std::size_t aJ, std::size_t aK ) const;
+
+		std::uint16_t const* labels() const;
+
+		// total_element_count() labels, or none to remove the labels.
+		void set_labels( std::vector<std::uint16_t> );
+
 	private:
 		std::vector<float> mData;
 		std::size_t mWidth, mHeight, mDepth;
+
+		std::vector<std::uint16_t> mLabels; // empty if there are none
+
+		std::shared_ptr<VolumeStatistics const> mStatistics;
 };
 
+using VolumeHandle = std::shared_ptr<Volume const>;
+
+// Moves aVolume into a new (shared, immutable) volume.
+VolumeHandle make_volume_handle( Volume&& aVolume );
+
 /* Use this method to load a Volume from a file. We've included two example
  * volumes in the `data/` subdirectory.
+ *
+ * The .mhd may also be an entry of a .zip archive, which then contains the
+ * data as well: "data/bundle.zip/bonsai.mhd" loads "bonsai.mhd" from
+ * "data/bundle.zip", and its ElementDataFile (relative to the .mhd) from
+ * the same archive.
  */
 Volume load_mhd_volume( char const* aFileName );
 
+/* Loads the labels of aVolume from aFileName (.mhd, as above). The file must
+ * have the size of aVolume, and 8- or 16-bit integer elements (signed ones
+ * are taken as unsigned). Returns false (and leaves aVolume as-is) on errors.
+ */
+bool load_mhd_labels( char const* aFileName, Volume& aVolume );
+
+/* Element type of the files written by `save_mhd_volume()`. The densities
+ * (in [0,1]) are quantized to [0,255] or [0,32767], respectively.
+ */
+enum class EMHDElementType
+{
+	u8,
+	s16
+};
+
+/* Writes aVolume to aFileName (.mhd) and its data to a file next to it, with
+ * the same name and the extension .raw (or .zraw if aCompressed). Compressed
+ * data is deflated in independent chunks in parallel, which are joined into
+ * a single zlib stream. Errors are reported with std::runtime_error.
+ */
+void save_mhd_volume( Volume const&, char const* aFileName, EMHDElementType = EMHDElementType::s16, bool aCompressed = true );
+
 
 // Implementation:
 inline
@@ -125,3 +214,58 @@ std::size_t Volume::to_linear_index( std::size_t aI, std::size_t aJ, std::size_t
 {
 	return aK*mWidth*mHeight + aJ*mWidth + aI;
 }
+
+inline
+bool Volume::has_statistics() const
+{
+	return !!mStatistics;
+}
+inline
+VolumeStatistics const& Volume::statistics() const
+{
+	assert( mStatistics );
+	return *mStatistics;
+}
+inline
+std::shared_ptr<VolumeStatistics const> const& Volume::statistics_handle() const
+{
+	return mStatistics;
+}
+
+inline
+void Volume::set_statistics( std::shared_ptr<VolumeStatistics const> aStatistics )
+{
+	mStatistics = std::move(aStatistics);
+}
+
+inline
+bool Volume::has_labels() const
+{
+	return !mLabels.empty();
+}
+inline
+std::uint16_t Volume::label( std::size_t aI, std::size_t aJ, std::size_t aK ) const
+{
+	assert( aI < mWidth && aJ < mHeight && aK < mDepth );
+	assert( has_labels() );
+	return mLabels[to_linear_index(aI,aJ,aK)];
+}
+
+inline
+std::uint16_t const* Volume::labels() const
+{
+	return mLabels.data();
+}
+
+inline
+void Volume::set_labels( std::vector<std::uint16_t> aLabels )
+{
+	assert( aLabels.empty() || aLabels.size() == total_element_count() );
+	mLabels = std::move(aLabels);
+}
+
+inline
+VolumeHandle make_volume_handle( Volume&& aVolume )
+{
+	return std::make_shared<Volume const>( std::move(aVolume) );
+}
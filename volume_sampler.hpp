@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+
+#include <cassert>
+#include <cstddef>
+
+#include "volume.hpp"
+#include "vec3DPack.hpp"
+
+/* Trilinear sampling of a volume
+ *
+ * `VolumeSampler` interpolates the densities of a volume at arbitrary (float)
+ * grid coordinates:
+ *
+ *   VolumeSampler const sampler( volume );
+ *   float density = sampler.sample( 1.5f, 3.25f, 8.f );
+ *
+ * Each sample computes a single base index and fetches the 2x2x2 corners of
+ * the cell around the sample point at fixed offsets from it (see gather()),
+ * instead of computing the index of each corner separately. Coordinates
+ * outside of the volume are clamped to it.
+ *
+ * Batches of samples are interpolated a Pack at a time: the corners are
+ * gathered per lane, the interpolation itself runs on all lanes at once (see
+ * vec3DPack.hpp).
+ *
+ * sample_centered() covers the project's "trilinear interpolation" at voxel
+ * centers: it interpolates at the center of the cell spanned by the eight
+ * diagonal neighbours at distance aRadius, i.e., averages them.
+ *
+ * The sampler refers to the volume's data; it must not outlive the volume,
+ * and must be recreated when the volume is replaced.
+ *
+ * gradient() computes the density gradient at a voxel with central
+ * differences (one-sided differences on the border of the volume).
+ * central_difference() fetches the two densities of one such difference;
+ * packed versions of gradient() are built on it, so that all of them use the
+ * same neighbours.
+ */
+class VolumeSampler
+{
+	public:
+		// The corners of a cell; corner (i,j,k) is at index i + 2*j + 4*k.
+		struct Cell
+		{
+			float corner[8];
+		};
+
+	public:
+		explicit VolumeSampler( Volume const& );
+
+	public:
+		float sample( float aX, float aY, float aZ ) const;
+
+		template< std::size_t tLanes >
+		Pack<float,tLanes> sample( Pack<float,tLanes> const& aX, Pack<float,tLanes> const& aY, Pack<float,tLanes> const& aZ ) const;
+
+		// Samples at (aX[i], aY[i], aZ[i]) for i in [0, aCount), into aOut[i].
+		void sample( std::size_t aCount, float const* aX, float const* aY, float const* aZ, float* aOut ) const;
+
+		/* Interpolates at the center of the cell with the corners
+		 * (aX +/- aRadius, aY +/- aRadius, aZ +/- aRadius), all of which
+		 * must lie inside of the volume.
+		 */
+		float sample_centered( int aX, int aY, int aZ, int aRadius ) const;
+
+	public:
+		/* Fetches the corners of the cell (aX, aY, aZ) + {0, aSpacing}^3,
+		 * which must lie inside of the volume.
+		 */
+		void gather( int aX, int aY, int aZ, int aSpacing, Cell& ) const;
+
+		static float interpolate( Cell const&, float aFx, float aFy, float aFz );
+
+	private:
+		// Clamps aCoord to axis aAxis; returns the cell's lower corner, and
+		// the fraction within the cell in aFraction.
+		int locate_( int aAxis, float aCoord, float& aFraction ) const;
+
+		float const* corner_base_( int aX, int aY, int aZ ) const;
+
+	private:
+		float const* mData;
+		int mSize[3];
+		std::ptrdiff_t mStride[3];
+
+		// Offset to the next corner along each axis; zero for axes with a
+		// single voxel, where all corners coincide.
+		std::ptrdiff_t mStep[3];
+};
+
+Vec3Df gradient( Volume const&, int aX, int aY, int aZ );
+
+/* Fetches the densities of the neighbours before (aLo) and after (aHi) the
+ * voxel (aX, aY, aZ) along aAxis, and their distance (aStep); on the border,
+ * the voxel itself stands in for the missing neighbour. Returns false (and
+ * leaves the outputs alone) if the volume has a single voxel along aAxis.
+ */
+bool central_difference( Volume const&, int aX, int aY, int aZ, int aAxis, float& aLo, float& aHi, float& aStep );
+
+
+// Implementation:
+namespace detail
+{
+	inline
+	float sampler_lerp( float aA, float aB, float aT )
+	{
+		return aA * (1.f - aT) + aB * aT;
+	}
+
+	template< std::size_t tLanes > inline
+	Pack<float,tLanes> sampler_lerp( Pack<float,tLanes> const& aA, Pack<float,tLanes> const& aB, Pack<float,tLanes> const& aT )
+	{
+		return aA * (Pack<float,tLanes>( 1.f ) - aT) + aB * aT;
+	}
+}
+
+inline
+VolumeSampler::VolumeSampler( Volume const& aVolume )
+	: mData( aVolume.data() )
+{
+	mSize[0] = int(aVolume.width());
+	mSize[1] = int(aVolume.height());
+	mSize[2] = int(aVolume.depth());
+
+	mStride[0] = 1;
+	mStride[1] = std::ptrdiff_t(aVolume.width());
+	mStride[2] = std::ptrdiff_t(aVolume.width() * aVolume.height());
+
+	for( int axis = 0; axis < 3; ++axis )
+		mStep[axis] = mSize[axis] > 1 ? mStride[axis] : 0;
+}
+
+inline
+float VolumeSampler::sample( float aX, float aY, float aZ ) const
+{
+	float fx, fy, fz;
+	int const x = locate_( 0, aX, fx );
+	int const y = locate_( 1, aY, fy );
+	int const z = locate_( 2, aZ, fz );
+
+	float const* base = corner_base_( x, y, z );
+
+	Cell cell;
+	for( int k = 0; k < 2; ++k )
+	{
+		for( int j = 0; j < 2; ++j )
+		{
+			cell.corner[4*k + 2*j + 0] = base[k*mStep[2] + j*mStep[1]];
+			cell.corner[4*k + 2*j + 1] = base[k*mStep[2] + j*mStep[1] + mStep[0]];
+		}
+	}
+
+	return interpolate( cell, fx, fy, fz );
+}
+
+template< std::size_t tLanes > inline
+Pack<float,tLanes> VolumeSampler::sample( Pack<float,tLanes> const& aX, Pack<float,tLanes> const& aY, Pack<float,tLanes> const& aZ ) const
+{
+	using Lanes = Pack<float,tLanes>;
+
+	// Gather the corners of each lane's cell ...
+	Lanes fx, fy, fz;
+	Lanes corner[8];
+	for( std::size_t i = 0; i < tLanes; ++i )
+	{
+		int const x = locate_( 0, aX[i], fx[i] );
+		int const y = locate_( 1, aY[i], fy[i] );
+		int const z = locate_( 2, aZ[i], fz[i] );
+
+		float const* base = corner_base_( x, y, z );
+		for( int k = 0; k < 2; ++k )
+		{
+			for( int j = 0; j < 2; ++j )
+			{
+				corner[4*k + 2*j + 0][i] = base[k*mStep[2] + j*mStep[1]];
+				corner[4*k + 2*j + 1][i] = base[k*mStep[2] + j*mStep[1] + mStep[0]];
+			}
+		}
+	}
+
+	// ... and interpolate all lanes at once (x, then y, then z).
+	Lanes const c00 = detail::sampler_lerp( corner[0], corner[1], fx );
+	Lanes const c10 = detail::sampler_lerp( corner[2], corner[3], fx );
+	Lanes const c01 = detail::sampler_lerp( corner[4], corner[5], fx );
+	Lanes const c11 = detail::sampler_lerp( corner[6], corner[7], fx );
+
+	Lanes const c0 = detail::sampler_lerp( c00, c10, fy );
+	Lanes const c1 = detail::sampler_lerp( c01, c11, fy );
+
+	return detail::sampler_lerp( c0, c1, fz );
+}
+
+inline
+void VolumeSampler::sample( std::size_t aCount, float const* aX, float const* aY, float const* aZ, float* aOut ) const
+{
+	std::size_t const lanes = Packf::kLanes;
+
+	std::size_t i = 0;
+	for( ; i + lanes <= aCount; i += lanes )
+	{
+		Packf x, y, z;
+		std::copy( aX+i, aX+i+lanes, x.v );
+		std::copy( aY+i, aY+i+lanes, y.v );
+		std::copy( aZ+i, aZ+i+lanes, z.v );
+
+		Packf const result = sample( x, y, z );
+		std::copy( result.v, result.v+lanes, aOut+i );
+	}
+
+	for( ; i < aCount; ++i )
+		aOut[i] = sample( aX[i], aY[i], aZ[i] );
+}
+
+inline
+float VolumeSampler::sample_centered( int aX, int aY, int aZ, int aRadius ) const
+{
+	Cell cell;
+	gather( aX - aRadius, aY - aRadius, aZ - aRadius, 2*aRadius, cell );
+	return interpolate( cell, 0.5f, 0.5f, 0.5f );
+}
+
+inline
+void VolumeSampler::gather( int aX, int aY, int aZ, int aSpacing, Cell& aCell ) const
+{
+	assert( aX >= 0 && aX + aSpacing < mSize[0] );
+	assert( aY >= 0 && aY + aSpacing < mSize[1] );
+	assert( aZ >= 0 && aZ + aSpacing < mSize[2] );
+
+	float const* base = corner_base_( aX, aY, aZ );
+	std::ptrdiff_t const dx = aSpacing * mStride[0];
+	std::ptrdiff_t const dy = aSpacing * mStride[1];
+	std::ptrdiff_t const dz = aSpacing * mStride[2];
+
+	aCell.corner[0] = base[0];
+	aCell.corner[1] = base[dx];
+	aCell.corner[2] = base[dy];
+	aCell.corner[3] = base[dy + dx];
+	aCell.corner[4] = base[dz];
+	aCell.corner[5] = base[dz + dx];
+	aCell.corner[6] = base[dz + dy];
+	aCell.corner[7] = base[dz + dy + dx];
+}
+
+inline
+float VolumeSampler::interpolate( Cell const& aCell, float aFx, float aFy, float aFz )
+{
+	float const* c = aCell.corner;
+
+	float const c00 = detail::sampler_lerp( c[0], c[1], aFx );
+	float const c10 = detail::sampler_lerp( c[2], c[3], aFx );
+	float const c01 = detail::sampler_lerp( c[4], c[5], aFx );
+	float const c11 = detail::sampler_lerp( c[6], c[7], aFx );
+
+	float const c0 = detail::sampler_lerp( c00, c10, aFy );
+	float const c1 = detail::sampler_lerp( c01, c11, aFy );
+
+	return detail::sampler_lerp( c0, c1, aFz );
+}
+
+inline
+int VolumeSampler::locate_( int aAxis, float aCoord, float& aFraction ) const
+{
+	float const hi = float(mSize[aAxis] - 1);
+	float const coord = std::min( std::max( aCoord, 0.f ), hi );
+
+	// The last cell ends at the last voxel; with a single voxel, all
+	// corners are the same and the fraction doesn't matter.
+	int const cell = std::max( std::min( int(coord), mSize[aAxis] - 2 ), 0 );
+	aFraction = coord - float(cell);
+	return cell;
+}
+
+inline
+float const* VolumeSampler::corner_base_( int aX, int aY, int aZ ) const
+{
+	return mData + aZ*mStride[2] + aY*mStride[1] + aX;
+}
+
+inline
+Vec3Df gradient( Volume const& aVolume, int aX, int aY, int aZ )
+{
+	Vec3Df ret( 0.f, 0.f, 0.f );
+	for( int axis = 0; axis < 3; ++axis )
+	{
+		float lo, hi, step;
+		if( central_difference( aVolume, aX, aY, aZ, axis, lo, hi, step ) )
+			ret[axis] = (hi - lo) / step;
+	}
+	return ret;
+}
+
+inline
+bool central_difference( Volume const& aVolume, int aX, int aY, int aZ, int aAxis, float& aLo, float& aHi, float& aStep )
+{
+	int const size[3] = { int(aVolume.width()), int(aVolume.height()), int(aVolume.depth()) };
+
+	int n0[3] = { aX, aY, aZ }, n1[3] = { aX, aY, aZ };
+	n0[aAxis] = std::max( n0[aAxis] - 1, 0 );
+	n1[aAxis] = std::min( n1[aAxis] + 1, size[aAxis] - 1 );
+	if( n1[aAxis] <= n0[aAxis] )
+		return false;
+
+	aLo = aVolume( n0[0], n0[1], n0[2] );
+	aHi = aVolume( n1[0], n1[1], n1[2] );
+	aStep = float(n1[aAxis] - n0[aAxis]);
+	return true;
+}
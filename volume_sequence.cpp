@@ -0,0 +1,194 @@
+#include "volume_sequence.hpp"
+
+#include <cstdio>
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+
+namespace
+{
+	std::size_t const kNoFrame = std::numeric_limits<std::size_t>::max();
+
+	bool file_exists_( std::string const& aFileName )
+	{
+		if( FILE* file = std::fopen( aFileName.c_str(), "rb" ) )
+		{
+			std::fclose( file );
+			return true;
+		}
+
+		return false;
+	}
+}
+
+VolumeSequence::VolumeSequence( std::vector<std::string> aFiles, std::size_t aRingSize, std::size_t aWorkerCount )
+	: mFiles( std::move(aFiles) )
+	, mRing( std::max( std::min( aRingSize, mFiles.size() ), std::size_t(1) ) )
+{
+	for( auto& slot : mRing )
+		slot.frame = kNoFrame;
+
+	for( std::size_t i = 0; i < std::max( aWorkerCount, std::size_t(1) ); ++i )
+		mWorkers.emplace_back( [this] { run_(); } );
+}
+
+VolumeSequence::~VolumeSequence()
+{
+	{
+		std::unique_lock<std::mutex> lock( mMutex );
+		mQuit = true;
+		mQueue.clear();
+	}
+	mWakeUp.notify_all();
+
+	for( auto& worker : mWorkers )
+		worker.join();
+}
+
+std::vector<std::string> VolumeSequence::files_from_pattern( char const* aPattern )
+{
+	auto name = [&] (std::size_t aIndex) {
+		char buffer[1024];
+		std::snprintf( buffer, sizeof(buffer), aPattern, int(aIndex) );
+		return std::string( buffer );
+	};
+
+	std::size_t index = file_exists_( name( 0 ) ) ? 0 : 1;
+
+	std::vector<std::string> ret;
+	for( ; file_exists_( name( index ) ); ++index )
+		ret.emplace_back( name( index ) );
+
+	return ret;
+}
+
+std::size_t VolumeSequence::frame_count() const
+{
+	return mFiles.size();
+}
+std::string const& VolumeSequence::file( std::size_t aIndex ) const
+{
+	assert( aIndex < mFiles.size() );
+	return mFiles[aIndex];
+}
+
+VolumeHandle VolumeSequence::request( std::size_t aIndex )
+{
+	assert( aIndex < mFiles.size() );
+
+	std::unique_lock<std::mutex> lock( mMutex );
+	schedule_( aIndex );
+
+	Slot_ const* slot = find_slot_( aIndex );
+	return slot ? slot->volume : nullptr;
+}
+
+VolumeHandle VolumeSequence::wait( std::size_t aIndex )
+{
+	assert( aIndex < mFiles.size() );
+
+	std::unique_lock<std::mutex> lock( mMutex );
+	schedule_( aIndex );
+
+	mLoaded.wait( lock, [&] {
+		Slot_ const* slot = find_slot_( aIndex );
+		return !slot || !slot->loading;
+	} );
+
+	// The frame can only have been evicted by another request() for a later
+	// window, in which case the caller gets nothing (as with request()).
+	Slot_ const* slot = find_slot_( aIndex );
+	return slot ? slot->volume : nullptr;
+}
+
+VolumeSequence::Slot_* VolumeSequence::find_slot_( std::size_t aFrame )
+{
+	// Called with mMutex held.
+	for( auto& slot : mRing )
+	{
+		if( slot.frame == aFrame )
+			return &slot;
+	}
+
+	return nullptr;
+}
+
+void VolumeSequence::schedule_( std::size_t aIndex )
+{
+	// Called with mMutex held.
+	//
+	// The window holds mRing.size() distinct frames (the ring is never larger
+	// than the sequence), so the slots whose frames are outside of the window
+	// suffice for the frames of the window that aren't in a slot yet. Slots
+	// can't be picked by frame % mRing.size(): when the window wraps around
+	// the end of the sequence, two of its frames may share that slot.
+	std::size_t const count = mRing.size();
+	auto in_window = [&] (std::size_t aFrame) {
+		return kNoFrame != aFrame && (aFrame + mFiles.size() - aIndex) % mFiles.size() < count;
+	};
+
+	bool queued = false;
+	std::size_t victim = 0;
+	for( std::size_t i = 0; i < count; ++i )
+	{
+		std::size_t const frame = (aIndex + i) % mFiles.size();
+		if( find_slot_( frame ) )
+			continue;
+
+		while( in_window( mRing[victim].frame ) )
+			++victim;
+
+		assert( victim < count );
+		Slot_& slot = mRing[victim];
+
+		// Evict whatever the slot holds; a worker still loading the old
+		// frame drops its result (see run_()).
+		slot.frame = frame;
+		slot.volume = nullptr;
+		slot.loading = true;
+
+		mQueue.push_back( frame );
+		queued = true;
+	}
+
+	if( queued )
+		mWakeUp.notify_all();
+}
+
+void VolumeSequence::run_()
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	for( ;; )
+	{
+		mWakeUp.wait( lock, [this] { return mQuit || !mQueue.empty(); } );
+		if( mQuit )
+			return;
+
+		std::size_t const frame = mQueue.front();
+		mQueue.pop_front();
+
+		// Skip frames that were evicted while queued, or that were queued
+		// again (after an eviction) and have been loaded in the meantime.
+		Slot_ const* queuedSlot = find_slot_( frame );
+		if( !queuedSlot || !queuedSlot->loading )
+			continue;
+
+		lock.unlock();
+		VolumeHandle volume = make_volume_handle( load_mhd_volume( mFiles[frame].c_str() ) );
+		lock.lock();
+
+		// The frame may have been evicted, or even evicted and scheduled
+		// again (into a new slot, loading) in the meantime; either way, the
+		// slot that holds it now takes the result.
+		Slot_* slot = find_slot_( frame );
+		if( slot && slot->loading )
+		{
+			slot->volume = std::move(volume);
+			slot->loading = false;
+		}
+
+		mLoaded.notify_all();
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <cstddef>
+
+#include "volume.hpp"
+
+/* Time-varying (4D) volumes
+ *
+ * A `VolumeSequence` is a series of MHD files, one per time step (frame). Only
+ * a bounded window of frames is kept in memory, in a ring of aRingSize
+ * slots.
+ *
+ *   VolumeSequence sequence( VolumeSequence::files_from_pattern( "scan_%03d.mhd" ) );
+ *   ...
+ *   if( VolumeHandle frame = sequence.request( index ) )
+ *      show( frame );
+ *
+ * request() never blocks: it returns the frame if it has been decoded, and a
+ * null handle otherwise. Either way, it schedules the frame and the following
+ * aRingSize-1 frames (wrapping around at the end of the sequence, for looped
+ * playback). These are loaded by aWorkerCount worker threads, so that during
+ * playback the next frames are decoded while the current one is shown.
+ *
+ * Frames are loaded with load_mhd_volume(), i.e., on the worker threads, they
+ * are normalized and their statistics (density and gradient histograms, see
+ * volume_stats.hpp) are computed. A frame that fails to load is returned as an
+ * empty (0x0x0) volume.
+ */
+class VolumeSequence
+{
+	public:
+		explicit VolumeSequence( std::vector<std::string> aFiles, std::size_t aRingSize = 4, std::size_t aWorkerCount = 2 );
+		~VolumeSequence();
+
+		VolumeSequence( VolumeSequence const& ) = delete;
+		VolumeSequence& operator= (VolumeSequence const&) = delete;
+
+	public:
+		/* Expands a printf()-style pattern with a single integer conversion
+		 * (e.g., "data/scan_%03d.mhd") for the indices 0, 1, 2, ... (or 1, 2,
+		 * ... if there's no file for index 0) until there's no file for the
+		 * index.
+		 */
+		static std::vector<std::string> files_from_pattern( char const* aPattern );
+
+	public:
+		std::size_t frame_count() const;
+		std::string const& file( std::size_t aIndex ) const;
+
+		// Returns frame aIndex if it is decoded; schedules the window of
+		// frames starting at aIndex. See above.
+		VolumeHandle request( std::size_t aIndex );
+
+		// Like request(), but waits for frame aIndex.
+		VolumeHandle wait( std::size_t aIndex );
+
+	private:
+		struct Slot_
+		{
+			std::size_t frame;
+			VolumeHandle volume;
+			bool loading = false;
+		};
+
+	private:
+		// The slot that holds (or loads) aFrame, if any
+		Slot_* find_slot_( std::size_t aFrame );
+
+		void schedule_( std::size_t aIndex );
+		void run_();
+
+	private:
+		std::vector<std::string> mFiles;
+		std::vector<Slot_> mRing;
+
+		std::vector<std::thread> mWorkers;
+
+		std::mutex mMutex;
+		std::condition_variable mWakeUp, mLoaded;
+		std::deque<std::size_t> mQueue;
+		bool mQuit = false;
+};
@@ -0,0 +1,86 @@
+#include "volume_stats.hpp"
+
+#include <cmath>
+
+VolumeStatistics::VolumeStatistics()
+	: mHistogram( kHistogramBins, 0 )
+	, mJoint( kJointBins*kJointBins, 0 )
+{}
+
+void VolumeStatistics::merge( VolumeStatistics const& aOther )
+{
+	for( std::size_t i = 0; i < mHistogram.size(); ++i )
+		mHistogram[i] += aOther.mHistogram[i];
+	for( std::size_t i = 0; i < mJoint.size(); ++i )
+		mJoint[i] += aOther.mJoint[i];
+
+	mCount += aOther.mCount;
+	mSum += aOther.mSum;
+	mSumOfSquares += aOther.mSumOfSquares;
+	mMaxGradient = std::max( mMaxGradient, aOther.mMaxGradient );
+}
+
+void VolumeStatistics::finalize()
+{
+	mCumulative.resize( mHistogram.size() );
+
+	std::uint64_t sum = 0;
+	for( std::size_t i = 0; i < mHistogram.size(); ++i )
+	{
+		sum += mHistogram[i];
+		mCumulative[i] = sum;
+	}
+}
+
+float VolumeStatistics::mean() const
+{
+	return mCount ? float(mSum / mCount) : 0.f;
+}
+float VolumeStatistics::standard_deviation() const
+{
+	if( !mCount )
+		return 0.f;
+
+	double const mean = mSum / mCount;
+	return float(std::sqrt( std::max( mSumOfSquares / mCount - mean*mean, 0.0 ) ));
+}
+float VolumeStatistics::max_gradient_magnitude() const
+{
+	return mMaxGradient;
+}
+
+float VolumeStatistics::percentile( float aFraction ) const
+{
+	assert( mCumulative.size() == mHistogram.size() && "finalize() wasn't called" );
+	if( !mCount )
+		return 0.f;
+
+	double const target = double(std::min( std::max( aFraction, 0.f ), 1.f )) * mCount;
+
+	// First bin in which the running sum reaches the target.
+	auto const it = std::lower_bound( mCumulative.begin(), mCumulative.end(), target, [] (std::uint64_t aSum, double aTarget) {
+		return double(aSum) < aTarget;
+	} );
+	std::size_t const bin = std::min( std::size_t(it - mCumulative.begin()), mCumulative.size()-1 );
+
+	std::uint64_t const before = bin ? mCumulative[bin-1] : 0;
+	double const within = mHistogram[bin] ? (target - before) / mHistogram[bin] : 0.0;
+
+	return float((bin + within) / kHistogramBins);
+}
+
+std::uint64_t VolumeStatistics::count_between( float aLow, float aHigh ) const
+{
+	assert( mCumulative.size() == mHistogram.size() && "finalize() wasn't called" );
+	if( aLow > aHigh )
+		return 0;
+
+	std::size_t const lo = density_bin( aLow, kHistogramBins );
+	std::size_t const hi = density_bin( aHigh, kHistogramBins );
+	return mCumulative[hi] - (lo ? mCumulative[lo-1] : 0);
+}
+
+VolumeStatistics compute_volume_statistics( Volume const& aVolume )
+{
+	return compute_statistics( aVolume.data(), aVolume.width(), aVolume.height(), aVolume.depth(), 0.f, 1.f, [] (std::size_t, float) {} );
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include <cmath>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "parallel.hpp"
+
+#include "volume.hpp"
+
+/* Density statistics of a volume
+ *
+ * `VolumeStatistics` summarizes the (normalized, i.e., in [0,1]) densities of
+ * a volume:
+ *
+ *   - a histogram of the densities with kHistogramBins bins, and its running
+ *     sum, from which percentile() answers "below which density are N% of
+ *     the voxels" in O(log bins);
+ *   - a joint (2D) histogram of density and gradient magnitude, with
+ *     kJointBins x kJointBins bins. Boundaries between materials show up as
+ *     arcs in this histogram, which makes it the usual basis for placing
+ *     transfer-function widgets;
+ *   - the mean and standard deviation of the densities and the largest
+ *     gradient magnitude.
+ *
+ * The gradient is computed as in gradient() (see volume_sampler.hpp): central
+ * differences, one-sided at the border of the volume. Gradient magnitudes of
+ * kMaxGradientMagnitude and above land in the last gradient bin.
+ *
+ * load_mhd_volume() computes the statistics while it normalizes the data and
+ * attaches them to the volume (see Volume::statistics()); for volumes that
+ * are created differently, use compute_volume_statistics().
+ */
+class VolumeStatistics
+{
+	public:
+		static std::size_t const kHistogramBins = 4096;
+		static std::size_t const kJointBins = 256;
+
+		static constexpr float kMaxGradientMagnitude = 0.5f;
+
+	public:
+		VolumeStatistics();
+
+	public:
+		// Adds a single voxel. Not thread safe; see compute_statistics().
+		void add( float aDensity, float aGradientMagnitude );
+
+		// Adds the voxels of another (partial) statistics.
+		void merge( VolumeStatistics const& );
+
+		// Computes the derived values. Call after the last add()/merge().
+		void finalize();
+
+	public:
+		std::uint64_t count() const;
+
+		float mean() const;
+		float standard_deviation() const;
+		float max_gradient_magnitude() const;
+
+		/* Density below which (approximately) aFraction of the voxels lie,
+		 * aFraction in [0,1]. Interpolates linearly within the bin.
+		 */
+		float percentile( float aFraction ) const;
+
+		// Number of voxels with a density in [aLow, aHigh].
+		std::uint64_t count_between( float aLow, float aHigh ) const;
+
+		std::vector<std::uint32_t> const& histogram() const;
+
+		/* The joint histogram, row-major with one row per density bin:
+		 * joint_histogram()[densityBin*kJointBins + gradientBin].
+		 */
+		std::vector<std::uint32_t> const& joint_histogram() const;
+
+	public:
+		static std::size_t density_bin( float aDensity, std::size_t aBins );
+		static float bin_density( std::size_t aBin, std::size_t aBins );
+
+	private:
+		std::vector<std::uint32_t> mHistogram;
+		std::vector<std::uint64_t> mCumulative;
+		std::vector<std::uint32_t> mJoint;
+
+		std::uint64_t mCount = 0;
+		double mSum = 0.0, mSumOfSquares = 0.0;
+		float mMaxGradient = 0.f;
+};
+
+/* Computes the statistics of a volume of `aWidth*aHeight*aDepth` values of
+ * type tType at aData, whose normalized densities are (value - aMin) / aRange.
+ *
+ * The volume is split into slabs along z that are processed in parallel, each
+ * into its own partial statistics. aVisit( linearIndex, density ) is called
+ * for each voxel from these tasks; the loader uses it to store the normalized
+ * densities in the same pass.
+ */
+template< typename tType, typename tVisit >
+VolumeStatistics compute_statistics( tType const* aData, std::size_t aWidth, std::size_t aHeight, std::size_t aDepth, float aMin, float aRange, tVisit&& aVisit );
+
+VolumeStatistics compute_volume_statistics( Volume const& );
+
+
+// Implementation:
+inline
+void VolumeStatistics::add( float aDensity, float aGradientMagnitude )
+{
+	std::size_t const bin = density_bin( aDensity, kHistogramBins );
+	++mHistogram[bin];
+
+	std::size_t const gbin = std::min( std::size_t(aGradientMagnitude * (kJointBins / kMaxGradientMagnitude)), kJointBins-1 );
+	++mJoint[bin / (kHistogramBins/kJointBins) * kJointBins + gbin];
+
+	++mCount;
+	mSum += aDensity;
+	mSumOfSquares += double(aDensity) * aDensity;
+	mMaxGradient = std::max( mMaxGradient, aGradientMagnitude );
+}
+
+inline
+std::uint64_t VolumeStatistics::count() const
+{
+	return mCount;
+}
+
+inline
+std::vector<std::uint32_t> const& VolumeStatistics::histogram() const
+{
+	return mHistogram;
+}
+inline
+std::vector<std::uint32_t> const& VolumeStatistics::joint_histogram() const
+{
+	return mJoint;
+}
+
+inline
+std::size_t VolumeStatistics::density_bin( float aDensity, std::size_t aBins )
+{
+	// Also maps NaNs to bin 0.
+	if( !(aDensity > 0.f) )
+		return 0;
+
+	return std::min( std::size_t(aDensity * aBins), aBins-1 );
+}
+inline
+float VolumeStatistics::bin_density( std::size_t aBin, std::size_t aBins )
+{
+	return float(aBin) / aBins;
+}
+
+template< typename tType, typename tVisit > inline
+VolumeStatistics compute_statistics( tType const* aData, std::size_t aWidth, std::size_t aHeight, std::size_t aDepth, float aMin, float aRange, tVisit&& aVisit )
+{
+	// A few slabs per core: enough to balance the load, without paying for
+	// a (~300 kB) partial statistics per slice.
+	std::size_t const cores = std::max( std::thread::hardware_concurrency(), 1u );
+	std::size_t const slabCount = std::min( aDepth, 4*cores );
+
+	std::vector<std::unique_ptr<VolumeStatistics>> partial( slabCount );
+	concurrency::parallel_for( std::size_t(0), slabCount, [&] (std::size_t aSlab) {
+		partial[aSlab].reset( new VolumeStatistics() );
+		VolumeStatistics& stats = *partial[aSlab];
+
+		std::size_t const sliceSize = aWidth*aHeight;
+		auto value = [&] (std::size_t aX, std::size_t aY, std::size_t aZ) {
+			return float(aData[aZ*sliceSize + aY*aWidth + aX]);
+		};
+
+		// Central differences, one-sided at the border; the difference of
+		// raw values is converted to normalized densities by aRange.
+		auto derivative = [&] (std::size_t aI, std::size_t aN, float aLo, float aHi) {
+			return (aI == 0 || aI+1 == aN) ? (aHi - aLo) : 0.5f * (aHi - aLo);
+		};
+
+		std::size_t const z0 = aDepth * aSlab / slabCount;
+		std::size_t const z1 = aDepth * (aSlab+1) / slabCount;
+		for( std::size_t z = z0; z < z1; ++z )
+		{
+			std::size_t const zl = z > 0 ? z-1 : z, zh = std::min( z+1, aDepth-1 );
+			for( std::size_t y = 0; y < aHeight; ++y )
+			{
+				std::size_t const yl = y > 0 ? y-1 : y, yh = std::min( y+1, aHeight-1 );
+				for( std::size_t x = 0; x < aWidth; ++x )
+				{
+					std::size_t const xl = x > 0 ? x-1 : x, xh = std::min( x+1, aWidth-1 );
+
+					float const gx = aWidth > 1 ? derivative( x, aWidth, value( xl, y, z ), value( xh, y, z ) ) : 0.f;
+					float const gy = aHeight > 1 ? derivative( y, aHeight, value( x, yl, z ), value( x, yh, z ) ) : 0.f;
+					float const gz = aDepth > 1 ? derivative( z, aDepth, value( x, y, zl ), value( x, y, zh ) ) : 0.f;
+					float const gradient = std::sqrt( gx*gx + gy*gy + gz*gz ) / aRange;
+
+					std::size_t const index = z*sliceSize + y*aWidth + x;
+					float const density = (float(aData[index]) - aMin) / aRange;
+
+					aVisit( index, density );
+					stats.add( density, gradient );
+				}
+			}
+		}
+	} );
+
+	VolumeStatistics ret;
+	for( auto const& stats : partial )
+		ret.merge( *stats );
+
+	ret.finalize();
+	return ret;
+}